@@ -23,6 +23,9 @@
 
 const uint32_t FAT32_MAX_FILE_SIZE = UINT32_MAX;
 
+// Room left in every .swm part for its header, blob table and XML data, which wimlib doesn't count towards the part size
+const uint32_t SWM_PART_RESERVED_SIZE = 16777216;
+
 // 8MB Buffer for copying files with interrupt-like callback
 const uint64_t COPY_BUFFER_SIZE = 8388608;
 
@@ -340,9 +343,9 @@ return NO;
                              callback: (ChainedCallbackAction)callback {
     
     /*
-     Macro for handling callback with cleanup of temporary files.
-     We need it since we are make a copy of Windows Install Image on the system drive in order to patch it.
-     I don't think that there can be a better solution without "goto cleanup" and macros.
+     Macro for handling callback with jumping to the end of the operation.
+     Windows Install Image is never copied to the system drive anymore: when splitting is required,
+     the patched XML data is written straight into the .swm parts while reading the source image.
      */
     
 #define CallbackHandlerWithCleanup(dwFile, writtenBytes, operationType, operationResult, error)                 \
@@ -367,7 +370,8 @@ goto cleanup;
      */
     
     BOOL requiresSplitting = !((dwFile.size <= FAT32_MAX_FILE_SIZE && self.destinationFilesystem == FilesystemFAT32) || self.destinationFilesystem == FilesystemExFAT);
-    NSString *tempDirectory = NULL;
+    UInt8 partsCount = ceil((double)dwFile.size / (double)(FAT32_MAX_FILE_SIZE - SWM_PART_RESERVED_SIZE));
+    WimlibWrapper *wimlibWrapper = NULL;
     
     // Check if we can write Windows Image file without modifications
     if (!requiresSplitting) {
@@ -396,80 +400,36 @@ goto cleanup;
         }
         
     } else {
-        if (![sourcePath.lowercaseString.pathExtension isEqualToString:@"wim"]) {
-            NSError *error = [NSError errorWithStringValue: [LocalizedStrings errorTextSplittingEsdSwmNotSupported]];
+        // Solid (.esd) images are split as well, with each solid resource kept whole inside a single part.
+        if ([sourcePath.lowercaseString.pathExtension isEqualToString:@"swm"]) {
+            NSError *error = [NSError errorWithStringValue: [LocalizedStrings errorTextSplittingSwmNotSupported]];
             
             CallbackHandlerWithCleanup(dwFile, 0, DWOperationTypeSplitWindowsImage, DWOperationResultFailure, error);
             
             goto cleanup;
         }
         
-        if (self.patchInstallerRequirements) {
-            NSString *randomFolderName = [NSString stringWithFormat:@"install-image-%@", [HelperFunctions randomStringWithLength:10]];
-            
-            // Defining the path to the temporary location for the Windows Install Image on the system drive.
-            tempDirectory = [NSString pathWithComponents: @[
-                [HelperFunctions applicationTempFolder],
-                randomFolderName
-            ]];
-            
-            CallbackHandlerWithCleanup(dwFile, 0, DWOperationTypeCreateDirectory, DWOperationResultStart, NULL);
-            
-            NSError *directoryCreateError = NULL;
-            
-            BOOL directoryCreatedSuccessfully = [localFileManager createDirectoryAtPath: tempDirectory
-                                                            withIntermediateDirectories: YES
-                                                                             attributes: NULL
-                                                                                  error: &directoryCreateError];
-            
-            CallbackHandlerWithCleanup(dwFile, 0, DWOperationTypeCreateDirectory, (directoryCreatedSuccessfully ? DWOperationResultSuccess : DWOperationResultFailure), directoryCreateError);
-            
-            // We don't need to continue unless creating a directory wasn't successful. All further operations require a success from the previous operation.
-            if (!directoryCreatedSuccessfully) {
-                goto cleanup;
-            }
-            
-            // Setting the location for Windows Install Image to the NSTemporaryDirectory(). (Example: /var/folders/b2/zvoxm8cn7995b9jnt2love090000gn/T/windiskwriter-ABCDEFGHI1/install.wim)
-            sourcePath = [tempDirectory stringByAppendingPathComponent: sourcePath.lastPathComponent];
-            
-            __block DWAction latestAction = DWActionContinue;
-            
-            // Copying Windows Install File into a temporary directory
-            BOOL copyWasSuccessfull = [self copyFileWithDWFile: dwFile
-                                           destinationFilePath: sourcePath
-                                                    bufferSize: COPY_BUFFER_SIZE
-                                         ignoreFilesystemCheck: YES
-                                                      callback:^DWAction(DWFile *dwFile, uint64 copiedBytes, DWOperationType operationType, DWOperationResult operationResult, NSError *error) {
-                
-                latestAction = callback(dwFile, copiedBytes, operationType, operationResult, error);
-                
-                return latestAction;
-            }];
+        // The source image is only read from, so it can be opened directly from the (read-only) installation media.
+        wimlibWrapper = [[WimlibWrapper alloc] initWithWimPath: sourcePath];
+        
+        // Resources are never divided between parts, so a solid resource larger than 4 GB would end up in a part that doesn't fit into FAT32.
+        UInt64 largestPartSize = 0;
+        WimlibWrapperResult planSplitResult = [wimlibWrapper largestSplitPartSizeWithMaxSliceSizeInBytes: FAT32_MAX_FILE_SIZE - SWM_PART_RESERVED_SIZE
+                                                                                              partsCount: partsCount
+                                                                                         largestPartSize: &largestPartSize];
+        
+        if (planSplitResult != WimlibWrapperResultSuccess) {
+            CallbackHandlerWithCleanup(dwFile, 0, DWOperationTypeSplitWindowsImage, DWOperationResultFailure, NULL);
             
-            // We don't need to continue unless copying wasn't successful. All further operations require a success from the previous operation.
-            if (!copyWasSuccessfull) {
-                goto cleanup;
-            }
+            goto cleanup;
+        }
+        
+        if (largestPartSize > FAT32_MAX_FILE_SIZE - SWM_PART_RESERVED_SIZE) {
+            NSError *error = [NSError errorWithStringValue: [LocalizedStrings errorTextSplitPartExceedsFat32Limit]];
             
-            // If we're running as root, we need to 'chmod 777' install.wim/.esd in order to be accepted by wimlib.
-            if ([HelperFunctions hasElevatedRights]) {
-                CallbackHandlerWithCleanup(dwFile, 0, DWOperationTypeSetFilePermissions, DWOperationResultStart, NULL);
-
-                NSError *setAllPermissionsError = NULL;
-                
-                [HelperFunctions setAllPermissionsForPath: sourcePath
-                                                    error: &setAllPermissionsError];
-                
-                CallbackHandlerWithCleanup(dwFile, 0, DWOperationTypeSetFilePermissions, (setAllPermissionsError == NULL ? DWOperationResultSuccess : DWOperationResultFailure), NULL);
-                
-                if (setAllPermissionsError != NULL) {
-                    goto cleanup;
-                }
-            }
+            CallbackHandlerWithCleanup(dwFile, 0, DWOperationTypeSplitWindowsImage, DWOperationResultFailure, error);
             
-            if (latestAction == DWActionStop) {
-                goto cleanup;
-            }
+            goto cleanup;
         }
     }
     
@@ -477,12 +437,15 @@ goto cleanup;
     if (self.patchInstallerRequirements) {
         CallbackHandlerWithCleanup(dwFile, 0, DWOperationTypePatchWindowsInstallerRequirements, DWOperationResultStart, NULL);
         
-        WimlibWrapper *wimlibWrapper = [[WimlibWrapper alloc] initWithWimPath:
-                                            /* Choosing Windows Installer Image Path based on previous operations */
-                                        tempDirectory != NULL ? sourcePath : destinationPath
-        ];
+        if (wimlibWrapper == NULL) {
+            wimlibWrapper = [[WimlibWrapper alloc] initWithWimPath: destinationPath];
+        }
         
-        WimlibWrapperResult installerRequirementsPatchResult = [wimlibWrapper patchWindowsRequirementsChecks];
+        /*
+         The copied image is patched in place.
+         An image that is going to be split is only patched in memory, since wimlib writes the modified XML data into every .swm part.
+         */
+        WimlibWrapperResult installerRequirementsPatchResult = [wimlibWrapper patchWindowsRequirementsChecksApplyingChanges: !requiresSplitting];
         
         DWOperationResult operationResult;
         switch (installerRequirementsPatchResult) {
@@ -501,18 +464,14 @@ goto cleanup;
     
     // Splitting install.wim file in order to fit into FAT32 partition
     if (requiresSplitting) {
-        UInt8 partsCount = ceil((double)dwFile.size / (double)FAT32_MAX_FILE_SIZE);
-        UInt32 maxSliceSize = dwFile.size / partsCount;
-        
         CallbackHandlerWithCleanup(dwFile, 0, DWOperationTypeSplitWindowsImage, DWOperationResultStart, NULL);
         
-        WimlibWrapper *wimlibWrapper = [[WimlibWrapper alloc] initWithWimPath: sourcePath];
-        
         __block DWAction lastAction = DWActionContinue;
         
         __block BOOL isFirstCall = YES;
         WimlibWrapperResult splitImageResult = [wimlibWrapper splitWithDestinationDirectoryPath: [destinationPath stringByDeletingLastPathComponent]
-                                                                            maxSliceSizeInBytes: maxSliceSize
+                                                                            maxSliceSizeInBytes: FAT32_MAX_FILE_SIZE - SWM_PART_RESERVED_SIZE
+                                                                                     partsCount: partsCount
                                                                                        callback: ^BOOL(uint32_t totalPartsCount, uint32 currentPartNumber, uint64 bytesWritten, uint64 bytesTotal) {
             
             if (isFirstCall) {
@@ -548,13 +507,7 @@ goto cleanup;
     
     operationWasSuccessful = YES;
     
-cleanup: {
-    BOOL wimLibTempDirectoryExists = [localFileManager fileExistsAtPath: tempDirectory];
-    if (wimLibTempDirectoryExists) {
-        [localFileManager removeItemAtPath: tempDirectory
-                                     error: NULL];
-    }
-}
+cleanup:
     return operationWasSuccessful;
 }
 
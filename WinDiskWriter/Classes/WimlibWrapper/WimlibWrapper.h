@@ -60,6 +60,12 @@ typedef NS_ENUM(NSInteger, WimLibWrapperCPUArch) {
                                             progressHandler: (wimlib_progress_func_t _Nullable)progressHandler
                                                     context: (void *_Nullable)context;
 
+- (enum wimlib_error_code)splitWithDestinationDirectoryPath: (NSString *)destinationDirectoryPath
+                                        maxSliceSizeInBytes: (UInt64)maxSliceSizeInBytes
+                                                 partsCount: (UInt32)partsCount
+                                            progressHandler: (wimlib_progress_func_t _Nullable)progressHandler
+                                                    context: (void *_Nullable)context;
+
 - (BOOL)extractFiles: (NSArray *)files
 destinationDirectory: (NSString *)destinationDirectory
       fromImageIndex: (UInt32)imageIndex;
@@ -68,12 +74,23 @@ destinationDirectory: (NSString *)destinationDirectory
 
 - (WimlibWrapperResult)patchWindowsRequirementsChecks;
 
+- (WimlibWrapperResult)patchWindowsRequirementsChecksApplyingChanges: (BOOL)applyChanges;
+
 typedef BOOL (^WimLibWrapperSplitImageCallback)(uint32_t totalPartsCount, uint32 currentPartNumber, uint64 bytesWritten, uint64 bytesTotal);
 
 - (WimlibWrapperResult)splitWithDestinationDirectoryPath: (NSString *)destinationDirectoryPath
                                      maxSliceSizeInBytes: (UInt64 *)maxSliceSizeInBytes
                                                 callback: (WimLibWrapperSplitImageCallback)callback;
 
+- (WimlibWrapperResult)splitWithDestinationDirectoryPath: (NSString *)destinationDirectoryPath
+                                     maxSliceSizeInBytes: (UInt64)maxSliceSizeInBytes
+                                              partsCount: (UInt32)partsCount
+                                                callback: (WimLibWrapperSplitImageCallback)callback;
+
+- (WimlibWrapperResult)largestSplitPartSizeWithMaxSliceSizeInBytes: (UInt64)maxSliceSizeInBytes
+                                                        partsCount: (UInt32)partsCount
+                                                   largestPartSize: (UInt64 *)largestPartSize;
+
 @end
 
 NS_ASSUME_NONNULL_END
@@ -170,6 +170,33 @@
                         );
 }
 
+/*
+ Splits the image into parts of balanced sizes.
+ partsCount is the desired number of parts, which is only exceeded if some parts wouldn't fit into maxSliceSizeInBytes otherwise.
+ */
+- (enum wimlib_error_code)splitWithDestinationDirectoryPath: (NSString *)destinationDirectoryPath
+                                        maxSliceSizeInBytes: (UInt64)maxSliceSizeInBytes
+                                                 partsCount: (UInt32)partsCount
+                                            progressHandler: (wimlib_progress_func_t _Nullable)progressHandler
+                                                    context: (void *_Nullable)context {
+    if (currentWIM == NULL) {
+        return WIMLIB_ERR_ABORTED_BY_PROGRESS;
+    }
+    
+    if (progressHandler != NULL) {
+        wimlib_register_progress_function(currentWIM, progressHandler, context);
+    }
+    
+    NSString *destinationFileName = [[[_wimPath lastPathComponent] stringByDeletingPathExtension] stringByAppendingPathExtension:@"swm"];
+    
+    return wimlib_split_balanced(currentWIM,
+                                 [[destinationDirectoryPath stringByAppendingPathComponent:destinationFileName] UTF8String],
+                                 maxSliceSizeInBytes,
+                                 partsCount,
+                                 0
+                                 );
+}
+
 enum wimlib_progress_status defaultSplitProgress(enum wimlib_progress_msg msg, union wimlib_progress_info *info, void *context) {
     WimlibSplitInfo *contextWimlibSplitStatus = (__bridge WimlibSplitInfo *)(context);
 
@@ -220,6 +247,61 @@ enum wimlib_progress_status defaultSplitProgress(enum wimlib_progress_msg msg, u
 
 }
 
+- (WimlibWrapperResult)splitWithDestinationDirectoryPath: (NSString *)destinationDirectoryPath
+                                     maxSliceSizeInBytes: (UInt64)maxSliceSizeInBytes
+                                              partsCount: (UInt32)partsCount
+                                                callback: (WimLibWrapperSplitImageCallback)callback {
+    
+    WimlibSplitInfo *wimlibSplitInfo = [[WimlibSplitInfo alloc] initWithCallback: callback];
+    
+    enum wimlib_error_code wimlibSplitStatus = [self splitWithDestinationDirectoryPath: destinationDirectoryPath
+                                                                   maxSliceSizeInBytes: maxSliceSizeInBytes
+                                                                            partsCount: partsCount
+                                                                       progressHandler: defaultSplitProgress
+                                                                               context: (__bridge void * _Nullable)(wimlibSplitInfo)];
+    
+    switch (wimlibSplitStatus) {
+        case WIMLIB_ERR_SUCCESS:
+            return WimlibWrapperResultSuccess;
+        case WIMLIB_ERR_ABORTED_BY_PROGRESS:
+            return WimlibWrapperResultSkipped;
+        default:
+            return WimlibWrapperResultFailure;
+    }
+}
+
+/*
+ Computes the size of the largest part that -splitWithDestinationDirectoryPath:maxSliceSizeInBytes:partsCount:callback: would write, without writing anything.
+ A part is larger than maxSliceSizeInBytes if it holds a single resource that doesn't fit (e.g. a solid resource of an .esd image), since resources are never divided between parts.
+ */
+- (WimlibWrapperResult)largestSplitPartSizeWithMaxSliceSizeInBytes: (UInt64)maxSliceSizeInBytes
+                                                        partsCount: (UInt32)partsCount
+                                                   largestPartSize: (UInt64 *)largestPartSize {
+    if (currentWIM == NULL) {
+        return WimlibWrapperResultFailure;
+    }
+    
+    unsigned plannedPartsCount = 0;
+    if (wimlib_plan_split(currentWIM, maxSliceSizeInBytes, partsCount, WIMLIB_SPLIT_FLAG_BALANCED, NULL, &plannedPartsCount) != WIMLIB_ERR_SUCCESS) {
+        return WimlibWrapperResultFailure;
+    }
+    
+    NSMutableData *partSizesData = [NSMutableData dataWithLength: plannedPartsCount * sizeof(UInt64)];
+    UInt64 *partSizes = partSizesData.mutableBytes;
+    
+    if (wimlib_plan_split(currentWIM, maxSliceSizeInBytes, partsCount, WIMLIB_SPLIT_FLAG_BALANCED, partSizes, &plannedPartsCount) != WIMLIB_ERR_SUCCESS) {
+        return WimlibWrapperResultFailure;
+    }
+    
+    UInt64 largestSize = 0;
+    for (unsigned i = 0; i < plannedPartsCount; i++) {
+        largestSize = MAX(largestSize, partSizes[i]);
+    }
+    
+    *largestPartSize = largestSize;
+    
+    return WimlibWrapperResultSuccess;
+}
 
 - (BOOL)extractFiles: (NSArray *)files
 destinationDirectory: (NSString *)destinationDirectory
@@ -276,6 +358,14 @@ destinationDirectory: (NSString *)destinationDirectory
 }
 
 - (WimlibWrapperResult)patchWindowsRequirementsChecks {
+    return [self patchWindowsRequirementsChecksApplyingChanges: YES];
+}
+
+/*
+ Without applying changes the patched properties only live in memory.
+ They are still written by -splitWithDestinationDirectoryPath:, so the source image can stay untouched.
+ */
+- (WimlibWrapperResult)patchWindowsRequirementsChecksApplyingChanges: (BOOL)applyChanges {
     if (currentWIM == NULL) {
         return WimlibWrapperResultFailure;
     }
@@ -291,6 +381,10 @@ destinationDirectory: (NSString *)destinationDirectory
             break;
     }
     
+    if (!applyChanges) {
+        return WimlibWrapperResultSuccess;
+    }
+    
     BOOL applyChangesResult = [self applyChanges];
     
     return applyChangesResult ? WimlibWrapperResultSuccess : WimlibWrapperResultFailure;
@@ -351,8 +351,11 @@ NS_ASSUME_NONNULL_BEGIN
 /// @brief Specified BSD name does not exist. Can't erase this volume.
 + (NSString *)errorTextSpecifiedBsdNameDoesntExistCantErase;
 
-/// @brief Splitting Windows Install Images with .esd and .swm extensions is currently not supported.
-+ (NSString *)errorTextSplittingEsdSwmNotSupported;
+/// @brief Windows Install Image can't be split into parts that fit into FAT32, since it contains a compressed resource larger than 4 GB.
++ (NSString *)errorTextSplitPartExceedsFat32Limit;
+
+/// @brief Splitting Windows Install Images with the .swm extension is not supported.
++ (NSString *)errorTextSplittingSwmNotSupported;
 
 /// @brief Can't unmount the destination device
 + (NSString *)errorTextUnmountDestinationDeviceFailure;
@@ -470,8 +470,12 @@
     return NSLocalizedString(@"ERROR_TEXT_SPECIFIED_BSD_NAME_DOESNT_EXIST_CANT_ERASE", NULL);
 }
 
-+ (NSString *)errorTextSplittingEsdSwmNotSupported {
-    return NSLocalizedString(@"ERROR_TEXT_SPLITTING_ESD_SWM_NOT_SUPPORTED", NULL);
++ (NSString *)errorTextSplitPartExceedsFat32Limit {
+    return NSLocalizedString(@"ERROR_TEXT_SPLIT_PART_EXCEEDS_FAT32_LIMIT", NULL);
+}
+
++ (NSString *)errorTextSplittingSwmNotSupported {
+    return NSLocalizedString(@"ERROR_TEXT_SPLITTING_SWM_NOT_SUPPORTED", NULL);
 }
 
 + (NSString *)errorTextUnmountDestinationDeviceFailure {
@@ -856,6 +856,13 @@ union wimlib_progress_info {
 		/** Since wimlib v1.13.4: Like @p completed_bytes, but counts
 		 * the compressed size.  */
 		uint64_t completed_compressed_bytes;
+
+		/** If data is being compressed on multiple threads, an array
+		 * of @p num_threads values giving the percentage of time, from
+		 * 0 to 100, that each thread has spent compressing data since
+		 * compression started.  Otherwise NULL.  The array is only
+		 * valid during the progress callback.  */
+		const uint8_t *thread_utilization;
 	} write_streams;
 
 	/** Valid on messages ::WIMLIB_PROGRESS_MSG_SCAN_BEGIN,
@@ -2133,6 +2140,14 @@ typedef int (*wimlib_iterate_lookup_table_callback_t)(const struct wimlib_resour
  * called.  */
 #define WIMLIB_OPEN_FLAG_WRITE_ACCESS			0x00000004
 
+/** Map the WIM file into memory and read its data directly from the mapping
+ * where possible, rather than copying it into buffers with read system calls.
+ * This can make reading large WIM files faster.  It has no effect on pipes or
+ * on platforms that don't support it.  Note: while the WIM file is mapped, an
+ * I/O error reading it, or another process truncating it, terminates the
+ * program with a signal rather than causing an error to be returned.  */
+#define WIMLIB_OPEN_FLAG_MMAP				0x00000008
+
 /** @} */
 /** @addtogroup G_mounting_wim_images
  * @{ */
@@ -2440,6 +2455,11 @@ typedef int (*wimlib_iterate_lookup_table_callback_t)(const struct wimlib_resour
  * wimlib_reference_resources().  */
 #define WIMLIB_REF_FLAG_GLOB_ERR_ON_NOMATCH	0x00000002
 
+/** For wimlib_plan_split(), plan parts of balanced sizes as
+ * wimlib_split_balanced() does, rather than filling each part as much as
+ * possible as wimlib_split() does.  */
+#define WIMLIB_SPLIT_FLAG_BALANCED		0x00000001
+
 /** @} */
 /** @addtogroup G_modifying_wims
  * @{ */
@@ -3000,6 +3020,68 @@ extern int
 wimlib_extract_image(WIMStruct *wim, int image,
 		     const wimlib_tchar *target, int extract_flags);
 
+/**
+ * @ingroup G_extracting_wims
+ *
+ * Set the number of threads that will be used for decompressing data read from
+ * a ::WIMStruct, for example by wimlib_extract_image(), wimlib_extract_paths(),
+ * and wimlib_verify_wim().  Compressed data is only decompressed on multiple
+ * threads when enough of it is being read at once to make this worthwhile.
+ *
+ * @param wim
+ *	The ::WIMStruct for which to set the number of decompression threads.
+ *	This applies to the data contained in its backing file only; for split
+ *	WIMs, set it on each part.
+ * @param num_threads
+ *	The number of threads to use for decompressing data, or 0 to have the
+ *	library automatically choose an appropriate number (the default).
+ *	Specify 1 to always decompress data on the calling thread.
+ */
+extern void
+wimlib_set_decompression_threads(WIMStruct *wim, unsigned num_threads);
+
+/**
+ * @ingroup G_extracting_wims
+ *
+ * Set the maximum size of the cache of decompressed chunks kept for a
+ * ::WIMStruct.  The cache is used for small reads of file data, such as reads
+ * of files in an image mounted with wimlib_mount_image(), so that reading a
+ * file a little at a time does not decompress the same chunk again for each
+ * read.  This matters most for solid resources, whose chunks can be as large
+ * as 64 MiB.  Setting a new size discards the cached chunks.
+ *
+ * @param wim
+ *	The ::WIMStruct for which to set the cache size.  This applies to the
+ *	data contained in its backing file only; for split WIMs, set it on each
+ *	part.
+ * @param max_size
+ *	The maximum number of bytes of decompressed data to cache, or 0 to
+ *	disable the cache.  The default is 128 MiB.  Chunks larger than half
+ *	this size are never cached.
+ */
+extern void
+wimlib_set_decompressed_chunk_cache_size(WIMStruct *wim, uint64_t max_size);
+
+/**
+ * @ingroup G_extracting_wims
+ *
+ * Get the number of lookups in the decompressed chunk cache of a ::WIMStruct
+ * (see wimlib_set_decompressed_chunk_cache_size()) that have found and not
+ * found the needed chunk so far.  These are reset when the cache size is
+ * changed.
+ *
+ * @param wim
+ *	The ::WIMStruct to query.
+ * @param hits_ret
+ *	If non-NULL, the number of lookups that found the chunk is written here.
+ * @param misses_ret
+ *	If non-NULL, the number of lookups that did not find the chunk is
+ *	written here.
+ */
+extern void
+wimlib_get_decompressed_chunk_cache_stats(WIMStruct *wim, uint64_t *hits_ret,
+					  uint64_t *misses_ret);
+
 /**
  * @ingroup G_extracting_wims
  *
@@ -3617,6 +3699,10 @@ wimlib_join_with_progress(const wimlib_tchar * const *swms,
  * same time, but only if different ::WIMStruct's are used.  It is @b not safe
  * to mount multiple images from the same WIM file read-write at the same time.
  *
+ * A read-only mount serves filesystem operations on multiple threads, so that
+ * files read in parallel are also decompressed in parallel.  A read-write
+ * mount serves them one at a time.
+ *
  * To unmount the image, call wimlib_unmount_image().  This may be done in a
  * different process.
  */
@@ -4307,8 +4393,22 @@ wimlib_set_wim_info(WIMStruct *wim, const struct wimlib_wim_info *info,
  * @retval ::WIMLIB_ERR_INVALID_PARAM
  *	@p swm_name was not a nonempty string, or @p part_size was 0.
  * @retval ::WIMLIB_ERR_UNSUPPORTED
- *	The WIM contains solid resources.  Splitting a WIM containing solid
- *	resources is not supported.
+ *	An image in @p wim has been modified in memory; only WIMs whose images
+ *	are unchanged from the on-disk WIM file can be split.  Or, the WIM
+ *	contains solid resources and ::WIMLIB_WRITE_FLAG_PIPABLE was specified.
+ *
+ * Image properties changed in memory, for example with
+ * wimlib_set_image_property(), do not count as modifications: the current
+ * XML data is written to every part.  Therefore, a WIM can be opened
+ * read-only, have its properties changed, and be split without first being
+ * written with wimlib_write() or wimlib_overwrite().  The file resources are
+ * copied from @p wim in their compressed form.
+ *
+ * A WIM containing solid resources, such as an ESD file, can be split as well.
+ * Each solid resource is copied whole into a single part, so a part may be
+ * larger than @p part_size if the WIM contains a solid resource that is.  The
+ * parts are never recompressed, so this costs no more than splitting a
+ * non-solid WIM.
  *
  * If a progress function is registered with @p wim, then for each split WIM
  * part that is written it will receive the messages
@@ -4323,6 +4423,128 @@ wimlib_split(WIMStruct *wim,
 	     uint64_t part_size,
 	     int write_flags);
 
+/**
+ * @ingroup G_nonstandalone_wims
+ *
+ * Same as wimlib_split(), but make the parts as even in size as possible.
+ *
+ * wimlib_split() fills each part until the next file resource would not fit,
+ * so the last part is often much smaller than the others.  This function
+ * instead lowers the maximum size it fills parts to as far as possible without
+ * needing more parts.  The file resources are still assigned to parts in the
+ * order they are located in the WIM file, so each part is read sequentially.
+ *
+ * @param wim
+ *	The ::WIMStruct for the WIM to split.
+ * @param swm_name
+ *	Name of the split WIM (SWM) file to create, as for wimlib_split().
+ * @param part_size
+ *	The maximum size per part, in bytes, with the same caveats as for
+ *	wimlib_split().
+ * @param num_parts
+ *	If greater than the number of parts needed for @p part_size, the number
+ *	of parts to split the WIM into instead.  Specify 0 to use as few parts
+ *	as possible.  It's not guaranteed that exactly this many parts will be
+ *	created; for example, there can't be more parts than file resources.
+ * @param write_flags
+ *	Bitwise OR of relevant flags prefixed with @c WIMLIB_WRITE_FLAG, as for
+ *	wimlib_split().
+ *
+ * @return 0 on success; a ::wimlib_error_code value on failure.  The same error
+ * codes as for wimlib_split() can be returned, and the same progress messages
+ * are sent.
+ */
+extern int
+wimlib_split_balanced(WIMStruct *wim,
+		      const wimlib_tchar *swm_name,
+		      uint64_t part_size,
+		      unsigned num_parts,
+		      int write_flags);
+
+/**
+ * @ingroup G_nonstandalone_wims
+ *
+ * Compute how a WIM would be split by wimlib_split() or wimlib_split_balanced(),
+ * without writing anything.
+ *
+ * @param wim
+ *	The ::WIMStruct for the WIM that would be split.
+ * @param part_size
+ *	The maximum size per part, in bytes.
+ * @param num_parts
+ *	With ::WIMLIB_SPLIT_FLAG_BALANCED, the @p num_parts argument that would
+ *	be given to wimlib_split_balanced().  Otherwise ignored.
+ * @param split_flags
+ *	0 to plan the parts as wimlib_split() would, or
+ *	::WIMLIB_SPLIT_FLAG_BALANCED to plan them as wimlib_split_balanced()
+ *	would.
+ * @param part_sizes
+ *	If not @c NULL, the total size in bytes of the file and metadata
+ *	resources in each part is written to this array, which must have room
+ *	for all the parts.  The planning is deterministic, so the function can
+ *	first be called with @c NULL here to get the number of parts.  The
+ *	actual part files are somewhat larger, since they also contain a header,
+ *	a blob table, the XML data, and possibly an integrity table.
+ * @param num_parts_ret
+ *	The number of parts is written to this location.
+ *
+ * @return 0 on success; a ::wimlib_error_code value on failure.
+ *
+ * @retval ::WIMLIB_ERR_INVALID_PARAM
+ *	@p part_size was 0, @p num_parts_ret was @c NULL, or an unrecognized
+ *	flag was specified in @p split_flags.
+ * @retval ::WIMLIB_ERR_UNSUPPORTED
+ *	@p wim can't be split, for the reasons listed for wimlib_split().
+ */
+extern int
+wimlib_plan_split(WIMStruct *wim,
+		  uint64_t part_size,
+		  unsigned num_parts,
+		  int split_flags,
+		  uint64_t *part_sizes,
+		  unsigned *num_parts_ret);
+
+/**
+ * @ingroup G_nonstandalone_wims
+ *
+ * Set how many parts of a split WIM wimlib_split() and wimlib_split_balanced()
+ * may write at the same time.
+ * By default, the parts are written one after another.  Writing several parts
+ * at once can be much faster if the destination handles concurrent writes well,
+ * such as a fast SSD or a RAID array, but is usually slower on a single
+ * spinning disk or a USB flash drive.
+ *
+ * Parts are only written concurrently when this requires nothing more than
+ * copying the already-compressed data out of the WIM file, that is, when
+ * neither the compression type nor the chunk size is being changed and
+ * ::WIMLIB_WRITE_FLAG_RECOMPRESS and ::WIMLIB_WRITE_FLAG_PIPABLE are not
+ * specified.  Otherwise, the parts are written one at a time regardless of this
+ * setting.
+ *
+ * When parts are written concurrently, the progress function registered with
+ * @p wim may be called from threads other than the one which called
+ * wimlib_split(), though never from two threads at once.  The
+ * ::WIMLIB_PROGRESS_MSG_SPLIT_BEGIN_PART and
+ * ::WIMLIB_PROGRESS_MSG_SPLIT_END_PART messages of different parts, as well as
+ * the ::WIMLIB_PROGRESS_MSG_WRITE_STREAMS messages reporting the progress of
+ * each part, may then be interleaved.
+ *
+ * @param wim
+ *	The ::WIMStruct that will be split.
+ * @param num_threads
+ *	The maximum number of parts to write at the same time.  0 and 1 both
+ *	mean one at a time.
+ * @param max_threads_per_device
+ *	The maximum number of parts to write at the same time into directories
+ *	that are located on the same device, or 0 for no limit other than @p
+ *	num_threads.  The device is determined after
+ *	::WIMLIB_PROGRESS_MSG_SPLIT_BEGIN_PART is sent for the part, so it
+ *	reflects any change to the part name made by the progress function.
+ */
+extern void
+wimlib_set_split_threads(WIMStruct *wim, unsigned num_threads,
+			 unsigned max_threads_per_device);
+
 /**
  * @ingroup G_general
  *
@@ -4659,6 +4881,46 @@ struct wimlib_decompressor;
 extern int
 wimlib_set_default_compression_level(int ctype, unsigned int compression_level);
 
+/**
+ * Set a file in which to keep compressed chunks for reuse by later writes.
+ *
+ * When data is compressed while writing a WIM file (for example, because
+ * ::WIMLIB_WRITE_FLAG_RECOMPRESS was specified, or because the data is new),
+ * each chunk is first looked up in the cache by the SHA-1 message digest of its
+ * uncompressed data together with the compression type, compression level, and
+ * chunk size.  If it is found, the cached compressed data is written instead of
+ * compressing the chunk again.  Otherwise the chunk is compressed and the
+ * result is added to the cache.  This can make rewriting images that are
+ * mostly unchanged since a previous write much faster.
+ *
+ * The cache file is memory-mapped.  It is created if it doesn't exist, and its
+ * contents are discarded if it was created with a different size or wasn't
+ * closed cleanly.  When it is full, the oldest chunks are overwritten.  Only
+ * one write at a time can use the cache; other writes run without it.  The
+ * file is not portable between machines.
+ *
+ * Problems opening the cache file are reported as warnings, not errors.  This
+ * function must not be called while a WIM file is being written.  It is not
+ * supported on Windows.
+ *
+ * @param path
+ *	Path to the cache file, or @c NULL to stop using a cache.
+ * @param max_size
+ *	Size of the cache file in bytes, or 0 for the default of 1 GiB.  Must be
+ *	at least 1 MiB.
+ *
+ * @return 0 on success; a ::wimlib_error_code value on failure.
+ *
+ * @retval ::WIMLIB_ERR_INVALID_PARAM
+ *	@p max_size was too small or too large.
+ * @retval ::WIMLIB_ERR_NOMEM
+ *	Out of memory.
+ * @retval ::WIMLIB_ERR_UNSUPPORTED
+ *	Chunk caches are not supported on this platform.
+ */
+extern int
+wimlib_set_chunk_cache(const wimlib_tchar *path, uint64_t max_size);
+
 /**
  * Return the approximate number of bytes needed to allocate a compressor with
  * wimlib_create_compressor() for the specified compression type, maximum block
@@ -4674,6 +4936,8 @@ wimlib_get_compressor_needed_memory(enum wimlib_compression_type ctype,
 
 #define WIMLIB_COMPRESSOR_FLAG_DESTRUCTIVE	0x80000000
 
+#define WIMLIB_COMPRESSOR_FLAG_HELPER_THREAD	0x40000000
+
 /**
  * Allocate a compressor for the specified compression type using the specified
  * parameters.  This function is part of wimlib's compression API; it is not
@@ -4727,6 +4991,14 @@ wimlib_get_compressor_needed_memory(enum wimlib_compression_type ctype,
  *	may have been written to but will have been restored exactly to its
  *	original state.  This mode is designed to save some memory when using
  *	large buffer sizes.
+ *	<br/>
+ *	This parameter can also be OR-ed with the flag
+ *	::WIMLIB_COMPRESSOR_FLAG_HELPER_THREAD.  This allows the compressor to
+ *	use a second thread to speed up compressing each buffer, without
+ *	changing the compressed output.  Currently this only has an effect for
+ *	LZX at compression levels of 35 and above and for buffers of at least
+ *	200000 bytes.  The extra memory used by the thread is not included in
+ *	the value returned by wimlib_get_compressor_needed_memory().
  * @param compressor_ret
  *	A location into which to return the pointer to the allocated compressor.
  *	The allocated compressor can be used for any number of calls to
@@ -266,6 +266,13 @@ struct apply_operations {
 	 * that form a single tree, not multiple trees.
 	 */
 	bool single_tree_only;
+	/*
+	 * Set this if the extraction backend's blob callbacks can handle a
+	 * blob with any number of extraction targets.  Otherwise,
+	 * extract_blob_list() splits up blobs with more than MAX_OPEN_FILES
+	 * targets.
+	 */
+	bool any_number_of_targets;
 };
 
 #ifdef __WIN32__
@@ -108,6 +108,14 @@ new_blob_descriptor(void)
 	return CALLOC(1, sizeof(struct blob_descriptor));
 }
 
+#ifdef WITH_FUSE
+static size_t
+staging_chunk_map_size(u64 size)
+{
+	return DIV_ROUND_UP(DIV_ROUND_UP(size, STAGING_CHUNK_SIZE), 8);
+}
+#endif
+
 struct blob_descriptor *
 clone_blob_descriptor(const struct blob_descriptor *old)
 {
@@ -122,12 +130,24 @@ clone_blob_descriptor(const struct blob_descriptor *old)
 		list_add(&new->rdesc_node, &new->rdesc->blob_list);
 		break;
 
-	case BLOB_IN_FILE_ON_DISK:
 #ifdef WITH_FUSE
 	case BLOB_IN_STAGING_FILE:
-		STATIC_ASSERT((void*)&old->file_on_disk ==
-			      (void*)&old->staging_file_name);
+		new->staging_base = NULL;
+		new->staging_file_name = STRDUP(old->staging_file_name);
+		if (new->staging_file_name == NULL)
+			goto out_free;
+		if (old->staging_base) {
+			new->staging_base = new_staging_base(old->staging_base->blob,
+							     old->staging_base->size);
+			if (new->staging_base == NULL)
+				goto out_free;
+			memcpy(new->staging_base->chunk_map,
+			       old->staging_base->chunk_map,
+			       staging_chunk_map_size(old->staging_base->size));
+		}
+		break;
 #endif
+	case BLOB_IN_FILE_ON_DISK:
 		new->file_on_disk = TSTRDUP(old->file_on_disk);
 		if (new->file_on_disk == NULL)
 			goto out_free;
@@ -173,12 +193,13 @@ blob_release_location(struct blob_descriptor *blob)
 		}
 		break;
 	}
-	case BLOB_IN_FILE_ON_DISK:
 #ifdef WITH_FUSE
 	case BLOB_IN_STAGING_FILE:
-		STATIC_ASSERT((void*)&blob->file_on_disk ==
-			      (void*)&blob->staging_file_name);
+		free_staging_base(blob->staging_base);
+		FREE(blob->staging_file_name);
+		break;
 #endif
+	case BLOB_IN_FILE_ON_DISK:
         case BLOB_IN_ATTACHED_BUFFER: {
             ((void)sizeof(char[1 - 2 * !((void*)&blob->file_on_disk ==
                                          (void*)&blob->attached_buffer)]));
@@ -297,6 +318,128 @@ blob_decrement_num_opened_fds(struct blob_descriptor *blob)
 	if (--blob->num_opened_fds == 0 && blob->refcnt == 0)
 		finalize_blob(blob);
 }
+
+/* Allocate a staging_base for staged data whose first @size bytes are, for now,
+ * those of @blob, which must be located in a WIM file.  No chunks are marked as
+ * copied yet.  */
+struct staging_base *
+new_staging_base(const struct blob_descriptor *blob, u64 size)
+{
+	size_t map_size = staging_chunk_map_size(size);
+	struct staging_base *base;
+
+	wimlib_assert(blob->blob_location == BLOB_IN_WIM);
+	wimlib_assert(size <= blob->size);
+
+	base = CALLOC(1, sizeof(*base) + map_size);
+	if (!base)
+		return NULL;
+	base->blob = clone_blob_descriptor(blob);
+	if (!base->blob) {
+		FREE(base);
+		return NULL;
+	}
+	base->size = size;
+	return base;
+}
+
+void
+free_staging_base(struct staging_base *base)
+{
+	if (base) {
+		free_blob_descriptor(base->blob);
+		FREE(base);
+	}
+}
+#endif
+
+#if defined(WITH_FUSE) || defined(ENABLE_TEST_SUPPORT)
+/*
+ * Determine where the staged data of a blob located in a staging file, whose
+ * staging_base is @base, starting at @offset comes from: the staging file, or
+ * the original blob (in which case it is at the same offset there).  Returns
+ * the number of bytes, up to @end - @offset, that come from the same place.
+ */
+u64
+staging_data_run(const struct staging_base *base, u64 offset, u64 end,
+		 bool *in_staging_file_ret)
+{
+	u64 chunk_idx;
+	u64 run_end;
+	bool in_staging_file;
+
+	if (!base || offset >= base->size) {
+		*in_staging_file_ret = true;
+		return end - offset;
+	}
+
+	chunk_idx = offset / STAGING_CHUNK_SIZE;
+	in_staging_file = staging_chunk_is_copied(base, chunk_idx);
+	run_end = (chunk_idx + 1) * STAGING_CHUNK_SIZE;
+	while (run_end < min(base->size, end) &&
+	       staging_chunk_is_copied(base, run_end / STAGING_CHUNK_SIZE) ==
+			in_staging_file)
+		run_end += STAGING_CHUNK_SIZE;
+
+	if (run_end >= base->size)
+		run_end = in_staging_file ? end : base->size;
+	*in_staging_file_ret = in_staging_file;
+	return min(run_end, end) - offset;
+}
+
+/*
+ * Before the range [@start, @end) of staged data is overwritten, find the
+ * original data that must first be copied into the staging file: the parts of
+ * the first and last chunks touched by the write that lie outside the range,
+ * up to @base->size, in chunks not copied yet.  Note that a write at or past
+ * @base->size still touches the last chunk of the original data if that chunk
+ * is partial.  Stores up to two [start, end) ranges in @ranges and returns the
+ * number stored.
+ */
+unsigned
+staging_edges_to_copy(const struct staging_base *base, u64 start, u64 end,
+		      u64 ranges[2][2])
+{
+	u64 chunk_idx;
+	u64 chunk_start;
+	unsigned num_ranges = 0;
+
+	if (start >= end)
+		return 0;
+
+	chunk_idx = start / STAGING_CHUNK_SIZE;
+	chunk_start = chunk_idx * STAGING_CHUNK_SIZE;
+	if (chunk_start < min(start, base->size) &&
+	    !staging_chunk_is_copied(base, chunk_idx))
+	{
+		ranges[num_ranges][0] = chunk_start;
+		ranges[num_ranges][1] = min(start, base->size);
+		num_ranges++;
+	}
+
+	chunk_idx = (end - 1) / STAGING_CHUNK_SIZE;
+	chunk_start = chunk_idx * STAGING_CHUNK_SIZE;
+	if (end < min(chunk_start + STAGING_CHUNK_SIZE, base->size) &&
+	    !staging_chunk_is_copied(base, chunk_idx))
+	{
+		ranges[num_ranges][0] = end;
+		ranges[num_ranges][1] = min(chunk_start + STAGING_CHUNK_SIZE,
+					    base->size);
+		num_ranges++;
+	}
+	return num_ranges;
+}
+
+/* Record that the range [@start, @end) of staged data has been written, after
+ * the ranges given by staging_edges_to_copy() were copied.  Every chunk of the
+ * original data that the range touched is now entirely in the staging file.  */
+void
+staging_mark_written(struct staging_base *base, u64 start, u64 end)
+{
+	for (u64 i = start / STAGING_CHUNK_SIZE;
+	     i * STAGING_CHUNK_SIZE < min(end, base->size); i++)
+		staging_mark_chunk_copied(base, i);
+}
 #endif
 
 static void
@@ -877,6 +1020,8 @@ read_blob_table(WIMStruct *wim)
 {
 	int ret;
 	size_t num_entries;
+	const struct wim_reshdr *table_reshdr = &wim->hdr.blob_table_reshdr;
+	const void *table_data = NULL;
 	void *buf = NULL;
 	struct blob_table *table = NULL;
 	struct blob_descriptor *cur_blob = NULL;
@@ -891,10 +1036,18 @@ read_blob_table(WIMStruct *wim)
 	num_entries = wim->hdr.blob_table_reshdr.uncompressed_size /
 		      sizeof(struct blob_descriptor_disk);
 
-	/* Read the blob table into a buffer.  */
-	ret = wim_reshdr_to_data(&wim->hdr.blob_table_reshdr, wim, &buf);
-	if (ret)
-		goto out;
+	/* If the blob table is stored uncompressed in a mapped WIM file, use it
+	 * in place.  Otherwise read it into a buffer.  */
+	if (!(table_reshdr->flags & WIM_RESHDR_FLAG_COMPRESSED) &&
+	    table_reshdr->size_in_wim == table_reshdr->uncompressed_size)
+		table_data = filedes_mapped(&wim->in_fd, table_reshdr->offset_in_wim,
+					    table_reshdr->uncompressed_size);
+	if (!table_data) {
+		ret = wim_reshdr_to_data(table_reshdr, wim, &buf);
+		if (ret)
+			goto out;
+		table_data = buf;
+	}
 
 	/* Allocate a hash table to map SHA-1 message digests into blob
 	 * descriptors.  This is the in-memory "blob table".  */
@@ -906,7 +1059,7 @@ read_blob_table(WIMStruct *wim)
 	 * buffer.  */
 	for (size_t i = 0; i < num_entries; i++) {
 		const struct blob_descriptor_disk *disk_entry =
-			&((const struct blob_descriptor_disk*)buf)[i];
+			&((const struct blob_descriptor_disk*)table_data)[i];
 		struct wim_reshdr reshdr;
 		u16 part_number;
 
@@ -29,7 +29,8 @@ enum blob_location {
 #ifdef WITH_FUSE
 	/* The blob's data is available as the contents of the file with name
 	 * @staging_file_name relative to the open directory file descriptor
-	 * @staging_dir_fd.  */
+	 * @staging_dir_fd, except that if @staging_base is not NULL, parts of
+	 * it may still need to be taken from another blob instead.  */
 	BLOB_IN_STAGING_FILE,
 #endif
 
@@ -48,6 +49,32 @@ enum blob_location {
 #endif
 };
 
+#if defined(WITH_FUSE) || defined(ENABLE_TEST_SUPPORT)
+/* Size of the chunks in which the data of a blob in a WIM file is copied into a
+ * staging file when it's modified in a read-write mounted image  */
+#define STAGING_CHUNK_SIZE 32768
+
+/*
+ * For a blob in a staging file that was created from a blob in a WIM file
+ * without copying any data: the original blob, and which of its chunks have
+ * been copied into the staging file so far.  A chunk is copied just before
+ * part of it is first modified, so a small modification to a large file only
+ * costs copying a chunk or two; the unmodified data is read from the WIM file.
+ */
+struct staging_base {
+	/* Private copy of the descriptor of the original blob  */
+	struct blob_descriptor *blob;
+
+	/* The data of the original blob that's still part of the staged data,
+	 * in bytes.  This only ever decreases, when the staged data is
+	 * truncated.  Beyond this, the staging file holds all the data.  */
+	u64 size;
+
+	/* Bitmap of the chunks below @size that are in the staging file  */
+	u8 chunk_map[];
+};
+#endif
+
 /* A "blob extraction target" is a stream, and the inode to which that stream
  * belongs, to which a blob needs to be extracted as part of an extraction
  * operation.  Since blobs are single-instanced, a blob may have multiple
@@ -189,6 +216,7 @@ struct blob_descriptor {
 				struct {
 					char *staging_file_name;
 					int staging_dir_fd;
+					struct staging_base *staging_base;
 				};
 			#endif
 
@@ -297,6 +325,37 @@ blob_subtract_refcnt(struct blob_descriptor *blob, struct blob_table *table,
 #ifdef WITH_FUSE
 extern void
 blob_decrement_num_opened_fds(struct blob_descriptor *blob);
+
+extern struct staging_base *
+new_staging_base(const struct blob_descriptor *blob, u64 size);
+
+extern void
+free_staging_base(struct staging_base *base);
+#endif
+
+#if defined(WITH_FUSE) || defined(ENABLE_TEST_SUPPORT)
+static inline bool
+staging_chunk_is_copied(const struct staging_base *base, u64 chunk_idx)
+{
+	return base->chunk_map[chunk_idx / 8] & (1U << (chunk_idx % 8));
+}
+
+static inline void
+staging_mark_chunk_copied(struct staging_base *base, u64 chunk_idx)
+{
+	base->chunk_map[chunk_idx / 8] |= 1U << (chunk_idx % 8);
+}
+
+extern u64
+staging_data_run(const struct staging_base *base, u64 offset, u64 end,
+		 bool *in_staging_file_ret);
+
+extern unsigned
+staging_edges_to_copy(const struct staging_base *base, u64 start, u64 end,
+		      u64 ranges[2][2]);
+
+extern void
+staging_mark_written(struct staging_base *base, u64 start, u64 end);
 #endif
 
 extern void
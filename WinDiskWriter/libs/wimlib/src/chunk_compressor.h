@@ -58,6 +58,12 @@ struct chunk_compressor {
 	 * being compressed.  */
 	bool (*get_compression_result)(struct chunk_compressor *,
 				       const void **, u32 *, u32 *);
+	/* Optional; only provided by implementations which compress chunks on
+	 * other threads.  Returns an array of ->num_threads values, each the
+	 * percentage of time the corresponding thread has spent compressing
+	 * since the chunk compressor was created.  The array is in storage
+	 * internal to the chunk compressor and is updated by each call.  */
+	const u8 *(*get_thread_utilization)(struct chunk_compressor *);
 };
 
 
@@ -70,6 +76,11 @@ new_parallel_chunk_compressor(int out_ctype, u32 out_chunk_size,
 
 int
 new_serial_chunk_compressor(int out_ctype, u32 out_chunk_size,
+			    bool use_helper_thread,
 			    struct chunk_compressor **compressor_ret);
 
+int
+new_caching_chunk_compressor(struct chunk_compressor *inner,
+			     struct chunk_compressor **compressor_ret);
+
 #endif /* _WIMLIB_CHUNK_COMPRESSOR_H  */
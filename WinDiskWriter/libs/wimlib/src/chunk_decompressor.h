@@ -0,0 +1,74 @@
+/*
+ * chunk_decompressor.h
+ *
+ * Interface for parallel chunk decompression.
+ */
+
+#ifndef _WIMLIB_CHUNK_DECOMPRESSOR_H
+#define _WIMLIB_CHUNK_DECOMPRESSOR_H
+
+#include "types.h"
+
+/* Interface for chunk decompression.  Users can submit compressed chunks of
+ * data to be decompressed, then retrieve the uncompressed data later in order.
+ * This is the read-side counterpart of 'struct chunk_compressor'; the serial
+ * case is handled directly by read_compressed_wim_resource(), so the only
+ * implementation has other threads asynchronously decompress the chunks.  */
+struct chunk_decompressor {
+	/* Variables set by the chunk decompressor when it is created.  */
+	int ctype;
+	u32 chunk_size;
+	unsigned num_threads;
+
+	/* Approximate number of bytes of memory used for chunk buffers  */
+	u64 buffer_size;
+
+	/* If set, chunks that fail to decompress are zero-filled and
+	 * decompressed as far as possible rather than causing an error.  This
+	 * applies to chunks submitted after it is changed.  */
+	bool recover_data;
+
+	/* Free the chunk decompressor.  */
+	void (*destroy)(struct chunk_decompressor *);
+
+	/* Try to borrow a buffer into which the data for the next chunk, which
+	 * is @csize bytes compressed and @usize bytes uncompressed, should be
+	 * read.  If @csize == @usize the chunk is stored uncompressed.
+	 *
+	 * Only one buffer can be borrowed at a time.
+	 *
+	 * Returns a pointer to the buffer, or NULL if no buffer is available.
+	 * If no buffer is available, you must call
+	 * ->get_decompression_result() to retrieve an uncompressed chunk before
+	 * trying again.  */
+	void *(*get_chunk_buffer)(struct chunk_decompressor *, u32 csize,
+				  u32 usize);
+
+	/* Signals to the chunk decompressor that the buffer which was loaned
+	 * out from ->get_chunk_buffer() has finished being filled.  */
+	void (*signal_chunk_filled)(struct chunk_decompressor *);
+
+	/* Get the next chunk of uncompressed data.
+	 *
+	 * The uncompressed data, its size, and the status of decompressing it
+	 * (0 or WIMLIB_ERR_DECOMPRESSION) are returned in the locations pointed
+	 * to by arguments 2-4.  The data is in storage internal to the chunk
+	 * decompressor, and it cannot be accessed beyond any subsequent calls
+	 * to the chunk decompressor.
+	 *
+	 * Chunks will be returned in the same order in which they were
+	 * submitted for decompression.
+	 *
+	 * The return value is %true if a chunk of uncompressed data was
+	 * successfully retrieved, or %false if there are no chunks currently
+	 * being decompressed.  */
+	bool (*get_decompression_result)(struct chunk_decompressor *,
+					 const void **, u32 *, int *);
+};
+
+int
+new_parallel_chunk_decompressor(int ctype, u32 chunk_size,
+				unsigned num_threads, u64 max_memory,
+				struct chunk_decompressor **decompressor_ret);
+
+#endif /* _WIMLIB_CHUNK_DECOMPRESSOR_H  */
@@ -113,6 +113,12 @@
  * the case if the function contains only static assertions.  */
 #define _unused_attribute	__attribute__((unused))
 
+/* Declare that the annotated function should be compiled to use the specified
+ * instruction set extensions (e.g. "avx2") in addition to those enabled for the
+ * whole program.  Such a function must only be called after checking at
+ * runtime that the processor supports the extensions.  */
+#define _target_attribute(attrs)	__attribute__((target(attrs)))
+
 /* Endianness definitions.  Either CPU_IS_BIG_ENDIAN() or CPU_IS_LITTLE_ENDIAN()
  * evaluates to 1.  The other evaluates to 0.  Note that newer gcc supports
  * __BYTE_ORDER__ for easily determining the endianness; older gcc doesn't.  In
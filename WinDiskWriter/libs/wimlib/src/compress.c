@@ -58,6 +58,20 @@ compressor_ctype_valid(int ctype)
 		compressor_ops[ctype] != NULL);
 }
 
+/* Return the compression level that wimlib_create_compressor() uses for @ctype
+ * when it is passed 0.  */
+unsigned int
+get_default_compression_level(int ctype)
+{
+	unsigned int compression_level = 0;
+
+	if (compressor_ctype_valid(ctype))
+		compression_level = default_compression_levels[ctype];
+	if (compression_level == 0)
+		compression_level = DEFAULT_COMPRESSION_LEVEL;
+	return compression_level;
+}
+
 WIMLIBAPI int
 wimlib_set_default_compression_level(int ctype, unsigned int compression_level)
 {
@@ -83,7 +97,8 @@ wimlib_get_compressor_needed_memory(enum wimlib_compression_type ctype,
 	u64 size;
 
 	destructive = (compression_level & WIMLIB_COMPRESSOR_FLAG_DESTRUCTIVE);
-	compression_level &= ~WIMLIB_COMPRESSOR_FLAG_DESTRUCTIVE;
+	compression_level &= ~(WIMLIB_COMPRESSOR_FLAG_DESTRUCTIVE |
+			       WIMLIB_COMPRESSOR_FLAG_HELPER_THREAD);
 
 	if (!compressor_ctype_valid(ctype))
 		return 0;
@@ -121,10 +136,13 @@ wimlib_create_compressor(enum wimlib_compression_type ctype,
 			 struct wimlib_compressor **c_ret)
 {
 	bool destructive;
+	bool helper_thread;
 	struct wimlib_compressor *c;
 
 	destructive = (compression_level & WIMLIB_COMPRESSOR_FLAG_DESTRUCTIVE);
-	compression_level &= ~WIMLIB_COMPRESSOR_FLAG_DESTRUCTIVE;
+	helper_thread = (compression_level & WIMLIB_COMPRESSOR_FLAG_HELPER_THREAD);
+	compression_level &= ~(WIMLIB_COMPRESSOR_FLAG_DESTRUCTIVE |
+			       WIMLIB_COMPRESSOR_FLAG_HELPER_THREAD);
 
 	if (!compressor_ctype_valid(ctype))
 		return WIMLIB_ERR_INVALID_COMPRESSION_TYPE;
@@ -161,6 +179,8 @@ wimlib_create_compressor(enum wimlib_compression_type ctype,
 			FREE(c);
 			return ret;
 		}
+		if (helper_thread && c->ops->start_helper_thread)
+			c->ops->start_helper_thread(c->private);
 	}
 	*c_ret = c;
 	return 0;
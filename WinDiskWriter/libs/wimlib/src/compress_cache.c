@@ -0,0 +1,580 @@
+/*
+ * compress_cache.c
+ *
+ * A chunk_compressor that looks up each chunk in a persistent cache of
+ * compressed chunks before handing it to another chunk_compressor.
+ */
+
+/*
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this file; if not, see http://www.gnu.org/licenses/.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <string.h>
+#ifndef __WIN32__
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#  include <unistd.h>
+#endif
+
+#include "wimlib.h"
+#include "assert.h"
+#include "bitops.h"
+#include "chunk_compressor.h"
+#include "compressor_ops.h"
+#include "error.h"
+#include "file_io.h"
+#include "sha1.h"
+#include "unaligned.h"
+#include "util.h"
+
+/* The cache file set with wimlib_set_chunk_cache(), or NULL if none  */
+static tchar *chunk_cache_path;
+static u64 chunk_cache_size;
+
+#define DEFAULT_CHUNK_CACHE_SIZE	((u64)1 << 30)
+#define MIN_CHUNK_CACHE_SIZE		((u64)1 << 20)
+
+WIMLIBAPI int
+wimlib_set_chunk_cache(const tchar *path, uint64_t max_size)
+{
+	tchar *new_path = NULL;
+
+	if (path) {
+#ifdef __WIN32__
+		return WIMLIB_ERR_UNSUPPORTED;
+#else
+		if (max_size == 0)
+			max_size = DEFAULT_CHUNK_CACHE_SIZE;
+		if (max_size < MIN_CHUNK_CACHE_SIZE || max_size > SIZE_MAX)
+			return WIMLIB_ERR_INVALID_PARAM;
+		new_path = TSTRDUP(path);
+		if (!new_path)
+			return WIMLIB_ERR_NOMEM;
+#endif
+	}
+	FREE(chunk_cache_path);
+	chunk_cache_path = new_path;
+	chunk_cache_size = max_size;
+	return 0;
+}
+
+#ifndef __WIN32__
+
+/*
+ * Layout of the cache file: a header, then a hash table of entries, then a
+ * data area which is written as a ring buffer.  Positions in the data area
+ * are "log positions" which only increase; the data for log position 'pos'
+ * is at offset 'pos % data_size'.  An entry is stale once the ring buffer has
+ * wrapped around past its data.
+ *
+ * The file is only meant to be used on the machine that created it, so all
+ * fields are in native byte order.
+ */
+
+#define CHUNK_CACHE_MAGIC	"WLCHKCCH"
+#define CHUNK_CACHE_VERSION	2
+
+/* Number of entries per hash table bucket  */
+#define CHUNK_CACHE_WAYS	4
+
+/* Size of the data area per hash table bucket  */
+#define CHUNK_CACHE_BYTES_PER_BUCKET	16384
+
+#define CHUNK_CACHE_ALIGN	4096
+
+struct chunk_cache_hdr {
+	char magic[8];
+	u32 version;
+	u32 num_buckets;
+	u64 file_size;
+	u64 data_offset;
+	u64 data_size;
+
+	/* Log position at which the next data will be written  */
+	u64 head;
+
+	/* Set while the file is open for use.  If it is still set when the
+	 * file is opened, the previous user didn't close the cache cleanly,
+	 * and its contents are discarded.  */
+	u32 dirty;
+};
+
+/* What a compressed chunk is looked up by  */
+struct chunk_cache_key {
+	u8 hash[SHA1_HASH_SIZE];
+	u32 ctype;
+	u32 level;
+	u32 chunk_size;
+	u32 usize;
+};
+
+struct chunk_cache_entry {
+	struct chunk_cache_key key;
+	u32 csize;		/* 0 if the entry is unused  */
+	u64 pos;
+
+	/* SHA-1 message digest of the compressed data  */
+	u8 csum[SHA1_HASH_SIZE];
+};
+
+/* Set while a chunk_cache is open in this process  */
+static atomic_bool chunk_cache_in_use;
+
+struct chunk_cache {
+	int fd;
+	u8 *map;
+	size_t map_size;
+	struct chunk_cache_hdr *hdr;
+	struct chunk_cache_entry *entries;
+	u8 *data;
+	u32 bucket_mask;
+};
+
+static bool
+chunk_cache_entry_is_live(const struct chunk_cache *cache,
+			  const struct chunk_cache_entry *entry)
+{
+	return entry->csize != 0 &&
+	       entry->pos + cache->hdr->data_size >= cache->hdr->head;
+}
+
+/*
+ * Return true if a live entry which matches a lookup can be used.  The cache
+ * file may have been damaged or edited, so don't trust anything in the entry:
+ * it must describe data that lies within the part of the data area written so
+ * far, that is smaller than the uncompressed chunk, and whose checksum
+ * matches.  Otherwise the chunk is treated as not cached.
+ */
+static bool
+chunk_cache_entry_is_valid(const struct chunk_cache *cache,
+			   const struct chunk_cache_entry *entry)
+{
+	const struct chunk_cache_hdr *hdr = cache->hdr;
+	u8 csum[SHA1_HASH_SIZE];
+
+	if (entry->csize >= entry->key.usize ||
+	    entry->pos > hdr->head ||
+	    entry->csize > hdr->head - entry->pos ||
+	    entry->pos % hdr->data_size + entry->csize > hdr->data_size)
+		return false;
+
+	sha1_buffer(&cache->data[entry->pos % hdr->data_size], entry->csize,
+		    csum);
+	return hashes_equal(csum, entry->csum);
+}
+
+static struct chunk_cache_entry *
+chunk_cache_bucket(const struct chunk_cache *cache,
+		   const struct chunk_cache_key *key)
+{
+	u32 i = get_unaligned_le32(key->hash) & cache->bucket_mask;
+
+	return &cache->entries[(size_t)i * CHUNK_CACHE_WAYS];
+}
+
+/* Look up a compressed chunk.  On success, return a pointer to its data
+ * (valid until the data area wraps around past it) and its size and log
+ * position.  Otherwise return NULL.  */
+static const u8 *
+chunk_cache_lookup(const struct chunk_cache *cache,
+		   const struct chunk_cache_key *key, u32 *csize_ret,
+		   u64 *pos_ret)
+{
+	const struct chunk_cache_entry *bucket = chunk_cache_bucket(cache, key);
+
+	for (int i = 0; i < CHUNK_CACHE_WAYS; i++) {
+		const struct chunk_cache_entry *entry = &bucket[i];
+
+		if (chunk_cache_entry_is_live(cache, entry) &&
+		    !memcmp(&entry->key, key, sizeof(*key)) &&
+		    chunk_cache_entry_is_valid(cache, entry))
+		{
+			*csize_ret = entry->csize;
+			*pos_ret = entry->pos;
+			return &cache->data[entry->pos % cache->hdr->data_size];
+		}
+	}
+	return NULL;
+}
+
+/* Add a compressed chunk to the cache, unless doing so would overwrite data
+ * at or after log position @keep_pos, which is still in use.  */
+static void
+chunk_cache_insert(struct chunk_cache *cache,
+		   const struct chunk_cache_key *key,
+		   const void *cdata, u32 csize, u64 keep_pos)
+{
+	struct chunk_cache_hdr *hdr = cache->hdr;
+	struct chunk_cache_entry *bucket = chunk_cache_bucket(cache, key);
+	struct chunk_cache_entry *victim = NULL;
+	u64 pos;
+
+	if (csize == 0 || csize > hdr->data_size / 4)
+		return;
+
+	/* Don't let a chunk's data wrap around the end of the data area.  */
+	pos = hdr->head;
+	if (pos % hdr->data_size + csize > hdr->data_size)
+		pos += hdr->data_size - pos % hdr->data_size;
+
+	if (pos + csize > keep_pos + hdr->data_size)
+		return;
+
+	/* Replace an unused or stale entry, or else the oldest one.  Entries
+	 * which are still live will only be made stale after the head has
+	 * advanced, so check against the new head.  */
+	for (int i = 0; i < CHUNK_CACHE_WAYS; i++) {
+		struct chunk_cache_entry *entry = &bucket[i];
+
+		if (entry->csize == 0 ||
+		    entry->pos + hdr->data_size < pos + csize) {
+			victim = entry;
+			break;
+		}
+		if (!victim || entry->pos < victim->pos)
+			victim = entry;
+	}
+
+	memcpy(&cache->data[pos % hdr->data_size], cdata, csize);
+	hdr->head = pos + csize;
+	victim->key = *key;
+	victim->csize = csize;
+	victim->pos = pos;
+	sha1_buffer(cdata, csize, victim->csum);
+}
+
+static void
+chunk_cache_reset(struct chunk_cache *cache, u32 num_buckets, u64 data_offset)
+{
+	struct chunk_cache_hdr *hdr = cache->hdr;
+
+	memset(cache->map, 0, data_offset);
+	memcpy(hdr->magic, CHUNK_CACHE_MAGIC, sizeof(hdr->magic));
+	hdr->version = CHUNK_CACHE_VERSION;
+	hdr->num_buckets = num_buckets;
+	hdr->file_size = cache->map_size;
+	hdr->data_offset = data_offset;
+	hdr->data_size = cache->map_size - data_offset;
+	hdr->head = 0;
+}
+
+static void
+chunk_cache_close(struct chunk_cache *cache)
+{
+	/* Make sure the data is on disk before the cache is marked clean.  */
+	msync(cache->map, cache->map_size, MS_SYNC);
+	cache->hdr->dirty = 0;
+	msync(cache->map, CHUNK_CACHE_ALIGN, MS_SYNC);
+	munmap(cache->map, cache->map_size);
+	close(cache->fd);
+	FREE(cache);
+	atomic_store(&chunk_cache_in_use, false);
+}
+
+/* Open (creating it if needed) the cache file set with
+ * wimlib_set_chunk_cache().  Returns NULL if there is none or if it can't be
+ * used; that isn't an error.  */
+static struct chunk_cache *
+chunk_cache_open(void)
+{
+	struct chunk_cache *cache;
+	struct stat stbuf;
+	struct flock lock = {
+		.l_type = F_WRLCK,
+		.l_whence = SEEK_SET,
+	};
+	size_t file_size;
+	u32 num_buckets;
+	u64 data_offset;
+	void *map;
+
+	if (!chunk_cache_path)
+		return NULL;
+
+	/* Only one write at a time can use the cache, both within this process
+	 * (for example, when split WIM parts are written concurrently) and
+	 * across processes.  */
+	if (atomic_exchange(&chunk_cache_in_use, true))
+		return NULL;
+
+	cache = CALLOC(1, sizeof(*cache));
+	if (!cache)
+		goto err_release;
+
+	cache->fd = topen(chunk_cache_path, O_RDWR | O_CREAT | O_BINARY, 0644);
+	if (cache->fd < 0) {
+		WARNING_WITH_ERRNO("Can't open chunk cache \"%"TS"\"",
+				   chunk_cache_path);
+		goto err_free;
+	}
+
+	if (fcntl(cache->fd, F_SETLK, &lock)) {
+		WARNING("Chunk cache \"%"TS"\" is in use by another process; "
+			"not using it", chunk_cache_path);
+		goto err_close;
+	}
+
+	file_size = chunk_cache_size;
+	num_buckets = 1U << bsr64(max(file_size / CHUNK_CACHE_BYTES_PER_BUCKET,
+				      16));
+	data_offset = ALIGN(sizeof(struct chunk_cache_hdr), CHUNK_CACHE_ALIGN) +
+		      ALIGN((u64)num_buckets * CHUNK_CACHE_WAYS *
+			    sizeof(struct chunk_cache_entry), CHUNK_CACHE_ALIGN);
+
+	if (fstat(cache->fd, &stbuf) ||
+	    ((u64)stbuf.st_size != file_size && ftruncate(cache->fd, file_size)))
+	{
+		WARNING_WITH_ERRNO("Can't resize chunk cache \"%"TS"\"",
+				   chunk_cache_path);
+		goto err_close;
+	}
+
+	map = mmap(NULL, file_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   cache->fd, 0);
+	if (map == MAP_FAILED) {
+		WARNING_WITH_ERRNO("Can't map chunk cache \"%"TS"\"",
+				   chunk_cache_path);
+		goto err_close;
+	}
+	cache->map = map;
+	cache->map_size = file_size;
+	cache->hdr = map;
+	cache->entries = (void *)(cache->map +
+				  ALIGN(sizeof(struct chunk_cache_hdr),
+					CHUNK_CACHE_ALIGN));
+	cache->data = cache->map + data_offset;
+	cache->bucket_mask = num_buckets - 1;
+
+	if (memcmp(cache->hdr->magic, CHUNK_CACHE_MAGIC,
+		   sizeof(cache->hdr->magic)) ||
+	    cache->hdr->version != CHUNK_CACHE_VERSION ||
+	    cache->hdr->num_buckets != num_buckets ||
+	    cache->hdr->file_size != file_size ||
+	    cache->hdr->data_offset != data_offset ||
+	    cache->hdr->data_size != file_size - data_offset ||
+	    cache->hdr->dirty)
+		chunk_cache_reset(cache, num_buckets, data_offset);
+
+	cache->hdr->dirty = 1;
+	msync(cache->map, CHUNK_CACHE_ALIGN, MS_SYNC);
+	return cache;
+
+err_close:
+	close(cache->fd);
+err_free:
+	FREE(cache);
+err_release:
+	atomic_store(&chunk_cache_in_use, false);
+	return NULL;
+}
+
+/* Maximum number of chunks that can be waiting to be returned  */
+#define MAX_PENDING_CHUNKS	128
+
+struct pending_chunk {
+	struct chunk_cache_key key;
+
+	/* If not NULL, the chunk was found in the cache and this is its
+	 * compressed data.  Otherwise the chunk is being compressed by the
+	 * wrapped chunk compressor.  */
+	const u8 *cached_data;
+	u32 csize;
+	u64 pos;
+};
+
+struct caching_chunk_compressor {
+	struct chunk_compressor base;
+	struct chunk_compressor *inner;
+	struct chunk_cache *cache;
+	unsigned level;
+
+	/* The buffer borrowed from the wrapped chunk compressor, if any.  The
+	 * buffer of a chunk found in the cache is reused for the next chunk.
+	 */
+	u8 *cur_buf;
+
+	struct pending_chunk pending[MAX_PENDING_CHUNKS];
+	size_t pending_head;
+	size_t num_pending;
+};
+
+static void
+caching_chunk_compressor_destroy(struct chunk_compressor *_ctx)
+{
+	struct caching_chunk_compressor *ctx =
+		(struct caching_chunk_compressor *)_ctx;
+
+	ctx->inner->destroy(ctx->inner);
+	chunk_cache_close(ctx->cache);
+	FREE(ctx);
+}
+
+static void *
+caching_chunk_compressor_get_chunk_buffer(struct chunk_compressor *_ctx)
+{
+	struct caching_chunk_compressor *ctx =
+		(struct caching_chunk_compressor *)_ctx;
+
+	if (ctx->num_pending == MAX_PENDING_CHUNKS)
+		return NULL;
+	if (!ctx->cur_buf)
+		ctx->cur_buf = ctx->inner->get_chunk_buffer(ctx->inner);
+	return ctx->cur_buf;
+}
+
+static void
+caching_chunk_compressor_signal_chunk_filled(struct chunk_compressor *_ctx,
+					     u32 usize)
+{
+	struct caching_chunk_compressor *ctx =
+		(struct caching_chunk_compressor *)_ctx;
+	struct pending_chunk *chunk;
+
+	wimlib_assert(ctx->cur_buf);
+	wimlib_assert(ctx->num_pending < MAX_PENDING_CHUNKS);
+
+	chunk = &ctx->pending[(ctx->pending_head + ctx->num_pending++) %
+			      MAX_PENDING_CHUNKS];
+	memset(&chunk->key, 0, sizeof(chunk->key));
+	sha1_buffer(ctx->cur_buf, usize, chunk->key.hash);
+	chunk->key.ctype = ctx->base.out_ctype;
+	chunk->key.level = ctx->level;
+	chunk->key.chunk_size = ctx->base.out_chunk_size;
+	chunk->key.usize = usize;
+
+	chunk->cached_data = chunk_cache_lookup(ctx->cache, &chunk->key,
+						&chunk->csize, &chunk->pos);
+	if (!chunk->cached_data) {
+		ctx->inner->signal_chunk_filled(ctx->inner, usize);
+		ctx->cur_buf = NULL;
+	}
+}
+
+/* Return the log position of the oldest cached data which is still waiting to
+ * be returned, or the current head if there is none.  */
+static u64
+oldest_pending_pos(const struct caching_chunk_compressor *ctx)
+{
+	u64 pos = ctx->cache->hdr->head;
+
+	for (size_t i = 0; i < ctx->num_pending; i++) {
+		const struct pending_chunk *chunk =
+			&ctx->pending[(ctx->pending_head + i) %
+				      MAX_PENDING_CHUNKS];
+		if (chunk->cached_data)
+			pos = min(pos, chunk->pos);
+	}
+	return pos;
+}
+
+static bool
+caching_chunk_compressor_get_compression_result(struct chunk_compressor *_ctx,
+						const void **cdata_ret,
+						u32 *csize_ret, u32 *usize_ret)
+{
+	struct caching_chunk_compressor *ctx =
+		(struct caching_chunk_compressor *)_ctx;
+	struct pending_chunk *chunk;
+
+	if (ctx->num_pending == 0)
+		return false;
+
+	chunk = &ctx->pending[ctx->pending_head];
+	ctx->pending_head = (ctx->pending_head + 1) % MAX_PENDING_CHUNKS;
+	ctx->num_pending--;
+
+	if (chunk->cached_data) {
+		*cdata_ret = chunk->cached_data;
+		*csize_ret = chunk->csize;
+		*usize_ret = chunk->key.usize;
+		return true;
+	}
+
+	/* The wrapped chunk compressor may reclaim a buffer which was borrowed
+	 * but not filled.  */
+	ctx->cur_buf = NULL;
+	if (!ctx->inner->get_compression_result(ctx->inner, cdata_ret,
+						csize_ret, usize_ret))
+		wimlib_assert(0);
+	wimlib_assert(*usize_ret == chunk->key.usize);
+
+	/* Chunks that didn't compress are written uncompressed; there's no
+	 * point in caching them.  */
+	if (*csize_ret < *usize_ret) {
+		chunk_cache_insert(ctx->cache, &chunk->key, *cdata_ret,
+				   *csize_ret, oldest_pending_pos(ctx));
+	}
+	return true;
+}
+
+static const u8 *
+caching_chunk_compressor_get_thread_utilization(struct chunk_compressor *_ctx)
+{
+	struct caching_chunk_compressor *ctx =
+		(struct caching_chunk_compressor *)_ctx;
+
+	return ctx->inner->get_thread_utilization(ctx->inner);
+}
+
+int
+new_caching_chunk_compressor(struct chunk_compressor *inner,
+			     struct chunk_compressor **compressor_ret)
+{
+	struct caching_chunk_compressor *ctx;
+	struct chunk_cache *cache;
+
+	cache = chunk_cache_open();
+	if (!cache)
+		return -1;
+
+	ctx = CALLOC(1, sizeof(*ctx));
+	if (!ctx) {
+		chunk_cache_close(cache);
+		return WIMLIB_ERR_NOMEM;
+	}
+
+	ctx->base.out_ctype = inner->out_ctype;
+	ctx->base.out_chunk_size = inner->out_chunk_size;
+	ctx->base.num_threads = inner->num_threads;
+	ctx->base.destroy = caching_chunk_compressor_destroy;
+	ctx->base.get_chunk_buffer = caching_chunk_compressor_get_chunk_buffer;
+	ctx->base.signal_chunk_filled = caching_chunk_compressor_signal_chunk_filled;
+	ctx->base.get_compression_result = caching_chunk_compressor_get_compression_result;
+	if (inner->get_thread_utilization)
+		ctx->base.get_thread_utilization = caching_chunk_compressor_get_thread_utilization;
+	ctx->inner = inner;
+	ctx->cache = cache;
+	ctx->level = get_default_compression_level(inner->out_ctype);
+
+	*compressor_ret = &ctx->base;
+	return 0;
+}
+
+#else /* !__WIN32__ */
+
+int
+new_caching_chunk_compressor(struct chunk_compressor *inner,
+			     struct chunk_compressor **compressor_ret)
+{
+	return -1;
+}
+
+#endif /* __WIN32__ */
@@ -380,15 +380,14 @@ compute_length_counts(u32 A[], unsigned root_idx, unsigned len_counts[],
 }
 
 /*
- * Generate the codewords for a canonical Huffman code.
+ * Assign codeword lengths to symbols.
  *
  * @A
- *	The output array for codewords.  In addition, initially this
- *	array must contain the symbols, sorted primarily by frequency and
- *	secondarily by symbol value, in the low NUM_SYMBOL_BITS bits of
+ *	An array that must contain the symbols, sorted primarily by frequency
+ *	and secondarily by symbol value, in the low NUM_SYMBOL_BITS bits of
  *	each entry.
  *
- * @len
+ * @lens
  *	Output array for codeword lengths.
  *
  * @len_counts
@@ -397,19 +396,13 @@ compute_length_counts(u32 A[], unsigned root_idx, unsigned len_counts[],
  *
  * @max_codeword_len
  *	Maximum length, in bits, of each codeword.
- *
- * @num_syms
- *	Number of symbols in the alphabet, including symbols with zero
- *	frequency.  This is the length of the 'A' and 'len' arrays.
  */
 static void
-gen_codewords(u32 A[], u8 lens[], const unsigned len_counts[],
-	      unsigned max_codeword_len, unsigned num_syms)
+gen_lens(const u32 A[], u8 lens[], const unsigned len_counts[],
+	 unsigned max_codeword_len)
 {
-	u32 next_codewords[MAX_CODEWORD_LEN + 1];
 	unsigned i;
 	unsigned len;
-	unsigned sym;
 
 	/*
 	 * Given the number of codewords that will have each length, assign
@@ -423,12 +416,40 @@ gen_codewords(u32 A[], u8 lens[], const unsigned len_counts[],
 		while (count--)
 			lens[A[i++] & SYMBOL_MASK] = len;
 	}
+}
+
+/*
+ * Generate the codewords for a canonical Huffman code.
+ *
+ * @codewords
+ *	The output array for codewords.
+ *
+ * @lens
+ *	The codeword length of each symbol, as assigned by gen_lens().
+ *
+ * @len_counts
+ *	An array that provides the number of codewords that have each
+ *	possible length <= max_codeword_len.
+ *
+ * @max_codeword_len
+ *	Maximum length, in bits, of each codeword.
+ *
+ * @num_syms
+ *	Number of symbols in the alphabet, including symbols with zero
+ *	frequency.  This is the length of the 'codewords' and 'lens' arrays.
+ */
+static void
+gen_codewords(u32 codewords[], const u8 lens[], const unsigned len_counts[],
+	      unsigned max_codeword_len, unsigned num_syms)
+{
+	u32 next_codewords[MAX_CODEWORD_LEN + 1];
+	unsigned len;
+	unsigned sym;
 
 	/*
-	 * Generate the codewords themselves.  We initialize the
-	 * 'next_codewords' array to provide the lexicographically first
-	 * codeword of each length, then assign codewords in symbol order.  This
-	 * produces a canonical code.
+	 * We initialize the 'next_codewords' array to provide the
+	 * lexicographically first codeword of each length, then assign
+	 * codewords in symbol order.  This produces a canonical code.
 	 */
 	next_codewords[0] = 0;
 	next_codewords[1] = 0;
@@ -437,7 +458,94 @@ gen_codewords(u32 A[], u8 lens[], const unsigned len_counts[],
 			(next_codewords[len - 1] + len_counts[len - 1]) << 1;
 
 	for (sym = 0; sym < num_syms; sym++)
-		A[sym] = next_codewords[lens[sym]]++;
+		codewords[sym] = next_codewords[lens[sym]]++;
+}
+
+/*
+ * Like make_canonical_huffman_code(), but only compute the codeword lengths,
+ * for decoders that rebuild a decode table from the lengths anyway.  @A is
+ * temporary space for @num_syms entries.  The number of codewords having each
+ * length is returned in @len_counts[0...max_codeword_len], where @len_counts[0]
+ * is the number of symbols that have zero frequency.
+ */
+void
+make_canonical_huffman_lens(unsigned num_syms, unsigned max_codeword_len,
+			    const u32 freqs[], u8 lens[], u32 A[],
+			    unsigned len_counts[])
+{
+	unsigned num_used_syms;
+	unsigned len;
+
+	wimlib_assert(num_syms <= MAX_NUM_SYMS);
+	STATIC_ASSERT(MAX_NUM_SYMS <= 1 << NUM_SYMBOL_BITS);
+	wimlib_assert(max_codeword_len <= MAX_CODEWORD_LEN);
+
+	/*
+	 * We begin by sorting the symbols primarily by frequency and
+	 * secondarily by symbol value.  As an optimization, the array used for
+	 * this purpose ('A') shares storage with the space in which
+	 * make_canonical_huffman_code() will eventually return the codewords.
+	 */
+	num_used_syms = sort_symbols(num_syms, freqs, lens, A);
+
+	/*
+	 * 'num_used_syms' is the number of symbols with nonzero frequency.
+	 * This may be less than @num_syms.  'num_used_syms' is also the number
+	 * of entries in 'A' that are valid.  Each entry consists of a distinct
+	 * symbol and a nonzero frequency packed into a 32-bit integer.
+	 */
+
+	/*
+	 * Handle special cases where only 0 or 1 symbols were used (had nonzero
+	 * frequency).
+	 */
+
+	if (unlikely(num_used_syms < 2)) {
+		for (len = 0; len <= max_codeword_len; len++)
+			len_counts[len] = 0;
+		len_counts[0] = num_syms;
+
+		if (num_used_syms == 0) {
+			/*
+			 * Code is empty.  sort_symbols() already set all
+			 * lengths to 0, so there is nothing more to do.
+			 */
+			return;
+		}
+
+		/*
+		 * Only one symbol was used, so we only need one codeword.  But
+		 * two codewords are needed to form the smallest complete
+		 * Huffman code, which uses codewords 0 and 1.  Therefore, we
+		 * choose another symbol to which to assign a codeword.  We use
+		 * 0 (if the used symbol is not 0) or 1 (if the used symbol is
+		 * 0).  In either case, the lesser-valued symbol will be
+		 * assigned codeword 0 so that the resulting code is canonical.
+		 */
+		unsigned sym = A[0] & SYMBOL_MASK;
+		unsigned nonzero_idx = sym ? sym : 1;
+
+		lens[0] = 1;
+		lens[nonzero_idx] = 1;
+		len_counts[0] -= 2;
+		len_counts[1] = 2;
+		return;
+	}
+
+	/*
+	 * Build a stripped-down version of the Huffman tree, sharing the array
+	 * 'A' with the symbol values.  Then extract length counts from the tree
+	 * and use them to assign the codeword lengths.
+	 */
+
+	build_tree(A, num_used_syms);
+
+	compute_length_counts(A, num_used_syms - 2,
+			      len_counts, max_codeword_len);
+
+	gen_lens(A, lens, len_counts, max_codeword_len);
+
+	len_counts[0] = num_syms - num_used_syms;
 }
 
 /*
@@ -596,76 +704,10 @@ void
 make_canonical_huffman_code(unsigned num_syms, unsigned max_codeword_len,
 			    const u32 freqs[], u8 lens[], u32 codewords[])
 {
-	u32 *A = codewords;
-	unsigned num_used_syms;
+	unsigned len_counts[MAX_CODEWORD_LEN + 1];
 
-	wimlib_assert(num_syms <= MAX_NUM_SYMS);
-	STATIC_ASSERT(MAX_NUM_SYMS <= 1 << NUM_SYMBOL_BITS);
-	wimlib_assert(max_codeword_len <= MAX_CODEWORD_LEN);
-
-	/*
-	 * We begin by sorting the symbols primarily by frequency and
-	 * secondarily by symbol value.  As an optimization, the array used for
-	 * this purpose ('A') shares storage with the space in which we will
-	 * eventually return the codewords.
-	 */
-	num_used_syms = sort_symbols(num_syms, freqs, lens, A);
+	make_canonical_huffman_lens(num_syms, max_codeword_len, freqs, lens,
+				    codewords, len_counts);
 
-	/*
-	 * 'num_used_syms' is the number of symbols with nonzero frequency.
-	 * This may be less than @num_syms.  'num_used_syms' is also the number
-	 * of entries in 'A' that are valid.  Each entry consists of a distinct
-	 * symbol and a nonzero frequency packed into a 32-bit integer.
-	 */
-
-	/*
-	 * Handle special cases where only 0 or 1 symbols were used (had nonzero
-	 * frequency).
-	 */
-
-	if (unlikely(num_used_syms == 0)) {
-		/*
-		 * Code is empty.  sort_symbols() already set all lengths to 0,
-		 * so there is nothing more to do.
-		 */
-		return;
-	}
-
-	if (unlikely(num_used_syms == 1)) {
-		/*
-		 * Only one symbol was used, so we only need one codeword.  But
-		 * two codewords are needed to form the smallest complete
-		 * Huffman code, which uses codewords 0 and 1.  Therefore, we
-		 * choose another symbol to which to assign a codeword.  We use
-		 * 0 (if the used symbol is not 0) or 1 (if the used symbol is
-		 * 0).  In either case, the lesser-valued symbol must be
-		 * assigned codeword 0 so that the resulting code is canonical.
-		 */
-
-		unsigned sym = A[0] & SYMBOL_MASK;
-		unsigned nonzero_idx = sym ? sym : 1;
-
-		codewords[0] = 0;
-		lens[0] = 1;
-		codewords[nonzero_idx] = 1;
-		lens[nonzero_idx] = 1;
-		return;
-	}
-
-	/*
-	 * Build a stripped-down version of the Huffman tree, sharing the array
-	 * 'A' with the symbol values.  Then extract length counts from the tree
-	 * and use them to generate the final codewords.
-	 */
-
-	build_tree(A, num_used_syms);
-
-	{
-		unsigned len_counts[MAX_CODEWORD_LEN + 1];
-
-		compute_length_counts(A, num_used_syms - 2,
-				      len_counts, max_codeword_len);
-
-		gen_codewords(A, lens, len_counts, max_codeword_len, num_syms);
-	}
+	gen_codewords(codewords, lens, len_counts, max_codeword_len, num_syms);
 }
@@ -16,4 +16,9 @@ void
 make_canonical_huffman_code(unsigned num_syms, unsigned max_codeword_len,
 			    const u32 freqs[], u8 lens[], u32 codewords[]);
 
+void
+make_canonical_huffman_lens(unsigned num_syms, unsigned max_codeword_len,
+			    const u32 freqs[], u8 lens[], u32 A[],
+			    unsigned len_counts[]);
+
 #endif /* _WIMLIB_COMPRESS_COMMON_H */
@@ -27,28 +27,67 @@
 
 #include <errno.h>
 #include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#if defined(__i386__) || defined(__x86_64__)
+#  include <emmintrin.h>
+#endif
 
 #include "assert.h"
+#include "bitops.h"
 #include "chunk_compressor.h"
 #include "error.h"
 #include "list.h"
 #include "util.h"
 
+/*
+ * Messages are passed between the writer thread and the compressor threads
+ * through bounded rings which need no lock in the common case.  Each slot has a
+ * sequence number which tells whether the slot is ready to be filled or emptied
+ * on the current lap around the ring, so any number of threads can put and get
+ * messages concurrently (this is Dmitry Vyukov's bounded MPMC queue).  A ring
+ * never fills up, since it is sized for all the messages that exist.
+ *
+ * A thread which finds the queue empty spins briefly, then sleeps on a
+ * condition variable.  Threads putting messages only take the lock when
+ * someone is sleeping.
+ */
+struct message_ring_slot {
+	atomic_size_t seq;
+	struct message *msg;
+};
+
 struct message_queue {
-	struct list_head list;
+	struct message_ring_slot *slots;
+	size_t mask;
+	_aligned_attribute(64) atomic_size_t put_pos;
+	_aligned_attribute(64) atomic_size_t get_pos;
+	_aligned_attribute(64) atomic_uint num_waiters;
+	atomic_size_t kick_seq;
+	atomic_bool terminating;
 	pthread_mutex_t lock;
 	pthread_cond_t msg_avail_cond;
-	pthread_cond_t space_avail_cond;
-	bool terminating;
 };
 
+/* Number of times to poll an empty queue before going to sleep.  */
+#define QUEUE_SPIN_COUNT 256
+
+struct parallel_chunk_compressor;
+
 struct compressor_thread_data {
 	pthread_t thread;
+	struct parallel_chunk_compressor *ctx;
 	struct message_queue *chunks_to_compress_queue;
 	struct message_queue *compressed_chunks_queue;
 	struct wimlib_compressor *compressor;
+
+	/* Microseconds spent compressing chunks, not counting the chunk being
+	 * compressed now, which was started at @busy_since (0 if none).  These
+	 * are read by the writer thread to report utilization.  */
+	_Atomic u64 busy_usec;
+	_Atomic u64 busy_since;
 };
 
 #define MAX_CHUNKS_PER_MSG 16
@@ -63,8 +102,23 @@ struct message {
 	struct list_head list;
 	bool complete;
 	struct list_head submission_list;
+
+	/* While the message is being compressed, any thread may claim its
+	 * chunks one at a time.  This word holds the next chunk to claim in
+	 * bits 0-7, the number of chunks in bits 8-15, and a generation number
+	 * in the remaining bits, which changes each time the message is taken
+	 * from the queue so that a stale claim can't succeed.  */
+	_Atomic u64 claim;
+
+	/* Number of chunks whose compression has finished.  The thread which
+	 * finishes the last one passes the message on to the writer.  */
+	atomic_size_t num_done_chunks;
 };
 
+#define CLAIM_NEXT(w)	((w) & 0xFF)
+#define CLAIM_COUNT(w)	(((w) >> 8) & 0xFF)
+#define CLAIM_GEN(w)	((w) >> 16)
+
 struct parallel_chunk_compressor {
 	struct chunk_compressor base;
 
@@ -82,32 +136,62 @@ struct parallel_chunk_compressor {
 	struct message *next_submit_msg;
 	struct message *next_ready_msg;
 	size_t next_chunk_idx;
+
+	/* For reporting how busy each thread has been  */
+	u64 start_time;
+	u8 *thread_utilization;
 };
 
+static forceinline void
+cpu_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+	_mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+	__asm__ volatile("yield");
+#endif
+}
+
+static u64
+now_usec(void)
+{
+	struct timeval tv;
 
+	gettimeofday(&tv, NULL);
+	return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
 
 static int
-message_queue_init(struct message_queue *q)
+message_queue_init(struct message_queue *q, size_t capacity)
 {
+	capacity = roundup_pow_of_2(max(capacity, 2));
+	q->slots = MALLOC(capacity * sizeof(q->slots[0]));
+	if (!q->slots)
+		goto err;
+	for (size_t i = 0; i < capacity; i++)
+		atomic_init(&q->slots[i].seq, i);
+	q->mask = capacity - 1;
+	atomic_init(&q->put_pos, 0);
+	atomic_init(&q->get_pos, 0);
+	atomic_init(&q->num_waiters, 0);
+	atomic_init(&q->kick_seq, 0);
+	atomic_init(&q->terminating, false);
+
 	if (pthread_mutex_init(&q->lock, NULL)) {
 		ERROR_WITH_ERRNO("Failed to initialize mutex");
-		goto err;
+		goto err_free_slots;
 	}
 	if (pthread_cond_init(&q->msg_avail_cond, NULL)) {
 		ERROR_WITH_ERRNO("Failed to initialize condition variable");
 		goto err_destroy_lock;
 	}
-	if (pthread_cond_init(&q->space_avail_cond, NULL)) {
-		ERROR_WITH_ERRNO("Failed to initialize condition variable");
-		goto err_destroy_msg_avail_cond;
-	}
-	INIT_LIST_HEAD(&q->list);
 	return 0;
 
-err_destroy_msg_avail_cond:
-	pthread_cond_destroy(&q->msg_avail_cond);
 err_destroy_lock:
 	pthread_mutex_destroy(&q->lock);
+err_free_slots:
+	FREE(q->slots);
+	q->slots = NULL;
 err:
 	return WIMLIB_ERR_NOMEM;
 }
@@ -115,35 +199,129 @@ err:
 static void
 message_queue_destroy(struct message_queue *q)
 {
-	if (q->list.next != NULL) {
+	if (q->slots != NULL) {
 		pthread_mutex_destroy(&q->lock);
 		pthread_cond_destroy(&q->msg_avail_cond);
-		pthread_cond_destroy(&q->space_avail_cond);
+		FREE(q->slots);
 	}
 }
 
 static void
 message_queue_put(struct message_queue *q, struct message *msg)
 {
-	pthread_mutex_lock(&q->lock);
-	list_add_tail(&msg->list, &q->list);
-	pthread_cond_signal(&q->msg_avail_cond);
-	pthread_mutex_unlock(&q->lock);
+	struct message_ring_slot *slot;
+	size_t pos = atomic_load_explicit(&q->put_pos, memory_order_relaxed);
+
+	for (;;) {
+		slot = &q->slots[pos & q->mask];
+		size_t seq = atomic_load_explicit(&slot->seq,
+						  memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(
+					&q->put_pos, &pos, pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed))
+				break;
+		} else {
+			/* The ring can't be full, so another thread must have
+			 * taken this slot first.  */
+			wimlib_assert((ssize_t)(seq - pos) > 0);
+			pos = atomic_load_explicit(&q->put_pos,
+						   memory_order_relaxed);
+		}
+	}
+	slot->msg = msg;
+	atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+
+	/* Pairs with the fence in message_queue_get(): either the sleeper sees
+	 * the message, or we see the sleeper.  */
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&q->num_waiters, memory_order_relaxed)) {
+		pthread_mutex_lock(&q->lock);
+		pthread_cond_signal(&q->msg_avail_cond);
+		pthread_mutex_unlock(&q->lock);
+	}
 }
 
 static struct message *
-message_queue_get(struct message_queue *q)
+message_queue_try_get(struct message_queue *q)
 {
+	struct message_ring_slot *slot;
 	struct message *msg;
+	size_t pos = atomic_load_explicit(&q->get_pos, memory_order_relaxed);
+
+	for (;;) {
+		slot = &q->slots[pos & q->mask];
+		size_t seq = atomic_load_explicit(&slot->seq,
+						  memory_order_acquire);
+		ssize_t diff = (ssize_t)(seq - (pos + 1));
+
+		if (diff == 0) {
+			if (atomic_compare_exchange_weak_explicit(
+					&q->get_pos, &pos, pos + 1,
+					memory_order_relaxed,
+					memory_order_relaxed))
+				break;
+		} else if (diff < 0) {
+			return NULL;  /* Empty  */
+		} else {
+			pos = atomic_load_explicit(&q->get_pos,
+						   memory_order_relaxed);
+		}
+	}
+	msg = slot->msg;
+	atomic_store_explicit(&slot->seq, pos + q->mask + 1,
+			      memory_order_release);
+	return msg;
+}
+
+static size_t
+message_queue_kick_seq(struct message_queue *q)
+{
+	return atomic_load_explicit(&q->kick_seq, memory_order_acquire);
+}
 
+/* Wake up one thread waiting on the queue even though there is no message for
+ * it, so that it can look for other work.  */
+static void
+message_queue_kick(struct message_queue *q)
+{
+	atomic_fetch_add_explicit(&q->kick_seq, 1, memory_order_release);
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit(&q->num_waiters, memory_order_relaxed)) {
+		pthread_mutex_lock(&q->lock);
+		pthread_cond_signal(&q->msg_avail_cond);
+		pthread_mutex_unlock(&q->lock);
+	}
+}
+
+/* Get the next message from the queue, waiting for one if needed.  Returns
+ * NULL if the queue has been terminated, or if message_queue_kick() was called
+ * after message_queue_kick_seq() returned @kick_seq.  */
+static struct message *
+message_queue_get(struct message_queue *q, size_t kick_seq)
+{
+	struct message *msg;
+
+	for (int i = 0; i < QUEUE_SPIN_COUNT; i++) {
+		if (atomic_load_explicit(&q->terminating, memory_order_acquire) ||
+		    message_queue_kick_seq(q) != kick_seq)
+			return NULL;
+		msg = message_queue_try_get(q);
+		if (msg)
+			return msg;
+		cpu_relax();
+	}
+
+	msg = NULL;
 	pthread_mutex_lock(&q->lock);
-	while (list_empty(&q->list) && !q->terminating)
+	atomic_fetch_add_explicit(&q->num_waiters, 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_seq_cst);
+	while (!atomic_load_explicit(&q->terminating, memory_order_acquire) &&
+	       message_queue_kick_seq(q) == kick_seq &&
+	       !(msg = message_queue_try_get(q)))
 		pthread_cond_wait(&q->msg_avail_cond, &q->lock);
-	if (!q->terminating) {
-		msg = list_entry(q->list.next, struct message, list);
-		list_del(&msg->list);
-	} else
-		msg = NULL;
+	atomic_fetch_sub_explicit(&q->num_waiters, 1, memory_order_relaxed);
 	pthread_mutex_unlock(&q->lock);
 	return msg;
 }
@@ -152,7 +330,7 @@ static void
 message_queue_terminate(struct message_queue *q)
 {
 	pthread_mutex_lock(&q->lock);
-	q->terminating = true;
+	atomic_store_explicit(&q->terminating, true, memory_order_release);
 	pthread_cond_broadcast(&q->msg_avail_cond);
 	pthread_mutex_unlock(&q->lock);
 }
@@ -207,30 +385,121 @@ allocate_messages(size_t count, size_t chunks_per_msg, u32 out_chunk_size)
 	return msgs;
 }
 
+/*
+ * Work is scheduled in two ways.  The writer thread puts messages of chunks on
+ * the shared queue, and an idle compressor thread takes the next one.  But as
+ * chunks can take very different times to compress (and at the end of a write
+ * there may be fewer messages than threads), a message is not owned by the
+ * thread which took it: all its threads claim its chunks one at a time, and a
+ * thread which finds the queue empty steals unclaimed chunks from the messages
+ * other threads are working on.
+ */
+
+/* Try to claim the next chunk of @msg.  On success, also return the number of
+ * chunks in the message, which must not be read from the message itself: once
+ * another thread finishes the last chunk, the writer may refill it.  */
+static bool
+claim_chunk(struct message *msg, size_t *idx_ret, size_t *count_ret)
+{
+	u64 w = atomic_load_explicit(&msg->claim, memory_order_relaxed);
+
+	do {
+		if (CLAIM_NEXT(w) >= CLAIM_COUNT(w))
+			return false;
+	} while (!atomic_compare_exchange_weak_explicit(&msg->claim, &w, w + 1,
+							memory_order_acquire,
+							memory_order_relaxed));
+	*idx_ret = CLAIM_NEXT(w);
+	*count_ret = CLAIM_COUNT(w);
+	return true;
+}
+
+static void
+compress_chunk(struct compressor_thread_data *params, struct message *msg,
+	       size_t i, size_t count)
+{
+	u64 start_time = now_usec();
+
+	atomic_store_explicit(&params->busy_since, start_time,
+			      memory_order_relaxed);
+
+	wimlib_assert(msg->uncompressed_chunk_sizes[i] != 0);
+	msg->compressed_chunk_sizes[i] =
+		wimlib_compress(msg->uncompressed_chunks[i],
+				msg->uncompressed_chunk_sizes[i],
+				msg->compressed_chunks[i],
+				msg->uncompressed_chunk_sizes[i] - 1,
+				params->compressor);
+
+	atomic_store_explicit(&params->busy_since, 0, memory_order_relaxed);
+	atomic_fetch_add_explicit(&params->busy_usec, now_usec() - start_time,
+				  memory_order_relaxed);
+
+	if (atomic_fetch_add_explicit(&msg->num_done_chunks, 1,
+				      memory_order_acq_rel) + 1 == count)
+		message_queue_put(params->compressed_chunks_queue, msg);
+}
+
+/* Start compressing a message just taken from the queue.  */
 static void
-compress_chunks(struct message *msg, struct wimlib_compressor *compressor)
+begin_message(struct compressor_thread_data *params, struct message *msg)
 {
+	u64 w = atomic_load_explicit(&msg->claim, memory_order_relaxed);
+	size_t count = msg->num_filled_chunks;
+
+	STATIC_ASSERT(MAX_CHUNKS_PER_MSG <= 0xFF);
 
-	for (size_t i = 0; i < msg->num_filled_chunks; i++) {
-		wimlib_assert(msg->uncompressed_chunk_sizes[i] != 0);
-		msg->compressed_chunk_sizes[i] =
-			wimlib_compress(msg->uncompressed_chunks[i],
-					msg->uncompressed_chunk_sizes[i],
-					msg->compressed_chunks[i],
-					msg->uncompressed_chunk_sizes[i] - 1,
-					compressor);
+	atomic_store_explicit(&msg->num_done_chunks, 0, memory_order_relaxed);
+	w = ((CLAIM_GEN(w) + 1) << 16) | ((u64)count << 8);
+	atomic_store_explicit(&msg->claim, w, memory_order_release);
+
+	/* Let a sleeping thread help with the rest of this message.  */
+	if (count > 1)
+		message_queue_kick(params->chunks_to_compress_queue);
+}
+
+/* Claim and compress one chunk of a message which another thread is working
+ * on, if there is any such chunk.  */
+static bool
+steal_chunk(struct compressor_thread_data *params)
+{
+	struct parallel_chunk_compressor *ctx = params->ctx;
+	size_t start = params - ctx->thread_data;
+
+	for (size_t j = 0; j < ctx->num_messages; j++) {
+		struct message *msg = &ctx->msgs[(start + j) % ctx->num_messages];
+		size_t idx, count;
+
+		if (claim_chunk(msg, &idx, &count)) {
+			compress_chunk(params, msg, idx, count);
+			return true;
+		}
 	}
+	return false;
 }
 
 static void *
 compressor_thread_proc(void *arg)
 {
 	struct compressor_thread_data *params = arg;
+	struct message_queue *q = params->chunks_to_compress_queue;
 	struct message *msg;
-
-	while ((msg = message_queue_get(params->chunks_to_compress_queue)) != NULL) {
-		compress_chunks(msg, params->compressor);
-		message_queue_put(params->compressed_chunks_queue, msg);
+	size_t idx, count;
+
+	while (!atomic_load_explicit(&q->terminating, memory_order_acquire)) {
+		size_t kick_seq = message_queue_kick_seq(q);
+
+		msg = message_queue_try_get(q);
+		if (!msg) {
+			if (steal_chunk(params))
+				continue;
+			msg = message_queue_get(q, kick_seq);
+			if (!msg)
+				continue;
+		}
+		begin_message(params, msg);
+		while (claim_chunk(msg, &idx, &count))
+			compress_chunk(params, msg, idx, count);
 	}
 	return NULL;
 }
@@ -262,6 +531,8 @@ parallel_chunk_compressor_destroy(struct chunk_compressor *_ctx)
 
 	free_messages(ctx->msgs, ctx->num_messages);
 
+	FREE(ctx->thread_utilization);
+
 	FREE(ctx);
 }
 
@@ -309,7 +580,14 @@ parallel_chunk_compressor_signal_chunk_filled(struct chunk_compressor *_ctx, u32
 
 	msg = ctx->next_submit_msg;
 	msg->uncompressed_chunk_sizes[msg->num_filled_chunks] = usize;
-	if (++msg->num_filled_chunks == msg->num_alloc_chunks)
+	msg->num_filled_chunks++;
+
+	/* Submit the message once it is full, or already once it is half full
+	 * if a compressor thread has run out of work.  */
+	if (msg->num_filled_chunks == msg->num_alloc_chunks ||
+	    (msg->num_filled_chunks * 2 >= msg->num_alloc_chunks &&
+	     atomic_load_explicit(&ctx->chunks_to_compress_queue.num_waiters,
+				  memory_order_relaxed) != 0))
 		submit_compression_msg(ctx);
 }
 
@@ -321,8 +599,16 @@ parallel_chunk_compressor_get_compression_result(struct chunk_compressor *_ctx,
 	struct parallel_chunk_compressor *ctx = (struct parallel_chunk_compressor *)_ctx;
 	struct message *msg;
 
-	if (ctx->next_submit_msg)
-		submit_compression_msg(ctx);
+	if (ctx->next_submit_msg) {
+		/* A buffer may have been borrowed but never filled.  */
+		if (ctx->next_submit_msg->num_filled_chunks == 0) {
+			list_add(&ctx->next_submit_msg->list,
+				 &ctx->available_msgs);
+			ctx->next_submit_msg = NULL;
+		} else {
+			submit_compression_msg(ctx);
+		}
+	}
 
 	if (ctx->next_ready_msg) {
 		msg = ctx->next_ready_msg;
@@ -333,7 +619,8 @@ parallel_chunk_compressor_get_compression_result(struct chunk_compressor *_ctx,
 		while (!(msg = list_entry(ctx->submitted_msgs.next,
 					  struct message,
 					  submission_list))->complete)
-			message_queue_get(&ctx->compressed_chunks_queue)->complete = true;
+			message_queue_get(&ctx->compressed_chunks_queue,
+					  0)->complete = true;
 
 		ctx->next_ready_msg = msg;
 		ctx->next_chunk_idx = 0;
@@ -356,6 +643,27 @@ parallel_chunk_compressor_get_compression_result(struct chunk_compressor *_ctx,
 	return true;
 }
 
+static const u8 *
+parallel_chunk_compressor_get_thread_utilization(struct chunk_compressor *_ctx)
+{
+	struct parallel_chunk_compressor *ctx = (struct parallel_chunk_compressor *)_ctx;
+	u64 now = now_usec();
+	u64 elapsed = max(now - ctx->start_time, 1);
+
+	for (unsigned i = 0; i < ctx->num_started_threads; i++) {
+		struct compressor_thread_data *dat = &ctx->thread_data[i];
+		u64 busy = atomic_load_explicit(&dat->busy_usec,
+						memory_order_relaxed);
+		u64 since = atomic_load_explicit(&dat->busy_since,
+						 memory_order_relaxed);
+
+		if (since != 0 && since < now)
+			busy += now - since;
+		ctx->thread_utilization[i] = min(busy * 100 / elapsed, 100);
+	}
+	return ctx->thread_utilization;
+}
+
 int
 new_parallel_chunk_compressor(int out_ctype, u32 out_chunk_size,
 			      unsigned num_threads, u64 max_memory,
@@ -441,14 +749,17 @@ new_parallel_chunk_compressor(int out_ctype, u32 out_chunk_size,
 	ctx->base.get_chunk_buffer = parallel_chunk_compressor_get_chunk_buffer;
 	ctx->base.signal_chunk_filled = parallel_chunk_compressor_signal_chunk_filled;
 	ctx->base.get_compression_result = parallel_chunk_compressor_get_compression_result;
+	ctx->base.get_thread_utilization = parallel_chunk_compressor_get_thread_utilization;
 
 	ctx->num_thread_data = num_threads;
 
-	ret = message_queue_init(&ctx->chunks_to_compress_queue);
+	ret = message_queue_init(&ctx->chunks_to_compress_queue,
+				 num_threads * msgs_per_thread);
 	if (ret)
 		goto err;
 
-	ret = message_queue_init(&ctx->compressed_chunks_queue);
+	ret = message_queue_init(&ctx->compressed_chunks_queue,
+				 num_threads * msgs_per_thread);
 	if (ret)
 		goto err;
 
@@ -457,11 +768,17 @@ new_parallel_chunk_compressor(int out_ctype, u32 out_chunk_size,
 	if (ctx->thread_data == NULL)
 		goto err;
 
+	ctx->thread_utilization = CALLOC(num_threads,
+					 sizeof(ctx->thread_utilization[0]));
+	if (ctx->thread_utilization == NULL)
+		goto err;
+
 	for (i = 0; i < num_threads; i++) {
 		struct compressor_thread_data *dat;
 
 		dat = &ctx->thread_data[i];
 
+		dat->ctx = ctx;
 		dat->chunks_to_compress_queue = &ctx->chunks_to_compress_queue;
 		dat->compressed_chunks_queue = &ctx->compressed_chunks_queue;
 		ret = wimlib_create_compressor(out_ctype, out_chunk_size,
@@ -471,6 +788,21 @@ new_parallel_chunk_compressor(int out_ctype, u32 out_chunk_size,
 			goto err;
 	}
 
+	/* The messages must exist before the threads start, since the threads
+	 * look through them for chunks to steal.  */
+	ret = WIMLIB_ERR_NOMEM;
+	ctx->num_messages = num_threads * msgs_per_thread;
+	ctx->msgs = allocate_messages(ctx->num_messages,
+				      chunks_per_msg, out_chunk_size);
+	if (ctx->msgs == NULL)
+		goto err;
+
+	INIT_LIST_HEAD(&ctx->available_msgs);
+	for (size_t i = 0; i < ctx->num_messages; i++)
+		list_add_tail(&ctx->msgs[i].list, &ctx->available_msgs);
+
+	INIT_LIST_HEAD(&ctx->submitted_msgs);
+
 	for (ctx->num_started_threads = 0;
 	     ctx->num_started_threads < num_threads;
 	     ctx->num_started_threads++)
@@ -493,18 +825,7 @@ new_parallel_chunk_compressor(int out_ctype, u32 out_chunk_size,
 
 	ctx->base.num_threads = ctx->num_started_threads;
 
-	ret = WIMLIB_ERR_NOMEM;
-	ctx->num_messages = ctx->num_started_threads * msgs_per_thread;
-	ctx->msgs = allocate_messages(ctx->num_messages,
-				      chunks_per_msg, out_chunk_size);
-	if (ctx->msgs == NULL)
-		goto err;
-
-	INIT_LIST_HEAD(&ctx->available_msgs);
-	for (size_t i = 0; i < ctx->num_messages; i++)
-		list_add_tail(&ctx->msgs[i].list, &ctx->available_msgs);
-
-	INIT_LIST_HEAD(&ctx->submitted_msgs);
+	ctx->start_time = now_usec();
 
 	*compressor_ret = &ctx->base;
 	return 0;
@@ -27,10 +27,17 @@ struct compressor_ops {
 			   void *private);
 
 	void (*free_compressor)(void *private);
+
+	/* Optional: let the compressor use an extra thread to compress each
+	 * buffer faster.  The output must not change.  */
+	void (*start_helper_thread)(void *private);
 };
 
 extern const struct compressor_ops lzx_compressor_ops;
 extern const struct compressor_ops xpress_compressor_ops;
 extern const struct compressor_ops lzms_compressor_ops;
 
+extern unsigned int
+get_default_compression_level(int ctype);
+
 #endif /* _WIMLIB_COMPRESSOR_OPS_H */
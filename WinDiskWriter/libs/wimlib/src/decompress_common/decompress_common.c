@@ -37,102 +37,58 @@
 
 #ifdef __SSE2__
 #  include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
 #endif
 
 #include "decompress_common.h"
 
+#ifdef LZ_COPY_HAVE_PATTERN
 /*
- * make_huffman_decode_table() -
- *
- * Given an alphabet of symbols and the length of each symbol's codeword in a
- * canonical prefix code, build a table for quickly decoding symbols that were
- * encoded with that code.
- *
- * A _prefix code_ is an assignment of bitstrings called _codewords_ to symbols
- * such that no whole codeword is a prefix of any other.  A prefix code might be
- * a _Huffman code_, which means that it is an optimum prefix code for a given
- * list of symbol frequencies and was generated by the Huffman algorithm.
- * Although the prefix codes processed here will ordinarily be "Huffman codes",
- * strictly speaking the decoder cannot know whether a given code was actually
- * generated by the Huffman algorithm or not.
- *
- * A prefix code is _canonical_ if and only if a longer codeword never
- * lexicographically precedes a shorter codeword, and the lexicographic ordering
- * of codewords of equal length is the same as the lexicographic ordering of the
- * corresponding symbols.  The advantage of using a canonical prefix code is
- * that the codewords can be reconstructed from only the symbol => codeword
- * length mapping.  This eliminates the need to transmit the codewords
- * explicitly.  Instead, they can be enumerated in lexicographic order after
- * sorting the symbols primarily by increasing codeword length and secondarily
- * by increasing symbol value.
- *
- * However, the decoder's real goal is to decode symbols with the code, not just
- * generate the list of codewords.  Consequently, this function directly builds
- * a table for efficiently decoding symbols using the code.  The basic idea is
- * that given the next 'max_codeword_len' bits of input, the decoder can look up
- * the next decoded symbol by indexing a table containing '2^max_codeword_len'
- * entries.  A codeword with length 'max_codeword_len' will have exactly one
- * entry in this table, whereas a codeword shorter than 'max_codeword_len' will
- * have multiple entries in this table.  Precisely, a codeword of length 'n'
- * will have '2^(max_codeword_len - n)' entries.  The index of each such entry,
- * considered as a bitstring of length 'max_codeword_len', will contain the
- * corresponding codeword as a prefix.
- *
- * That's the basic idea, but we extend it in two ways:
- *
- * - Often the maximum codeword length is too long for it to be efficient to
- *   build the full decode table whenever a new code is used.  Instead, we build
- *   a "root" table using only '2^table_bits' entries, where 'table_bits <=
- *   max_codeword_len'.  Then, a lookup of 'table_bits' bits produces either a
- *   symbol directly (for codewords not longer than 'table_bits'), or the index
- *   of a subtable which must be indexed with additional bits of input to fully
- *   decode the symbol (for codewords longer than 'table_bits').
- *
- * - Whenever the decoder decodes a symbol, it needs to know the codeword length
- *   so that it can remove the appropriate number of input bits.  The obvious
- *   solution would be to simply retain the codeword lengths array and use the
- *   decoded symbol as an index into it.  However, that would require two array
- *   accesses when decoding each symbol.  Our strategy is to instead store the
- *   codeword length directly in the decode table entry along with the symbol.
- *
- * See MAKE_DECODE_TABLE_ENTRY() for full details on the format of decode table
- * entries, and see read_huffsym() for full details on how symbols are decoded.
- *
- * @decode_table:
- *	The array in which to build the decode table.  This must have been
- *	declared by the DECODE_TABLE() macro.  This may alias @lens, since all
- *	@lens are consumed before the decode table is written to.
- *
- * @num_syms:
- *	The number of symbols in the alphabet.
- *
- * @table_bits:
- *	The log base 2 of the number of entries in the root table.
- *
- * @lens:
- *	An array of length @num_syms, indexed by symbol, that gives the length
- *	of the codeword, in bits, for each symbol.  The length can be 0, which
- *	means that the symbol does not have a codeword assigned.  In addition,
- *	@lens may alias @decode_table, as noted above.
- *
- * @max_codeword_len:
- *	The maximum codeword length permitted for this code.  All entries in
- *	'lens' must be less than or equal to this value.
- *
- * @working_space
- *	A temporary array that was declared with DECODE_TABLE_WORKING_SPACE().
- *
- * Returns 0 on success, or -1 if the lengths do not form a valid prefix code.
+ * Shuffle indices and store steps which lz_copy() uses to copy matches with
+ * offsets shorter than a vector.  Row 'offset' repeats bytes 0 through
+ * 'offset - 1'.  Row 0 is only used for invalid matches with offset 0, and
+ * just has to keep lz_copy() from looping forever.
  */
-int
-make_huffman_decode_table(u16 decode_table[], unsigned num_syms,
+const u8 lz_copy_pattern_indices[LZ_COPY_VECTOR_BYTES][LZ_COPY_VECTOR_BYTES]
+	_aligned_attribute(LZ_COPY_VECTOR_BYTES) = {
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0 },
+	{  0,  1,  0,  1,  0,  1,  0,  1,  0,  1,  0,  1,  0,  1,  0,  1 },
+	{  0,  1,  2,  0,  1,  2,  0,  1,  2,  0,  1,  2,  0,  1,  2,  0 },
+	{  0,  1,  2,  3,  0,  1,  2,  3,  0,  1,  2,  3,  0,  1,  2,  3 },
+	{  0,  1,  2,  3,  4,  0,  1,  2,  3,  4,  0,  1,  2,  3,  4,  0 },
+	{  0,  1,  2,  3,  4,  5,  0,  1,  2,  3,  4,  5,  0,  1,  2,  3 },
+	{  0,  1,  2,  3,  4,  5,  6,  0,  1,  2,  3,  4,  5,  6,  0,  1 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  0,  1,  2,  3,  4,  5,  6,  7 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  0,  1,  2,  3,  4,  5,  6 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  0,  1,  2,  3,  4,  5 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10,  0,  1,  2,  3,  4 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11,  0,  1,  2,  3 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12,  0,  1,  2 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13,  0,  1 },
+	{  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,  0 },
+};
+
+const u8 lz_copy_pattern_steps[LZ_COPY_VECTOR_BYTES] = {
+	16, 16, 16, 15, 16, 15, 12, 14, 16, 9, 10, 11, 12, 13, 14, 15,
+};
+#endif /* LZ_COPY_HAVE_PATTERN */
+
+/*
+ * Fill in the decode table for a complete prefix code, given the codeword
+ * length of each symbol and, at the start of @working_space, the number of
+ * codewords that have each length.
+ */
+static forceinline void
+fill_huffman_decode_table(u16 decode_table[], unsigned num_syms,
 			  unsigned table_bits, const u8 lens[],
 			  unsigned max_codeword_len, u16 working_space[])
 {
 	u16 * const len_counts = &working_space[0];
 	u16 * const offsets = &working_space[1 * (max_codeword_len + 1)];
 	u16 * const sorted_syms = &working_space[2 * (max_codeword_len + 1)];
-	s32 remainder = 1;
+	s32 remainder;
 	void *entry_ptr = decode_table;
 	unsigned codeword_len = 1;
 	unsigned sym_idx;
@@ -141,42 +97,6 @@ make_huffman_decode_table(u16 decode_table[], unsigned num_syms,
 	unsigned subtable_bits;
 	unsigned subtable_prefix;
 
-	/* Count how many codewords have each length, including 0.  */
-	for (unsigned len = 0; len <= max_codeword_len; len++)
-		len_counts[len] = 0;
-	for (unsigned sym = 0; sym < num_syms; sym++)
-		len_counts[lens[sym]]++;
-
-	/* It is already guaranteed that all lengths are <= max_codeword_len,
-	 * but it cannot be assumed they form a complete prefix code.  A
-	 * codeword of length n should require a proportion of the codespace
-	 * equaling (1/2)^n.  The code is complete if and only if, by this
-	 * measure, the codespace is exactly filled by the lengths.  */
-	for (unsigned len = 1; len <= max_codeword_len; len++) {
-		remainder = (remainder << 1) - len_counts[len];
-		/* Do the lengths overflow the codespace? */
-		if (unlikely(remainder < 0))
-			return -1;
-	}
-
-	if (remainder != 0) {
-		/* The lengths do not fill the codespace; that is, they form an
-		 * incomplete code.  This is permitted only if the code is empty
-		 * (contains no symbols). */
-
-		if (unlikely(remainder != 1U << max_codeword_len))
-			return -1;
-
-		/* The code is empty.  When processing a well-formed stream, the
-		 * decode table need not be initialized in this case.  However,
-		 * we cannot assume the stream is well-formed, so we must
-		 * initialize the decode table anyway.  Setting all entries to 0
-		 * makes the decode table always produce symbol '0' without
-		 * consuming any bits, which is good enough. */
-		memset(decode_table, 0, sizeof(decode_table[0]) << table_bits);
-		return 0;
-	}
-
 	/* Sort the symbols primarily by increasing codeword length and
 	 * secondarily by increasing symbol value. */
 
@@ -196,9 +116,9 @@ make_huffman_decode_table(u16 decode_table[], unsigned num_syms,
 	 * The table will start with entries for the shortest codeword(s), which
 	 * will have the most entries.  From there, the number of entries per
 	 * codeword will decrease.  As an optimization, we may begin filling
-	 * entries with SSE2 vector accesses (8 entries/store), then change to
-	 * word accesses (2 or 4 entries/store), then change to 16-bit accesses
-	 * (1 entry/store).
+	 * entries with SSE2 or NEON vector accesses (8 entries/store), then
+	 * change to word accesses (2 or 4 entries/store), then change to 16-bit
+	 * accesses (1 entry/store).
 	 */
 	sym_idx = offsets[0];
 
@@ -224,7 +144,25 @@ make_huffman_decode_table(u16 decode_table[], unsigned num_syms,
 			} while (--n);
 		}
 	}
-#endif /* __SSE2__ */
+#elif defined(__ARM_NEON)
+	/* Fill entries one 128-bit vector (8 entries) at a time. */
+	for (unsigned stores_per_loop = (1U << (table_bits - codeword_len)) /
+				    (sizeof(uint16x8_t) / sizeof(decode_table[0]));
+	     stores_per_loop != 0; codeword_len++, stores_per_loop >>= 1)
+	{
+		unsigned end_sym_idx = sym_idx + len_counts[codeword_len];
+		for (; sym_idx < end_sym_idx; sym_idx++) {
+			uint16x8_t v = vdupq_n_u16(
+				MAKE_DECODE_TABLE_ENTRY(sorted_syms[sym_idx],
+							codeword_len));
+			unsigned n = stores_per_loop;
+			do {
+				vst1q_u16(entry_ptr, v);
+				entry_ptr += sizeof(v);
+			} while (--n);
+		}
+	}
+#endif /* __ARM_NEON */
 
 #ifdef __GNUC__
 	/* Fill entries one word (2 or 4 entries) at a time. */
@@ -272,7 +210,7 @@ make_huffman_decode_table(u16 decode_table[], unsigned num_syms,
 
 	/* If all symbols were processed, then no subtables are required. */
 	if (sym_idx == num_syms)
-		return 0;
+		return;
 
 	/* At least one subtable is required.  Process the remaining symbols. */
 	codeword = ((u16 *)entry_ptr - decode_table) << 1;
@@ -339,6 +277,248 @@ make_huffman_decode_table(u16 decode_table[], unsigned num_syms,
 		len_counts[codeword_len]--;
 		codeword++;
 	} while (++sym_idx < num_syms);
+}
 
+/*
+ * make_huffman_decode_table() -
+ *
+ * Given an alphabet of symbols and the length of each symbol's codeword in a
+ * canonical prefix code, build a table for quickly decoding symbols that were
+ * encoded with that code.
+ *
+ * A _prefix code_ is an assignment of bitstrings called _codewords_ to symbols
+ * such that no whole codeword is a prefix of any other.  A prefix code might be
+ * a _Huffman code_, which means that it is an optimum prefix code for a given
+ * list of symbol frequencies and was generated by the Huffman algorithm.
+ * Although the prefix codes processed here will ordinarily be "Huffman codes",
+ * strictly speaking the decoder cannot know whether a given code was actually
+ * generated by the Huffman algorithm or not.
+ *
+ * A prefix code is _canonical_ if and only if a longer codeword never
+ * lexicographically precedes a shorter codeword, and the lexicographic ordering
+ * of codewords of equal length is the same as the lexicographic ordering of the
+ * corresponding symbols.  The advantage of using a canonical prefix code is
+ * that the codewords can be reconstructed from only the symbol => codeword
+ * length mapping.  This eliminates the need to transmit the codewords
+ * explicitly.  Instead, they can be enumerated in lexicographic order after
+ * sorting the symbols primarily by increasing codeword length and secondarily
+ * by increasing symbol value.
+ *
+ * However, the decoder's real goal is to decode symbols with the code, not just
+ * generate the list of codewords.  Consequently, this function directly builds
+ * a table for efficiently decoding symbols using the code.  The basic idea is
+ * that given the next 'max_codeword_len' bits of input, the decoder can look up
+ * the next decoded symbol by indexing a table containing '2^max_codeword_len'
+ * entries.  A codeword with length 'max_codeword_len' will have exactly one
+ * entry in this table, whereas a codeword shorter than 'max_codeword_len' will
+ * have multiple entries in this table.  Precisely, a codeword of length 'n'
+ * will have '2^(max_codeword_len - n)' entries.  The index of each such entry,
+ * considered as a bitstring of length 'max_codeword_len', will contain the
+ * corresponding codeword as a prefix.
+ *
+ * That's the basic idea, but we extend it in two ways:
+ *
+ * - Often the maximum codeword length is too long for it to be efficient to
+ *   build the full decode table whenever a new code is used.  Instead, we build
+ *   a "root" table using only '2^table_bits' entries, where 'table_bits <=
+ *   max_codeword_len'.  Then, a lookup of 'table_bits' bits produces either a
+ *   symbol directly (for codewords not longer than 'table_bits'), or the index
+ *   of a subtable which must be indexed with additional bits of input to fully
+ *   decode the symbol (for codewords longer than 'table_bits').
+ *
+ * - Whenever the decoder decodes a symbol, it needs to know the codeword length
+ *   so that it can remove the appropriate number of input bits.  The obvious
+ *   solution would be to simply retain the codeword lengths array and use the
+ *   decoded symbol as an index into it.  However, that would require two array
+ *   accesses when decoding each symbol.  Our strategy is to instead store the
+ *   codeword length directly in the decode table entry along with the symbol.
+ *
+ * See MAKE_DECODE_TABLE_ENTRY() for full details on the format of decode table
+ * entries, and see read_huffsym() for full details on how symbols are decoded.
+ *
+ * @decode_table:
+ *	The array in which to build the decode table.  This must have been
+ *	declared by the DECODE_TABLE() macro.  This may alias @lens, since all
+ *	@lens are consumed before the decode table is written to.
+ *
+ * @num_syms:
+ *	The number of symbols in the alphabet.
+ *
+ * @table_bits:
+ *	The log base 2 of the number of entries in the root table.
+ *
+ * @lens:
+ *	An array of length @num_syms, indexed by symbol, that gives the length
+ *	of the codeword, in bits, for each symbol.  The length can be 0, which
+ *	means that the symbol does not have a codeword assigned.  In addition,
+ *	@lens may alias @decode_table, as noted above.
+ *
+ * @max_codeword_len:
+ *	The maximum codeword length permitted for this code.  All entries in
+ *	'lens' must be less than or equal to this value.
+ *
+ * @working_space
+ *	A temporary array that was declared with DECODE_TABLE_WORKING_SPACE().
+ *
+ * Returns 0 on success, or -1 if the lengths do not form a valid prefix code.
+ */
+int
+make_huffman_decode_table(u16 decode_table[], unsigned num_syms,
+			  unsigned table_bits, const u8 lens[],
+			  unsigned max_codeword_len, u16 working_space[])
+{
+	u16 * const len_counts = &working_space[0];
+	s32 remainder = 1;
+
+	/* Count how many codewords have each length, including 0.  */
+	for (unsigned len = 0; len <= max_codeword_len; len++)
+		len_counts[len] = 0;
+	for (unsigned sym = 0; sym < num_syms; sym++)
+		len_counts[lens[sym]]++;
+
+	/* It is already guaranteed that all lengths are <= max_codeword_len,
+	 * but it cannot be assumed they form a complete prefix code.  A
+	 * codeword of length n should require a proportion of the codespace
+	 * equaling (1/2)^n.  The code is complete if and only if, by this
+	 * measure, the codespace is exactly filled by the lengths.  */
+	for (unsigned len = 1; len <= max_codeword_len; len++) {
+		remainder = (remainder << 1) - len_counts[len];
+		/* Do the lengths overflow the codespace? */
+		if (unlikely(remainder < 0))
+			return -1;
+	}
+
+	if (remainder != 0) {
+		/* The lengths do not fill the codespace; that is, they form an
+		 * incomplete code.  This is permitted only if the code is empty
+		 * (contains no symbols). */
+
+		if (unlikely(remainder != 1U << max_codeword_len))
+			return -1;
+
+		/* The code is empty.  When processing a well-formed stream, the
+		 * decode table need not be initialized in this case.  However,
+		 * we cannot assume the stream is well-formed, so we must
+		 * initialize the decode table anyway.  Setting all entries to 0
+		 * makes the decode table always produce symbol '0' without
+		 * consuming any bits, which is good enough. */
+		memset(decode_table, 0, sizeof(decode_table[0]) << table_bits);
+		return 0;
+	}
+
+	fill_huffman_decode_table(decode_table, num_syms, table_bits, lens,
+				  max_codeword_len, working_space);
 	return 0;
 }
+
+/*
+ * make_huffman_decode_table_from_counts() -
+ *
+ * Like make_huffman_decode_table(), but for a prefix code that is known to be
+ * complete and whose number of codewords of each length, including 0, is
+ * already known and given in @len_counts[0...max_codeword_len].  This skips
+ * counting and validating the lengths, which matters to decoders that rebuild
+ * their codes often, like the LZMS one does from make_canonical_huffman_lens().
+ */
+void
+make_huffman_decode_table_from_counts(u16 decode_table[], unsigned num_syms,
+				      unsigned table_bits, const u8 lens[],
+				      const unsigned len_counts[],
+				      unsigned max_codeword_len,
+				      u16 working_space[])
+{
+	for (unsigned len = 0; len <= max_codeword_len; len++)
+		working_space[len] = len_counts[len];
+
+	fill_huffman_decode_table(decode_table, num_syms, table_bits, lens,
+				  max_codeword_len, working_space);
+}
+
+/*
+ * multi_literal_table_pays_off() -
+ *
+ * Given the codeword lengths of a Huffman code whose first 256 symbols are
+ * literals, decide whether decoding it with a multi-literal table is likely to
+ * be faster than decoding one symbol per table lookup.  Going by the code
+ * itself, the probability that a lookup decodes two literals is the sum of
+ * 2^-a * 2^-b over all pairs of literal codewords whose lengths 'a' and 'b' add
+ * up to at most 'table_bits'.  The multi-literal table is only worth its extra
+ * lookup if that happens at least about a quarter of the time.
+ */
+bool
+multi_literal_table_pays_off(const u8 lens[], unsigned table_bits)
+{
+	unsigned len_counts[DECODE_TABLE_MAX_LENGTH + 1] = { 0 };
+	u64 weighted_pairs = 0;
+
+	for (unsigned sym = 0; sym < 256; sym++)
+		if (lens[sym] <= table_bits)
+			len_counts[lens[sym]]++;
+
+	/* Sum in units of 2^-(2 * table_bits).  */
+	for (unsigned a = 1; a < table_bits; a++)
+		for (unsigned b = 1; a + b <= table_bits; b++)
+			weighted_pairs += ((u64)len_counts[a] * len_counts[b]) <<
+					  (2 * table_bits - a - b);
+
+	return weighted_pairs >= ((u64)1 << (2 * table_bits)) / 4;
+}
+
+/*
+ * make_multi_literal_table() -
+ *
+ * Build a multi-literal table (see MULTI_LITERAL_TABLE()) from the root table
+ * of a Huffman decode table built by make_huffman_decode_table() with the same
+ * 'table_bits'.  Symbols less than 256 are taken to be literals.
+ *
+ * For each root table index, the first codeword is the one the root table entry
+ * gives.  The bits following it are the low 'table_bits - len1' bits of the
+ * index; shifted up, they index the root table again, with the low 'len1' bits
+ * unknown.  That lookup gives the second codeword if it is no longer than the
+ * known bits, since then every entry for those bits holds the same codeword.
+ */
+void
+make_multi_literal_table(u32 literal_table[], const u16 decode_table[],
+			 unsigned table_bits)
+{
+	const unsigned table_mask = (1U << table_bits) - 1;
+	const unsigned max_literal_entry =
+		MAKE_DECODE_TABLE_ENTRY(0xFF, DECODE_TABLE_MAX_LENGTH);
+
+	for (unsigned i = 0; i <= table_mask; i++) {
+		unsigned entry1 = decode_table[i];
+		unsigned len1 = entry1 & DECODE_TABLE_LENGTH_MASK;
+		unsigned entry2;
+		unsigned len2;
+
+		/* The first codeword must be a literal.  This excludes
+		 * subtable pointers, and the all-zeroes entries of an empty
+		 * code which consume no bits. */
+		if (entry1 > max_literal_entry || len1 == 0) {
+			literal_table[i] = entry1;
+			continue;
+		}
+
+		literal_table[i] = MULTI_LITERAL_FLAG |
+				   (1U << MULTI_LITERAL_COUNT_SHIFT) |
+				   (len1 << MULTI_LITERAL_LEN1_SHIFT) |
+				   (len1 << MULTI_LITERAL_LEN_SHIFT) |
+				   (entry1 >> DECODE_TABLE_SYMBOL_SHIFT);
+
+		if (len1 == table_bits)
+			continue;
+
+		entry2 = decode_table[(i << len1) & table_mask];
+		len2 = entry2 & DECODE_TABLE_LENGTH_MASK;
+		if (entry2 > max_literal_entry ||
+		    len2 == 0 || len2 > table_bits - len1)
+			continue;
+
+		literal_table[i] = MULTI_LITERAL_FLAG |
+				   (2U << MULTI_LITERAL_COUNT_SHIFT) |
+				   (len1 << MULTI_LITERAL_LEN1_SHIFT) |
+				   ((len1 + len2) << MULTI_LITERAL_LEN_SHIFT) |
+				   ((entry2 >> DECODE_TABLE_SYMBOL_SHIFT) << 8) |
+				   (entry1 >> DECODE_TABLE_SYMBOL_SHIFT);
+	}
+}
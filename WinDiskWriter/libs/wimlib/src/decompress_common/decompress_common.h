@@ -32,6 +32,15 @@
 
 #include <string.h>
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#  ifdef __SSSE3__
+#    include <tmmintrin.h>
+#  endif
+#elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+#endif
+
 #include "compiler.h"
 #include "types.h"
 #include "unaligned.h"
@@ -47,12 +56,19 @@
 struct input_bitstream {
 
 	/* Bits that have been read from the input buffer.  The bits are
-	 * left-justified; the next bit is always bit 31.  */
-	u32 bitbuf;
+	 * left-justified; the next bit is always the highest bit.  Bits below
+	 * the first @bitsleft are either zero or the bits that follow them in
+	 * the input, so more coding units can simply be ORed in.  */
+	machine_word_t bitbuf;
 
-	/* Number of bits currently held in @bitbuf.  */
+	/* Number of bits currently held in @bitbuf.  This is always a multiple
+	 * of 16 bits away from a coding unit boundary in the input.  */
 	u32 bitsleft;
 
+	/* Number of zero bytes that have been "read" past the end of the input
+	 * buffer.  */
+	u32 overrun;
+
 	/* Pointer to the next byte to be retrieved from the input buffer.  */
 	const u8 *next;
 
@@ -66,10 +82,15 @@ init_input_bitstream(struct input_bitstream *is, const void *buffer, u32 size)
 {
 	is->bitbuf = 0;
 	is->bitsleft = 0;
+	is->overrun = 0;
 	is->next = buffer;
 	is->end = is->next + size;
 }
 
+/* The maximum number of bits that bitstream_ensure_bits() can ensure.  A refill
+ * always leaves less than one coding unit of free space in the bit buffer.  */
+#define BITSTREAM_MAX_ENSURE_BITS	(WORDBITS - 15)
+
 /* Note: for performance reasons, the following methods don't return error codes
  * to the caller if the input buffer is overrun.  Instead, they just assume that
  * all overrun data is zeroes.  This has no effect on well-formed compressed
@@ -77,37 +98,66 @@ init_input_bitstream(struct input_bitstream *is, const void *buffer, u32 size)
  * but even this is irrelevant if higher level code checksums the uncompressed
  * data anyway.  */
 
+/* Load a machine word's worth of coding units from @p, returning them in the
+ * order they are to be read, i.e. with the first coding unit in the high bits.
+ */
+static forceinline machine_word_t
+bitstream_load_units(const u8 *p)
+{
+	if (WORDBITS == 64) {
+		u64 v = le64_to_cpu(load_le64_unaligned(p));
+
+		v = (v << 32) | (v >> 32);
+		return ((v & 0x0000FFFF0000FFFF) << 16) |
+		       ((v >> 16) & 0x0000FFFF0000FFFF);
+	} else {
+		u32 v = le32_to_cpu(load_le32_unaligned(p));
+
+		return (v << 16) | (v >> 16);
+	}
+}
+
+/* Refill the bit buffer one coding unit at a time, as far as it will go.  This
+ * is used near the end of the input buffer, where a whole machine word cannot
+ * be loaded, and for CPUs that do not handle unaligned loads well.  */
+static forceinline void
+bitstream_refill_slow(struct input_bitstream *is)
+{
+	do {
+		if (likely(is->end - is->next >= 2)) {
+			is->bitbuf |= (machine_word_t)get_unaligned_le16(is->next) <<
+				      (WORDBITS - 16 - is->bitsleft);
+			is->next += 2;
+		} else {
+			is->overrun += 2;
+		}
+		is->bitsleft += 16;
+	} while (is->bitsleft <= WORDBITS - 16);
+}
+
 /* Ensure the bit buffer variable for the bitstream contains at least @num_bits
  * bits.  Following this, bitstream_peek_bits() and/or bitstream_remove_bits()
- * may be called on the bitstream to peek or remove up to @num_bits bits.  */
+ * may be called on the bitstream to peek or remove up to @num_bits bits.
+ *
+ * The bit buffer is refilled with as many coding units as fit, so most calls
+ * find enough bits already there and cost only a comparison.  Away from the end
+ * of the input, the refill itself is a single unaligned load with no further
+ * branches.  */
 static forceinline void
 bitstream_ensure_bits(struct input_bitstream *is, const unsigned num_bits)
 {
-	/* This currently works for at most 17 bits.  */
+	STATIC_ASSERT(BITSTREAM_MAX_ENSURE_BITS >= 17);
 
 	if (is->bitsleft >= num_bits)
 		return;
 
-	if (unlikely(is->end - is->next < 2))
-		goto overflow;
-
-	is->bitbuf |= (u32)get_unaligned_le16(is->next) << (16 - is->bitsleft);
-	is->next += 2;
-	is->bitsleft += 16;
-
-	if (unlikely(num_bits == 17 && is->bitsleft == 16)) {
-		if (unlikely(is->end - is->next < 2))
-			goto overflow;
-
-		is->bitbuf |= (u32)get_unaligned_le16(is->next);
-		is->next += 2;
-		is->bitsleft = 32;
+	if (UNALIGNED_ACCESS_IS_FAST && likely(is->end - is->next >= WORDBYTES)) {
+		is->bitbuf |= bitstream_load_units(is->next) >> is->bitsleft;
+		is->next += ((WORDBITS - is->bitsleft) >> 4) << 1;
+		is->bitsleft += (WORDBITS - is->bitsleft) & ~15;
+	} else {
+		bitstream_refill_slow(is);
 	}
-
-	return;
-
-overflow:
-	is->bitsleft = 32;
 }
 
 /* Return the next @num_bits bits from the bitstream, without removing them.
@@ -116,7 +166,7 @@ overflow:
 static forceinline u32
 bitstream_peek_bits(const struct input_bitstream *is, const unsigned num_bits)
 {
-	return (is->bitbuf >> 1) >> (sizeof(is->bitbuf) * 8 - num_bits - 1);
+	return (is->bitbuf >> 1) >> (WORDBITS - num_bits - 1);
 }
 
 /* Remove @num_bits from the bitstream.  There must be at least @num_bits
@@ -148,6 +198,32 @@ bitstream_read_bits(struct input_bitstream *is, unsigned num_bits)
 	return bitstream_pop_bits(is, num_bits);
 }
 
+/*
+ * Give back to the input buffer the coding units which the bit buffer holds
+ * beyond the one in which the next @num_bits bits end.  There must be at least
+ * @num_bits remaining in the buffer variable.
+ *
+ * Literal bytes embedded in the bitstream are located where a reader that
+ * refills one coding unit at a time would be after ensuring @num_bits bits;
+ * that is, just after the coding unit in which those bits end.  This must be
+ * called before reading such bytes, since bitstream_ensure_bits() reads ahead.
+ */
+static forceinline void
+bitstream_unread_units(struct input_bitstream *is, unsigned num_bits)
+{
+	unsigned keep = num_bits + ((is->bitsleft - num_bits) & 15);
+	u32 unread = (is->bitsleft - keep) / 8;
+
+	if (unread <= is->overrun) {
+		is->overrun -= unread;
+	} else {
+		is->next -= unread - is->overrun;
+		is->overrun = 0;
+	}
+	is->bitbuf &= ~(~(machine_word_t)0 >> (keep - 1) >> 1);
+	is->bitsleft = keep;
+}
+
 /* Read and return the next literal byte embedded in the bitstream.  */
 static forceinline u8
 bitstream_read_byte(struct input_bitstream *is)
@@ -195,10 +271,13 @@ bitstream_read_bytes(struct input_bitstream *is, void *dst_buffer, size_t count)
 	return 0;
 }
 
-/* Align the input bitstream on a coding-unit boundary.  */
+/* Align the input bitstream on the next coding-unit boundary.  If the bitstream
+ * is already aligned, skip a whole coding unit.  There must be at least 1 bit
+ * remaining in the buffer variable.  */
 static forceinline void
 bitstream_align(struct input_bitstream *is)
 {
+	bitstream_unread_units(is, 1);
 	is->bitsleft = 0;
 	is->bitbuf = 0;
 }
@@ -240,30 +319,19 @@ bitstream_align(struct input_bitstream *is)
 	(((symbol) << DECODE_TABLE_SYMBOL_SHIFT) | (length))
 
 /*
- * Read and return the next Huffman-encoded symbol from the given bitstream
- * using the given decode table.
- *
- * If the input data is exhausted, then the Huffman symbol will be decoded as if
- * the missing bits were all zeroes.
- *
- * XXX: This is mostly duplicated in lzms_decode_huffman_symbol() in
- * lzms_decompress.c; keep them in sync!
+ * Finish decoding a Huffman-encoded symbol, given the root table entry that the
+ * next 'table_bits' bits of input index.  The bitbuffer must already contain at
+ * least 'max_codeword_len' bits.  This is the second half of read_huffsym(), for
+ * decoders which look up the root table entry themselves.
  */
 static forceinline unsigned
-read_huffsym(struct input_bitstream *is, const u16 decode_table[],
-	     unsigned table_bits, unsigned max_codeword_len)
+decode_huffsym_entry(struct input_bitstream *is, const u16 decode_table[],
+		     unsigned entry, unsigned table_bits,
+		     unsigned max_codeword_len)
 {
-	unsigned entry;
 	unsigned symbol;
 	unsigned length;
 
-	/* Preload the bitbuffer with 'max_codeword_len' bits so that we're
-	 * guaranteed to be able to fully decode a codeword. */
-	bitstream_ensure_bits(is, max_codeword_len);
-
-	/* Index the root table by the next 'table_bits' bits of input. */
-	entry = decode_table[bitstream_peek_bits(is, table_bits)];
-
 	/* Extract the "symbol" and "length" from the entry. */
 	symbol = entry >> DECODE_TABLE_SYMBOL_SHIFT;
 	length = entry & DECODE_TABLE_LENGTH_MASK;
@@ -292,6 +360,33 @@ read_huffsym(struct input_bitstream *is, const u16 decode_table[],
 	return symbol;
 }
 
+/*
+ * Read and return the next Huffman-encoded symbol from the given bitstream
+ * using the given decode table.
+ *
+ * If the input data is exhausted, then the Huffman symbol will be decoded as if
+ * the missing bits were all zeroes.
+ *
+ * XXX: This is mostly duplicated in lzms_decode_huffman_symbol() in
+ * lzms_decompress.c; keep them in sync!
+ */
+static forceinline unsigned
+read_huffsym(struct input_bitstream *is, const u16 decode_table[],
+	     unsigned table_bits, unsigned max_codeword_len)
+{
+	unsigned entry;
+
+	/* Preload the bitbuffer with 'max_codeword_len' bits so that we're
+	 * guaranteed to be able to fully decode a codeword. */
+	bitstream_ensure_bits(is, max_codeword_len);
+
+	/* Index the root table by the next 'table_bits' bits of input. */
+	entry = decode_table[bitstream_peek_bits(is, table_bits)];
+
+	return decode_huffsym_entry(is, decode_table, entry,
+				    table_bits, max_codeword_len);
+}
+
 /*
  * The DECODE_TABLE_ENOUGH() macro evaluates to the maximum number of decode
  * table entries, including all subtable entries, that may be required for
@@ -417,6 +512,71 @@ make_huffman_decode_table(u16 decode_table[], unsigned num_syms,
 			  unsigned table_bits, const u8 lens[],
 			  unsigned max_codeword_len, u16 working_space[]);
 
+extern void
+make_huffman_decode_table_from_counts(u16 decode_table[], unsigned num_syms,
+				      unsigned table_bits, const u8 lens[],
+				      const unsigned len_counts[],
+				      unsigned max_codeword_len,
+				      u16 working_space[]);
+
+/*
+ * A multi-literal table lets a decoder decode up to two literals with one table
+ * lookup.  It is indexed like the root table of a Huffman decode table, by the
+ * next 'table_bits' bits of input.  When those bits begin with a complete
+ * codeword for a literal (a symbol less than 256), the entry has
+ * MULTI_LITERAL_FLAG set and holds the literal byte and its codeword length.
+ * If the bits following that codeword also hold a complete codeword for a
+ * literal, the entry holds the second literal byte too, and a literal count of
+ * 2 and the total length of the two codewords.  Otherwise the entry is just a
+ * copy of the root table entry, to be passed to decode_huffsym_entry().
+ *
+ * This only pays off when literal codewords are often short enough that two of
+ * them fit in the root table bits, as in sparse data full of zero bytes.
+ * Otherwise the extra table lookup makes decoding slower, so decoders ask
+ * multi_literal_table_pays_off() before using one.  Literal entries are written
+ * with the same code whether they hold one literal or two, so that decoding
+ * them takes no extra unpredictable branch.
+ */
+#define MULTI_LITERAL_FLAG		0x80000000
+#define MULTI_LITERAL_COUNT_SHIFT	26
+#define MULTI_LITERAL_LEN1_SHIFT	21
+#define MULTI_LITERAL_LEN_SHIFT		16
+#define MULTI_LITERAL_LEN_MASK		0x1F
+
+#define MULTI_LITERAL_TABLE(name, table_bits) \
+	u32 name[1U << (table_bits)] _aligned_attribute(DECODE_TABLE_ALIGNMENT)
+
+extern bool
+multi_literal_table_pays_off(const u8 lens[], unsigned table_bits);
+
+extern void
+make_multi_literal_table(u32 literal_table[], const u16 decode_table[],
+			 unsigned table_bits);
+
+/*
+ * Write the literal(s) from a multi-literal table entry that has
+ * MULTI_LITERAL_FLAG set, and discard their codewords from the bitstream.  Only
+ * the first literal is decoded if there isn't room for two bytes in the output
+ * buffer.  Return the new output position.
+ */
+static forceinline u8 *
+write_multi_literal(struct input_bitstream *is, u32 entry,
+		    u8 *out_next, u8 *out_end)
+{
+	out_next[0] = (u8)entry;
+	if (likely(out_end - out_next >= 2)) {
+		/* The second byte is garbage if there is only one literal,
+		 * but then it is overwritten by whatever comes next.  */
+		out_next[1] = (u8)(entry >> 8);
+		bitstream_remove_bits(is, (entry >> MULTI_LITERAL_LEN_SHIFT) &
+					  MULTI_LITERAL_LEN_MASK);
+		return out_next + (entry >> MULTI_LITERAL_COUNT_SHIFT & 3);
+	}
+	bitstream_remove_bits(is, (entry >> MULTI_LITERAL_LEN1_SHIFT) &
+				  MULTI_LITERAL_LEN_MASK);
+	return out_next + 1;
+}
+
 /******************************************************************************/
 /*                             LZ match copying                               */
 /*----------------------------------------------------------------------------*/
@@ -444,6 +604,81 @@ repeat_byte(u8 b)
 	return repeat_u16(((u16)b << 8) | b);
 }
 
+/*
+ * On CPUs with 128-bit vectors, matches are copied 16 bytes at a time.  Where
+ * a byte shuffle is available (SSSE3, or NEON on AArch64), matches with offsets
+ * shorter than a vector are copied by repeating the pattern of their first
+ * 'offset' bytes across a vector with one shuffle, then storing that vector
+ * every 'lz_copy_pattern_steps[offset]' bytes: the largest multiple of 'offset'
+ * that is at most 16.
+ */
+#if defined(__SSE2__) || defined(__ARM_NEON)
+#  define LZ_COPY_VECTOR_BYTES	16
+#  if defined(__SSSE3__) || defined(__aarch64__)
+#    define LZ_COPY_HAVE_PATTERN	1
+#  endif
+#endif
+
+#ifdef LZ_COPY_VECTOR_BYTES
+
+#ifdef __SSE2__
+typedef __m128i lz_copy_vec_t;
+
+static forceinline lz_copy_vec_t
+load_vec_unaligned(const void *p)
+{
+	return _mm_loadu_si128((const __m128i *)p);
+}
+
+static forceinline void
+store_vec_unaligned(lz_copy_vec_t v, void *p)
+{
+	_mm_storeu_si128((__m128i *)p, v);
+}
+#else
+typedef uint8x16_t lz_copy_vec_t;
+
+static forceinline lz_copy_vec_t
+load_vec_unaligned(const void *p)
+{
+	return vld1q_u8(p);
+}
+
+static forceinline void
+store_vec_unaligned(lz_copy_vec_t v, void *p)
+{
+	vst1q_u8(p, v);
+}
+#endif
+
+static forceinline void
+copy_vec_unaligned(const void *src, void *dst)
+{
+	store_vec_unaligned(load_vec_unaligned(src), dst);
+}
+
+#ifdef LZ_COPY_HAVE_PATTERN
+extern const u8 lz_copy_pattern_indices[LZ_COPY_VECTOR_BYTES]
+				       [LZ_COPY_VECTOR_BYTES];
+extern const u8 lz_copy_pattern_steps[LZ_COPY_VECTOR_BYTES];
+
+/* Return a vector filled with repetitions of the first 'offset' bytes at 'src',
+ * where 1 <= offset < 16.  All 16 bytes at 'src' must be readable.  */
+static forceinline lz_copy_vec_t
+load_vec_pattern(const u8 *src, u32 offset)
+{
+#ifdef __SSE2__
+	return _mm_shuffle_epi8(load_vec_unaligned(src),
+				load_vec_unaligned(lz_copy_pattern_indices[offset]));
+#else
+	return vqtbl1q_u8(load_vec_unaligned(src),
+			  load_vec_unaligned(lz_copy_pattern_indices[offset]));
+#endif
+}
+#endif /* LZ_COPY_HAVE_PATTERN */
+
+#endif /* LZ_COPY_VECTOR_BYTES */
+
 /*
  * Copy an LZ77 match of 'length' bytes from the match source at 'out_next -
  * offset' to the match destination at 'out_next'.  The source and destination
@@ -476,6 +711,17 @@ lz_copy(u32 length, u32 offset, u8 *out_begin, u8 *out_next, u8 *out_end,
 	 * this scenario.
 	 */
 	src = out_next - offset;
+#ifdef LZ_COPY_VECTOR_BYTES
+	if (length <= 2 * LZ_COPY_VECTOR_BYTES &&
+	    offset >= LZ_COPY_VECTOR_BYTES &&
+	    out_end - out_next >= 2 * LZ_COPY_VECTOR_BYTES)
+	{
+		copy_vec_unaligned(src, out_next);
+		copy_vec_unaligned(src + LZ_COPY_VECTOR_BYTES,
+				   out_next + LZ_COPY_VECTOR_BYTES);
+		return 0;
+	}
+#endif
 	if (UNALIGNED_ACCESS_IS_FAST && length <= 3 * WORDBYTES &&
 	    offset >= WORDBYTES && out_end - out_next >= 3 * WORDBYTES)
 	{
@@ -491,6 +737,41 @@ lz_copy(u32 length, u32 offset, u8 *out_begin, u8 *out_next, u8 *out_end,
 		return -1;
 	end = out_next + length;
 
+#ifdef LZ_COPY_VECTOR_BYTES
+	/*
+	 * Copy one vector at a time, as long as the vector stores that run past
+	 * the end of the match stay within the output buffer.
+	 */
+	if (likely(out_end - end >= LZ_COPY_VECTOR_BYTES - 1)) {
+		if (offset >= LZ_COPY_VECTOR_BYTES) {
+			/* The source and destination vectors don't overlap. */
+			do {
+				copy_vec_unaligned(src, out_next);
+				src += LZ_COPY_VECTOR_BYTES;
+				out_next += LZ_COPY_VECTOR_BYTES;
+			} while (out_next < end);
+			return 0;
+		}
+#ifdef LZ_COPY_HAVE_PATTERN
+		/*
+		 * The match repeats its first 'offset' bytes, which are all
+		 * before 'out_next'.  The 16 bytes loaded from 'src' end no
+		 * later than 'out_next + 15', which is in the buffer.
+		 */
+		{
+			const lz_copy_vec_t v = load_vec_pattern(src, offset);
+			const u32 step = lz_copy_pattern_steps[offset];
+
+			do {
+				store_vec_unaligned(v, out_next);
+				out_next += step;
+			} while (out_next < end);
+			return 0;
+		}
+#endif
+	}
+#endif /* LZ_COPY_VECTOR_BYTES */
+
 	/*
 	 * Try to copy one word at a time.  On i386 and x86_64 this is faster
 	 * than copying one byte at a time, unless the data is near-random and
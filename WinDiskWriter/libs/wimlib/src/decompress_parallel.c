@@ -0,0 +1,529 @@
+/*
+ * decompress_parallel.c
+ *
+ * Decompress chunks of data (parallel version).
+ */
+
+/*
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this file; if not, see http://www.gnu.org/licenses/.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wimlib.h"
+#include "assert.h"
+#include "chunk_decompressor.h"
+#include "error.h"
+#include "list.h"
+#include "resource.h"
+#include "util.h"
+
+struct message_queue {
+	struct list_head list;
+	pthread_mutex_t lock;
+	pthread_cond_t msg_avail_cond;
+	bool terminating;
+};
+
+struct decompressor_thread_data {
+	pthread_t thread;
+	struct message_queue *chunks_to_decompress_queue;
+	struct message_queue *decompressed_chunks_queue;
+	struct wimlib_decompressor *decompressor;
+};
+
+#define MAX_CHUNKS_PER_MSG 16
+
+struct message {
+	u8 *compressed_chunks[MAX_CHUNKS_PER_MSG];
+	u8 *uncompressed_chunks[MAX_CHUNKS_PER_MSG];
+	u32 compressed_chunk_sizes[MAX_CHUNKS_PER_MSG];
+	u32 uncompressed_chunk_sizes[MAX_CHUNKS_PER_MSG];
+	int statuses[MAX_CHUNKS_PER_MSG];
+	size_t num_filled_chunks;
+	size_t num_alloc_chunks;
+	bool recover_data;
+	struct list_head list;
+	bool complete;
+	struct list_head submission_list;
+};
+
+struct parallel_chunk_decompressor {
+	struct chunk_decompressor base;
+
+	struct message_queue chunks_to_decompress_queue;
+	struct message_queue decompressed_chunks_queue;
+	struct decompressor_thread_data *thread_data;
+	unsigned num_thread_data;
+	unsigned num_started_threads;
+
+	struct message *msgs;
+	size_t num_messages;
+
+	struct list_head available_msgs;
+	struct list_head submitted_msgs;
+	struct message *next_submit_msg;
+	struct message *next_ready_msg;
+	size_t next_chunk_idx;
+};
+
+static int
+message_queue_init(struct message_queue *q)
+{
+	if (pthread_mutex_init(&q->lock, NULL)) {
+		ERROR_WITH_ERRNO("Failed to initialize mutex");
+		goto err;
+	}
+	if (pthread_cond_init(&q->msg_avail_cond, NULL)) {
+		ERROR_WITH_ERRNO("Failed to initialize condition variable");
+		goto err_destroy_lock;
+	}
+	INIT_LIST_HEAD(&q->list);
+	return 0;
+
+err_destroy_lock:
+	pthread_mutex_destroy(&q->lock);
+err:
+	return WIMLIB_ERR_NOMEM;
+}
+
+static void
+message_queue_destroy(struct message_queue *q)
+{
+	if (q->list.next != NULL) {
+		pthread_mutex_destroy(&q->lock);
+		pthread_cond_destroy(&q->msg_avail_cond);
+	}
+}
+
+static void
+message_queue_put(struct message_queue *q, struct message *msg)
+{
+	pthread_mutex_lock(&q->lock);
+	list_add_tail(&msg->list, &q->list);
+	pthread_cond_signal(&q->msg_avail_cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static struct message *
+message_queue_get(struct message_queue *q)
+{
+	struct message *msg;
+
+	pthread_mutex_lock(&q->lock);
+	while (list_empty(&q->list) && !q->terminating)
+		pthread_cond_wait(&q->msg_avail_cond, &q->lock);
+	if (!q->terminating) {
+		msg = list_entry(q->list.next, struct message, list);
+		list_del(&msg->list);
+	} else
+		msg = NULL;
+	pthread_mutex_unlock(&q->lock);
+	return msg;
+}
+
+static void
+message_queue_terminate(struct message_queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->terminating = true;
+	pthread_cond_broadcast(&q->msg_avail_cond);
+	pthread_mutex_unlock(&q->lock);
+}
+
+static int
+init_message(struct message *msg, size_t num_chunks, u32 chunk_size)
+{
+	msg->num_alloc_chunks = num_chunks;
+	for (size_t i = 0; i < num_chunks; i++) {
+		msg->compressed_chunks[i] = MALLOC(chunk_size - 1);
+		msg->uncompressed_chunks[i] = MALLOC(chunk_size);
+		if (msg->compressed_chunks[i] == NULL ||
+		    msg->uncompressed_chunks[i] == NULL)
+			return WIMLIB_ERR_NOMEM;
+	}
+	return 0;
+}
+
+static void
+destroy_message(struct message *msg)
+{
+	for (size_t i = 0; i < msg->num_alloc_chunks; i++) {
+		FREE(msg->compressed_chunks[i]);
+		FREE(msg->uncompressed_chunks[i]);
+	}
+}
+
+static void
+free_messages(struct message *msgs, size_t num_messages)
+{
+	if (msgs) {
+		for (size_t i = 0; i < num_messages; i++)
+			destroy_message(&msgs[i]);
+		FREE(msgs);
+	}
+}
+
+static struct message *
+allocate_messages(size_t count, size_t chunks_per_msg, u32 chunk_size)
+{
+	struct message *msgs;
+
+	msgs = CALLOC(count, sizeof(struct message));
+	if (msgs == NULL)
+		return NULL;
+	for (size_t i = 0; i < count; i++) {
+		if (init_message(&msgs[i], chunks_per_msg, chunk_size)) {
+			free_messages(msgs, count);
+			return NULL;
+		}
+	}
+	return msgs;
+}
+
+static void
+decompress_chunks(struct message *msg, struct wimlib_decompressor *decompressor)
+{
+	for (size_t i = 0; i < msg->num_filled_chunks; i++) {
+		u32 csize = msg->compressed_chunk_sizes[i];
+		u32 usize = msg->uncompressed_chunk_sizes[i];
+
+		/* Chunks stored uncompressed were read directly into the
+		 * uncompressed buffer.  */
+		if (csize == usize) {
+			msg->statuses[i] = 0;
+			continue;
+		}
+		msg->statuses[i] = decompress_chunk(msg->compressed_chunks[i],
+						    csize,
+						    msg->uncompressed_chunks[i],
+						    usize, decompressor,
+						    msg->recover_data);
+	}
+}
+
+static void *
+decompressor_thread_proc(void *arg)
+{
+	struct decompressor_thread_data *params = arg;
+	struct message *msg;
+
+	while ((msg = message_queue_get(params->chunks_to_decompress_queue)) != NULL) {
+		decompress_chunks(msg, params->decompressor);
+		message_queue_put(params->decompressed_chunks_queue, msg);
+	}
+	return NULL;
+}
+
+static void
+parallel_chunk_decompressor_destroy(struct chunk_decompressor *_ctx)
+{
+	struct parallel_chunk_decompressor *ctx = (struct parallel_chunk_decompressor *)_ctx;
+	unsigned i;
+
+	if (ctx == NULL)
+		return;
+
+	if (ctx->num_started_threads != 0) {
+		message_queue_terminate(&ctx->chunks_to_decompress_queue);
+
+		for (i = 0; i < ctx->num_started_threads; i++)
+			pthread_join(ctx->thread_data[i].thread, NULL);
+	}
+
+	message_queue_destroy(&ctx->chunks_to_decompress_queue);
+	message_queue_destroy(&ctx->decompressed_chunks_queue);
+
+	if (ctx->thread_data != NULL)
+		for (i = 0; i < ctx->num_thread_data; i++)
+			wimlib_free_decompressor(ctx->thread_data[i].decompressor);
+
+	FREE(ctx->thread_data);
+
+	free_messages(ctx->msgs, ctx->num_messages);
+
+	FREE(ctx);
+}
+
+static void
+submit_decompression_msg(struct parallel_chunk_decompressor *ctx)
+{
+	struct message *msg = ctx->next_submit_msg;
+
+	ctx->next_submit_msg = NULL;
+
+	/* A buffer may have been borrowed but never filled, e.g. if reading
+	 * the compressed data failed.  */
+	if (msg->num_filled_chunks == 0) {
+		list_add(&msg->list, &ctx->available_msgs);
+		return;
+	}
+
+	msg->complete = false;
+	msg->recover_data = ctx->base.recover_data;
+	list_add_tail(&msg->submission_list, &ctx->submitted_msgs);
+	message_queue_put(&ctx->chunks_to_decompress_queue, msg);
+}
+
+static void *
+parallel_chunk_decompressor_get_chunk_buffer(struct chunk_decompressor *_ctx,
+					     u32 csize, u32 usize)
+{
+	struct parallel_chunk_decompressor *ctx = (struct parallel_chunk_decompressor *)_ctx;
+	struct message *msg;
+	size_t idx;
+
+	wimlib_assert(csize > 0);
+	wimlib_assert(csize <= usize);
+	wimlib_assert(usize <= ctx->base.chunk_size);
+
+	if (ctx->next_submit_msg) {
+		msg = ctx->next_submit_msg;
+	} else {
+		if (list_empty(&ctx->available_msgs))
+			return NULL;
+
+		msg = list_entry(ctx->available_msgs.next, struct message, list);
+		list_del(&msg->list);
+		ctx->next_submit_msg = msg;
+		msg->num_filled_chunks = 0;
+	}
+
+	idx = msg->num_filled_chunks;
+	msg->compressed_chunk_sizes[idx] = csize;
+	msg->uncompressed_chunk_sizes[idx] = usize;
+
+	if (csize == usize)
+		return msg->uncompressed_chunks[idx];
+	return msg->compressed_chunks[idx];
+}
+
+static void
+parallel_chunk_decompressor_signal_chunk_filled(struct chunk_decompressor *_ctx)
+{
+	struct parallel_chunk_decompressor *ctx = (struct parallel_chunk_decompressor *)_ctx;
+	struct message *msg;
+
+	wimlib_assert(ctx->next_submit_msg);
+
+	msg = ctx->next_submit_msg;
+	if (++msg->num_filled_chunks == msg->num_alloc_chunks)
+		submit_decompression_msg(ctx);
+}
+
+static bool
+parallel_chunk_decompressor_get_decompression_result(struct chunk_decompressor *_ctx,
+						     const void **udata_ret,
+						     u32 *usize_ret,
+						     int *status_ret)
+{
+	struct parallel_chunk_decompressor *ctx = (struct parallel_chunk_decompressor *)_ctx;
+	struct message *msg;
+
+	if (ctx->next_submit_msg)
+		submit_decompression_msg(ctx);
+
+	if (ctx->next_ready_msg) {
+		msg = ctx->next_ready_msg;
+	} else {
+		if (list_empty(&ctx->submitted_msgs))
+			return false;
+
+		while (!(msg = list_entry(ctx->submitted_msgs.next,
+					  struct message,
+					  submission_list))->complete)
+			message_queue_get(&ctx->decompressed_chunks_queue)->complete = true;
+
+		ctx->next_ready_msg = msg;
+		ctx->next_chunk_idx = 0;
+	}
+
+	*udata_ret = msg->uncompressed_chunks[ctx->next_chunk_idx];
+	*usize_ret = msg->uncompressed_chunk_sizes[ctx->next_chunk_idx];
+	*status_ret = msg->statuses[ctx->next_chunk_idx];
+
+	if (++ctx->next_chunk_idx == msg->num_filled_chunks) {
+		list_del(&msg->submission_list);
+		list_add_tail(&msg->list, &ctx->available_msgs);
+		ctx->next_ready_msg = NULL;
+	}
+	return true;
+}
+
+int
+new_parallel_chunk_decompressor(int ctype, u32 chunk_size,
+				unsigned num_threads, u64 max_memory,
+				struct chunk_decompressor **decompressor_ret)
+{
+	u64 approx_mem_required;
+	size_t chunks_per_msg;
+	size_t msgs_per_thread;
+	size_t extra_msgs;
+	struct parallel_chunk_decompressor *ctx;
+	unsigned i;
+	int ret;
+	unsigned desired_num_threads;
+
+	wimlib_assert(chunk_size > 0);
+
+	if (num_threads == 0)
+		num_threads = get_available_cpus();
+
+	if (num_threads == 1)
+		return -1;
+
+	/* The decompressed chunks are only a window onto data which the caller
+	 * is about to consume, so don't let them take more than a quarter of
+	 * the memory.  This only matters for the large chunks (up to 64 MiB)
+	 * of solid resources.  */
+	if (max_memory == 0)
+		max_memory = get_available_memory() / 4;
+
+	desired_num_threads = num_threads;
+
+	/* Unlike compression, a single read often covers only a handful of
+	 * chunks, so only batch chunks together when they are so small that
+	 * the per-message overhead would otherwise dominate.  Two messages per
+	 * thread keep the threads busy while the caller reads the next chunks
+	 * and consumes the previous ones.
+	 *
+	 * Large chunks get only one message per thread, plus one more: the
+	 * caller holds on to the oldest chunk while passing it to the callback,
+	 * and without the extra message one thread would sit idle all that
+	 * time, and the next chunk could not be read until it was done.  */
+	chunks_per_msg = max(32768 / chunk_size, 1);
+	chunks_per_msg = min(chunks_per_msg, MAX_CHUNKS_PER_MSG);
+	msgs_per_thread = (chunk_size < ((u32)1 << 23)) ? 2 : 1;
+
+	for (;;) {
+		extra_msgs = (msgs_per_thread == 1) ? 1 : 0;
+		approx_mem_required =
+			(u64)chunks_per_msg *
+			((u64)msgs_per_thread * num_threads + extra_msgs) *
+			(u64)chunk_size * 2
+			+ 1000000;
+		if (approx_mem_required <= max_memory)
+			break;
+
+		if (chunks_per_msg > 1)
+			chunks_per_msg--;
+		else if (msgs_per_thread > 1)
+			msgs_per_thread--;
+		else if (num_threads > 1)
+			num_threads--;
+		else
+			break;
+	}
+
+	if (num_threads < desired_num_threads) {
+		WARNING("Wanted to use %u decompression threads, but limiting "
+			"to %u to fit in available memory!",
+			desired_num_threads, num_threads);
+	}
+
+	if (num_threads == 1)
+		return -2;
+
+	ret = WIMLIB_ERR_NOMEM;
+	ctx = CALLOC(1, sizeof(*ctx));
+	if (ctx == NULL)
+		goto err;
+
+	ctx->base.ctype = ctype;
+	ctx->base.chunk_size = chunk_size;
+	ctx->base.destroy = parallel_chunk_decompressor_destroy;
+	ctx->base.get_chunk_buffer = parallel_chunk_decompressor_get_chunk_buffer;
+	ctx->base.signal_chunk_filled = parallel_chunk_decompressor_signal_chunk_filled;
+	ctx->base.get_decompression_result = parallel_chunk_decompressor_get_decompression_result;
+
+	ctx->num_thread_data = num_threads;
+
+	ret = message_queue_init(&ctx->chunks_to_decompress_queue);
+	if (ret)
+		goto err;
+
+	ret = message_queue_init(&ctx->decompressed_chunks_queue);
+	if (ret)
+		goto err;
+
+	ret = WIMLIB_ERR_NOMEM;
+	ctx->thread_data = CALLOC(num_threads, sizeof(ctx->thread_data[0]));
+	if (ctx->thread_data == NULL)
+		goto err;
+
+	for (i = 0; i < num_threads; i++) {
+		struct decompressor_thread_data *dat;
+
+		dat = &ctx->thread_data[i];
+
+		dat->chunks_to_decompress_queue = &ctx->chunks_to_decompress_queue;
+		dat->decompressed_chunks_queue = &ctx->decompressed_chunks_queue;
+		ret = wimlib_create_decompressor(ctype, chunk_size,
+						 &dat->decompressor);
+		if (ret)
+			goto err;
+	}
+
+	for (ctx->num_started_threads = 0;
+	     ctx->num_started_threads < num_threads;
+	     ctx->num_started_threads++)
+	{
+		ret = pthread_create(&ctx->thread_data[ctx->num_started_threads].thread,
+				     NULL,
+				     decompressor_thread_proc,
+				     &ctx->thread_data[ctx->num_started_threads]);
+		if (ret) {
+			errno = ret;
+			WARNING_WITH_ERRNO("Failed to create decompressor thread %u of %u",
+					   ctx->num_started_threads + 1,
+					   num_threads);
+			ret = WIMLIB_ERR_NOMEM;
+			if (ctx->num_started_threads >= 2)
+				break;
+			goto err;
+		}
+	}
+
+	ctx->base.num_threads = ctx->num_started_threads;
+
+	ret = WIMLIB_ERR_NOMEM;
+	ctx->num_messages = ctx->num_started_threads * msgs_per_thread +
+			    extra_msgs;
+	ctx->msgs = allocate_messages(ctx->num_messages,
+				      chunks_per_msg, chunk_size);
+	if (ctx->msgs == NULL)
+		goto err;
+	ctx->base.buffer_size = (u64)ctx->num_messages * chunks_per_msg *
+				chunk_size * 2;
+
+	INIT_LIST_HEAD(&ctx->available_msgs);
+	for (size_t i = 0; i < ctx->num_messages; i++)
+		list_add_tail(&ctx->msgs[i].list, &ctx->available_msgs);
+
+	INIT_LIST_HEAD(&ctx->submitted_msgs);
+
+	*decompressor_ret = &ctx->base;
+	return 0;
+
+err:
+	parallel_chunk_decompressor_destroy(&ctx->base);
+	return ret;
+}
@@ -0,0 +1,294 @@
+/*
+ * decompressed_chunk_cache.c
+ *
+ * Cache of decompressed chunks of WIM resources, so that small reads at nearby
+ * offsets (for example, reads of a file in a mounted image) don't decompress
+ * the same chunk over and over.
+ */
+
+/*
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this file; if not, see http://www.gnu.org/licenses/.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+#include "decompressed_chunk_cache.h"
+#include "util.h"
+
+/*
+ * The cache is split into shards, each with its own lock, hash table, and LRU
+ * list, so that threads reading different chunks rarely contend.  The size
+ * limit applies to the cache as a whole: after an insertion pushes the total
+ * size over the limit, the least recently used chunks of that shard are
+ * evicted first, then those of the other shards.
+ */
+#define DCACHE_NUM_SHARDS		16
+#define DCACHE_NUM_BUCKETS		256
+
+struct dcache_shard {
+	pthread_mutex_t lock;
+
+	/* Chunks in this shard, most recently used first  */
+	struct list_head lru_list;
+
+	struct cached_chunk *buckets[DCACHE_NUM_BUCKETS];
+
+	u64 num_hits;
+	u64 num_misses;
+};
+
+struct decompressed_chunk_cache {
+	u64 max_size;
+	atomic_uint_fast64_t cur_size;
+	struct dcache_shard shards[DCACHE_NUM_SHARDS];
+};
+
+static u64
+chunk_hash(u64 res_offset, u64 chunk_idx)
+{
+	return (res_offset * 0x9E3779B97F4A7C15ULL + chunk_idx) *
+		0xC2B2AE3D27D4EB4FULL;
+}
+
+static struct dcache_shard *
+get_shard(struct decompressed_chunk_cache *cache, u64 hash)
+{
+	return &cache->shards[(hash >> 32) % DCACHE_NUM_SHARDS];
+}
+
+static struct cached_chunk **
+get_bucket(struct dcache_shard *shard, u64 hash)
+{
+	return &shard->buckets[(hash >> 40) % DCACHE_NUM_BUCKETS];
+}
+
+struct decompressed_chunk_cache *
+new_decompressed_chunk_cache(u64 max_size)
+{
+	struct decompressed_chunk_cache *cache = CALLOC(1, sizeof(*cache));
+
+	if (!cache)
+		return NULL;
+	cache->max_size = max_size;
+	for (int i = 0; i < DCACHE_NUM_SHARDS; i++) {
+		struct dcache_shard *shard = &cache->shards[i];
+
+		if (pthread_mutex_init(&shard->lock, NULL)) {
+			while (i--)
+				pthread_mutex_destroy(&cache->shards[i].lock);
+			FREE(cache);
+			return NULL;
+		}
+		INIT_LIST_HEAD(&shard->lru_list);
+	}
+	return cache;
+}
+
+void
+free_decompressed_chunk_cache(struct decompressed_chunk_cache *cache)
+{
+	if (!cache)
+		return;
+	dcache_clear(cache);
+	for (int i = 0; i < DCACHE_NUM_SHARDS; i++)
+		pthread_mutex_destroy(&cache->shards[i].lock);
+	FREE(cache);
+}
+
+/* Look up a chunk.  If it's found, return a new reference to it; the caller
+ * must release it with release_cached_chunk().  Otherwise return NULL.  */
+struct cached_chunk *
+dcache_lookup(struct decompressed_chunk_cache *cache, u64 res_offset,
+	      u64 chunk_idx)
+{
+	const u64 hash = chunk_hash(res_offset, chunk_idx);
+	struct dcache_shard *shard = get_shard(cache, hash);
+	struct cached_chunk *chunk;
+
+	pthread_mutex_lock(&shard->lock);
+	for (chunk = *get_bucket(shard, hash); chunk; chunk = chunk->hash_next) {
+		if (chunk->res_offset == res_offset &&
+		    chunk->chunk_idx == chunk_idx)
+			break;
+	}
+	if (chunk) {
+		list_move(&chunk->lru_list, &shard->lru_list);
+		chunk->refcnt++;
+		shard->num_hits++;
+	} else {
+		shard->num_misses++;
+	}
+	pthread_mutex_unlock(&shard->lock);
+	return chunk;
+}
+
+/* Allocate a chunk of @usize bytes, not yet in the cache, with a single
+ * reference held by the caller.  */
+struct cached_chunk *
+new_cached_chunk(u64 res_offset, u64 chunk_idx, u32 usize)
+{
+	struct cached_chunk *chunk = MALLOC(sizeof(*chunk) + usize);
+
+	if (!chunk)
+		return NULL;
+	chunk->res_offset = res_offset;
+	chunk->chunk_idx = chunk_idx;
+	chunk->refcnt = 1;
+	chunk->usize = usize;
+	chunk->hash_next = NULL;
+	INIT_LIST_HEAD(&chunk->lru_list);
+	return chunk;
+}
+
+/* Remove a chunk from its shard, dropping the cache's reference.  The shard
+ * must be locked.  Returns true if the chunk should now be freed.  */
+static bool
+evict_chunk(struct decompressed_chunk_cache *cache, struct dcache_shard *shard,
+	    struct cached_chunk *chunk)
+{
+	struct cached_chunk **pp;
+
+	pp = get_bucket(shard, chunk_hash(chunk->res_offset, chunk->chunk_idx));
+	while (*pp != chunk)
+		pp = &(*pp)->hash_next;
+	*pp = chunk->hash_next;
+	list_del(&chunk->lru_list);
+	atomic_fetch_sub(&cache->cur_size, chunk->usize);
+	return --chunk->refcnt == 0;
+}
+
+/* Evict least recently used chunks from the shard until the cache is within
+ * its size limit or the shard is empty.  */
+static void
+shrink_shard(struct decompressed_chunk_cache *cache, struct dcache_shard *shard)
+{
+	LIST_HEAD(to_free);
+	struct cached_chunk *chunk, *tmp;
+
+	pthread_mutex_lock(&shard->lock);
+	while (atomic_load(&cache->cur_size) > cache->max_size &&
+	       !list_empty(&shard->lru_list))
+	{
+		chunk = list_entry(shard->lru_list.prev, struct cached_chunk,
+				   lru_list);
+		if (evict_chunk(cache, shard, chunk))
+			list_add(&chunk->lru_list, &to_free);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	list_for_each_entry_safe(chunk, tmp, &to_free, lru_list)
+		FREE(chunk);
+}
+
+/* Add a chunk from new_cached_chunk() to the cache.  The caller keeps its own
+ * reference.  Nothing is done if the chunk is too large for the cache, or if
+ * another thread already added the same chunk.  */
+void
+dcache_insert(struct decompressed_chunk_cache *cache,
+	      struct cached_chunk *chunk)
+{
+	const u64 hash = chunk_hash(chunk->res_offset, chunk->chunk_idx);
+	struct dcache_shard *shard = get_shard(cache, hash);
+	struct cached_chunk **bucket = get_bucket(shard, hash);
+	struct cached_chunk *p;
+
+	if (chunk->usize > cache->max_size / 2)
+		return;
+
+	pthread_mutex_lock(&shard->lock);
+	for (p = *bucket; p; p = p->hash_next) {
+		if (p->res_offset == chunk->res_offset &&
+		    p->chunk_idx == chunk->chunk_idx)
+			break;
+	}
+	if (!p) {
+		chunk->hash_next = *bucket;
+		*bucket = chunk;
+		list_add(&chunk->lru_list, &shard->lru_list);
+		chunk->refcnt++;
+		atomic_fetch_add(&cache->cur_size, chunk->usize);
+	}
+	pthread_mutex_unlock(&shard->lock);
+
+	for (int i = 0; i < DCACHE_NUM_SHARDS &&
+			atomic_load(&cache->cur_size) > cache->max_size; i++)
+	{
+		shrink_shard(cache,
+			     &cache->shards[(shard - cache->shards + i) %
+					    DCACHE_NUM_SHARDS]);
+	}
+}
+
+/* Release a reference to a chunk returned by dcache_lookup() or
+ * new_cached_chunk().  */
+void
+release_cached_chunk(struct decompressed_chunk_cache *cache,
+		     struct cached_chunk *chunk)
+{
+	struct dcache_shard *shard =
+		get_shard(cache, chunk_hash(chunk->res_offset, chunk->chunk_idx));
+	bool free_it;
+
+	pthread_mutex_lock(&shard->lock);
+	free_it = (--chunk->refcnt == 0);
+	pthread_mutex_unlock(&shard->lock);
+	if (free_it)
+		FREE(chunk);
+}
+
+/* Remove all chunks from the cache.  This must be done whenever the data at a
+ * given offset in the WIM file may have changed.  */
+void
+dcache_clear(struct decompressed_chunk_cache *cache)
+{
+	for (int i = 0; i < DCACHE_NUM_SHARDS; i++) {
+		struct dcache_shard *shard = &cache->shards[i];
+		LIST_HEAD(to_free);
+		struct cached_chunk *chunk, *tmp;
+
+		pthread_mutex_lock(&shard->lock);
+		while (!list_empty(&shard->lru_list)) {
+			chunk = list_entry(shard->lru_list.next,
+					   struct cached_chunk, lru_list);
+			if (evict_chunk(cache, shard, chunk))
+				list_add(&chunk->lru_list, &to_free);
+		}
+		pthread_mutex_unlock(&shard->lock);
+
+		list_for_each_entry_safe(chunk, tmp, &to_free, lru_list)
+			FREE(chunk);
+	}
+}
+
+void
+dcache_get_stats(struct decompressed_chunk_cache *cache, u64 *hits_ret,
+		 u64 *misses_ret)
+{
+	*hits_ret = 0;
+	*misses_ret = 0;
+	for (int i = 0; i < DCACHE_NUM_SHARDS; i++) {
+		struct dcache_shard *shard = &cache->shards[i];
+
+		pthread_mutex_lock(&shard->lock);
+		*hits_ret += shard->num_hits;
+		*misses_ret += shard->num_misses;
+		pthread_mutex_unlock(&shard->lock);
+	}
+}
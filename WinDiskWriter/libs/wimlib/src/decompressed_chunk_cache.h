@@ -0,0 +1,62 @@
+/*
+ * decompressed_chunk_cache.h
+ *
+ * Cache of decompressed chunks of WIM resources.
+ */
+
+#ifndef _WIMLIB_DECOMPRESSED_CHUNK_CACHE_H
+#define _WIMLIB_DECOMPRESSED_CHUNK_CACHE_H
+
+#include "list.h"
+#include "types.h"
+
+/* Default maximum size of a WIMStruct's chunk cache, in bytes.  This is enough
+ * for two chunks of the largest size used in solid resources.  */
+#define DEFAULT_DECOMPRESSED_CHUNK_CACHE_SIZE	(128 << 20)
+
+/* A decompressed chunk, identified by the offset of its resource in the WIM
+ * file and its index in the resource.  Chunks are reference counted; the cache
+ * holds one reference to each chunk in it, and each lookup hands out another.
+ * The reference count is protected by the lock of the cache shard the chunk
+ * belongs to.  */
+struct cached_chunk {
+	u64 res_offset;
+	u64 chunk_idx;
+	u32 refcnt;
+	u32 usize;
+	struct list_head lru_list;
+	struct cached_chunk *hash_next;
+	u8 data[];
+};
+
+struct decompressed_chunk_cache;
+
+extern struct decompressed_chunk_cache *
+new_decompressed_chunk_cache(u64 max_size);
+
+extern void
+free_decompressed_chunk_cache(struct decompressed_chunk_cache *cache);
+
+extern struct cached_chunk *
+dcache_lookup(struct decompressed_chunk_cache *cache, u64 res_offset,
+	      u64 chunk_idx);
+
+extern struct cached_chunk *
+new_cached_chunk(u64 res_offset, u64 chunk_idx, u32 usize);
+
+extern void
+dcache_insert(struct decompressed_chunk_cache *cache,
+	      struct cached_chunk *chunk);
+
+extern void
+release_cached_chunk(struct decompressed_chunk_cache *cache,
+		     struct cached_chunk *chunk);
+
+extern void
+dcache_clear(struct decompressed_chunk_cache *cache);
+
+extern void
+dcache_get_stats(struct decompressed_chunk_cache *cache, u64 *hits_ret,
+		 u64 *misses_ret);
+
+#endif /* _WIMLIB_DECOMPRESSED_CHUNK_CACHE_H */
@@ -428,7 +428,8 @@ begin_extract_blob(struct blob_descriptor *blob, void *_ctx)
 {
 	struct apply_ctx *ctx = _ctx;
 
-	if (unlikely(blob->out_refcnt > MAX_OPEN_FILES))
+	if (unlikely(blob->out_refcnt > MAX_OPEN_FILES) &&
+	    !ctx->apply_ops->any_number_of_targets)
 		return create_temporary_file(&ctx->tmpfile_fd, &ctx->tmpfile_name);
 
 	return call_begin_blob(blob, ctx->saved_cbs);
@@ -565,7 +566,8 @@ end_extract_blob(struct blob_descriptor *blob, int status, void *_ctx)
  * This also works if the WIM is being read from a pipe.
  *
  * This also will split up blobs that will need to be extracted to more than
- * MAX_OPEN_FILES locations, as measured by the 'out_refcnt' of each blob.
+ * MAX_OPEN_FILES locations, as measured by the 'out_refcnt' of each blob,
+ * unless the apply_operations implementation sets 'any_number_of_targets'.
  * Therefore, the apply_operations implementation need not worry about running
  * out of file descriptors, unless it might open more than one file descriptor
  * per 'blob_extraction_target' (e.g. Win32 currently might because the
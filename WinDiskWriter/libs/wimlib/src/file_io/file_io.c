@@ -24,7 +24,14 @@
 #endif
 
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
 #include <unistd.h>
+#ifndef __WIN32__
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
 
 #include "error.h"
 #include "file_io.h"
@@ -113,9 +120,17 @@ pipe_read(struct filedes *fd, void *buf, size_t count, off_t offset)
 int
 full_pread(struct filedes *fd, void *buf, size_t count, off_t offset)
 {
+	const void *mapped;
+
 	if (fd->is_pipe)
 		goto is_pipe;
 
+	mapped = filedes_mapped(fd, offset, count);
+	if (mapped) {
+		memcpy(buf, mapped, count);
+		return 0;
+	}
+
 	while (count) {
 		ssize_t ret = pread(fd->fd, buf, count, offset);
 		if (unlikely(ret <= 0)) {
@@ -206,7 +221,95 @@ off_t filedes_seek(struct filedes *fd, off_t offset)
 	return offset;
 }
 
+/*
+ * Hint that @size bytes at @offset will be read soon, so that the OS can start
+ * reading them into the page cache asynchronously.  This lets disk or network
+ * latency overlap with whatever the caller does before it actually reads the
+ * data.  This is only a hint; errors are ignored, and nothing is done for
+ * pipes or on platforms that don't support it.
+ */
+void filedes_prefetch(struct filedes *fd, off_t offset, off_t size)
+{
+	if (fd->is_pipe || size <= 0)
+		return;
+#ifndef __WIN32__
+	if (filedes_mapped(fd, offset, size)) {
+		/* madvise() needs a page-aligned address.  */
+		uintptr_t start = (uintptr_t)fd->map + offset;
+		uintptr_t page_offset = start & (sysconf(_SC_PAGESIZE) - 1);
+
+		(void)madvise((void *)(start - page_offset), size + page_offset,
+			      MADV_WILLNEED);
+		return;
+	}
+#endif
+#if defined(F_RDADVISE)
+	while (size > 0) {
+		struct radvisory ra = {
+			.ra_offset = offset,
+			.ra_count = min(size, INT_MAX & ~4095),
+		};
+		if (fcntl(fd->fd, F_RDADVISE, &ra) == -1)
+			return;
+		offset += ra.ra_count;
+		size -= ra.ra_count;
+	}
+#elif defined(POSIX_FADV_WILLNEED)
+	(void)posix_fadvise(fd->fd, offset, size, POSIX_FADV_WILLNEED);
+#endif
+}
+
 bool filedes_is_seekable(struct filedes *fd)
 {
 	return !fd->is_pipe && lseek(fd->fd, 0, SEEK_CUR) != -1;
 }
+
+/*
+ * Try to map the file read-only into memory, so that data can be read from it
+ * without copying it through pread().  Only regular files can be mapped.  The
+ * mapping covers the file's size at the time of the call; reads beyond it still
+ * go through pread().  Since the mapping may be read from after the file is
+ * truncated, it must be removed with filedes_unmap() before the file is
+ * truncated.
+ *
+ * Returns %true if the file is now mapped, or %false if it isn't (which is not
+ * an error).
+ */
+bool filedes_map(struct filedes *fd)
+{
+#ifndef __WIN32__
+	struct stat stbuf;
+	void *map;
+
+	if (fd->map)
+		return true;
+	if (fd->is_pipe || fstat(fd->fd, &stbuf) || !S_ISREG(stbuf.st_mode) ||
+	    stbuf.st_size <= 0 || (u64)stbuf.st_size > SIZE_MAX)
+		return false;
+
+	map = mmap(NULL, stbuf.st_size, PROT_READ, MAP_SHARED, fd->fd, 0);
+	if (map == MAP_FAILED)
+		return false;
+
+	/* WIM resources are mostly read in order of increasing offset.  */
+	(void)madvise(map, stbuf.st_size, MADV_SEQUENTIAL);
+
+	fd->map = map;
+	fd->map_size = stbuf.st_size;
+	return true;
+#else
+	return false;
+#endif
+}
+
+/* Remove the mapping of the file, if any, made by filedes_map().  */
+void filedes_unmap(struct filedes *fd)
+{
+#ifndef __WIN32__
+	if (fd->map) {
+		munmap(fd->map, fd->map_size);
+		fd->map = NULL;
+		fd->map_size = 0;
+	}
+#endif
+}
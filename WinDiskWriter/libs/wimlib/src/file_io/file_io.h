@@ -12,6 +12,11 @@ struct filedes {
 	int fd;
 	unsigned int is_pipe : 1;
 	off_t offset;
+
+	/* If not NULL, a read-only mapping of the first @map_size bytes of the
+	 * file.  Reads within the mapping don't need to go through pread().  */
+	void *map;
+	size_t map_size;
 };
 
 extern int
@@ -33,14 +38,36 @@ full_pwrite(struct filedes *fd, const void *buf, size_t count, off_t offset);
 extern off_t
 filedes_seek(struct filedes *fd, off_t offset);
 
+extern void
+filedes_prefetch(struct filedes *fd, off_t offset, off_t size);
+
 extern bool
 filedes_is_seekable(struct filedes *fd);
 
+extern bool
+filedes_map(struct filedes *fd);
+
+extern void
+filedes_unmap(struct filedes *fd);
+
 static inline void filedes_init(struct filedes *fd, int raw_fd)
 {
 	fd->fd = raw_fd;
 	fd->offset = 0;
 	fd->is_pipe = 0;
+	fd->map = NULL;
+	fd->map_size = 0;
+}
+
+/* Return a pointer to the @size bytes at @offset in the file if they are all
+ * within the file's mapping, otherwise NULL.  */
+static inline const void *
+filedes_mapped(const struct filedes *fd, off_t offset, size_t size)
+{
+	if (fd->map && offset >= 0 && (size_t)offset <= fd->map_size &&
+	    size <= fd->map_size - (size_t)offset)
+		return (const char *)fd->map + offset;
+	return NULL;
 }
 
 static inline void filedes_invalidate(struct filedes *fd)
@@ -48,7 +75,7 @@ static inline void filedes_invalidate(struct filedes *fd)
 	fd->fd = -1;
 }
 
-#define filedes_close(f) close((f)->fd)
+#define filedes_close(f) (filedes_unmap(f), close((f)->fd))
 
 static inline bool
 filedes_valid(const struct filedes *fd)
@@ -27,6 +27,9 @@
 #  include "config.h"
 #endif
 
+#include <errno.h>
+#include <pthread.h>
+
 #include "assert.h"
 #include "endianness.h"
 #include "error.h"
@@ -35,6 +38,7 @@
 #include "progress.h"
 #include "resource.h"
 #include "sha1.h"
+#include "util.h"
 #include "wim.h"
 #include "write.h"
 
@@ -82,6 +86,247 @@ calculate_chunk_sha1(struct filedes *in_fd, size_t this_chunk_size,
 	return 0;
 }
 
+/*
+ * Calculate the SHA-1 message digests of @num_chunks consecutive chunks, each
+ * @chunk_size bytes, beginning at @offset.  If sha1_update_multi() can hash
+ * several messages at once, the chunks are read in interleaved pieces and
+ * hashed together; @num_chunks mustn't exceed sha1_multi_lanes().
+ */
+static int
+calculate_chunk_sha1s(struct filedes *in_fd, size_t chunk_size,
+		      unsigned num_chunks, off_t offset,
+		      u8 sha1_mds[][SHA1_HASH_SIZE])
+{
+	u8 *buf;
+	SHA_CTX ctxs[SHA1_MAX_LANES];
+	SHA_CTX *ctx_ptrs[SHA1_MAX_LANES];
+	const void *pieces[SHA1_MAX_LANES];
+	size_t pos;
+	size_t bytes_to_read;
+	int ret;
+
+	wimlib_assert(num_chunks <= sha1_multi_lanes());
+
+	if (num_chunks == 1)
+		return calculate_chunk_sha1(in_fd, chunk_size, offset,
+					    sha1_mds[0]);
+
+	buf = MALLOC(num_chunks * BUFFER_SIZE);
+	if (!buf)
+		return WIMLIB_ERR_NOMEM;
+
+	for (unsigned i = 0; i < num_chunks; i++) {
+		sha1_init(&ctxs[i]);
+		ctx_ptrs[i] = &ctxs[i];
+		pieces[i] = &buf[i * BUFFER_SIZE];
+	}
+
+	for (pos = 0; pos < chunk_size; pos += bytes_to_read) {
+		bytes_to_read = min(chunk_size - pos, BUFFER_SIZE);
+		for (unsigned i = 0; i < num_chunks; i++) {
+			ret = full_pread(in_fd, &buf[i * BUFFER_SIZE],
+					 bytes_to_read,
+					 offset + (u64)i * chunk_size + pos);
+			if (ret) {
+				ERROR_WITH_ERRNO("Read error while calculating "
+						 "integrity checksums");
+				goto out;
+			}
+		}
+		sha1_update_multi(ctx_ptrs, pieces, bytes_to_read, num_chunks);
+	}
+
+	for (unsigned i = 0; i < num_chunks; i++)
+		sha1_final(sha1_mds[i], &ctxs[i]);
+	ret = 0;
+out:
+	FREE(buf);
+	return ret;
+}
+
+enum {
+	CHUNK_PENDING,
+	CHUNK_CLAIMED,
+	CHUNK_DONE,
+};
+
+/* State for calculating the SHA-1 message digests of the chunks covered by an
+ * integrity table, possibly using several threads.  */
+struct integrity_hasher {
+	struct filedes *in_fd;
+
+	/* Offset of the first chunk, the size of each chunk except the last,
+	 * and the size of the last chunk  */
+	u64 offset;
+	size_t chunk_size;
+	size_t last_chunk_size;
+
+	u32 num_chunks;
+
+	/* Array where the SHA-1 message digests are stored  */
+	u8 (*sha1s)[SHA1_HASH_SIZE];
+
+	/* CHUNK_* status of each chunk.  Chunks whose message digests are
+	 * already known start out as CHUNK_DONE.  */
+	u8 *statuses;
+
+	/* Maximum number of chunks that are hashed together  */
+	unsigned max_chunks_at_once;
+
+	pthread_mutex_t lock;
+	pthread_cond_t chunk_done_cond;
+
+	/* All chunks before this index have been claimed or are done.  */
+	u32 next_chunk;
+
+	/* Error code from hashing a chunk, or 0  */
+	int error;
+
+	/* Set when no more chunks should be hashed.  */
+	bool aborting;
+};
+
+/*
+ * Claim the next group of pending chunks, hash them, and mark them done.
+ * Returns %false if there were no pending chunks to claim.  Must be called with
+ * the lock held, which is released while hashing.
+ */
+static bool
+hash_next_chunks(struct integrity_hasher *h)
+{
+	u32 i, num_chunks;
+	size_t size;
+	int ret;
+
+	while (h->next_chunk < h->num_chunks &&
+	       h->statuses[h->next_chunk] != CHUNK_PENDING)
+		h->next_chunk++;
+	if (h->next_chunk == h->num_chunks || h->aborting)
+		return false;
+
+	/* Full-size chunks can be hashed together; the last chunk may be
+	 * shorter, so it is hashed by itself.  */
+	i = h->next_chunk;
+	num_chunks = 1;
+	if (i != h->num_chunks - 1) {
+		while (num_chunks < h->max_chunks_at_once &&
+		       i + num_chunks < h->num_chunks - 1 &&
+		       h->statuses[i + num_chunks] == CHUNK_PENDING)
+			num_chunks++;
+		size = h->chunk_size;
+	} else {
+		size = h->last_chunk_size;
+	}
+	memset(&h->statuses[i], CHUNK_CLAIMED, num_chunks);
+	h->next_chunk = i + num_chunks;
+
+	pthread_mutex_unlock(&h->lock);
+	ret = calculate_chunk_sha1s(h->in_fd, size, num_chunks,
+				    h->offset + (u64)i * h->chunk_size,
+				    &h->sha1s[i]);
+	pthread_mutex_lock(&h->lock);
+
+	if (ret && !h->error) {
+		h->error = ret;
+		h->aborting = true;
+	}
+	memset(&h->statuses[i], CHUNK_DONE, num_chunks);
+	pthread_cond_broadcast(&h->chunk_done_cond);
+	return true;
+}
+
+static void *
+integrity_hasher_thread_proc(void *_h)
+{
+	struct integrity_hasher *h = _h;
+
+	pthread_mutex_lock(&h->lock);
+	while (hash_next_chunks(h))
+		;
+	pthread_mutex_unlock(&h->lock);
+	return NULL;
+}
+
+/*
+ * Calculate the SHA-1 message digests of all chunks whose status is
+ * CHUNK_PENDING.  The work is spread across up to one thread per processor, and
+ * the calling thread helps too.  Chunks are reported to @chunk_done in order, as
+ * soon as each one and all before it are done; if it returns nonzero, hashing
+ * stops and that value is returned.  The in-flight data is bounded by the small
+ * read buffer each thread uses.
+ */
+static int
+hash_integrity_chunks(struct integrity_hasher *h,
+		      int (*chunk_done)(struct integrity_hasher *, u32, void *),
+		      void *chunk_done_ctx)
+{
+	unsigned num_threads;
+	unsigned num_started_threads = 0;
+	pthread_t *threads = NULL;
+	int ret = 0;
+
+	h->max_chunks_at_once = sha1_multi_lanes();
+	h->next_chunk = 0;
+	h->error = 0;
+	h->aborting = false;
+	if (pthread_mutex_init(&h->lock, NULL)) {
+		ERROR_WITH_ERRNO("Failed to initialize mutex");
+		return WIMLIB_ERR_NOMEM;
+	}
+	if (pthread_cond_init(&h->chunk_done_cond, NULL)) {
+		ERROR_WITH_ERRNO("Failed to initialize condition variable");
+		pthread_mutex_destroy(&h->lock);
+		return WIMLIB_ERR_NOMEM;
+	}
+
+	/* The calling thread counts as one of the threads.  */
+	num_threads = min(get_available_cpus(),
+			  DIV_ROUND_UP(h->num_chunks, h->max_chunks_at_once));
+	if (num_threads > 1)
+		threads = MALLOC((num_threads - 1) * sizeof(threads[0]));
+	while (threads && num_started_threads < num_threads - 1) {
+		int err = pthread_create(&threads[num_started_threads], NULL,
+					 integrity_hasher_thread_proc, h);
+		if (err) {
+			errno = err;
+			WARNING_WITH_ERRNO("Failed to create integrity "
+					   "hashing thread");
+			break;
+		}
+		num_started_threads++;
+	}
+
+	pthread_mutex_lock(&h->lock);
+	for (u32 i = 0; i < h->num_chunks; i++) {
+		while (h->statuses[i] != CHUNK_DONE && !h->error)
+			if (!hash_next_chunks(h))
+				pthread_cond_wait(&h->chunk_done_cond, &h->lock);
+		if (h->error) {
+			ret = h->error;
+			break;
+		}
+		pthread_mutex_unlock(&h->lock);
+		ret = (*chunk_done)(h, i, chunk_done_ctx);
+		pthread_mutex_lock(&h->lock);
+		if (ret)
+			break;
+	}
+	h->aborting = true;
+	pthread_mutex_unlock(&h->lock);
+
+	for (unsigned i = 0; i < num_started_threads; i++)
+		pthread_join(threads[i], NULL);
+	FREE(threads);
+	pthread_cond_destroy(&h->chunk_done_cond);
+	pthread_mutex_destroy(&h->lock);
+	return ret;
+}
+
+static size_t
+integrity_chunk_size(const struct integrity_hasher *h, u32 i)
+{
+	return (i == h->num_chunks - 1) ? h->last_chunk_size : h->chunk_size;
+}
 
 /*
  * read_integrity_table: -  Reads the integrity table from a WIM file.
@@ -139,6 +384,36 @@ read_integrity_table(WIMStruct *wim, u64 num_checked_bytes,
 	return 0;
 }
 
+struct integrity_progress_ctx {
+	union wimlib_progress_info *progress;
+	enum wimlib_progress_msg msg;
+	wimlib_progress_func_t progfunc;
+	void *progctx;
+
+	/* When verifying, the expected message digests  */
+	const struct integrity_table *table;
+	bool mismatch;
+};
+
+/* Report that chunk @i has been hashed, and if verifying, check its message
+ * digest.  */
+static int
+report_integrity_chunk_done(struct integrity_hasher *h, u32 i, void *_ctx)
+{
+	struct integrity_progress_ctx *ctx = _ctx;
+	size_t this_chunk_size = integrity_chunk_size(h, i);
+
+	if (ctx->table && !hashes_equal(h->sha1s[i], ctx->table->sha1sums[i])) {
+		ctx->mismatch = true;
+		return WIM_INTEGRITY_NOT_OK;
+	}
+
+	ctx->progress->integrity.completed_chunks++;
+	ctx->progress->integrity.completed_bytes += this_chunk_size;
+	return call_progress(ctx->progfunc, ctx->msg, ctx->progress,
+			     ctx->progctx);
+}
+
 /*
  * calculate_integrity_table():
  *
@@ -212,7 +487,6 @@ calculate_integrity_table(struct filedes *in_fd,
 	new_table->size = new_table_size;
 	new_table->chunk_size = chunk_size;
 
-	u64 offset = WIM_HEADER_DISK_SIZE;
 	union wimlib_progress_info progress;
 
 	progress.integrity.total_bytes      = new_check_bytes;
@@ -227,6 +501,12 @@ calculate_integrity_table(struct filedes *in_fd,
 	if (ret)
 		goto out_free_new_table;
 
+	u8 *statuses = MALLOC(new_num_chunks);
+	if (!statuses) {
+		ret = WIMLIB_ERR_NOMEM;
+		goto out_free_new_table;
+	}
+
 	for (u32 i = 0; i < new_num_chunks; i++) {
 		size_t this_chunk_size;
 		if (i == new_num_chunks - 1)
@@ -240,22 +520,34 @@ calculate_integrity_table(struct filedes *in_fd,
 			/* Can use SHA1 message digest from old integrity table
 			 * */
 			copy_hash(new_table->sha1sums[i], old_table->sha1sums[i]);
+			statuses[i] = CHUNK_DONE;
 		} else {
-			/* Calculate the SHA1 message digest of this chunk */
-			ret = calculate_chunk_sha1(in_fd, this_chunk_size,
-						   offset, new_table->sha1sums[i]);
-			if (ret)
-				goto out_free_new_table;
+			/* Need to calculate the SHA1 message digest of this
+			 * chunk  */
+			statuses[i] = CHUNK_PENDING;
 		}
-		offset += this_chunk_size;
-
-		progress.integrity.completed_chunks++;
-		progress.integrity.completed_bytes += this_chunk_size;
-		ret = call_progress(progfunc, WIMLIB_PROGRESS_MSG_CALC_INTEGRITY,
-				    &progress, progctx);
-		if (ret)
-			goto out_free_new_table;
 	}
+
+	struct integrity_hasher hasher = {
+		.in_fd		= in_fd,
+		.offset		= WIM_HEADER_DISK_SIZE,
+		.chunk_size	= chunk_size,
+		.last_chunk_size = new_last_chunk_size,
+		.num_chunks	= new_num_chunks,
+		.sha1s		= new_table->sha1sums,
+		.statuses	= statuses,
+	};
+	struct integrity_progress_ctx progress_ctx = {
+		.progress	= &progress,
+		.msg		= WIMLIB_PROGRESS_MSG_CALC_INTEGRITY,
+		.progfunc	= progfunc,
+		.progctx	= progctx,
+	};
+	ret = hash_integrity_chunks(&hasher, report_integrity_chunk_done,
+				    &progress_ctx);
+	FREE(statuses);
+	if (ret)
+		goto out_free_new_table;
 	*integrity_table_ret = new_table;
 	return 0;
 
@@ -358,8 +650,6 @@ verify_integrity(struct filedes *in_fd, const tchar *filename,
 		 wimlib_progress_func_t progfunc, void *progctx)
 {
 	int ret;
-	u64 offset = WIM_HEADER_DISK_SIZE;
-	u8 sha1_md[SHA1_HASH_SIZE];
 	union wimlib_progress_info progress;
 
 	progress.integrity.total_bytes      = bytes_to_check;
@@ -374,30 +664,37 @@ verify_integrity(struct filedes *in_fd, const tchar *filename,
 	if (ret)
 		return ret;
 
-	for (u32 i = 0; i < table->num_entries; i++) {
-		size_t this_chunk_size;
-		if (i == table->num_entries - 1)
-			this_chunk_size = MODULO_NONZERO(bytes_to_check,
-							 table->chunk_size);
-		else
-			this_chunk_size = table->chunk_size;
-
-		ret = calculate_chunk_sha1(in_fd, this_chunk_size, offset, sha1_md);
-		if (ret)
-			return ret;
-
-		if (!hashes_equal(sha1_md, table->sha1sums[i]))
-			return WIM_INTEGRITY_NOT_OK;
-
-		offset += this_chunk_size;
-		progress.integrity.completed_chunks++;
-		progress.integrity.completed_bytes += this_chunk_size;
-
-		ret = call_progress(progfunc, WIMLIB_PROGRESS_MSG_VERIFY_INTEGRITY,
-				    &progress, progctx);
-		if (ret)
-			return ret;
-	}
+	u8 (*sha1s)[SHA1_HASH_SIZE] = MALLOC((size_t)table->num_entries *
+					     (SHA1_HASH_SIZE + 1));
+	if (!sha1s)
+		return WIMLIB_ERR_NOMEM;
+	u8 *statuses = (u8 *)&sha1s[table->num_entries];
+	memset(statuses, CHUNK_PENDING, table->num_entries);
+
+	struct integrity_hasher hasher = {
+		.in_fd		= in_fd,
+		.offset		= WIM_HEADER_DISK_SIZE,
+		.chunk_size	= table->chunk_size,
+		.last_chunk_size = MODULO_NONZERO(bytes_to_check,
+						  table->chunk_size),
+		.num_chunks	= table->num_entries,
+		.sha1s		= sha1s,
+		.statuses	= statuses,
+	};
+	struct integrity_progress_ctx progress_ctx = {
+		.progress	= &progress,
+		.msg		= WIMLIB_PROGRESS_MSG_VERIFY_INTEGRITY,
+		.progfunc	= progfunc,
+		.progctx	= progctx,
+		.table		= table,
+	};
+	ret = hash_integrity_chunks(&hasher, report_integrity_chunk_done,
+				    &progress_ctx);
+	FREE(sha1s);
+	if (progress_ctx.mismatch)
+		return WIM_INTEGRITY_NOT_OK;
+	if (ret)
+		return ret;
 	return WIM_INTEGRITY_OK;
 }
 
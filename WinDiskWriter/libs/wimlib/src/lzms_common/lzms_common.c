@@ -25,12 +25,14 @@
 #  include "config.h"
 #endif
 
+#include "bitops.h"
 #include "lzms_common.h"
 #include "unaligned.h"
-#include "x86_cpu_features.h"
 
 #ifdef __x86_64__
 #  include <emmintrin.h>
+#elif defined(__aarch64__)
+#  include <arm_neon.h>
 #endif
 
 /* Table: offset slot => offset slot base value  */
@@ -380,32 +382,64 @@ lzms_dilute_symbol_frequencies(u32 freqs[], unsigned num_syms)
 }
 
 
+/*
+ * Find the next byte that is one of the potential opcodes, 16 bytes at a time.
+ * 0x48 and 0x4C differ only in bit 2, and 0xE8 and 0xE9 only in bit 0, so six
+ * opcodes take four comparisons.  All 16 bytes at the returned position must be
+ * readable, which the sentinel byte placed by lzms_x86_filter() ensures.
+ */
 #ifdef __x86_64__
 static forceinline u8 *
-find_next_opcode_sse4_2(u8 *p)
+find_next_opcode_sse2(u8 *p)
 {
-	const __v16qi potential_opcodes = (__v16qi) {0x48, 0x4C, 0xE8, 0xE9, 0xF0, 0xFF};
-	__asm__(
-		"  pcmpestri $0x0, (%[p]), %[potential_opcodes]      \n"
-		"  jc 2f                                             \n"
-		"1:                                                  \n"
-		"  add $0x10, %[p]                                   \n"
-		"  pcmpestri $0x0, (%[p]), %[potential_opcodes]      \n"
-		"  jnc 1b                                            \n"
-		"2:                                                  \n"
-	#ifdef __ILP32__ /* x32 ABI (x86_64 with 32-bit pointers) */
-		"  add %%ecx, %[p]                                   \n"
-	#else
-		"  add %%rcx, %[p]                                   \n"
-	#endif
-		: [p] "+r" (p)
-		: [potential_opcodes] "x" (potential_opcodes), "a" (6), "d" (16)
-		: "rcx", "cc"
-	       );
+	const __m128i bit_0 = _mm_set1_epi8(0x01);
+	const __m128i bit_2 = _mm_set1_epi8(0x04);
+	const __m128i op_4C = _mm_set1_epi8(0x4C);
+	const __m128i op_E9 = _mm_set1_epi8((char)0xE9);
+	const __m128i op_F0 = _mm_set1_epi8((char)0xF0);
+	const __m128i op_FF = _mm_set1_epi8((char)0xFF);
 
-	return p;
+	for (;;) {
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(_mm_or_si128(v, bit_2), op_4C),
+				     _mm_cmpeq_epi8(_mm_or_si128(v, bit_0), op_E9)),
+			_mm_or_si128(_mm_cmpeq_epi8(v, op_F0),
+				     _mm_cmpeq_epi8(v, op_FF)));
+		u32 mask = _mm_movemask_epi8(m);
+
+		if (mask)
+			return p + bsf32(mask);
+		p += 16;
+	}
+}
+#elif defined(__aarch64__)
+static forceinline u8 *
+find_next_opcode_neon(u8 *p)
+{
+	const uint8x16_t bit_0 = vdupq_n_u8(0x01);
+	const uint8x16_t bit_2 = vdupq_n_u8(0x04);
+	const uint8x16_t op_4C = vdupq_n_u8(0x4C);
+	const uint8x16_t op_E9 = vdupq_n_u8(0xE9);
+	const uint8x16_t op_F0 = vdupq_n_u8(0xF0);
+	const uint8x16_t op_FF = vdupq_n_u8(0xFF);
+
+	for (;;) {
+		uint8x16_t v = vld1q_u8(p);
+		uint8x16_t m = vorrq_u8(
+			vorrq_u8(vceqq_u8(vorrq_u8(v, bit_2), op_4C),
+				 vceqq_u8(vorrq_u8(v, bit_0), op_E9)),
+			vorrq_u8(vceqq_u8(v, op_F0), vceqq_u8(v, op_FF)));
+		/* Narrow each byte of the comparison result to 4 bits.  */
+		u64 mask = vget_lane_u64(vreinterpret_u64_u8(
+				vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+
+		if (mask)
+			return p + (bsf64(mask) >> 2);
+		p += 16;
+	}
 }
-#endif /* __x86_64__ */
+#endif
 
 static forceinline u8 *
 find_next_opcode_default(u8 *p)
@@ -615,12 +649,16 @@ lzms_x86_filter(u8 data[restrict], s32 size,
 	p = data + 1;
 	tail_ptr = &data[size - 16];
 
-#ifdef __x86_64__
-	if (x86_have_cpu_feature(X86_CPU_FEATURE_SSE4_2)) {
+#if defined(__x86_64__) || defined(__aarch64__)
+	{
 		u8 saved_byte = *tail_ptr;
 		*tail_ptr = 0xE8;
 		for (;;) {
-			u8 *new_p = find_next_opcode_sse4_2(p);
+		#ifdef __x86_64__
+			u8 *new_p = find_next_opcode_sse2(p);
+		#else
+			u8 *new_p = find_next_opcode_neon(p);
+		#endif
 			if (new_p >= tail_ptr - 8)
 				break;
 			p = new_p;
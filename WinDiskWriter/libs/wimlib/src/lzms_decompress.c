@@ -509,21 +509,32 @@ lzms_decode_bit(struct lzms_range_decoder *rd, u32 *state_p, u32 num_states,
 	}
 }
 
+/*
+ * Build the decode table for a Huffman code from the current symbol
+ * frequencies.  Only the codeword lengths are needed for this, and since the
+ * frequencies are never 0, the lengths always form a complete code whose length
+ * counts we get for free.  So, neither the codewords themselves nor a separate
+ * pass to count and validate the lengths are needed.
+ */
 static void
 lzms_build_huffman_code(struct lzms_huffman_rebuild_info *rebuild_info)
 {
-	make_canonical_huffman_code(rebuild_info->num_syms,
+	unsigned len_counts[LZMS_MAX_CODEWORD_LENGTH + 1];
+
+	make_canonical_huffman_lens(rebuild_info->num_syms,
 				    LZMS_MAX_CODEWORD_LENGTH,
 				    rebuild_info->freqs,
 				    (u8 *)rebuild_info->decode_table,
-				    rebuild_info->codewords);
-
-	make_huffman_decode_table(rebuild_info->decode_table,
-				  rebuild_info->num_syms,
-				  rebuild_info->table_bits,
-				  (u8 *)rebuild_info->decode_table,
-				  LZMS_MAX_CODEWORD_LENGTH,
-				  (u16 *)rebuild_info->codewords);
+				    rebuild_info->codewords,
+				    len_counts);
+
+	make_huffman_decode_table_from_counts(rebuild_info->decode_table,
+					      rebuild_info->num_syms,
+					      rebuild_info->table_bits,
+					      (u8 *)rebuild_info->decode_table,
+					      len_counts,
+					      LZMS_MAX_CODEWORD_LENGTH,
+					      (u16 *)rebuild_info->codewords);
 
 	rebuild_info->num_syms_until_rebuild = rebuild_info->rebuild_freq;
 }
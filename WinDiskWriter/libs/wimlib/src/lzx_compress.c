@@ -179,6 +179,9 @@
 #  include "config.h"
 #endif
 
+#include <errno.h>
+#include <pthread.h>
+
 #include "compress_common.h"
 #include "compressor_ops.h"
 #include "error.h"
@@ -377,6 +380,10 @@ struct lzx_compressor {
 	void (*impl)(struct lzx_compressor *, const u8 *, size_t,
 		     struct lzx_output_bitstream *);
 
+	/* Thread that runs the matchfinder ahead of the near-optimal parser, or
+	 * NULL if the compressor is single-threaded */
+	struct lzx_helper *helper;
+
 	/* The log base 2 of the window size for match offset encoding purposes.
 	 * This will be >= LZX_MIN_WINDOW_ORDER and <= LZX_MAX_WINDOW_ORDER. */
 	unsigned window_order;
@@ -1541,12 +1548,13 @@ static forceinline struct lzx_lru_queue
 lzx_find_min_cost_path(struct lzx_compressor * const restrict c,
 		       const u8 * const restrict block_begin,
 		       const u32 block_size,
+		       struct lz_match * const restrict cache,
 		       const struct lzx_lru_queue initial_queue,
 		       bool is_16_bit)
 {
 	struct lzx_optimum_node *cur_node = c->optimum_nodes;
 	struct lzx_optimum_node * const end_node = cur_node + block_size;
-	struct lz_match *cache_ptr = c->match_cache;
+	struct lz_match *cache_ptr = cache;
 	const u8 *in_next = block_begin;
 	const u8 * const block_end = block_begin + block_size;
 
@@ -2112,6 +2120,7 @@ lzx_optimize_and_flush_block(struct lzx_compressor * const restrict c,
 			     struct lzx_output_bitstream * const restrict os,
 			     const u8 * const restrict block_begin,
 			     const u32 block_size,
+			     struct lz_match * const restrict cache,
 			     const struct lzx_lru_queue initial_queue,
 			     bool is_16_bit)
 {
@@ -2124,7 +2133,8 @@ lzx_optimize_and_flush_block(struct lzx_compressor * const restrict c,
 	for (;;) {
 		lzx_compute_match_costs(c);
 		new_queue = lzx_find_min_cost_path(c, block_begin, block_size,
-						   initial_queue, is_16_bit);
+						   cache, initial_queue,
+						   is_16_bit);
 
 		if (--num_passes_remaining == 0)
 			break;
@@ -2155,187 +2165,370 @@ lzx_optimize_and_flush_block(struct lzx_compressor * const restrict c,
  * ratio, which for LZX is probably impossible within any practical amount of
  * time, but rather to produce a compression ratio significantly better than a
  * simpler "greedy" or "lazy" parse while still being relatively fast.
+ *
+ * The work for each block is split into two phases: running the input through
+ * the binary trees matchfinder to fill the match cache and choose the block
+ * boundary, then optimizing and flushing the block.  The first phase only
+ * depends on the matchfinder state and the second phase only depends on the
+ * cached matches, so if the compressor has a helper thread the matchfinding for
+ * the next block is overlapped with the optimization of the current one.  The
+ * output is identical either way.
  */
+
+/* Matchfinding state carried from one block to the next */
+struct lzx_mf_state {
+	const u8 *in_begin;
+	const u8 *in_next;
+	const u8 *in_end;
+	u32 max_len;
+	u32 nice_len;
+	u32 next_hashes[2];
+};
+
+/* Set up to run the matchfinder over a new buffer. */
 static forceinline void
-lzx_compress_near_optimal(struct lzx_compressor * restrict c,
-			  const u8 * const restrict in_begin, size_t in_nbytes,
-			  struct lzx_output_bitstream * restrict os,
-			  bool is_16_bit)
+lzx_init_mf_state(struct lzx_compressor *c, struct lzx_mf_state *s,
+		  const u8 *in_begin, size_t in_nbytes, bool is_16_bit)
 {
-	const u8 *	 in_next = in_begin;
-	const u8 * const in_end  = in_begin + in_nbytes;
-	u32 max_len = LZX_MAX_MATCH_LEN;
-	u32 nice_len = min(c->nice_match_length, max_len);
-	u32 next_hashes[2] = {0, 0};
-	struct lzx_lru_queue queue = LZX_QUEUE_INITIALIZER;
+	s->in_begin = in_begin;
+	s->in_next = in_begin;
+	s->in_end = in_begin + in_nbytes;
+	s->max_len = LZX_MAX_MATCH_LEN;
+	s->nice_len = min(c->nice_match_length, s->max_len);
+	s->next_hashes[0] = 0;
+	s->next_hashes[1] = 0;
 
 	/* Initialize the matchfinder. */
 	CALL_BT_MF(is_16_bit, c, bt_matchfinder_init);
+}
 
-	do {
-		/* Starting a new block */
-
-		const u8 * const in_block_begin = in_next;
-		const u8 * const in_max_block_end =
-			in_next + min(SOFT_MAX_BLOCK_SIZE, in_end - in_next);
-		struct lz_match *cache_ptr = c->match_cache;
-		const u8 *next_search_pos = in_next;
-		const u8 *next_observation = in_next;
-		const u8 *next_pause_point =
-			min(in_next + min(MIN_BLOCK_SIZE,
-					  in_max_block_end - in_next),
-			    in_max_block_end - min(LZX_MAX_MATCH_LEN - 1,
-						   in_max_block_end - in_next));
-
-		lzx_init_block_split_stats(&c->split_stats);
-		lzx_reset_symbol_frequencies(c);
-
-		if (in_next >= next_pause_point)
-			goto pause;
+/*
+ * Find the matches for the next block, starting at s->in_next, and cache them
+ * in @cache.  Also tally initial symbol frequencies for the block in @freqs.
+ * On return, s->in_next points to the end of the block.
+ */
+static forceinline void
+lzx_find_block_matches(struct lzx_compressor * restrict c,
+		       struct lzx_mf_state * restrict s,
+		       struct lz_match * restrict cache,
+		       struct lzx_freqs * restrict freqs,
+		       bool is_16_bit)
+{
+	const u8 * const in_begin = s->in_begin;
+	const u8 *	 in_next = s->in_next;
+	const u8 * const in_end = s->in_end;
+	u32 max_len = s->max_len;
+	u32 nice_len = s->nice_len;
+	u32 next_hashes[2] = { s->next_hashes[0], s->next_hashes[1] };
+	const u8 * const in_max_block_end =
+		in_next + min(SOFT_MAX_BLOCK_SIZE, in_end - in_next);
+	struct lz_match *cache_ptr = cache;
+	const u8 *next_search_pos = in_next;
+	const u8 *next_observation = in_next;
+	const u8 *next_pause_point =
+		min(in_next + min(MIN_BLOCK_SIZE,
+				  in_max_block_end - in_next),
+		    in_max_block_end - min(LZX_MAX_MATCH_LEN - 1,
+					   in_max_block_end - in_next));
+
+	lzx_init_block_split_stats(&c->split_stats);
+	memset(freqs, 0, sizeof(*freqs));
+
+	if (in_next >= next_pause_point)
+		goto pause;
 
-		/*
-		 * Run the input buffer through the matchfinder, caching the
-		 * matches, until we decide to end the block.
-		 *
-		 * For a tighter matchfinding loop, we compute a "pause point",
-		 * which is the next position at which we may need to check
-		 * whether to end the block or to decrease max_len.  We then
-		 * only do these extra checks upon reaching the pause point.
-		 */
-	resume_matchfinding:
-		do {
-			if (in_next >= next_search_pos) {
-				/* Search for matches at this position. */
-				struct lz_match *lz_matchptr;
-				u32 best_len;
-
-				lz_matchptr = CALL_BT_MF(is_16_bit, c,
-							 bt_matchfinder_get_matches,
-							 in_begin,
-							 in_next - in_begin,
-							 max_len,
-							 nice_len,
-							 c->max_search_depth,
-							 next_hashes,
-							 &best_len,
-							 cache_ptr + 1);
-				cache_ptr->length = lz_matchptr - (cache_ptr + 1);
-				cache_ptr = lz_matchptr;
-
-				/* Accumulate literal/match statistics for block
-				 * splitting and for generating the initial cost
-				 * model. */
-				if (in_next >= next_observation) {
-					best_len = cache_ptr[-1].length;
-					if (best_len >= 3) {
-						/* Match (len >= 3) */
-
-						/*
-						 * Note: for performance reasons this has
-						 * been simplified significantly:
-						 *
-						 * - We wait until later to account for
-						 *   LZX_OFFSET_ADJUSTMENT.
-						 * - We don't account for repeat offsets.
-						 * - We don't account for different match headers.
-						 */
-						c->freqs.aligned[cache_ptr[-1].offset &
-							LZX_ALIGNED_OFFSET_BITMASK]++;
-						c->freqs.main[LZX_NUM_CHARS]++;
-
-						lzx_observe_match(&c->split_stats, best_len);
-						next_observation = in_next + best_len;
-					} else {
-						/* Literal */
-						c->freqs.main[*in_next]++;
-						lzx_observe_literal(&c->split_stats, *in_next);
-						next_observation = in_next + 1;
-					}
+	/*
+	 * Run the input buffer through the matchfinder, caching the
+	 * matches, until we decide to end the block.
+	 *
+	 * For a tighter matchfinding loop, we compute a "pause point",
+	 * which is the next position at which we may need to check
+	 * whether to end the block or to decrease max_len.  We then
+	 * only do these extra checks upon reaching the pause point.
+	 */
+resume_matchfinding:
+	do {
+		if (in_next >= next_search_pos) {
+			/* Search for matches at this position. */
+			struct lz_match *lz_matchptr;
+			u32 best_len;
+
+			lz_matchptr = CALL_BT_MF(is_16_bit, c,
+						 bt_matchfinder_get_matches,
+						 in_begin,
+						 in_next - in_begin,
+						 max_len,
+						 nice_len,
+						 c->max_search_depth,
+						 next_hashes,
+						 &best_len,
+						 cache_ptr + 1);
+			cache_ptr->length = lz_matchptr - (cache_ptr + 1);
+			cache_ptr = lz_matchptr;
+
+			/* Accumulate literal/match statistics for block
+			 * splitting and for generating the initial cost
+			 * model. */
+			if (in_next >= next_observation) {
+				best_len = cache_ptr[-1].length;
+				if (best_len >= 3) {
+					/* Match (len >= 3) */
+
+					/*
+					 * Note: for performance reasons this has
+					 * been simplified significantly:
+					 *
+					 * - We wait until later to account for
+					 *   LZX_OFFSET_ADJUSTMENT.
+					 * - We don't account for repeat offsets.
+					 * - We don't account for different match headers.
+					 */
+					freqs->aligned[cache_ptr[-1].offset &
+						LZX_ALIGNED_OFFSET_BITMASK]++;
+					freqs->main[LZX_NUM_CHARS]++;
+
+					lzx_observe_match(&c->split_stats, best_len);
+					next_observation = in_next + best_len;
+				} else {
+					/* Literal */
+					freqs->main[*in_next]++;
+					lzx_observe_literal(&c->split_stats, *in_next);
+					next_observation = in_next + 1;
 				}
+			}
 
-				/*
-				 * If there was a very long match found, then
-				 * don't cache any matches for the bytes covered
-				 * by that match.  This avoids degenerate
-				 * behavior when compressing highly redundant
-				 * data, where the number of matches can be very
-				 * large.
-				 *
-				 * This heuristic doesn't actually hurt the
-				 * compression ratio *too* much.  If there's a
-				 * long match, then the data must be highly
-				 * compressible, so it doesn't matter as much
-				 * what we do.
-				 */
-				if (best_len >= nice_len)
-					next_search_pos = in_next + best_len;
-			} else {
-				/* Don't search for matches at this position. */
-				CALL_BT_MF(is_16_bit, c,
-					   bt_matchfinder_skip_byte,
-					   in_begin,
-					   in_next - in_begin,
-					   nice_len,
-					   c->max_search_depth,
-					   next_hashes);
+			/*
+			 * If there was a very long match found, then
+			 * don't cache any matches for the bytes covered
+			 * by that match.  This avoids degenerate
+			 * behavior when compressing highly redundant
+			 * data, where the number of matches can be very
+			 * large.
+			 *
+			 * This heuristic doesn't actually hurt the
+			 * compression ratio *too* much.  If there's a
+			 * long match, then the data must be highly
+			 * compressible, so it doesn't matter as much
+			 * what we do.
+			 */
+			if (best_len >= nice_len)
+				next_search_pos = in_next + best_len;
+		} else {
+			/* Don't search for matches at this position. */
+			CALL_BT_MF(is_16_bit, c,
+				   bt_matchfinder_skip_byte,
+				   in_begin,
+				   in_next - in_begin,
+				   nice_len,
+				   c->max_search_depth,
+				   next_hashes);
+			cache_ptr->length = 0;
+			cache_ptr++;
+		}
+	} while (++in_next < next_pause_point &&
+		 likely(cache_ptr < &cache[CACHE_LENGTH]));
+
+pause:
+
+	/* Adjust max_len and nice_len if we're nearing the end of the
+	 * input buffer.  In addition, if we are so close to the end of
+	 * the input buffer that there cannot be any more matches, then
+	 * just advance through the last few positions and record no
+	 * matches. */
+	if (unlikely(max_len > in_end - in_next)) {
+		max_len = in_end - in_next;
+		nice_len = min(max_len, nice_len);
+		if (max_len < BT_MATCHFINDER_REQUIRED_NBYTES) {
+			while (in_next != in_end) {
 				cache_ptr->length = 0;
 				cache_ptr++;
-			}
-		} while (++in_next < next_pause_point &&
-			 likely(cache_ptr < &c->match_cache[CACHE_LENGTH]));
-
-	pause:
-
-		/* Adjust max_len and nice_len if we're nearing the end of the
-		 * input buffer.  In addition, if we are so close to the end of
-		 * the input buffer that there cannot be any more matches, then
-		 * just advance through the last few positions and record no
-		 * matches. */
-		if (unlikely(max_len > in_end - in_next)) {
-			max_len = in_end - in_next;
-			nice_len = min(max_len, nice_len);
-			if (max_len < BT_MATCHFINDER_REQUIRED_NBYTES) {
-				while (in_next != in_end) {
-					cache_ptr->length = 0;
-					cache_ptr++;
-					in_next++;
-				}
+				in_next++;
 			}
 		}
+	}
 
-		/* End the block if the match cache may overflow. */
-		if (unlikely(cache_ptr >= &c->match_cache[CACHE_LENGTH]))
-			goto end_block;
-
-		/* End the block if the soft maximum size has been reached. */
-		if (in_next >= in_max_block_end)
-			goto end_block;
-
-		/* End the block if the block splitting algorithm thinks this is
-		 * a good place to do so. */
-		if (c->split_stats.num_new_observations >=
-				NUM_OBSERVATIONS_PER_BLOCK_CHECK &&
-		    in_max_block_end - in_next >= MIN_BLOCK_SIZE &&
-		    lzx_should_end_block(&c->split_stats))
-			goto end_block;
-
-		/* It's not time to end the block yet.  Compute the next pause
-		 * point and resume matchfinding. */
-		next_pause_point =
-			min(in_next + min(NUM_OBSERVATIONS_PER_BLOCK_CHECK * 2 -
-					    c->split_stats.num_new_observations,
-					  in_max_block_end - in_next),
-			    in_max_block_end - min(LZX_MAX_MATCH_LEN - 1,
-						   in_max_block_end - in_next));
-		goto resume_matchfinding;
-
-	end_block:
-		/* We've decided on a block boundary and cached matches.  Now
-		 * choose a match/literal sequence and flush the block. */
-		queue = lzx_optimize_and_flush_block(c, os, in_block_begin,
-						     in_next - in_block_begin,
-						     queue, is_16_bit);
-	} while (in_next != in_end);
+	/* End the block if the match cache may overflow. */
+	if (unlikely(cache_ptr >= &cache[CACHE_LENGTH]))
+		goto end_block;
+
+	/* End the block if the soft maximum size has been reached. */
+	if (in_next >= in_max_block_end)
+		goto end_block;
+
+	/* End the block if the block splitting algorithm thinks this is
+	 * a good place to do so. */
+	if (c->split_stats.num_new_observations >=
+			NUM_OBSERVATIONS_PER_BLOCK_CHECK &&
+	    in_max_block_end - in_next >= MIN_BLOCK_SIZE &&
+	    lzx_should_end_block(&c->split_stats))
+		goto end_block;
+
+	/* It's not time to end the block yet.  Compute the next pause
+	 * point and resume matchfinding. */
+	next_pause_point =
+		min(in_next + min(NUM_OBSERVATIONS_PER_BLOCK_CHECK * 2 -
+				    c->split_stats.num_new_observations,
+				  in_max_block_end - in_next),
+		    in_max_block_end - min(LZX_MAX_MATCH_LEN - 1,
+					   in_max_block_end - in_next));
+	goto resume_matchfinding;
+
+end_block:
+	s->in_next = in_next;
+	s->max_len = max_len;
+	s->nice_len = nice_len;
+	s->next_hashes[0] = next_hashes[0];
+	s->next_hashes[1] = next_hashes[1];
+}
+
+/* A block whose matches have been found but which hasn't been flushed yet */
+struct lzx_pending_block {
+	const u8 *block_begin;
+	u32 block_size;
+	bool full;
+	bool last;
+	struct lzx_freqs freqs;
+	struct lz_match *cache;
+};
+
+/*
+ * A thread which runs the matchfinder one block ahead of the thread that calls
+ * lzx_compress().  Blocks are handed over through two slots, used alternately;
+ * slot 0 uses the compressor's own match cache.
+ */
+struct lzx_helper {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool terminate;
+	bool job_pending;
+	const u8 *job_in;
+	size_t job_in_nbytes;
+	bool job_is_16_bit;
+	struct lzx_pending_block slots[2];
+};
+
+static forceinline void
+lzx_helper_find_all_matches(struct lzx_compressor *c, struct lzx_helper *h,
+			    const u8 *in, size_t in_nbytes, bool is_16_bit)
+{
+	struct lzx_mf_state s;
+	unsigned i = 0;
+
+	lzx_init_mf_state(c, &s, in, in_nbytes, is_16_bit);
+	do {
+		struct lzx_pending_block *b = &h->slots[i];
+
+		pthread_mutex_lock(&h->lock);
+		while (b->full)
+			pthread_cond_wait(&h->cond, &h->lock);
+		pthread_mutex_unlock(&h->lock);
+
+		b->block_begin = s.in_next;
+		lzx_find_block_matches(c, &s, b->cache, &b->freqs, is_16_bit);
+		b->block_size = s.in_next - b->block_begin;
+
+		pthread_mutex_lock(&h->lock);
+		b->last = (s.in_next == s.in_end);
+		b->full = true;
+		pthread_cond_broadcast(&h->cond);
+		pthread_mutex_unlock(&h->lock);
+		i ^= 1;
+	} while (s.in_next != s.in_end);
+}
+
+static void *
+lzx_helper_thread_proc(void *arg)
+{
+	struct lzx_compressor *c = arg;
+	struct lzx_helper *h = c->helper;
+
+	pthread_mutex_lock(&h->lock);
+	for (;;) {
+		while (!h->job_pending && !h->terminate)
+			pthread_cond_wait(&h->cond, &h->lock);
+		if (h->terminate)
+			break;
+		h->job_pending = false;
+		pthread_mutex_unlock(&h->lock);
+
+		if (h->job_is_16_bit)
+			lzx_helper_find_all_matches(c, h, h->job_in,
+						    h->job_in_nbytes, true);
+		else
+			lzx_helper_find_all_matches(c, h, h->job_in,
+						    h->job_in_nbytes, false);
+
+		pthread_mutex_lock(&h->lock);
+	}
+	pthread_mutex_unlock(&h->lock);
+	return NULL;
+}
+
+static forceinline void
+lzx_compress_near_optimal(struct lzx_compressor * restrict c,
+			  const u8 * const restrict in_begin, size_t in_nbytes,
+			  struct lzx_output_bitstream * restrict os,
+			  bool is_16_bit)
+{
+	struct lzx_lru_queue queue = LZX_QUEUE_INITIALIZER;
+	struct lzx_helper *h = c->helper;
+
+	if (h && in_nbytes >= 2 * SOFT_MAX_BLOCK_SIZE) {
+		unsigned i = 0;
+		bool last;
+
+		pthread_mutex_lock(&h->lock);
+		h->job_in = in_begin;
+		h->job_in_nbytes = in_nbytes;
+		h->job_is_16_bit = is_16_bit;
+		h->job_pending = true;
+		pthread_cond_broadcast(&h->cond);
+		pthread_mutex_unlock(&h->lock);
+
+		do {
+			struct lzx_pending_block *b = &h->slots[i];
+
+			pthread_mutex_lock(&h->lock);
+			while (!b->full)
+				pthread_cond_wait(&h->cond, &h->lock);
+			pthread_mutex_unlock(&h->lock);
+
+			c->freqs = b->freqs;
+			queue = lzx_optimize_and_flush_block(c, os,
+							     b->block_begin,
+							     b->block_size,
+							     b->cache, queue,
+							     is_16_bit);
+			last = b->last;
+
+			pthread_mutex_lock(&h->lock);
+			b->full = false;
+			pthread_cond_broadcast(&h->cond);
+			pthread_mutex_unlock(&h->lock);
+			i ^= 1;
+		} while (!last);
+	} else {
+		struct lzx_mf_state s;
+
+		lzx_init_mf_state(c, &s, in_begin, in_nbytes, is_16_bit);
+		do {
+			const u8 * const in_block_begin = s.in_next;
+
+			lzx_find_block_matches(c, &s, c->match_cache,
+					       &c->freqs, is_16_bit);
+
+			/* We've decided on a block boundary and cached matches.
+			 * Now choose a match/literal sequence and flush the
+			 * block. */
+			queue = lzx_optimize_and_flush_block(c, os,
+							     in_block_begin,
+							     s.in_next -
+							     in_block_begin,
+							     c->match_cache,
+							     queue, is_16_bit);
+		} while (s.in_next != s.in_end);
+	}
 }
 
 static void
@@ -2837,6 +3030,7 @@ lzx_create_compressor(size_t max_bufsize, unsigned compression_level,
 	c->window_order = window_order;
 	c->num_main_syms = lzx_get_num_main_syms(window_order);
 	c->destructive = destructive;
+	c->helper = NULL;
 
 	/* Allocate the buffer for preprocessed data if needed. */
 	if (!c->destructive) {
@@ -2950,12 +3144,74 @@ lzx_compress(const void *restrict in, size_t in_nbytes,
 	return result;
 }
 
+/*
+ * Give a near-optimal LZX compressor a thread that finds the matches for each
+ * block while the previous block is being optimized.  This needs a second match
+ * cache.  Nothing is done for the lazy compressor, and failure is not an error;
+ * the compressor just stays single-threaded.
+ */
+static void
+lzx_start_helper_thread(void *_c)
+{
+	struct lzx_compressor *c = _c;
+	struct lzx_helper *h;
+	int ret;
+
+	if (c->impl != lzx_compress_near_optimal_16 &&
+	    c->impl != lzx_compress_near_optimal_32)
+		return;
+	if (c->helper)
+		return;
+
+	h = CALLOC(1, sizeof(*h));
+	if (!h)
+		return;
+	h->slots[0].cache = c->match_cache;
+	h->slots[1].cache = MALLOC(sizeof(c->match_cache));
+	if (!h->slots[1].cache)
+		goto err_free_helper;
+	if (pthread_mutex_init(&h->lock, NULL))
+		goto err_free_cache;
+	if (pthread_cond_init(&h->cond, NULL))
+		goto err_destroy_lock;
+	c->helper = h;
+	ret = pthread_create(&h->thread, NULL, lzx_helper_thread_proc, c);
+	if (ret) {
+		errno = ret;
+		WARNING_WITH_ERRNO("Failed to create LZX matchfinding thread");
+		c->helper = NULL;
+		goto err_destroy_cond;
+	}
+	return;
+
+err_destroy_cond:
+	pthread_cond_destroy(&h->cond);
+err_destroy_lock:
+	pthread_mutex_destroy(&h->lock);
+err_free_cache:
+	FREE(h->slots[1].cache);
+err_free_helper:
+	FREE(h);
+}
+
 /* Free an LZX compressor. */
 static void
 lzx_free_compressor(void *_c)
 {
 	struct lzx_compressor *c = _c;
-
+	struct lzx_helper *h = c->helper;
+
+	if (h) {
+		pthread_mutex_lock(&h->lock);
+		h->terminate = true;
+		pthread_cond_broadcast(&h->cond);
+		pthread_mutex_unlock(&h->lock);
+		pthread_join(h->thread, NULL);
+		pthread_cond_destroy(&h->cond);
+		pthread_mutex_destroy(&h->lock);
+		FREE(h->slots[1].cache);
+		FREE(h);
+	}
 	if (!c->destructive)
 		FREE(c->in_buffer);
 	FREE(c);
@@ -2966,4 +3222,5 @@ const struct compressor_ops lzx_compressor_ops = {
 	.create_compressor  = lzx_create_compressor,
 	.compress	    = lzx_compress,
 	.free_compressor    = lzx_free_compressor,
+	.start_helper_thread = lzx_start_helper_thread,
 };
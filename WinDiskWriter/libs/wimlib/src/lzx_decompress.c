@@ -74,6 +74,7 @@ struct lzx_decompressor {
 
 	DECODE_TABLE(maincode_decode_table, LZX_MAINCODE_MAX_NUM_SYMBOLS,
 		     LZX_MAINCODE_TABLEBITS, LZX_MAX_MAIN_CODEWORD_LEN);
+	MULTI_LITERAL_TABLE(maincode_literal_table, LZX_MAINCODE_TABLEBITS);
 	u8 maincode_lens[LZX_MAINCODE_MAX_NUM_SYMBOLS + LZX_READ_LENS_MAX_OVERRUN];
 
 	DECODE_TABLE(lencode_decode_table, LZX_LENCODE_NUM_SYMBOLS,
@@ -108,6 +109,17 @@ struct lzx_decompressor {
 					   LZX_MAX_PRE_CODEWORD_LEN);
 	};
 
+	/* The codeword lengths the main and length decode tables were last
+	 * built from.  A block whose codes are unchanged from the previous
+	 * block's can reuse the tables.  */
+	u8 maincode_table_lens[LZX_MAINCODE_MAX_NUM_SYMBOLS];
+	u8 lencode_table_lens[LZX_LENCODE_NUM_SYMBOLS];
+	bool maincode_table_valid;
+	bool lencode_table_valid;
+
+	/* Whether the main code is decoded with 'maincode_literal_table'  */
+	bool use_maincode_literal_table;
+
 	unsigned window_order;
 	unsigned num_main_syms;
 
@@ -125,14 +137,6 @@ read_presym(const struct lzx_decompressor *d, struct input_bitstream *is)
 			    LZX_PRECODE_TABLEBITS, LZX_MAX_PRE_CODEWORD_LEN);
 }
 
-/* Read a Huffman-encoded symbol using the main code. */
-static forceinline unsigned
-read_mainsym(const struct lzx_decompressor *d, struct input_bitstream *is)
-{
-	return read_huffsym(is, d->maincode_decode_table,
-			    LZX_MAINCODE_TABLEBITS, LZX_MAX_MAIN_CODEWORD_LEN);
-}
-
 /* Read a Huffman-encoded symbol using the length code. */
 static forceinline unsigned
 read_lensym(const struct lzx_decompressor *d, struct input_bitstream *is)
@@ -347,28 +351,54 @@ lzx_decompress_block(struct lzx_decompressor *d, struct input_bitstream *_is,
 	struct input_bitstream *is = &is_onstack;
 	u8 * const block_end = out_next + block_size;
 	unsigned min_aligned_offset_slot;
+	bool use_literal_table;
 
 	/*
-	 * Build the Huffman decode tables.  We always need to build the main
-	 * and length decode tables.  For aligned blocks we additionally need to
+	 * Build the Huffman decode tables.  We always need the main and length
+	 * decode tables, but they are only rebuilt if their codes changed
+	 * since the previous block.  For aligned blocks we additionally need to
 	 * build the aligned offset decode table.
 	 */
 
-	if (make_huffman_decode_table(d->maincode_decode_table,
-				      d->num_main_syms,
-				      LZX_MAINCODE_TABLEBITS,
-				      d->maincode_lens,
-				      LZX_MAX_MAIN_CODEWORD_LEN,
-				      d->maincode_working_space))
-		return -1;
+	if (!d->maincode_table_valid ||
+	    memcmp(d->maincode_table_lens, d->maincode_lens, d->num_main_syms))
+	{
+		d->maincode_table_valid = false;
+		if (make_huffman_decode_table(d->maincode_decode_table,
+					      d->num_main_syms,
+					      LZX_MAINCODE_TABLEBITS,
+					      d->maincode_lens,
+					      LZX_MAX_MAIN_CODEWORD_LEN,
+					      d->maincode_working_space))
+			return -1;
+		d->use_maincode_literal_table =
+			multi_literal_table_pays_off(d->maincode_lens,
+						     LZX_MAINCODE_TABLEBITS);
+		if (d->use_maincode_literal_table)
+			make_multi_literal_table(d->maincode_literal_table,
+						 d->maincode_decode_table,
+						 LZX_MAINCODE_TABLEBITS);
+		memcpy(d->maincode_table_lens, d->maincode_lens,
+		       d->num_main_syms);
+		d->maincode_table_valid = true;
+	}
 
-	if (make_huffman_decode_table(d->lencode_decode_table,
-				      LZX_LENCODE_NUM_SYMBOLS,
-				      LZX_LENCODE_TABLEBITS,
-				      d->lencode_lens,
-				      LZX_MAX_LEN_CODEWORD_LEN,
-				      d->lencode_working_space))
-		return -1;
+	if (!d->lencode_table_valid ||
+	    memcmp(d->lencode_table_lens, d->lencode_lens,
+		   LZX_LENCODE_NUM_SYMBOLS))
+	{
+		d->lencode_table_valid = false;
+		if (make_huffman_decode_table(d->lencode_decode_table,
+					      LZX_LENCODE_NUM_SYMBOLS,
+					      LZX_LENCODE_TABLEBITS,
+					      d->lencode_lens,
+					      LZX_MAX_LEN_CODEWORD_LEN,
+					      d->lencode_working_space))
+			return -1;
+		memcpy(d->lencode_table_lens, d->lencode_lens,
+		       LZX_LENCODE_NUM_SYMBOLS);
+		d->lencode_table_valid = true;
+	}
 
 	if (block_type == LZX_BLOCKTYPE_ALIGNED) {
 		if (make_huffman_decode_table(d->alignedcode_decode_table,
@@ -389,13 +419,34 @@ lzx_decompress_block(struct lzx_decompressor *d, struct input_bitstream *_is,
 
 	/* Decode the literals and matches. */
 
+	use_literal_table = d->use_maincode_literal_table;
 	do {
+		u32 entry;
 		unsigned mainsym;
 		unsigned length;
 		u32 offset;
 		unsigned offset_slot;
 
-		mainsym = read_mainsym(d, is);
+		/* If the next codeword is for a literal, decode it, and the
+		 * literal after it if that fits in the same table lookup.
+		 * Otherwise decode one main symbol the usual way.  */
+		bitstream_ensure_bits(is, LZX_MAX_MAIN_CODEWORD_LEN);
+		if (use_literal_table) {
+			entry = d->maincode_literal_table[
+				bitstream_peek_bits(is, LZX_MAINCODE_TABLEBITS)];
+			if (entry & MULTI_LITERAL_FLAG) {
+				out_next = write_multi_literal(is, entry,
+							       out_next,
+							       block_end);
+				continue;
+			}
+		} else {
+			entry = d->maincode_decode_table[
+				bitstream_peek_bits(is, LZX_MAINCODE_TABLEBITS)];
+		}
+		mainsym = decode_huffsym_entry(is, d->maincode_decode_table,
+					       entry, LZX_MAINCODE_TABLEBITS,
+					       LZX_MAX_MAIN_CODEWORD_LEN);
 		if (mainsym < LZX_NUM_CHARS) {
 			/* Literal */
 			*out_next++ = mainsym;
@@ -531,6 +582,8 @@ lzx_create_decompressor(size_t max_block_size, void **d_ret)
 
 	d->window_order = window_order;
 	d->num_main_syms = lzx_get_num_main_syms(window_order);
+	d->maincode_table_valid = false;
+	d->lencode_table_valid = false;
 
 	/* Initialize 'd->extra_offset_bits_minus_aligned'. */
 	STATIC_ASSERT(sizeof(d->extra_offset_bits_minus_aligned) ==
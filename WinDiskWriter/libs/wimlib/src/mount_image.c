@@ -167,6 +167,11 @@ struct wimfs_context {
 	/* Number of file descriptors open to the mounted WIM image.  */
 	unsigned long num_open_fds;
 
+	/* Protects the file descriptor tables of the inodes and the counts of
+	 * open file descriptors.  These are the only state that changes in a
+	 * read-only mount, which is served on multiple threads.  */
+	pthread_mutex_t fd_lock;
+
 	/* For read-write mounts, the original metadata resource of the mounted
 	 * image.  */
 	struct blob_descriptor *metadata_resource;
@@ -189,18 +194,6 @@ wimfs_get_context(void)
 	return WIMFS_CTX(fuse_get_context());
 }
 
-static void
-wimfs_inc_num_open_fds(void)
-{
-	wimfs_get_context()->num_open_fds++;
-}
-
-static void
-wimfs_dec_num_open_fds(void)
-{
-	wimfs_get_context()->num_open_fds--;
-}
-
 /* Retrieve the WIMStruct for the currently mounted WIM image.  */
 static inline WIMStruct *
 wimfs_get_WIMStruct(void)
@@ -238,9 +231,10 @@ fuse_mask_mode(mode_t mode, const struct fuse_context *fuse_ctx)
  * Returns 0 or a -errno code.
  */
 static int
-alloc_wimfs_fd(struct wim_inode *inode,
-	       struct wim_inode_stream *strm,
-	       struct wimfs_fd **fd_ret)
+alloc_wimfs_fd_locked(struct wimfs_context *ctx,
+		      struct wim_inode *inode,
+		      struct wim_inode_stream *strm,
+		      struct wimfs_fd **fd_ret)
 {
 	static const u16 min_fds_per_alloc = 8;
 	static const u16 max_fds = 0xffff;
@@ -296,22 +290,38 @@ alloc_wimfs_fd(struct wim_inode *inode,
 	inode->i_num_opened_fds++;
 	if (fd->f_blob)
 		fd->f_blob->num_opened_fds++;
-	wimfs_inc_num_open_fds();
+	ctx->num_open_fds++;
 	inode->i_next_fd = i + 1;
 	return 0;
 }
 
+static int
+alloc_wimfs_fd(struct wim_inode *inode,
+	       struct wim_inode_stream *strm,
+	       struct wimfs_fd **fd_ret)
+{
+	struct wimfs_context *ctx = wimfs_get_context();
+	int ret;
+
+	pthread_mutex_lock(&ctx->fd_lock);
+	ret = alloc_wimfs_fd_locked(ctx, inode, strm, fd_ret);
+	pthread_mutex_unlock(&ctx->fd_lock);
+	return ret;
+}
+
 /*
  * Close a file descriptor to a data stream in the mounted WIM image.
  *
  * Returns 0 or a -errno code.  The file descriptor is always closed.
  */
 static int
-close_wimfs_fd(struct wimfs_fd *fd)
+close_wimfs_fd(struct wimfs_context *ctx, struct wimfs_fd *fd)
 {
 	int ret = 0;
 	struct wim_inode *inode;
 
+	pthread_mutex_lock(&ctx->fd_lock);
+
 	/* Close the staging file if open.  */
 	if (filedes_valid(&fd->f_staging_fd))
 		 if (filedes_close(&fd->f_staging_fd))
@@ -321,7 +331,7 @@ close_wimfs_fd(struct wimfs_fd *fd)
 	if (fd->f_blob)
 		blob_decrement_num_opened_fds(fd->f_blob);
 
-	wimfs_dec_num_open_fds();
+	ctx->num_open_fds--;
 
 	/* Release this file descriptor from its inode.  */
 	inode = fd->f_inode;
@@ -330,6 +340,7 @@ close_wimfs_fd(struct wimfs_fd *fd)
 		inode->i_next_fd = fd->f_idx;
 	FREE(fd);
 	inode_dec_num_opened_fds(inode);
+	pthread_mutex_unlock(&ctx->fd_lock);
 	return ret;
 }
 
@@ -699,6 +710,11 @@ retry:
  *	of the blob will be extracted.  It may also be more than the actual blob
  *	length, in which case the extra space will be zero-filled.
  *
+ * If the blob is located in a WIM file, its data isn't actually copied here.
+ * Instead the staging file is created with the full size but no data, and the
+ * original blob is remembered as its staging base.  Chunks of the original data
+ * are then copied into the staging file only as they're modified.
+ *
  * Returns 0 or a -errno code.
  */
 static int
@@ -708,6 +724,7 @@ extract_blob_to_staging_dir(struct wim_inode *inode,
 {
 	struct blob_descriptor *old_blob;
 	struct blob_descriptor *new_blob;
+	struct staging_base *base = NULL;
 	char *staging_file_name;
 	int staging_fd;
 	off_t extract_size;
@@ -722,7 +739,18 @@ extract_blob_to_staging_dir(struct wim_inode *inode,
 		return -errno;
 
 	/* Extract the stream to the staging file (possibly truncated).  */
-	if (old_blob) {
+	if (old_blob && old_blob->blob_location == BLOB_IN_WIM) {
+		extract_size = 0;
+		result = 0;
+		if (min(old_blob->size, size)) {
+			base = new_staging_base(old_blob,
+						min(old_blob->size, size));
+			if (!base) {
+				errno = ENOMEM;
+				result = -1;
+			}
+		}
+	} else if (old_blob) {
 		struct filedes fd;
 
 		filedes_init(&fd, staging_fd);
@@ -793,6 +821,7 @@ extract_blob_to_staging_dir(struct wim_inode *inode,
 	new_blob->blob_location     = BLOB_IN_STAGING_FILE;
 	new_blob->staging_file_name = staging_file_name;
 	new_blob->staging_dir_fd    = ctx->staging_dir_fd;
+	new_blob->staging_base      = base;
 	new_blob->size              = size;
 
 	prepare_unhashed_blob(new_blob, inode, strm->stream_id,
@@ -814,11 +843,99 @@ out_revert_fd_changes:
 	}
 	free_blob_descriptor(new_blob);
 out_delete_staging_file:
+	free_staging_base(base);
 	unlinkat(ctx->staging_dir_fd, staging_file_name, 0);
 	FREE(staging_file_name);
 	return ret;
 }
 
+/*
+ * Copy the data of the staging base of @blob in the range [@start, @end), which
+ * must be within a single chunk, into the staging file @raw_fd.
+ *
+ * Returns 0 or a -errno code.
+ */
+static int
+copy_from_staging_base(int raw_fd, const struct blob_descriptor *blob,
+		       u64 start, u64 end)
+{
+	u8 buf[STAGING_CHUNK_SIZE];
+	ssize_t ret;
+
+	if (start >= end)
+		return 0;
+	if (read_partial_wim_blob_into_buf(blob->staging_base->blob, start,
+					   end - start, buf))
+		return errno ? -errno : -EIO;
+	ret = pwrite(raw_fd, buf, end - start, start);
+	if (ret < 0)
+		return -errno;
+	if (ret != end - start)
+		return -EIO;
+	return 0;
+}
+
+/*
+ * Prepare to write the range [@start, @end) of the staged data of @blob by
+ * copying, into the staging file @raw_fd, the original data of the parts of the
+ * first and last chunks touched by the write that lie outside the range.  The
+ * chunks in between will be entirely overwritten.
+ *
+ * Returns 0 or a -errno code.
+ */
+static int
+copy_staging_edges(int raw_fd, const struct blob_descriptor *blob,
+		   u64 start, u64 end)
+{
+	u64 ranges[2][2];
+	unsigned num_ranges;
+	int ret;
+
+	num_ranges = staging_edges_to_copy(blob->staging_base, start, end,
+					   ranges);
+	for (unsigned i = 0; i < num_ranges; i++) {
+		ret = copy_from_staging_base(raw_fd, blob, ranges[i][0],
+					     ranges[i][1]);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
+/* Read staged data of a blob which has a staging base, taking each part from
+ * either the staging file or the original blob.  */
+static ssize_t
+staging_pread(struct wimfs_fd *fd, char *buf, size_t size, off_t offset)
+{
+	const struct blob_descriptor *blob = fd->f_blob;
+	size_t done = 0;
+
+	while (done < size) {
+		bool in_staging_file;
+		u64 len;
+		ssize_t ret;
+
+		len = staging_data_run(blob->staging_base, offset + done,
+				       offset + size, &in_staging_file);
+		if (in_staging_file) {
+			ret = pread(fd->f_staging_fd.fd, buf + done, len,
+				    offset + done);
+			if (ret < 0)
+				return -errno;
+			if (ret == 0)
+				break;
+			done += ret;
+		} else {
+			if (read_partial_wim_blob_into_buf(blob->staging_base->blob,
+							   offset + done, len,
+							   buf + done))
+				return errno ? -errno : -EIO;
+			done += len;
+		}
+	}
+	return done;
+}
+
 /*
  * Create the staging directory for the WIM file.
  *
@@ -967,6 +1084,65 @@ prepare_inodes(struct wimfs_context *ctx)
 	}
 }
 
+/* Call @func on each WIMStruct containing data of the mounted image.  */
+static void
+for_each_data_wim(struct wimfs_context *ctx, void (*func)(WIMStruct *))
+{
+	struct wim_image_metadata *imd;
+	struct wim_inode *inode;
+	WIMStruct *prev_wim = ctx->wim;
+
+	func(ctx->wim);
+	imd = wim_get_current_image_metadata(ctx->wim);
+	image_for_each_inode(inode, imd) {
+		for (unsigned i = 0; i < inode->i_num_streams; i++) {
+			const struct wim_inode_stream *strm =
+					&inode->i_streams[i];
+			const struct blob_descriptor *blob;
+
+			if (!strm->stream_resolved)
+				continue;
+			blob = stream_blob_resolved(strm);
+			if (blob && blob->blob_location == BLOB_IN_WIM &&
+			    blob->rdesc->wim != prev_wim)
+			{
+				prev_wim = blob->rdesc->wim;
+				func(prev_wim);
+			}
+		}
+	}
+}
+
+/*
+ * Prepare a read-only mounted image to be accessed on multiple threads.
+ *
+ * Path lookups don't take any locks, since the directory tree of a read-only
+ * mount never changes.  But looking up a file resolves its streams and may add
+ * an empty unnamed data stream to it, so do that for all files now.  Then set
+ * up the WIM files containing the data for concurrent reads, which gives each
+ * thread its own decompressors.
+ */
+static int
+prepare_concurrent_access(struct wimfs_context *ctx)
+{
+	struct wim_image_metadata *imd;
+	struct wim_inode *inode;
+
+	imd = wim_get_current_image_metadata(ctx->wim);
+	image_for_each_inode(inode, imd) {
+		if (!inode_get_unnamed_data_stream(inode) &&
+		    !inode_add_stream(inode, STREAM_TYPE_DATA,
+				      NO_STREAM_NAME, NULL))
+			return WIMLIB_ERR_NOMEM;
+
+		/* If a blob is missing, the error is reported when the file is
+		 * accessed.  */
+		inode_resolve_streams(inode, ctx->wim->blob_table, false);
+	}
+	for_each_data_wim(ctx, wim_begin_concurrent_reads);
+	return 0;
+}
+
 /* Delete the 'struct blob_descriptor' for any stream that was modified
  * or created in the read-write mounted image and had a final size of 0.  */
 static void
@@ -990,12 +1166,12 @@ delete_empty_blobs(struct wimfs_context *ctx)
  *
  * Note: closing the last file descriptor might free the inode.  */
 static void
-inode_close_fds(struct wim_inode *inode)
+inode_close_fds(struct wimfs_context *ctx, struct wim_inode *inode)
 {
 	u16 num_open_fds = inode->i_num_opened_fds;
 	for (u16 i = 0; num_open_fds; i++) {
 		if (inode->i_fds[i]) {
-			close_wimfs_fd(inode->i_fds[i]);
+			close_wimfs_fd(ctx, inode->i_fds[i]);
 			num_open_fds--;
 		}
 	}
@@ -1012,7 +1188,7 @@ close_all_fds(struct wimfs_context *ctx)
 	imd = wim_get_current_image_metadata(ctx->wim);
 
 	image_for_each_inode_safe(inode, tmp, imd)
-		inode_close_fds(inode);
+		inode_close_fds(ctx, inode);
 }
 
 /* Moves the currently selected image, which may have been modified, to a new
@@ -1147,9 +1323,13 @@ unmount_wimfs(void)
 	mqd_t mq = (mqd_t)-1;
 	int ret;
 
-	/* Ignore COMMIT if the image is mounted read-only.  */
-	if (!(wimfs_ctx->mount_flags & WIMLIB_MOUNT_FLAG_READWRITE))
-		unmount_flags &= ~WIMLIB_UNMOUNT_FLAG_COMMIT;
+	/* A read-only mount has nothing to commit.  Leave its file descriptors
+	 * open, since other threads may still be reading through them;
+	 * wimlib_mount_image() closes them once the FUSE loop has exited.  */
+	if (!(wimfs_ctx->mount_flags & WIMLIB_MOUNT_FLAG_READWRITE)) {
+		ret = 0;
+		goto out;
+	}
 
 	if (unmount_flags & WIMLIB_UNMOUNT_FLAG_SEND_PROGRESS) {
 		mq = mq_open(info->mq_name, O_WRONLY | O_NONBLOCK);
@@ -1180,8 +1360,7 @@ unmount_wimfs(void)
 	if (unmount_flags & WIMLIB_UNMOUNT_FLAG_COMMIT)
 		ret = commit_image(wimfs_ctx, unmount_flags, mq);
 	else
-		ret = 0;  /* Read-only mount, or discarding changes to
-			     a read-write mount  */
+		ret = 0;  /* Discarding changes to a read-write mount  */
 
 out:
 	/* Leave the image mounted if commit failed, unless this is a
@@ -1274,6 +1453,9 @@ wimfs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
 		return -errno;
 	touch_inode(fd->f_inode);
 	fd->f_blob->size = size;
+	if (fd->f_blob->staging_base)
+		fd->f_blob->staging_base->size =
+			min(fd->f_blob->staging_base->size, size);
 	return 0;
 }
 
@@ -1607,8 +1789,9 @@ wimfs_open(const char *path, struct fuse_file_info *fi)
 		raw_fd = openat(blob->staging_dir_fd, blob->staging_file_name,
 				(fi->flags & O_ACCMODE) | O_NOFOLLOW);
 		if (raw_fd < 0) {
-			close_wimfs_fd(fd);
-			return -errno;
+			ret = -errno;
+			close_wimfs_fd(ctx, fd);
+			return ret;
 		}
 		filedes_init(&fd->f_staging_fd, raw_fd);
 	}
@@ -1669,6 +1852,10 @@ wimfs_read(const char *path, char *buf, size_t size,
 			ret = size;
 		break;
 	case BLOB_IN_STAGING_FILE:
+		if (blob->staging_base) {
+			ret = staging_pread(fd, buf, size, offset);
+			break;
+		}
 		ret = pread(fd->f_staging_fd.fd, buf, size, offset);
 		if (ret < 0)
 			ret = -errno;
@@ -1744,7 +1931,7 @@ wimfs_readlink(const char *path, char *buf, size_t bufsize)
 static int
 wimfs_release(const char *path, struct fuse_file_info *fi)
 {
-	return close_wimfs_fd(WIMFS_FD(fi));
+	return close_wimfs_fd(wimfs_get_context(), WIMFS_FD(fi));
 }
 
 static int
@@ -1945,6 +2132,8 @@ wimfs_truncate(const char *path, off_t size)
 	if (close(fd) || ret)
 		return -errno;
 	blob->size = size;
+	if (blob->staging_base)
+		blob->staging_base->size = min(blob->staging_base->size, size);
 	touch_inode(dentry->d_inode);
 	return 0;
 }
@@ -2023,14 +2212,37 @@ wimfs_write(const char *path, const char *buf, size_t size,
 	    off_t offset, struct fuse_file_info *fi)
 {
 	struct wimfs_fd *fd = WIMFS_FD(fi);
+	struct staging_base *base = fd->f_blob->staging_base;
 	ssize_t ret;
 
+	/* If the staging file doesn't yet contain all the original data of the
+	 * chunks being written to, copy the rest of those chunks first.  */
+	if (base && size) {
+		ret = copy_staging_edges(fd->f_staging_fd.fd, fd->f_blob,
+					 offset, offset + size);
+		if (ret)
+			return ret;
+	}
+
 	ret = pwrite(fd->f_staging_fd.fd, buf, size, offset);
 	if (ret < 0)
 		return -errno;
 
-	if (offset + size > fd->f_blob->size)
-		fd->f_blob->size = offset + size;
+	if (base && ret) {
+		/* On a short write, the last chunk written to needs the rest
+		 * of its original data too.  */
+		if (ret < size) {
+			int ret2 = copy_staging_edges(fd->f_staging_fd.fd,
+						      fd->f_blob, offset,
+						      offset + ret);
+			if (ret2)
+				return ret2;
+		}
+		staging_mark_written(base, offset, offset + ret);
+	}
+
+	if (offset + ret > fd->f_blob->size)
+		fd->f_blob->size = offset + ret;
 
 	touch_inode(fd->f_inode);
 	return ret;
@@ -2149,6 +2361,13 @@ wimlib_mount_image(WIMStruct *wim, int image, const char *dir,
 
 	/* Start initializing the wimfs_context.  */
 	memset(&ctx, 0, sizeof(struct wimfs_context));
+	ret = pthread_mutex_init(&ctx.fd_lock, NULL);
+	if (ret) {
+		errno = ret;
+		ERROR_WITH_ERRNO("Failed to initialize mutex");
+		unlock_wim_for_append(wim);
+		return WIMLIB_ERR_NOMEM;
+	}
 	ctx.wim = wim;
 	ctx.mount_flags = mount_flags;
 	if (mount_flags & WIMLIB_MOUNT_FLAG_STREAM_INTERFACE_WINDOWS)
@@ -2174,6 +2393,12 @@ wimlib_mount_image(WIMStruct *wim, int image, const char *dir,
 	 * the file descriptor arrays  */
 	prepare_inodes(&ctx);
 
+	if (!(mount_flags & WIMLIB_MOUNT_FLAG_READWRITE)) {
+		ret = prepare_concurrent_access(&ctx);
+		if (ret)
+			goto out;
+	}
+
 	/* Save the absolute path to the mountpoint directory.  */
 	ctx.mountpoint_abspath = realpath(dir, NULL);
 	if (ctx.mountpoint_abspath)
@@ -2185,8 +2410,12 @@ wimlib_mount_image(WIMStruct *wim, int image, const char *dir,
 	fuse_argv[fuse_argc++] = "wimlib";
 	fuse_argv[fuse_argc++] = (char *)dir;
 
-	/* Disable multi-threaded operation.  */
-	fuse_argv[fuse_argc++] = "-s";
+	/* Disable multi-threaded operation for read-write mounts, whose
+	 * operations modify the image.  Read-only mounts are safe to serve on
+	 * multiple threads (see prepare_concurrent_access()), which lets
+	 * parallel readers of the mounted files decompress data in parallel.  */
+	if (mount_flags & WIMLIB_MOUNT_FLAG_READWRITE)
+		fuse_argv[fuse_argc++] = "-s";
 
 	/* Enable FUSE debug mode (don't fork) if requested by the user.  */
 	if (mount_flags & WIMLIB_MOUNT_FLAG_DEBUG)
@@ -2264,12 +2493,18 @@ wimlib_mount_image(WIMStruct *wim, int image, const char *dir,
 	/* Cleanup and return.  */
 	if (ret)
 		ret = WIMLIB_ERR_FUSE;
+	if (!(mount_flags & WIMLIB_MOUNT_FLAG_READWRITE)) {
+		/* All the FUSE threads have exited now.  */
+		close_all_fds(&ctx);
+		for_each_data_wim(&ctx, wim_end_concurrent_reads);
+	}
 out:
 	FREE(ctx.mountpoint_abspath);
 	free_blob_descriptor(ctx.metadata_resource);
 	if (ctx.staging_dir_name)
 		delete_staging_dir(&ctx);
 	unlock_wim_for_append(wim);
+	pthread_mutex_destroy(&ctx.fd_lock);
 	return ret;
 }
 
@@ -27,18 +27,22 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include "alloca.h"
 #include "assert.h"
 #include "bitops.h"
 #include "blob_table.h"
+#include "decompressed_chunk_cache.h"
+#include "chunk_decompressor.h"
 #include "endianness.h"
 #include "error.h"
 #include "file_io.h"
 #include "ntfs_3g.h"
 #include "resource.h"
 #include "sha1.h"
+#include "sha1_parallel.h"
 #include "wim.h"
 #include "win32.h"
 
@@ -83,7 +87,37 @@ struct data_range {
 	u64 size;
 };
 
-static int
+/* Position in the array of data ranges being read from a compressed resource.
+ */
+struct range_cursor {
+	const struct data_range *cur_range;
+	const struct data_range *end_range;
+	u64 cur_range_pos;
+	u64 cur_range_end;
+};
+
+/* Don't bother decompressing in parallel unless the chunks being read contain
+ * at least this many bytes of uncompressed data.  */
+#define MIN_PARALLEL_DECOMPRESSION_SIZE 262144
+
+/* Amount of data, in bytes, that is kept prefetched ahead of the position from
+ * which data is being read from the WIM file.  Prefetching is refreshed when
+ * less than half of this remains.  */
+#define PREFETCH_WINDOW_SIZE (8 << 20)
+
+/* When prefetching the resources of a list of blobs, resources separated by no
+ * more than this many bytes are prefetched together.  */
+#define PREFETCH_MAX_GAP 65536
+
+/* When reading a list of blobs with hashing enabled, blobs at least this large
+ * are hashed on another thread, concurrently with the rest of the reading.
+ * Smaller blobs are hashed inline, since waiting for the other thread would
+ * cost more than it saves.  */
+#define MIN_PARALLEL_SHA1_SIZE 1048576
+
+/* Decompress a chunk of a compressed WIM resource.  This may be called from
+ * any thread, as long as @decompressor is not shared with another thread.  */
+int
 decompress_chunk(const void *cbuf, u32 chunk_csize, u8 *ubuf, u32 chunk_usize,
 		 struct wimlib_decompressor *decompressor, bool recover_data)
 {
@@ -111,6 +145,256 @@ decompress_chunk(const void *cbuf, u32 chunk_csize, u8 *ubuf, u32 chunk_usize,
 	return WIMLIB_ERR_DECOMPRESSION;
 }
 
+/* Return true if any of the remaining data ranges overlaps the chunk which
+ * spans [@chunk_start_offset, @chunk_end_offset) in the uncompressed resource,
+ * first skipping any ranges which end before the chunk.  */
+static bool
+chunk_is_needed(struct range_cursor *cursor,
+		u64 chunk_start_offset, u64 chunk_end_offset)
+{
+	while (cursor->cur_range != cursor->end_range &&
+	       cursor->cur_range->offset + cursor->cur_range->size <=
+			chunk_start_offset)
+		cursor->cur_range++;
+
+	return cursor->cur_range != cursor->end_range &&
+	       cursor->cur_range->offset < chunk_end_offset;
+}
+
+/* Pass the data of an uncompressed chunk which is covered by the data ranges to
+ * the callback, advancing the cursor.  At least one of the remaining ranges
+ * must require data in this chunk.  */
+static int
+consume_needed_chunk_data(struct range_cursor *cursor, const u8 *ubuf,
+			  u64 chunk_start_offset, u32 chunk_usize,
+			  const struct consume_chunk_callback *cb)
+{
+	const u64 chunk_end_offset = chunk_start_offset + chunk_usize;
+	int ret;
+
+	do {
+		size_t start, end, size;
+
+		/* Calculate how many bytes of data should be sent to the
+		 * callback function, taking into account that data sent to the
+		 * callback function must not overlap range boundaries.  */
+		start = cursor->cur_range_pos - chunk_start_offset;
+		end = min(cursor->cur_range_end, chunk_end_offset) - chunk_start_offset;
+		size = end - start;
+
+		ret = consume_chunk(cb, &ubuf[start], size);
+		if (unlikely(ret))
+			return ret;
+
+		cursor->cur_range_pos += size;
+		if (cursor->cur_range_pos == cursor->cur_range_end) {
+			/* Advance to next range.  */
+			if (++cursor->cur_range == cursor->end_range) {
+				cursor->cur_range_pos = ~0ULL;
+			} else {
+				cursor->cur_range_pos = cursor->cur_range->offset;
+				cursor->cur_range_end = cursor->cur_range->offset +
+							cursor->cur_range->size;
+			}
+		}
+	} while (cursor->cur_range_pos < chunk_end_offset);
+
+	return 0;
+}
+
+/* Pass chunks which have been decompressed by the parallel chunk decompressor
+ * to the callback, in order.  If @all is false, stop after one chunk, which
+ * frees a buffer for reading the next chunk into.  Only needed chunks are ever
+ * submitted, so each chunk is the one containing the cursor's position.  */
+static int
+consume_decompressed_chunks(struct chunk_decompressor *chunk_decompressor,
+			    struct range_cursor *cursor,
+			    const struct consume_chunk_callback *cb, bool all)
+{
+	const u64 chunk_mask = (u64)chunk_decompressor->chunk_size - 1;
+	const void *udata;
+	u32 usize;
+	int ret;
+
+	while (chunk_decompressor->get_decompression_result(chunk_decompressor,
+							    &udata, &usize,
+							    &ret))
+	{
+		if (unlikely(ret)) {
+			errno = EINVAL;
+			return ret;
+		}
+		ret = consume_needed_chunk_data(cursor, udata,
+						cursor->cur_range_pos & ~chunk_mask,
+						usize, cb);
+		if (unlikely(ret))
+			return ret;
+		if (!all)
+			break;
+	}
+	return 0;
+}
+
+/* Borrow the WIM's cached parallel chunk decompressor, creating a new one if
+ * there is none for this compression type and chunk size.  Returns NULL if the
+ * chunks should be decompressed on the calling thread instead.  */
+static struct chunk_decompressor *
+get_chunk_decompressor(WIMStruct *wim, int ctype, u32 chunk_size)
+{
+	struct chunk_decompressor *chunk_decompressor = wim->chunk_decompressor;
+	int ret;
+
+	if (wim->num_decompression_threads == 1 || wim->concurrent_reads)
+		return NULL;
+
+	if (chunk_decompressor &&
+	    chunk_decompressor->ctype == ctype &&
+	    chunk_decompressor->chunk_size == chunk_size)
+	{
+		wim->chunk_decompressor = NULL;
+		return chunk_decompressor;
+	}
+
+	ret = new_parallel_chunk_decompressor(ctype, chunk_size,
+					      wim->num_decompression_threads,
+					      0, &chunk_decompressor);
+	if (ret > 0) {
+		WARNING("Couldn't create parallel chunk decompressor: %"TS".\n"
+			"          Falling back to single-threaded decompression.",
+			wimlib_get_error_string(ret));
+	}
+	if (ret)
+		return NULL;
+	return chunk_decompressor;
+}
+
+/* Parallel chunk decompressors whose buffers are larger than this aren't
+ * cached.  Those for the large chunks of solid resources are sized to use up to
+ * a quarter of the available memory, which shouldn't stay allocated for as long
+ * as the WIM is open.  */
+#define MAX_CACHED_CHUNK_DECOMPRESSOR_SIZE	(16 << 20)
+
+/* Return a chunk decompressor to the WIM's cache, replacing any other one, or
+ * free it if it's too large to cache.  */
+static void
+put_chunk_decompressor(WIMStruct *wim,
+		       struct chunk_decompressor *chunk_decompressor)
+{
+	if (chunk_decompressor->buffer_size > MAX_CACHED_CHUNK_DECOMPRESSOR_SIZE) {
+		chunk_decompressor->destroy(chunk_decompressor);
+		return;
+	}
+	if (wim->chunk_decompressor)
+		wim->chunk_decompressor->destroy(wim->chunk_decompressor);
+	wim->chunk_decompressor = chunk_decompressor;
+}
+
+/* The decompressor kept by a thread that reads from WIM files being read on
+ * several threads at once (see WIMStruct.concurrent_reads).  It is freed when
+ * the thread exits.  */
+struct thread_decompressor {
+	struct wimlib_decompressor *decompressor;
+	u8 ctype;
+	u32 max_block_size;
+};
+
+static pthread_key_t thread_decompressor_key;
+static pthread_once_t thread_decompressor_key_once = PTHREAD_ONCE_INIT;
+static bool thread_decompressor_key_valid;
+
+static void
+free_thread_decompressor(void *_td)
+{
+	struct thread_decompressor *td = _td;
+
+	wimlib_free_decompressor(td->decompressor);
+	FREE(td);
+}
+
+static void
+create_thread_decompressor_key(void)
+{
+	thread_decompressor_key_valid =
+		!pthread_key_create(&thread_decompressor_key,
+				    free_thread_decompressor);
+}
+
+/* Return the calling thread's decompressor slot, or NULL if it couldn't be
+ * allocated (in which case decompressors just aren't reused).  */
+static struct thread_decompressor *
+get_thread_decompressor(void)
+{
+	struct thread_decompressor *td;
+
+	pthread_once(&thread_decompressor_key_once,
+		     create_thread_decompressor_key);
+	if (!thread_decompressor_key_valid)
+		return NULL;
+	td = pthread_getspecific(thread_decompressor_key);
+	if (!td) {
+		td = CALLOC(1, sizeof(*td));
+		if (td && pthread_setspecific(thread_decompressor_key, td)) {
+			FREE(td);
+			td = NULL;
+		}
+	}
+	return td;
+}
+
+/* Borrow the decompressor cached in the WIMStruct, or by the calling thread if
+ * the WIM file is being read on several threads at once, creating a new one if
+ * there is none for this compression type and chunk size.  */
+static int
+get_decompressor(WIMStruct *wim, int ctype, u32 chunk_size,
+		 struct wimlib_decompressor **decompressor_ret)
+{
+	if (wim->concurrent_reads) {
+		struct thread_decompressor *td = get_thread_decompressor();
+
+		if (td && ctype == td->ctype &&
+		    chunk_size == td->max_block_size)
+		{
+			*decompressor_ret = td->decompressor;
+			td->ctype = WIMLIB_COMPRESSION_TYPE_NONE;
+			td->decompressor = NULL;
+			return 0;
+		}
+	} else if (likely(ctype == wim->decompressor_ctype &&
+			  chunk_size == wim->decompressor_max_block_size))
+	{
+		*decompressor_ret = wim->decompressor;
+		wim->decompressor_ctype = WIMLIB_COMPRESSION_TYPE_NONE;
+		wim->decompressor = NULL;
+		return 0;
+	}
+	return wimlib_create_decompressor(ctype, chunk_size, decompressor_ret);
+}
+
+/* Return a decompressor to where get_decompressor() would find it, replacing
+ * any other one.  */
+static void
+put_decompressor(WIMStruct *wim, int ctype, u32 chunk_size,
+		 struct wimlib_decompressor *decompressor)
+{
+	if (wim->concurrent_reads) {
+		struct thread_decompressor *td = get_thread_decompressor();
+
+		if (!td) {
+			wimlib_free_decompressor(decompressor);
+			return;
+		}
+		wimlib_free_decompressor(td->decompressor);
+		td->decompressor = decompressor;
+		td->ctype = ctype;
+		td->max_block_size = chunk_size;
+	} else {
+		wimlib_free_decompressor(wim->decompressor);
+		wim->decompressor = decompressor;
+		wim->decompressor_ctype = ctype;
+		wim->decompressor_max_block_size = chunk_size;
+	}
+}
+
 /*
  * Read data from a compressed WIM resource.
  *
@@ -129,6 +413,11 @@ decompress_chunk(const void *cbuf, u32 chunk_csize, u8 *ubuf, u32 chunk_usize,
  * @recover_data
  *	If a chunk can't be fully decompressed due to being corrupted, continue
  *	with whatever data can be recovered rather than return an error.
+ * @cache
+ *	If not NULL, a cache of decompressed chunks of the WIM file to look up
+ *	chunks in before reading them, and to add newly decompressed chunks to.
+ *	This is only done for chunks that are decompressed on the calling
+ *	thread.
  *
  * Possible return values:
  *
@@ -146,7 +435,8 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 			     const struct data_range * const ranges,
 			     const size_t num_ranges,
 			     const struct consume_chunk_callback *cb,
-			     bool recover_data)
+			     bool recover_data,
+			     struct decompressed_chunk_cache *cache)
 {
 	int ret;
 	u64 *chunk_offsets = NULL;
@@ -156,6 +446,8 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 	bool ubuf_malloced = false;
 	bool cbuf_malloced = false;
 	struct wimlib_decompressor *decompressor = NULL;
+	struct chunk_decompressor *chunk_decompressor = NULL;
+	struct cached_chunk *cached_chunk = NULL;
 
 	/* Sanity checks  */
 	wimlib_assert(num_ranges != 0);
@@ -180,6 +472,12 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 	const bool alt_chunk_table = (rdesc->flags & WIM_RESHDR_FLAG_SOLID)
 					&& !is_pipe_read;
 
+	/* Chunks read from a pipe can't be skipped, and partially recovered
+	 * chunks mustn't be handed out to later reads, so don't use the cache
+	 * in those cases.  */
+	if (is_pipe_read || recover_data)
+		cache = NULL;
+
 	/* Get the maximum size of uncompressed chunks in this resource, which
 	 * we require be a power of 2.  */
 	u64 cur_read_offset = rdesc->offset_in_wim;
@@ -202,24 +500,6 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 		goto out_cleanup;
 	}
 
-	/* Get valid decompressor.  */
-	if (likely(ctype == rdesc->wim->decompressor_ctype &&
-		   chunk_size == rdesc->wim->decompressor_max_block_size))
-	{
-		/* Cached decompressor.  */
-		decompressor = rdesc->wim->decompressor;
-		rdesc->wim->decompressor_ctype = WIMLIB_COMPRESSION_TYPE_NONE;
-		rdesc->wim->decompressor = NULL;
-	} else {
-		ret = wimlib_create_decompressor(ctype, chunk_size,
-						 &decompressor);
-		if (unlikely(ret)) {
-			if (ret != WIMLIB_ERR_NOMEM)
-				errno = EINVAL;
-			goto out_cleanup;
-		}
-	}
-
 	const u32 chunk_order = bsr32(chunk_size);
 
 	/* Calculate the total number of chunks the resource is divided into.  */
@@ -235,6 +515,30 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 	 * must always start from the 0th chunk.  */
 	const u64 read_start_chunk = (is_pipe_read ? 0 : first_needed_chunk);
 
+	/* If enough data is being read, decompress the chunks on other threads
+	 * while this thread reads the next chunks and passes the uncompressed
+	 * data to the callback.  */
+	const u64 num_chunks_to_read = last_needed_chunk - read_start_chunk + 1;
+	if (num_chunks_to_read >= 2 &&
+	    (num_chunks_to_read << chunk_order) >= MIN_PARALLEL_DECOMPRESSION_SIZE)
+	{
+		chunk_decompressor = get_chunk_decompressor(rdesc->wim, ctype,
+							    chunk_size);
+		if (chunk_decompressor)
+			chunk_decompressor->recover_data = recover_data;
+	}
+
+	/* Otherwise, get a valid decompressor to use on this thread.  */
+	if (!chunk_decompressor) {
+		ret = get_decompressor(rdesc->wim, ctype, chunk_size,
+				       &decompressor);
+		if (unlikely(ret)) {
+			if (ret != WIMLIB_ERR_NOMEM)
+				errno = EINVAL;
+			goto out_cleanup;
+		}
+	}
+
 	/* Calculate the number of chunk offsets that are needed for the chunks
 	 * being read.  */
 	const u64 num_needed_chunk_offsets =
@@ -261,6 +565,14 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 		(alt_chunk_table) ? chunk_table_size + sizeof(struct alt_chunk_table_header_disk)
 				  : chunk_table_size;
 
+	/* Offset in the WIM file just past the compressed data of the last
+	 * chunk being read, and the offset up to which the data has been
+	 * prefetched.  Only used for non-pipe reads of multiple chunks.  */
+	u64 read_end_offset = 0;
+	u64 prefetch_end_offset = 0;
+	const u64 prefetch_window = max((u64)PREFETCH_WINDOW_SIZE,
+					(u64)chunk_size * 2);
+
 	if (!is_pipe_read) {
 		/* Read the needed chunk table entries into memory and use them
 		 * to initialize the chunk_offsets array.  */
@@ -370,36 +682,64 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 			cur_read_offset += read_start_chunk * sizeof(struct pwm_chunk_hdr);
 		else
 			cur_read_offset += chunk_table_size;
-	}
 
-	/* Allocate buffer for holding the uncompressed data of each chunk.  */
-	if (chunk_size <= STACK_MAX) {
-		ubuf = alloca(chunk_size);
-	} else {
-		ubuf = MALLOC(chunk_size);
-		if (unlikely(!ubuf))
-			goto oom;
-		ubuf_malloced = true;
+		/* Set offset to end of last chunk to read.  */
+		if (num_chunks_to_read > 1) {
+			if (last_needed_chunk < num_chunks - 1) {
+				read_end_offset = cur_read_offset +
+					chunk_offsets[num_chunks_to_read] -
+					chunk_offsets[0];
+				if (rdesc->is_pipable)
+					read_end_offset += num_chunks_to_read *
+						sizeof(struct pwm_chunk_hdr);
+			} else {
+				read_end_offset = rdesc->offset_in_wim +
+						  rdesc->size_in_wim;
+				if (rdesc->is_pipable)
+					read_end_offset -= chunk_table_size;
+			}
+			prefetch_end_offset = cur_read_offset;
+		}
 	}
 
-	/* Allocate a temporary buffer for reading compressed chunks, each of
-	 * which can be at most @chunk_size - 1 bytes.  This excludes compressed
-	 * chunks that are a full @chunk_size bytes, which are actually stored
-	 * uncompressed.  */
-	if (chunk_size - 1 <= STACK_MAX) {
-		cbuf = alloca(chunk_size - 1);
-	} else {
-		cbuf = MALLOC(chunk_size - 1);
-		if (unlikely(!cbuf))
-			goto oom;
-		cbuf_malloced = true;
+	/* Allocate buffers for decompressing chunks on this thread.  The
+	 * parallel chunk decompressor has its own buffers.  */
+	if (!chunk_decompressor) {
+		/* Allocate buffer for holding the uncompressed data of each
+		 * chunk.  */
+		if (chunk_size <= STACK_MAX) {
+			ubuf = alloca(chunk_size);
+		} else {
+			ubuf = MALLOC(chunk_size);
+			if (unlikely(!ubuf))
+				goto oom;
+			ubuf_malloced = true;
+		}
+
+		/* Allocate a temporary buffer for reading compressed chunks,
+		 * each of which can be at most @chunk_size - 1 bytes.  This
+		 * excludes compressed chunks that are a full @chunk_size bytes,
+		 * which are actually stored uncompressed.  */
+		if (chunk_size - 1 <= STACK_MAX) {
+			cbuf = alloca(chunk_size - 1);
+		} else {
+			cbuf = MALLOC(chunk_size - 1);
+			if (unlikely(!cbuf))
+				goto oom;
+			cbuf_malloced = true;
+		}
 	}
 
-	/* Set current data range.  */
-	const struct data_range *cur_range = ranges;
-	const struct data_range * const end_range = &ranges[num_ranges];
-	u64 cur_range_pos = cur_range->offset;
-	u64 cur_range_end = cur_range->offset + cur_range->size;
+	/* Set current data range.  Chunks are passed to the callback some time
+	 * after they are read when decompressing in parallel, so the ranges
+	 * are tracked separately for deciding which chunks need to be read.  */
+	struct range_cursor cursor = {
+		.cur_range	= ranges,
+		.end_range	= &ranges[num_ranges],
+		.cur_range_pos	= ranges[0].offset,
+		.cur_range_end	= ranges[0].offset + ranges[0].size,
+	};
+	struct range_cursor read_cursor = cursor;
 
 	/* Read and process each needed chunk.  */
 	for (u64 i = read_start_chunk; i <= last_needed_chunk; i++) {
@@ -447,8 +787,22 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 		const u64 chunk_start_offset = i << chunk_order;
 		const u64 chunk_end_offset = chunk_start_offset + chunk_usize;
 
-		if (chunk_end_offset <= cur_range_pos) {
+		/* Keep the device busy reading the following chunks while this
+		 * one is being decompressed.  */
+		if (prefetch_end_offset < read_end_offset &&
+		    cur_read_offset + prefetch_window / 2 >= prefetch_end_offset)
+		{
+			u64 start = max(cur_read_offset, prefetch_end_offset);
+
+			prefetch_end_offset = min(cur_read_offset + prefetch_window,
+						  read_end_offset);
+			filedes_prefetch(in_fd, start,
+					 prefetch_end_offset - start);
+		}
 
+		if (!chunk_is_needed(&read_cursor, chunk_start_offset,
+				     chunk_end_offset))
+		{
 			/* The next range does not require data in this chunk,
 			 * so skip it.  */
 			cur_read_offset += chunk_csize;
@@ -459,16 +813,23 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 				if (unlikely(ret))
 					goto read_error;
 			}
-		} else {
+		} else if (chunk_decompressor) {
 
-			/* Read the chunk and feed data to the callback
-			 * function.  */
+			/* Read the chunk and submit it to be decompressed by
+			 * another thread.  If no buffer is free, first pass
+			 * the oldest decompressed chunk to the callback.  */
 			u8 *read_buf;
 
-			if (chunk_csize == chunk_usize)
-				read_buf = ubuf;
-			else
-				read_buf = cbuf;
+			while (!(read_buf = chunk_decompressor->get_chunk_buffer(
+						chunk_decompressor,
+						chunk_csize, chunk_usize)))
+			{
+				ret = consume_decompressed_chunks(chunk_decompressor,
+								  &cursor, cb,
+								  false);
+				if (unlikely(ret))
+					goto out_cleanup;
+			}
 
 			ret = full_pread(in_fd,
 					 read_buf,
@@ -477,47 +838,87 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 			if (unlikely(ret))
 				goto read_error;
 
-			if (read_buf == cbuf) {
-				ret = decompress_chunk(cbuf, chunk_csize,
-						       ubuf, chunk_usize,
-						       decompressor,
-						       recover_data);
-				if (unlikely(ret))
-					goto out_cleanup;
-			}
+			chunk_decompressor->signal_chunk_filled(chunk_decompressor);
 			cur_read_offset += chunk_csize;
+		} else {
 
-			/* At least one range requires data in this chunk.  */
-			do {
-				size_t start, end, size;
-
-				/* Calculate how many bytes of data should be
-				 * sent to the callback function, taking into
-				 * account that data sent to the callback
-				 * function must not overlap range boundaries.
-				 */
-				start = cur_range_pos - chunk_start_offset;
-				end = min(cur_range_end, chunk_end_offset) - chunk_start_offset;
-				size = end - start;
+			/* Read the chunk and feed data to the callback
+			 * function.  If the WIM file is mapped into memory,
+			 * use the chunk's data in place instead.  If the chunk
+			 * is compressed and is in the cache, skip reading and
+			 * decompressing it altogether.  */
+			const u8 *read_buf;
+			const u8 *udata = ubuf;
+			u8 *dbuf = ubuf;
+
+			if (cache && chunk_csize != chunk_usize) {
+				cached_chunk = dcache_lookup(cache,
+							rdesc->offset_in_wim, i);
+			}
+			if (cached_chunk) {
+				udata = cached_chunk->data;
+			} else {
+				if (cache && chunk_csize != chunk_usize) {
+					cached_chunk = new_cached_chunk(
+							rdesc->offset_in_wim,
+							i, chunk_usize);
+					if (cached_chunk)
+						dbuf = cached_chunk->data;
+				}
 
-				ret = consume_chunk(cb, &ubuf[start], size);
-				if (unlikely(ret))
-					goto out_cleanup;
+				read_buf = filedes_mapped(in_fd, cur_read_offset,
+							  chunk_csize);
+				if (!read_buf) {
+					u8 *buf = (chunk_csize == chunk_usize) ?
+							ubuf : cbuf;
+
+					ret = full_pread(in_fd,
+							 buf,
+							 chunk_csize,
+							 cur_read_offset);
+					if (unlikely(ret))
+						goto read_error;
+					read_buf = buf;
+				}
 
-				cur_range_pos += size;
-				if (cur_range_pos == cur_range_end) {
-					/* Advance to next range.  */
-					if (++cur_range == end_range) {
-						cur_range_pos = ~0ULL;
-					} else {
-						cur_range_pos = cur_range->offset;
-						cur_range_end = cur_range->offset + cur_range->size;
-					}
+				if (chunk_csize != chunk_usize) {
+					ret = decompress_chunk(read_buf,
+							       chunk_csize,
+							       dbuf, chunk_usize,
+							       decompressor,
+							       recover_data);
+					if (unlikely(ret))
+						goto out_cleanup;
+					udata = dbuf;
+					if (cached_chunk)
+						dcache_insert(cache,
+							      cached_chunk);
+				} else {
+					udata = read_buf;
 				}
-			} while (cur_range_pos < chunk_end_offset);
+			}
+			cur_read_offset += chunk_csize;
+
+			ret = consume_needed_chunk_data(&cursor, udata,
+							chunk_start_offset,
+							chunk_usize, cb);
+			if (cached_chunk) {
+				release_cached_chunk(cache, cached_chunk);
+				cached_chunk = NULL;
+			}
+			if (unlikely(ret))
+				goto out_cleanup;
 		}
 	}
 
+	if (chunk_decompressor) {
+		/* Pass the remaining decompressed chunks to the callback.  */
+		ret = consume_decompressed_chunks(chunk_decompressor, &cursor,
+						  cb, true);
+		if (unlikely(ret))
+			goto out_cleanup;
+	}
+
 	if (is_pipe_read &&
 	    last_offset == rdesc->uncompressed_size - 1 &&
 	    chunk_table_size)
@@ -535,12 +936,24 @@ read_compressed_wim_resource(const struct wim_resource_descriptor * const rdesc,
 	ret = 0;
 
 out_cleanup:
-	if (decompressor) {
-		wimlib_free_decompressor(rdesc->wim->decompressor);
-		rdesc->wim->decompressor = decompressor;
-		rdesc->wim->decompressor_ctype = ctype;
-		rdesc->wim->decompressor_max_block_size = chunk_size;
+	if (chunk_decompressor) {
+		const void *udata;
+		u32 usize;
+		int status;
+
+		/* On error, discard any chunks still being decompressed so that
+		 * the chunk decompressor can be reused.  */
+		while (chunk_decompressor->get_decompression_result(chunk_decompressor,
+								    &udata,
+								    &usize,
+								    &status))
+			;
+		put_chunk_decompressor(rdesc->wim, chunk_decompressor);
 	}
+	if (cached_chunk)
+		release_cached_chunk(cache, cached_chunk);
+	if (decompressor)
+		put_decompressor(rdesc->wim, ctype, chunk_size, decompressor);
 	if (chunk_offsets_malloced)
 		FREE(chunk_offsets);
 	if (ubuf_malloced)
@@ -571,11 +984,17 @@ read_raw_file_data(struct filedes *in_fd, u64 offset, u64 size,
 	int ret;
 
 	while (size) {
+		const void *data;
+
 		bytes_to_read = min(sizeof(buf), size);
-		ret = full_pread(in_fd, buf, bytes_to_read, offset);
-		if (unlikely(ret))
-			goto read_error;
-		ret = consume_chunk(cb, buf, bytes_to_read);
+		data = filedes_mapped(in_fd, offset, bytes_to_read);
+		if (!data) {
+			ret = full_pread(in_fd, buf, bytes_to_read, offset);
+			if (unlikely(ret))
+				goto read_error;
+			data = buf;
+		}
+		ret = consume_chunk(cb, data, bytes_to_read);
 		if (unlikely(ret))
 			return ret;
 		size -= bytes_to_read;
@@ -620,7 +1039,8 @@ static int
 read_partial_wim_resource(const struct wim_resource_descriptor *rdesc,
 			  const u64 offset, const u64 size,
 			  const struct consume_chunk_callback *cb,
-			  bool recover_data)
+			  bool recover_data,
+			  struct decompressed_chunk_cache *cache)
 {
 	if (rdesc->flags & (WIM_RESHDR_FLAG_COMPRESSED |
 			    WIM_RESHDR_FLAG_SOLID))
@@ -633,7 +1053,7 @@ read_partial_wim_resource(const struct wim_resource_descriptor *rdesc,
 			.size = size,
 		};
 		return read_compressed_wim_resource(rdesc, &range, 1, cb,
-						    recover_data);
+						    recover_data, cache);
 	}
 
 	/* Uncompressed resource  */
@@ -643,19 +1063,27 @@ read_partial_wim_resource(const struct wim_resource_descriptor *rdesc,
 }
 
 /* Read the specified range of uncompressed data from the specified blob, which
- * must be located in a WIM file, into the specified buffer.  */
+ * must be located in a WIM file, into the specified buffer.  Since this is used
+ * for small reads that often hit the same chunks repeatedly, decompressed
+ * chunks are cached in the WIMStruct.  */
 int
 read_partial_wim_blob_into_buf(const struct blob_descriptor *blob,
 			       u64 offset, size_t size, void *buf)
 {
+	WIMStruct *wim = blob->rdesc->wim;
 	struct consume_chunk_callback cb = {
 		.func	= bufferer_cb,
 		.ctx	= &buf,
 	};
+
+	if (!wim->dcache && wim->dcache_size &&
+	    !wim->concurrent_reads)
+		wim->dcache = new_decompressed_chunk_cache(wim->dcache_size);
+
 	return read_partial_wim_resource(blob->rdesc,
 					 blob->offset_in_res + offset,
 					 size,
-					 &cb, false);
+					 &cb, false, wim->dcache);
 }
 
 static int
@@ -672,7 +1100,8 @@ skip_wim_resource(const struct wim_resource_descriptor *rdesc)
 		.func = noop_cb,
 	};
 	return read_partial_wim_resource(rdesc, 0,
-					 rdesc->uncompressed_size, &cb, false);
+					 rdesc->uncompressed_size, &cb, false,
+					 NULL);
 }
 
 static int
@@ -680,7 +1109,7 @@ read_wim_blob_prefix(const struct blob_descriptor *blob, u64 size,
 		     const struct consume_chunk_callback *cb, bool recover_data)
 {
 	return read_partial_wim_resource(blob->rdesc, blob->offset_in_res,
-					 size, cb, recover_data);
+					 size, cb, recover_data, NULL);
 }
 
 /* This function handles reading blob data that is located in an external file,
@@ -729,7 +1158,30 @@ read_staging_file_prefix(const struct blob_descriptor *blob, u64 size,
 		return WIMLIB_ERR_OPEN;
 	}
 	filedes_init(&fd, raw_fd);
-	ret = read_raw_file_data(&fd, 0, size, cb, blob->staging_file_name);
+
+	/* If the staging file was created lazily, merge the chunks that have
+	 * been copied into it with the rest of the original data.  */
+	ret = 0;
+	for (u64 offset = 0; offset < size && !ret; ) {
+		const struct blob_descriptor *base_blob;
+		bool in_staging_file;
+		u64 len;
+
+		len = staging_data_run(blob->staging_base, offset, size,
+				       &in_staging_file);
+		if (in_staging_file) {
+			ret = read_raw_file_data(&fd, offset, len, cb,
+						 blob->staging_file_name);
+		} else {
+			base_blob = blob->staging_base->blob;
+			ret = read_partial_wim_resource(base_blob->rdesc,
+							base_blob->offset_in_res +
+								offset,
+							len, cb, recover_data,
+							NULL);
+		}
+		offset += len;
+	}
 	filedes_close(&fd);
 	return ret;
 }
@@ -979,6 +1431,13 @@ struct hasher_context {
 	SHA_CTX sha_ctx;
 	int flags;
 	struct read_blob_callbacks cbs;
+
+	/* If not NULL, large blobs are hashed using this context instead of
+	 * @sha_ctx.  */
+	struct parallel_sha1_ctx *parallel_sha1_ctx;
+
+	/* Whether the current blob is being hashed using @parallel_sha1_ctx  */
+	bool hashing_in_parallel;
 };
 
 /* Callback for starting to read a blob while calculating its SHA-1 message
@@ -988,7 +1447,12 @@ hasher_begin_blob(struct blob_descriptor *blob, void *_ctx)
 {
 	struct hasher_context *ctx = _ctx;
 
-	sha1_init(&ctx->sha_ctx);
+	ctx->hashing_in_parallel = (ctx->parallel_sha1_ctx != NULL &&
+				    blob->size >= MIN_PARALLEL_SHA1_SIZE);
+	if (ctx->hashing_in_parallel)
+		parallel_sha1_init(ctx->parallel_sha1_ctx);
+	else
+		sha1_init(&ctx->sha_ctx);
 	blob->corrupted = 0;
 
 	return call_begin_blob(blob, &ctx->cbs);
@@ -1006,7 +1470,10 @@ hasher_continue_blob(const struct blob_descriptor *blob, u64 offset,
 {
 	struct hasher_context *ctx = _ctx;
 
-	sha1_update(&ctx->sha_ctx, chunk, size);
+	if (ctx->hashing_in_parallel)
+		parallel_sha1_update(ctx->parallel_sha1_ctx, chunk, size);
+	else
+		sha1_update(&ctx->sha_ctx, chunk, size);
 
 	return call_continue_blob(blob, offset, chunk, size, &ctx->cbs);
 }
@@ -1089,7 +1556,10 @@ hasher_end_blob(struct blob_descriptor *blob, int status, void *_ctx)
 	}
 
 	/* Retrieve the final SHA-1 message digest.  */
-	sha1_final(hash, &ctx->sha_ctx);
+	if (ctx->hashing_in_parallel)
+		parallel_sha1_final(hash, ctx->parallel_sha1_ctx);
+	else
+		sha1_final(hash, &ctx->sha_ctx);
 
 	/* Set the SHA-1 message digest of the blob, or compare the calculated
 	 * value with stored value.  */
@@ -1185,7 +1655,7 @@ read_blobs_in_solid_resource(struct blob_descriptor *first_blob,
 	};
 
 	ret = read_compressed_wim_resource(first_blob->rdesc, ranges,
-					   blob_count, &cb, recover_data);
+					   blob_count, &cb, recover_data, NULL);
 
 	if (ranges_malloced)
 		FREE(ranges);
@@ -1201,6 +1671,68 @@ oom:
 	return WIMLIB_ERR_NOMEM;
 }
 
+/*
+ * Hint that the WIM resources of the blob at @cur and the blobs following it in
+ * @blob_list will be read soon, unless enough of them have already been
+ * prefetched.  The list must be sorted in sequential order.  Nearby resources
+ * are combined so that, for example, the chunk tables and data of many small
+ * resources are requested from the device together rather than one pread() at
+ * a time.
+ */
+void
+prefetch_blob_list(struct blob_list_prefetcher *pf, struct list_head *cur,
+		   struct list_head *blob_list, size_t list_head_offset)
+{
+	const struct blob_descriptor *blob;
+	const struct wim_resource_descriptor *rdesc;
+	const struct wim_resource_descriptor *prev_rdesc = NULL;
+	u64 window_end, run_start, run_end;
+
+	blob = (const struct blob_descriptor *)((u8 *)cur - list_head_offset);
+	rdesc = blob->rdesc;
+
+	if (pf->wim != rdesc->wim) {
+		pf->wim = rdesc->wim;
+		pf->end_offset = 0;
+	}
+
+	if (rdesc->offset_in_wim + PREFETCH_WINDOW_SIZE / 2 < pf->end_offset)
+		return;
+
+	window_end = rdesc->offset_in_wim + PREFETCH_WINDOW_SIZE;
+	run_start = run_end = max(pf->end_offset, rdesc->offset_in_wim);
+
+	for (; cur != blob_list; cur = cur->next) {
+		u64 start, end;
+
+		blob = (const struct blob_descriptor *)((u8 *)cur - list_head_offset);
+		if (blob->blob_location != BLOB_IN_WIM ||
+		    blob->rdesc->wim != pf->wim)
+			break;
+
+		rdesc = blob->rdesc;
+		if (rdesc == prev_rdesc)
+			continue;
+		prev_rdesc = rdesc;
+
+		start = rdesc->offset_in_wim;
+		if (start >= window_end)
+			break;
+		end = min(start + rdesc->size_in_wim, window_end);
+		if (end <= run_end)
+			continue;
+
+		if (start > run_end + PREFETCH_MAX_GAP) {
+			filedes_prefetch(&pf->wim->in_fd, run_start,
+					 run_end - run_start);
+			run_start = start;
+		}
+		run_end = end;
+	}
+	filedes_prefetch(&pf->wim->in_fd, run_start, run_end - run_start);
+	pf->end_offset = run_end;
+}
+
 /*
  * Read a list of blobs, each of which may be in any supported location (e.g.
  * in a WIM or in an external file).  This function optimizes the case where
@@ -1252,6 +1784,9 @@ read_blob_list(struct list_head *blob_list, size_t list_head_offset,
 	struct blob_descriptor *blob;
 	struct hasher_context *hasher_ctx;
 	struct read_blob_callbacks *sink_cbs;
+	struct blob_list_prefetcher prefetcher = {
+		.wim = NULL,
+	};
 
 	if (!(flags & BLOB_LIST_ALREADY_SORTED)) {
 		ret = sort_blob_list_by_sequential_order(blob_list,
@@ -1266,6 +1801,11 @@ read_blob_list(struct list_head *blob_list, size_t list_head_offset,
 			.flags	= flags,
 			.cbs	= *cbs,
 		};
+		/* Hash large blobs on another thread if there is a processor
+		 * to spare for it.  If the thread can't be created, just hash
+		 * everything inline.  */
+		if (get_available_cpus() > 1)
+			(void)new_parallel_sha1_ctx(&hasher_ctx->parallel_sha1_ctx);
 		sink_cbs = alloca(sizeof(*sink_cbs));
 		*sink_cbs = (struct read_blob_callbacks) {
 			.begin_blob	= hasher_begin_blob,
@@ -1283,6 +1823,10 @@ read_blob_list(struct list_head *blob_list, size_t list_head_offset,
 	{
 		blob = (struct blob_descriptor*)((u8*)cur - list_head_offset);
 
+		if (blob->blob_location == BLOB_IN_WIM)
+			prefetch_blob_list(&prefetcher, cur, blob_list,
+					   list_head_offset);
+
 		if (blob->blob_location == BLOB_IN_WIM &&
 		    blob->size != blob->rdesc->uncompressed_size)
 		{
@@ -1324,16 +1868,20 @@ read_blob_list(struct list_head *blob_list, size_t list_head_offset,
 								   sink_cbs,
 								   flags & RECOVER_DATA);
 				if (ret)
-					return ret;
+					goto out;
 				continue;
 			}
 		}
 
 		ret = read_blob_with_cbs(blob, sink_cbs, flags & RECOVER_DATA);
 		if (unlikely(ret && ret != BEGIN_BLOB_STATUS_SKIP_BLOB))
-			return ret;
+			goto out;
 	}
-	return 0;
+	ret = 0;
+out:
+	if (sink_cbs != cbs)
+		free_parallel_sha1_ctx(hasher_ctx->parallel_sha1_ctx);
+	return ret;
 }
 
 static int
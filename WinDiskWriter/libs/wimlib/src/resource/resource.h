@@ -8,6 +8,7 @@
 struct blob_descriptor;
 struct filedes;
 struct wim_image_metadata;
+struct wimlib_decompressor;
 
 /*
  * Description of a "resource" in a WIM file.  A "resource" is a standalone,
@@ -171,6 +172,10 @@ get_chunk_entry_size(u64 res_size, bool is_alt)
 
 /* Functions to read blobs  */
 
+extern int
+decompress_chunk(const void *cbuf, u32 chunk_csize, u8 *ubuf, u32 chunk_usize,
+		 struct wimlib_decompressor *decompressor, bool recover_data);
+
 extern int
 read_partial_wim_blob_into_buf(const struct blob_descriptor *blob,
 			       u64 offset, size_t size, void *buf);
@@ -279,6 +284,17 @@ extern int
 read_blob_list(struct list_head *blob_list, size_t list_head_offset,
 	       const struct read_blob_callbacks *cbs, int flags);
 
+/* State for prefetching the WIM resources of the blobs in a sorted list that
+ * is being read sequentially.  Zero-initialize before first use.  */
+struct blob_list_prefetcher {
+	struct WIMStruct *wim;
+	u64 end_offset;
+};
+
+extern void
+prefetch_blob_list(struct blob_list_prefetcher *pf, struct list_head *cur,
+		   struct list_head *blob_list, size_t list_head_offset);
+
 extern int
 read_blob_with_cbs(struct blob_descriptor *blob,
 		   const struct read_blob_callbacks *cbs, bool recover_data);
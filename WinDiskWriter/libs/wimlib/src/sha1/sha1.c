@@ -140,9 +140,9 @@ extern void
 sha1_transform_blocks_ssse3(u32 state[5], const void *data, size_t num_blocks);
 extern void
 sha1_transform_blocks_default(u32 state[5], const void *data, size_t num_blocks);
-#  define sha1_transform_blocks sha1_transform_blocks_ssse3
+#  define sha1_transform_blocks_generic sha1_transform_blocks_ssse3
 #else
-#  define sha1_transform_blocks sha1_transform_blocks_default
+#  define sha1_transform_blocks_generic sha1_transform_blocks_default
 #endif
 
 #ifndef ENABLE_SSSE3_SHA1
@@ -157,6 +157,340 @@ sha1_transform_blocks_default(u32 state[5], const void *data, size_t num_blocks)
 	} while (--num_blocks);
 }
 
+/*----------------------------------------------------------------------------*
+ *                     Hardware-accelerated implementations                   *
+ *----------------------------------------------------------------------------*/
+
+#if defined(__x86_64__) && (GCC_PREREQ(5, 1) || defined(__clang__))
+#  define HAVE_SHA1_X86_IMPLS 1
+#  include <immintrin.h>
+#  include "x86_cpu_features.h"
+#else
+#  define HAVE_SHA1_X86_IMPLS 0
+#endif
+
+#if defined(__aarch64__) && \
+	(defined(__ARM_FEATURE_CRYPTO) || defined(__ARM_FEATURE_SHA2))
+#  define HAVE_SHA1_ARM_IMPL 1
+#  include <arm_neon.h>
+#else
+#  define HAVE_SHA1_ARM_IMPL 0
+#endif
+
+#if HAVE_SHA1_X86_IMPLS
+
+/* Calculate @w_i from @w_{i-16} through @w_{i-1}, given in the registers
+ * @w_a, @w_b, @w_c, and @w_d respectively.  The result replaces @w_a.  */
+#define SHA1_X86_SCHEDULE(w_a, w_b, w_c, w_d)				\
+	w_a = _mm_sha1msg2_epu32(_mm_xor_si128(_mm_sha1msg1_epu32(w_a, w_b),	\
+					       w_c), w_d)
+
+/* Do 4 rounds using the round function @f.  */
+#define SHA1_X86_ROUNDS(w, f)						\
+	e = _mm_sha1nexte_epu32(e_saved, w);				\
+	e_saved = abcd;							\
+	abcd = _mm_sha1rnds4_epu32(abcd, e, f)
+
+/* Hash 512-bit blocks using the x86 SHA extensions.  */
+static void _target_attribute("sha,sse4.1")
+sha1_transform_blocks_x86_sha(u32 state[5], const void *data,
+			      size_t num_blocks)
+{
+	const __m128i bswap_mask = _mm_set_epi64x(0x0001020304050607ULL,
+						  0x08090a0b0c0d0e0fULL);
+	__m128i abcd, e0, abcd_save, e, e_saved;
+	__m128i w0, w1, w2, w3;
+
+	/* The instructions expect 'a' and 'e' in the highest lanes.  */
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)state), 0x1B);
+	e0 = _mm_set_epi32(state[4], 0, 0, 0);
+
+	do {
+		abcd_save = abcd;
+
+		w0 = _mm_shuffle_epi8(_mm_loadu_si128(data + 0), bswap_mask);
+		w1 = _mm_shuffle_epi8(_mm_loadu_si128(data + 16), bswap_mask);
+		w2 = _mm_shuffle_epi8(_mm_loadu_si128(data + 32), bswap_mask);
+		w3 = _mm_shuffle_epi8(_mm_loadu_si128(data + 48), bswap_mask);
+
+		/* Rounds 0-19  */
+		e = _mm_add_epi32(e0, w0);
+		e_saved = abcd;
+		abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+		SHA1_X86_ROUNDS(w1, 0);
+		SHA1_X86_ROUNDS(w2, 0);
+		SHA1_X86_ROUNDS(w3, 0);
+		SHA1_X86_SCHEDULE(w0, w1, w2, w3); SHA1_X86_ROUNDS(w0, 0);
+
+		/* Rounds 20-39  */
+		SHA1_X86_SCHEDULE(w1, w2, w3, w0); SHA1_X86_ROUNDS(w1, 1);
+		SHA1_X86_SCHEDULE(w2, w3, w0, w1); SHA1_X86_ROUNDS(w2, 1);
+		SHA1_X86_SCHEDULE(w3, w0, w1, w2); SHA1_X86_ROUNDS(w3, 1);
+		SHA1_X86_SCHEDULE(w0, w1, w2, w3); SHA1_X86_ROUNDS(w0, 1);
+		SHA1_X86_SCHEDULE(w1, w2, w3, w0); SHA1_X86_ROUNDS(w1, 1);
+
+		/* Rounds 40-59  */
+		SHA1_X86_SCHEDULE(w2, w3, w0, w1); SHA1_X86_ROUNDS(w2, 2);
+		SHA1_X86_SCHEDULE(w3, w0, w1, w2); SHA1_X86_ROUNDS(w3, 2);
+		SHA1_X86_SCHEDULE(w0, w1, w2, w3); SHA1_X86_ROUNDS(w0, 2);
+		SHA1_X86_SCHEDULE(w1, w2, w3, w0); SHA1_X86_ROUNDS(w1, 2);
+		SHA1_X86_SCHEDULE(w2, w3, w0, w1); SHA1_X86_ROUNDS(w2, 2);
+
+		/* Rounds 60-79  */
+		SHA1_X86_SCHEDULE(w3, w0, w1, w2); SHA1_X86_ROUNDS(w3, 3);
+		SHA1_X86_SCHEDULE(w0, w1, w2, w3); SHA1_X86_ROUNDS(w0, 3);
+		SHA1_X86_SCHEDULE(w1, w2, w3, w0); SHA1_X86_ROUNDS(w1, 3);
+		SHA1_X86_SCHEDULE(w2, w3, w0, w1); SHA1_X86_ROUNDS(w2, 3);
+		SHA1_X86_SCHEDULE(w3, w0, w1, w2); SHA1_X86_ROUNDS(w3, 3);
+
+		e0 = _mm_sha1nexte_epu32(e_saved, e0);
+		abcd = _mm_add_epi32(abcd, abcd_save);
+		data += 64;
+	} while (--num_blocks);
+
+	_mm_storeu_si128((__m128i *)state, _mm_shuffle_epi32(abcd, 0x1B));
+	state[4] = _mm_extract_epi32(e0, 3);
+}
+
+#undef SHA1_X86_SCHEDULE
+#undef SHA1_X86_ROUNDS
+
+/* Number of messages hashed in parallel by sha1_transform_blocks_x8_avx2()  */
+#define SHA1_AVX2_LANES 8
+
+#define rol_x8(x, n)	_mm256_or_si256(_mm256_slli_epi32((x), (n)),	\
+					_mm256_srli_epi32((x), 32 - (n)))
+
+/*
+ * Hash 512-bit blocks of up to 8 independent messages at once using AVX2, one
+ * message in each 32-bit lane.  This is useful on processors that have AVX2 but
+ * not the SHA extensions.  Each of the first @num_msgs states is updated with
+ * @num_blocks blocks of the corresponding message.
+ */
+static void _target_attribute("avx2")
+sha1_transform_blocks_x8_avx2(u32 * const states[], const u8 * const data[],
+			      unsigned num_msgs, size_t num_blocks)
+{
+	const __m256i bswap_mask = _mm256_set_epi8(12, 13, 14, 15, 8, 9, 10, 11,
+						   4, 5, 6, 7, 0, 1, 2, 3,
+						   12, 13, 14, 15, 8, 9, 10, 11,
+						   4, 5, 6, 7, 0, 1, 2, 3);
+	u32 dummy_state[5];
+	u32 *lane_states[SHA1_AVX2_LANES];
+	const u8 *lane_data[SHA1_AVX2_LANES];
+	u32 st[5][SHA1_AVX2_LANES] _aligned_attribute(32);
+	__m256i v[5];
+
+	/* Unused lanes hash a copy of the first message into a dummy state.  */
+	for (unsigned i = 0; i < SHA1_AVX2_LANES; i++) {
+		if (i < num_msgs) {
+			lane_states[i] = states[i];
+			lane_data[i] = data[i];
+		} else {
+			lane_states[i] = dummy_state;
+			lane_data[i] = data[0];
+		}
+	}
+
+	for (int j = 0; j < 5; j++)
+		for (unsigned i = 0; i < SHA1_AVX2_LANES; i++)
+			st[j][i] = lane_states[i][j];
+	for (int j = 0; j < 5; j++)
+		v[j] = _mm256_load_si256((const __m256i *)st[j]);
+
+	do {
+		__m256i a = v[0], b = v[1], c = v[2], d = v[3], e = v[4];
+		__m256i w[16];
+
+		for (int t = 0; t < 16; t++) {
+			w[t] = _mm256_set_epi32(
+				load_u32_unaligned(lane_data[7] + t * 4),
+				load_u32_unaligned(lane_data[6] + t * 4),
+				load_u32_unaligned(lane_data[5] + t * 4),
+				load_u32_unaligned(lane_data[4] + t * 4),
+				load_u32_unaligned(lane_data[3] + t * 4),
+				load_u32_unaligned(lane_data[2] + t * 4),
+				load_u32_unaligned(lane_data[1] + t * 4),
+				load_u32_unaligned(lane_data[0] + t * 4));
+			w[t] = _mm256_shuffle_epi8(w[t], bswap_mask);
+		}
+
+		for (int t = 0; t < 80; t++) {
+			__m256i f, k, tmp;
+
+			if (t >= 16) {
+				w[t & 15] = rol_x8(_mm256_xor_si256(
+					_mm256_xor_si256(w[(t + 13) & 15],
+							 w[(t + 8) & 15]),
+					_mm256_xor_si256(w[(t + 2) & 15],
+							 w[t & 15])), 1);
+			}
+			if (t < 20) {
+				f = _mm256_xor_si256(d, _mm256_and_si256(b,
+						_mm256_xor_si256(c, d)));
+				k = _mm256_set1_epi32(0x5A827999);
+			} else if (t < 40) {
+				f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+				k = _mm256_set1_epi32(0x6ED9EBA1);
+			} else if (t < 60) {
+				f = _mm256_or_si256(_mm256_and_si256(b, c),
+						    _mm256_and_si256(d,
+							_mm256_or_si256(b, c)));
+				k = _mm256_set1_epi32(0x8F1BBCDC);
+			} else {
+				f = _mm256_xor_si256(_mm256_xor_si256(b, c), d);
+				k = _mm256_set1_epi32(0xCA62C1D6);
+			}
+			tmp = _mm256_add_epi32(_mm256_add_epi32(rol_x8(a, 5), f),
+					       _mm256_add_epi32(_mm256_add_epi32(e, k),
+								w[t & 15]));
+			e = d;
+			d = c;
+			c = rol_x8(b, 30);
+			b = a;
+			a = tmp;
+		}
+
+		v[0] = _mm256_add_epi32(v[0], a);
+		v[1] = _mm256_add_epi32(v[1], b);
+		v[2] = _mm256_add_epi32(v[2], c);
+		v[3] = _mm256_add_epi32(v[3], d);
+		v[4] = _mm256_add_epi32(v[4], e);
+
+		for (unsigned i = 0; i < SHA1_AVX2_LANES; i++)
+			lane_data[i] += 64;
+	} while (--num_blocks);
+
+	for (int j = 0; j < 5; j++)
+		_mm256_store_si256((__m256i *)st[j], v[j]);
+	for (unsigned i = 0; i < num_msgs; i++)
+		for (int j = 0; j < 5; j++)
+			states[i][j] = st[j][i];
+}
+
+#undef rol_x8
+
+#endif /* HAVE_SHA1_X86_IMPLS */
+
+#if HAVE_SHA1_ARM_IMPL
+
+/* Calculate @w_i from @w_{i-16} through @w_{i-1}, given in the registers
+ * @w_a, @w_b, @w_c, and @w_d respectively.  The result replaces @w_a.  */
+#define SHA1_ARM_SCHEDULE(w_a, w_b, w_c, w_d)				\
+	w_a = vsha1su1q_u32(vsha1su0q_u32(w_a, w_b, w_c), w_d)
+
+/* Do 4 rounds using the round instruction @op and the round constant @k.  */
+#define SHA1_ARM_ROUNDS(op, w, k)					\
+	e1 = vsha1h_u32(vgetq_lane_u32(abcd, 0));			\
+	abcd = op(abcd, e0, vaddq_u32(w, k));				\
+	e0 = e1
+
+/* Hash 512-bit blocks using the ARMv8 SHA-1 instructions.  */
+static void
+sha1_transform_blocks_arm(u32 state[5], const void *data, size_t num_blocks)
+{
+	const uint32x4_t k0 = vdupq_n_u32(0x5A827999);
+	const uint32x4_t k1 = vdupq_n_u32(0x6ED9EBA1);
+	const uint32x4_t k2 = vdupq_n_u32(0x8F1BBCDC);
+	const uint32x4_t k3 = vdupq_n_u32(0xCA62C1D6);
+	uint32x4_t abcd = vld1q_u32(state);
+	u32 e0 = state[4];
+
+	do {
+		const uint32x4_t abcd_save = abcd;
+		const u32 e0_save = e0;
+		uint32x4_t w0, w1, w2, w3;
+		u32 e1;
+
+		w0 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8((const u8 *)data + 0)));
+		w1 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8((const u8 *)data + 16)));
+		w2 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8((const u8 *)data + 32)));
+		w3 = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8((const u8 *)data + 48)));
+
+		/* Rounds 0-19  */
+		SHA1_ARM_ROUNDS(vsha1cq_u32, w0, k0);
+		SHA1_ARM_ROUNDS(vsha1cq_u32, w1, k0);
+		SHA1_ARM_ROUNDS(vsha1cq_u32, w2, k0);
+		SHA1_ARM_ROUNDS(vsha1cq_u32, w3, k0);
+		SHA1_ARM_SCHEDULE(w0, w1, w2, w3); SHA1_ARM_ROUNDS(vsha1cq_u32, w0, k0);
+
+		/* Rounds 20-39  */
+		SHA1_ARM_SCHEDULE(w1, w2, w3, w0); SHA1_ARM_ROUNDS(vsha1pq_u32, w1, k1);
+		SHA1_ARM_SCHEDULE(w2, w3, w0, w1); SHA1_ARM_ROUNDS(vsha1pq_u32, w2, k1);
+		SHA1_ARM_SCHEDULE(w3, w0, w1, w2); SHA1_ARM_ROUNDS(vsha1pq_u32, w3, k1);
+		SHA1_ARM_SCHEDULE(w0, w1, w2, w3); SHA1_ARM_ROUNDS(vsha1pq_u32, w0, k1);
+		SHA1_ARM_SCHEDULE(w1, w2, w3, w0); SHA1_ARM_ROUNDS(vsha1pq_u32, w1, k1);
+
+		/* Rounds 40-59  */
+		SHA1_ARM_SCHEDULE(w2, w3, w0, w1); SHA1_ARM_ROUNDS(vsha1mq_u32, w2, k2);
+		SHA1_ARM_SCHEDULE(w3, w0, w1, w2); SHA1_ARM_ROUNDS(vsha1mq_u32, w3, k2);
+		SHA1_ARM_SCHEDULE(w0, w1, w2, w3); SHA1_ARM_ROUNDS(vsha1mq_u32, w0, k2);
+		SHA1_ARM_SCHEDULE(w1, w2, w3, w0); SHA1_ARM_ROUNDS(vsha1mq_u32, w1, k2);
+		SHA1_ARM_SCHEDULE(w2, w3, w0, w1); SHA1_ARM_ROUNDS(vsha1mq_u32, w2, k2);
+
+		/* Rounds 60-79  */
+		SHA1_ARM_SCHEDULE(w3, w0, w1, w2); SHA1_ARM_ROUNDS(vsha1pq_u32, w3, k3);
+		SHA1_ARM_SCHEDULE(w0, w1, w2, w3); SHA1_ARM_ROUNDS(vsha1pq_u32, w0, k3);
+		SHA1_ARM_SCHEDULE(w1, w2, w3, w0); SHA1_ARM_ROUNDS(vsha1pq_u32, w1, k3);
+		SHA1_ARM_SCHEDULE(w2, w3, w0, w1); SHA1_ARM_ROUNDS(vsha1pq_u32, w2, k3);
+		SHA1_ARM_SCHEDULE(w3, w0, w1, w2); SHA1_ARM_ROUNDS(vsha1pq_u32, w3, k3);
+
+		abcd = vaddq_u32(abcd, abcd_save);
+		e0 += e0_save;
+		data += 64;
+	} while (--num_blocks);
+
+	vst1q_u32(state, abcd);
+	state[4] = e0;
+}
+
+#undef SHA1_ARM_SCHEDULE
+#undef SHA1_ARM_ROUNDS
+
+#endif /* HAVE_SHA1_ARM_IMPL */
+
+typedef void (*sha1_transform_blocks_func_t)(u32 state[5], const void *data,
+					     size_t num_blocks);
+
+static void
+dispatch_sha1_transform_blocks(u32 state[5], const void *data,
+			       size_t num_blocks);
+
+/* The fastest implementation of sha1_transform_blocks() supported by the
+ * processor.  This is selected on first use.  */
+static volatile sha1_transform_blocks_func_t sha1_transform_blocks_impl =
+	dispatch_sha1_transform_blocks;
+
+static sha1_transform_blocks_func_t
+get_sha1_transform_blocks_func(void)
+{
+#if HAVE_SHA1_X86_IMPLS
+	if (x86_have_cpu_feature(X86_CPU_FEATURE_SHA) &&
+	    x86_have_cpu_feature(X86_CPU_FEATURE_SSE4_1))
+		return sha1_transform_blocks_x86_sha;
+#endif
+#if HAVE_SHA1_ARM_IMPL
+	return sha1_transform_blocks_arm;
+#endif
+	return sha1_transform_blocks_generic;
+}
+
+static void
+dispatch_sha1_transform_blocks(u32 state[5], const void *data,
+			       size_t num_blocks)
+{
+	sha1_transform_blocks_func_t f = get_sha1_transform_blocks_func();
+
+	sha1_transform_blocks_impl = f;
+	f(state, data, num_blocks);
+}
+
+static forceinline void
+sha1_transform_blocks(u32 state[5], const void *data, size_t num_blocks)
+{
+	sha1_transform_blocks_impl(state, data, num_blocks);
+}
+
 /* Initializes the specified SHA-1 context.
  *
  * After sha1_init(), call sha1_update() zero or more times to provide the data
@@ -225,6 +559,68 @@ sha1_final(u8 md[20], SHA_CTX *ctx)
 		store_be32_unaligned(cpu_to_be32(ctx->state[i]), &md[i * 4]);
 }
 
+/* Return the number of messages that sha1_update_multi() hashes at once, or 1
+ * if it just hashes them one at a time.  Callers can use this to decide whether
+ * it's worthwhile to arrange for several messages to be hashed together.  */
+unsigned
+sha1_multi_lanes(void)
+{
+#if HAVE_SHA1_X86_IMPLS
+	STATIC_ASSERT(SHA1_AVX2_LANES <= SHA1_MAX_LANES);
+	if (get_sha1_transform_blocks_func() == sha1_transform_blocks_generic &&
+	    x86_have_cpu_feature(X86_CPU_FEATURE_AVX2))
+		return SHA1_AVX2_LANES;
+#endif
+	return 1;
+}
+
+/*
+ * Updates each of the @num_ctxs SHA-1 contexts in @ctxs with @len bytes of data
+ * from the corresponding buffer in @data.  This gives the same results as
+ * calling sha1_update() on each context, but on processors where it's faster,
+ * several messages are hashed at once using SIMD instructions.  This is the
+ * case when AVX2 is available but the SHA extensions are not.  (With the SHA
+ * extensions, one message is hashed about as fast as AVX2 hashes eight.)
+ */
+void
+sha1_update_multi(SHA_CTX *ctxs[], const void * const data[], size_t len,
+		  unsigned num_ctxs)
+{
+#if HAVE_SHA1_X86_IMPLS
+	const size_t num_blocks = len / 64;
+	unsigned i;
+
+	if (num_ctxs < 2 || num_blocks == 0 || sha1_multi_lanes() == 1)
+		goto one_at_a_time;
+
+	/* All contexts must be at a block boundary.  */
+	for (i = 0; i < num_ctxs; i++)
+		if (ctxs[i]->bytecount & 63)
+			goto one_at_a_time;
+
+	for (i = 0; i < num_ctxs; i += SHA1_AVX2_LANES) {
+		const unsigned n = min(num_ctxs - i, SHA1_AVX2_LANES);
+		u32 *states[SHA1_AVX2_LANES];
+
+		for (unsigned j = 0; j < n; j++)
+			states[j] = ctxs[i + j]->state;
+		sha1_transform_blocks_x8_avx2(states,
+					      (const u8 * const *)&data[i],
+					      n, num_blocks);
+	}
+
+	for (i = 0; i < num_ctxs; i++) {
+		ctxs[i]->bytecount += num_blocks * 64;
+		sha1_update(ctxs[i], data[i] + num_blocks * 64, len & 63);
+	}
+	return;
+
+one_at_a_time:
+#endif
+	for (unsigned i = 0; i < num_ctxs; i++)
+		sha1_update(ctxs[i], data[i], len);
+}
+
 /* Calculate the SHA-1 message digest of the specified buffer.
  * @len is the buffer length in bytes.  */
 void
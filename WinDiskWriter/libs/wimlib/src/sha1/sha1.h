@@ -64,6 +64,10 @@ is_zero_hash(const u8 *hash)
 	return (hash == zero_hash || hashes_equal(hash, zero_hash));
 }
 
+/* The most messages that sha1_update_multi() hashes at once.  sha1_multi_lanes()
+ * never returns more than this.  */
+#define SHA1_MAX_LANES 8
+
 #ifdef WITH_LIBCRYPTO
 
 #include <openssl/sha.h>
@@ -78,6 +82,20 @@ sha1_buffer(const void *buffer, size_t len, u8 hash[SHA1_HASH_SIZE])
 	SHA1(buffer, len, hash);
 }
 
+static inline unsigned
+sha1_multi_lanes(void)
+{
+	return 1;
+}
+
+static inline void
+sha1_update_multi(SHA_CTX *ctxs[], const void * const data[], size_t len,
+		  unsigned num_ctxs)
+{
+	for (unsigned i = 0; i < num_ctxs; i++)
+		SHA1_Update(ctxs[i], data[i], len);
+}
+
 #else /* WITH_LIBCRYPTO */
 
 typedef struct {
@@ -92,6 +110,13 @@ sha1_init(SHA_CTX *ctx);
 extern void
 sha1_update(SHA_CTX *ctx, const void *data, size_t len);
 
+extern unsigned
+sha1_multi_lanes(void);
+
+extern void
+sha1_update_multi(SHA_CTX *ctxs[], const void * const data[], size_t len,
+		  unsigned num_ctxs);
+
 extern void
 sha1_final(u8 hash[SHA1_HASH_SIZE], SHA_CTX *ctx);
 
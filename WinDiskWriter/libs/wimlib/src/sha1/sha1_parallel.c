@@ -0,0 +1,237 @@
+/*
+ * sha1_parallel.c
+ *
+ * Calculate SHA-1 message digests on a separate thread.
+ */
+
+/*
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this file; if not, see http://www.gnu.org/licenses/.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+
+#include "wimlib.h"
+#include "error.h"
+#include "sha1_parallel.h"
+#include "util.h"
+
+/* Number of buffers through which data is passed to the hashing thread, and the
+ * size of each.  While the hashing thread works on one buffer, the caller can
+ * fill the others.  */
+#define NUM_HASH_BUFFERS	4
+#define HASH_BUFFER_SIZE	262144
+
+struct parallel_sha1_ctx {
+	/* SHA-1 context.  Updated only by the hashing thread, except when no
+	 * buffers are pending.  */
+	SHA_CTX sha_ctx;
+
+	pthread_t thread;
+	pthread_mutex_t lock;
+
+	/* Signaled when a buffer has been submitted or when the thread should
+	 * terminate.  */
+	pthread_cond_t work_avail_cond;
+
+	/* Signaled when a buffer has finished being hashed.  */
+	pthread_cond_t work_done_cond;
+
+	u8 *buffers[NUM_HASH_BUFFERS];
+	size_t buffer_lens[NUM_HASH_BUFFERS];
+
+	/* Index of the buffer being filled by the caller, and the number of
+	 * bytes in it so far.  */
+	unsigned fill_idx;
+	size_t fill_len;
+
+	/* Index of the next buffer to hash, and the number of buffers
+	 * submitted but not yet fully hashed.  */
+	unsigned hash_idx;
+	unsigned num_pending;
+
+	bool terminating;
+};
+
+static void *
+sha1_thread_proc(void *_ctx)
+{
+	struct parallel_sha1_ctx *ctx = _ctx;
+
+	pthread_mutex_lock(&ctx->lock);
+	for (;;) {
+		const u8 *buf;
+		size_t len;
+
+		while (ctx->num_pending == 0 && !ctx->terminating)
+			pthread_cond_wait(&ctx->work_avail_cond, &ctx->lock);
+		if (ctx->num_pending == 0)
+			break;
+
+		buf = ctx->buffers[ctx->hash_idx];
+		len = ctx->buffer_lens[ctx->hash_idx];
+		pthread_mutex_unlock(&ctx->lock);
+
+		sha1_update(&ctx->sha_ctx, buf, len);
+
+		pthread_mutex_lock(&ctx->lock);
+		ctx->hash_idx = (ctx->hash_idx + 1) % NUM_HASH_BUFFERS;
+		ctx->num_pending--;
+		pthread_cond_signal(&ctx->work_done_cond);
+	}
+	pthread_mutex_unlock(&ctx->lock);
+	return NULL;
+}
+
+/* Submit the buffer being filled, then wait until there is a free buffer to
+ * fill next.  */
+static void
+submit_fill_buffer(struct parallel_sha1_ctx *ctx)
+{
+	pthread_mutex_lock(&ctx->lock);
+	ctx->buffer_lens[ctx->fill_idx] = ctx->fill_len;
+	ctx->num_pending++;
+	pthread_cond_signal(&ctx->work_avail_cond);
+	while (ctx->num_pending == NUM_HASH_BUFFERS)
+		pthread_cond_wait(&ctx->work_done_cond, &ctx->lock);
+	pthread_mutex_unlock(&ctx->lock);
+
+	ctx->fill_idx = (ctx->fill_idx + 1) % NUM_HASH_BUFFERS;
+	ctx->fill_len = 0;
+}
+
+/* Wait until all submitted data has been hashed.  */
+static void
+drain(struct parallel_sha1_ctx *ctx)
+{
+	pthread_mutex_lock(&ctx->lock);
+	while (ctx->num_pending != 0)
+		pthread_cond_wait(&ctx->work_done_cond, &ctx->lock);
+	pthread_mutex_unlock(&ctx->lock);
+}
+
+int
+new_parallel_sha1_ctx(struct parallel_sha1_ctx **ctx_ret)
+{
+	struct parallel_sha1_ctx *ctx;
+	int ret;
+
+	ctx = CALLOC(1, sizeof(*ctx));
+	if (!ctx)
+		goto oom;
+
+	for (unsigned i = 0; i < NUM_HASH_BUFFERS; i++) {
+		ctx->buffers[i] = MALLOC(HASH_BUFFER_SIZE);
+		if (!ctx->buffers[i])
+			goto oom;
+	}
+
+	if (pthread_mutex_init(&ctx->lock, NULL)) {
+		WARNING_WITH_ERRNO("Failed to initialize mutex");
+		goto oom;
+	}
+	if (pthread_cond_init(&ctx->work_avail_cond, NULL)) {
+		WARNING_WITH_ERRNO("Failed to initialize condition variable");
+		goto err_destroy_lock;
+	}
+	if (pthread_cond_init(&ctx->work_done_cond, NULL)) {
+		WARNING_WITH_ERRNO("Failed to initialize condition variable");
+		goto err_destroy_work_avail_cond;
+	}
+
+	ret = pthread_create(&ctx->thread, NULL, sha1_thread_proc, ctx);
+	if (ret) {
+		errno = ret;
+		WARNING_WITH_ERRNO("Failed to create SHA-1 thread");
+		goto err_destroy_work_done_cond;
+	}
+
+	sha1_init(&ctx->sha_ctx);
+	*ctx_ret = ctx;
+	return 0;
+
+err_destroy_work_done_cond:
+	pthread_cond_destroy(&ctx->work_done_cond);
+err_destroy_work_avail_cond:
+	pthread_cond_destroy(&ctx->work_avail_cond);
+err_destroy_lock:
+	pthread_mutex_destroy(&ctx->lock);
+oom:
+	if (ctx)
+		for (unsigned i = 0; i < NUM_HASH_BUFFERS; i++)
+			FREE(ctx->buffers[i]);
+	FREE(ctx);
+	return WIMLIB_ERR_NOMEM;
+}
+
+void
+free_parallel_sha1_ctx(struct parallel_sha1_ctx *ctx)
+{
+	if (!ctx)
+		return;
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->terminating = true;
+	pthread_cond_signal(&ctx->work_avail_cond);
+	pthread_mutex_unlock(&ctx->lock);
+	pthread_join(ctx->thread, NULL);
+
+	pthread_cond_destroy(&ctx->work_done_cond);
+	pthread_cond_destroy(&ctx->work_avail_cond);
+	pthread_mutex_destroy(&ctx->lock);
+	for (unsigned i = 0; i < NUM_HASH_BUFFERS; i++)
+		FREE(ctx->buffers[i]);
+	FREE(ctx);
+}
+
+/* Start hashing a new message, discarding any data of the previous message that
+ * was not finalized.  */
+void
+parallel_sha1_init(struct parallel_sha1_ctx *ctx)
+{
+	drain(ctx);
+	ctx->fill_len = 0;
+	sha1_init(&ctx->sha_ctx);
+}
+
+void
+parallel_sha1_update(struct parallel_sha1_ctx *ctx, const void *data,
+		     size_t len)
+{
+	while (len) {
+		size_t n = min(len, HASH_BUFFER_SIZE - ctx->fill_len);
+
+		memcpy(&ctx->buffers[ctx->fill_idx][ctx->fill_len], data, n);
+		ctx->fill_len += n;
+		data += n;
+		len -= n;
+		if (ctx->fill_len == HASH_BUFFER_SIZE)
+			submit_fill_buffer(ctx);
+	}
+}
+
+/* Wait for all data to be hashed and return the message digest.  */
+void
+parallel_sha1_final(u8 hash[SHA1_HASH_SIZE], struct parallel_sha1_ctx *ctx)
+{
+	if (ctx->fill_len)
+		submit_fill_buffer(ctx);
+	drain(ctx);
+	sha1_final(hash, &ctx->sha_ctx);
+}
@@ -0,0 +1,35 @@
+/*
+ * sha1_parallel.h
+ *
+ * Calculate SHA-1 message digests on a separate thread.
+ */
+
+#ifndef _WIMLIB_SHA1_PARALLEL_H
+#define _WIMLIB_SHA1_PARALLEL_H
+
+#include "sha1.h"
+
+/* A SHA-1 context whose updates are performed asynchronously by a dedicated
+ * thread, so that hashing data can overlap with whatever the caller does with
+ * the data next.  The data passed to parallel_sha1_update() is copied, so the
+ * caller may reuse its buffer immediately.  Only one message can be hashed at a
+ * time, and the context must only be used from one thread.  */
+struct parallel_sha1_ctx;
+
+extern int
+new_parallel_sha1_ctx(struct parallel_sha1_ctx **ctx_ret);
+
+extern void
+free_parallel_sha1_ctx(struct parallel_sha1_ctx *ctx);
+
+extern void
+parallel_sha1_init(struct parallel_sha1_ctx *ctx);
+
+extern void
+parallel_sha1_update(struct parallel_sha1_ctx *ctx, const void *data,
+		     size_t len);
+
+extern void
+parallel_sha1_final(u8 hash[SHA1_HASH_SIZE], struct parallel_sha1_ctx *ctx);
+
+#endif /* _WIMLIB_SHA1_PARALLEL_H */
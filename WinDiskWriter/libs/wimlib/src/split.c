@@ -25,10 +25,15 @@
 #  include "config.h"
 #endif
 
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
 #include "wimlib.h"
 #include "alloca.h"
 #include "blob_table.h"
 #include "error.h"
+#include "file_io.h"
 #include "list.h"
 #include "metadata.h"
 #include "paths.h"
@@ -36,6 +41,7 @@
 #include "resource.h"
 #include "wim.h"
 #include "write.h"
+#include "xml.h"
 
 struct swm_part_info {
 	struct list_head blob_list;
@@ -55,6 +61,7 @@ struct swm_info {
 	unsigned num_alloc_parts;
 	u64 total_bytes;
 	u64 max_part_size;
+	const struct wim_resource_descriptor *prev_solid_rdesc;
 };
 
 static int
@@ -141,6 +148,364 @@ write_split_wim(WIMStruct *orig_wim, const tchar *swm_name,
 	return 0;
 }
 
+/* State of one part of a split WIM being written concurrently with others.  */
+struct split_part {
+	struct split_writer *writer;
+
+	/* Private copy of the original WIMStruct to write the part through.
+	 * It shares everything with the original except the output file, the
+	 * output header, the XML document (which libxml2 can't serialize from
+	 * several threads at once), and the progress function.  */
+	WIMStruct wim;
+
+	tchar *name;
+
+	/* Device of the directory the part is written to, valid while the part
+	 * is being written.  */
+	dev_t dev;
+	bool active;
+};
+
+/* State shared by the threads writing the parts of a split WIM.  */
+struct split_writer {
+	WIMStruct *orig_wim;
+	struct swm_info *swm_info;
+	struct split_part *parts;
+	int write_flags;
+	const u8 *guid;
+	unsigned max_threads_per_device;
+
+	/* The lock protects everything below.  It's also held while calling
+	 * the original WIMStruct's progress function, so that calls to it from
+	 * different parts don't overlap.  */
+	pthread_mutex_t lock;
+	pthread_cond_t part_done_cond;
+	union wimlib_progress_info progress;
+	unsigned next_part_number;
+	int error;
+};
+
+/* Can the parts of the split WIM be written on several threads at once?  This
+ * requires that writing a part only copies raw data out of the original WIM
+ * file.  Decompressing data would use the decompressors cached in the original
+ * WIMStruct, which can only be used by one thread at a time.  */
+static bool
+can_write_parts_concurrently(const WIMStruct *wim,
+			     const struct swm_info *swm_info, int write_flags)
+{
+	const struct blob_descriptor *blob;
+
+	if (write_flags & (WIMLIB_WRITE_FLAG_RECOMPRESS |
+			   WIMLIB_WRITE_FLAG_PIPABLE |
+			   WIMLIB_WRITE_FLAG_FILE_DESCRIPTOR))
+		return false;
+
+	if (wim_is_pipable(wim) ||
+	    wim->out_compression_type != wim->compression_type ||
+	    wim->out_chunk_size != wim->chunk_size)
+		return false;
+
+	for (int i = 0; i < wim->hdr.image_count; i++) {
+		blob = wim->image_metadata[i]->metadata_blob;
+		if (blob->blob_location != BLOB_IN_WIM ||
+		    blob->rdesc->wim != wim)
+			return false;
+	}
+
+	for (unsigned i = 0; i < swm_info->num_parts; i++) {
+		list_for_each_entry(blob, &swm_info->parts[i].blob_list,
+				    write_blobs_list)
+		{
+			/* Uncompressed resources need no decompressor, solid
+			 * ones are always copied raw, and other compressed
+			 * ones are copied raw if they already use the output
+			 * compression type and chunk size.  */
+			if (blob->blob_location != BLOB_IN_WIM ||
+			    blob->rdesc->wim != wim)
+				return false;
+			if (blob->rdesc->flags & WIM_RESHDR_FLAG_SOLID)
+				continue;
+			if ((blob->rdesc->flags & WIM_RESHDR_FLAG_COMPRESSED) &&
+			    (blob->rdesc->compression_type != wim->out_compression_type ||
+			     blob->rdesc->chunk_size != wim->out_chunk_size))
+				return false;
+		}
+	}
+	return true;
+}
+
+/* Progress function for the WIMStructs through which the parts are written.  */
+static enum wimlib_progress_status
+split_part_progress(enum wimlib_progress_msg msg,
+		    union wimlib_progress_info *info, void *_part)
+{
+	struct split_part *part = _part;
+	struct split_writer *w = part->writer;
+	enum wimlib_progress_status status;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->error)
+		status = WIMLIB_PROGRESS_STATUS_ABORT;
+	else
+		status = (*w->orig_wim->progfunc)(msg, info,
+						  w->orig_wim->progctx);
+	pthread_mutex_unlock(&w->lock);
+	return status;
+}
+
+/* Get the device containing the directory into which the file @path is
+ * written.  Returns false if it can't be determined.  */
+static bool
+get_part_device(const tchar *path, dev_t *dev_ret)
+{
+	size_t dir_len = path_basename(path) - path;
+	const tchar *dir = T(".");
+	tchar *buf;
+	struct stat st;
+
+	if (dir_len != 0) {
+		buf = alloca((dir_len + 1) * sizeof(tchar));
+		tmemcpy(buf, path, dir_len);
+		buf[dir_len] = T('\0');
+		dir = buf;
+	}
+	if (tstat(dir, &st))
+		return false;
+	*dev_ret = st.st_dev;
+	return true;
+}
+
+static unsigned
+num_parts_being_written_to_device(const struct split_writer *w, dev_t dev)
+{
+	unsigned count = 0;
+
+	for (unsigned i = 0; i < w->swm_info->num_parts; i++)
+		if (w->parts[i].active && w->parts[i].dev == dev)
+			count++;
+	return count;
+}
+
+/*
+ * Claim the next part that hasn't been started yet and write it.  Called with
+ * the lock held, which is dropped while the part is being written.  Returns
+ * false if there was no part left to write or if writing failed; the first
+ * error is saved in @w->error.
+ */
+static bool
+write_next_split_part(struct split_writer *w)
+{
+	struct split_part *part;
+	unsigned part_number;
+	int part_write_flags;
+	bool have_dev;
+	int ret;
+
+	if (w->error || w->next_part_number > w->swm_info->num_parts)
+		return false;
+
+	part_number = w->next_part_number++;
+	part = &w->parts[part_number - 1];
+
+	w->progress.split.cur_part_number = part_number;
+	w->progress.split.part_name = part->name;
+	ret = call_progress(w->orig_wim->progfunc,
+			    WIMLIB_PROGRESS_MSG_SPLIT_BEGIN_PART,
+			    &w->progress, w->orig_wim->progctx);
+	if (ret)
+		goto out_error;
+
+	/* The progress function may have changed the name, and with it the
+	 * destination device.  The new name is only guaranteed to be valid
+	 * until the progress function returns, so copy it.  */
+	if (w->progress.split.part_name != part->name) {
+		tchar *name = TSTRDUP(w->progress.split.part_name);
+
+		if (!name) {
+			ret = WIMLIB_ERR_NOMEM;
+			goto out_error;
+		}
+		FREE(part->name);
+		part->name = name;
+	}
+	have_dev = w->max_threads_per_device != 0 &&
+		   get_part_device(part->name, &part->dev);
+	while (have_dev && !w->error &&
+	       num_parts_being_written_to_device(w, part->dev) >=
+			w->max_threads_per_device)
+		pthread_cond_wait(&w->part_done_cond, &w->lock);
+	if (w->error)
+		return false;
+	part->active = have_dev;
+	pthread_mutex_unlock(&w->lock);
+
+	part_write_flags = w->write_flags;
+	part_write_flags |= WIMLIB_WRITE_FLAG_USE_EXISTING_TOTALBYTES;
+	if (part_number != 1)
+		part_write_flags |= WIMLIB_WRITE_FLAG_NO_METADATA;
+
+	ret = write_wim_part(&part->wim,
+			     part->name,
+			     WIMLIB_ALL_IMAGES,
+			     part_write_flags,
+			     1,
+			     part_number,
+			     w->swm_info->num_parts,
+			     &w->swm_info->parts[part_number - 1].blob_list,
+			     w->guid);
+
+	pthread_mutex_lock(&w->lock);
+	part->active = false;
+	pthread_cond_broadcast(&w->part_done_cond);
+	if (ret)
+		goto out_error;
+
+	w->progress.split.completed_bytes +=
+		w->swm_info->parts[part_number - 1].size;
+	w->progress.split.cur_part_number = part_number;
+	w->progress.split.part_name = part->name;
+	ret = call_progress(w->orig_wim->progfunc,
+			    WIMLIB_PROGRESS_MSG_SPLIT_END_PART,
+			    &w->progress, w->orig_wim->progctx);
+	if (ret)
+		goto out_error;
+	return true;
+
+out_error:
+	if (!w->error)
+		w->error = ret;
+	pthread_cond_broadcast(&w->part_done_cond);
+	return false;
+}
+
+static void *
+split_writer_thread_proc(void *_w)
+{
+	struct split_writer *w = _w;
+
+	pthread_mutex_lock(&w->lock);
+	while (write_next_split_part(w))
+		;
+	pthread_mutex_unlock(&w->lock);
+	return NULL;
+}
+
+/*
+ * Write the parts of a split WIM using up to @num_threads threads, including the
+ * calling thread.  Each part is written through its own copy of the WIMStruct,
+ * all of them reading the original WIM file with pread().  Parts are started in
+ * order, but are written to the same device by no more than
+ * @wim->max_split_threads_per_device threads at a time if that is nonzero.
+ */
+static int
+write_split_wim_concurrently(WIMStruct *orig_wim, const tchar *swm_name,
+			     struct swm_info *swm_info, int write_flags,
+			     unsigned num_threads)
+{
+	struct split_writer w;
+	const tchar *dot;
+	size_t swm_base_name_len;
+	size_t name_size;
+	pthread_t *threads;
+	unsigned num_started_threads = 0;
+	unsigned num_parts_set_up = 0;
+	u8 guid[GUID_SIZE];
+	int ret;
+
+	memset(&w, 0, sizeof(w));
+	w.orig_wim = orig_wim;
+	w.swm_info = swm_info;
+	w.write_flags = write_flags;
+	w.guid = guid;
+	w.max_threads_per_device = orig_wim->max_split_threads_per_device;
+	w.next_part_number = 1;
+
+	w.progress.split.completed_bytes = 0;
+	w.progress.split.total_bytes = 0;
+	for (unsigned i = 0; i < swm_info->num_parts; i++)
+		w.progress.split.total_bytes += swm_info->parts[i].size;
+	w.progress.split.total_parts = swm_info->num_parts;
+
+	generate_guid(guid);
+
+	dot = tstrrchr(path_basename(swm_name), T('.'));
+	swm_base_name_len = dot ? dot - swm_name : tstrlen(swm_name);
+	name_size = (tstrlen(swm_name) + 20) * sizeof(tchar);
+
+	threads = MALLOC((num_threads - 1) * sizeof(threads[0]));
+	w.parts = CALLOC(swm_info->num_parts, sizeof(w.parts[0]));
+	ret = WIMLIB_ERR_NOMEM;
+	if (!threads || !w.parts)
+		goto out_free;
+
+	for (unsigned i = 0; i < swm_info->num_parts; i++) {
+		struct split_part *part = &w.parts[i];
+
+		part->writer = &w;
+		part->wim = *orig_wim;
+		filedes_invalidate(&part->wim.out_fd);
+		if (orig_wim->progfunc) {
+			part->wim.progfunc = split_part_progress;
+			part->wim.progctx = part;
+		}
+		part->wim.xml_info = xml_copy_info_struct(orig_wim->xml_info);
+		part->name = MALLOC(name_size);
+		if (!part->wim.xml_info || !part->name) {
+			xml_free_info_struct(part->wim.xml_info);
+			FREE(part->name);
+			goto out_free_parts;
+		}
+		num_parts_set_up++;
+
+		tstrcpy(part->name, swm_name);
+		if (i != 0) {
+			tsprintf(part->name + swm_base_name_len, T("%u%"TS),
+				 i + 1, dot ? dot : T(""));
+		}
+	}
+
+	if (pthread_mutex_init(&w.lock, NULL)) {
+		ERROR_WITH_ERRNO("Failed to initialize mutex");
+		goto out_free_parts;
+	}
+	if (pthread_cond_init(&w.part_done_cond, NULL)) {
+		ERROR_WITH_ERRNO("Failed to initialize condition variable");
+		goto out_destroy_lock;
+	}
+
+	while (num_started_threads < num_threads - 1) {
+		int err = pthread_create(&threads[num_started_threads], NULL,
+					 split_writer_thread_proc, &w);
+		if (err) {
+			errno = err;
+			WARNING_WITH_ERRNO("Failed to create split WIM writer "
+					   "thread");
+			break;
+		}
+		num_started_threads++;
+	}
+
+	split_writer_thread_proc(&w);
+
+	for (unsigned i = 0; i < num_started_threads; i++)
+		pthread_join(threads[i], NULL);
+	pthread_cond_destroy(&w.part_done_cond);
+
+	ret = w.error;
+
+out_destroy_lock:
+	pthread_mutex_destroy(&w.lock);
+out_free_parts:
+	for (unsigned i = 0; i < num_parts_set_up; i++) {
+		xml_free_info_struct(w.parts[i].wim.xml_info);
+		FREE(w.parts[i].name);
+	}
+out_free:
+	FREE(w.parts);
+	FREE(threads);
+	return ret;
+}
+
 static int
 start_new_swm_part(struct swm_info *swm_info)
 {
@@ -166,17 +531,52 @@ start_new_swm_part(struct swm_info *swm_info)
 	return 0;
 }
 
+/* Get the number of bytes @blob takes up in a split WIM part.  */
+static u64
+swm_blob_stored_size(const struct blob_descriptor *blob)
+{
+	if (blob->blob_location == BLOB_IN_WIM)
+		return blob->rdesc->size_in_wim;
+	return blob->size;
+}
+
+/*
+ * A solid resource is copied into a split WIM part as a whole, so all the blobs
+ * it contains must go into the same part, and its size must only be counted
+ * once.  The blobs are visited in sequential order, so the blobs of each solid
+ * resource come one after another.  Return true if @blob is in the same solid
+ * resource as the blob visited before it, and remember its resource otherwise.
+ */
+static bool
+blob_continues_solid_resource(const struct blob_descriptor *blob,
+			      const struct wim_resource_descriptor **prev_rdesc)
+{
+	const struct wim_resource_descriptor *rdesc = NULL;
+
+	if (blob->blob_location == BLOB_IN_WIM &&
+	    (blob->rdesc->flags & WIM_RESHDR_FLAG_SOLID))
+		rdesc = blob->rdesc;
+
+	if (rdesc && rdesc == *prev_rdesc)
+		return true;
+	*prev_rdesc = rdesc;
+	return false;
+}
+
 static int
 add_blob_to_swm(struct blob_descriptor *blob, void *_swm_info)
 {
 	struct swm_info *swm_info = _swm_info;
-	u64 blob_stored_size;
+	u64 blob_stored_size = swm_blob_stored_size(blob);
 	int ret;
 
-	if (blob->blob_location == BLOB_IN_WIM)
-		blob_stored_size = blob->rdesc->size_in_wim;
-	else
-		blob_stored_size = blob->size;
+	/* The rest of a solid resource goes into the part its first blob went
+	 * into, and takes up no further space there.  */
+	if (blob_continues_solid_resource(blob, &swm_info->prev_solid_rdesc)) {
+		list_add_tail(&blob->write_blobs_list,
+			      &swm_info->parts[swm_info->num_parts - 1].blob_list);
+		return 0;
+	}
 
 	/* Start the next part if adding this blob exceeds the maximum part
 	 * size, UNLESS the blob is metadata or if no blobs at all have been
@@ -199,60 +599,258 @@ add_blob_to_swm(struct blob_descriptor *blob, void *_swm_info)
 	return 0;
 }
 
-/* API function documented in wimlib.h  */
-WIMLIBAPI int
-wimlib_split(WIMStruct *wim, const tchar *swm_name,
-	     u64 part_size, int write_flags)
+/* The stored sizes of the blobs that go into a split WIM, in the order
+ * add_blob_to_swm() is given them, except for the metadata blobs which always
+ * go into the first part together.  Each solid resource has a single entry.  */
+struct swm_blob_sizes {
+	u64 metadata_size;
+	u64 *sizes;
+	size_t num_sizes;
+	size_t num_alloc_sizes;
+	const struct wim_resource_descriptor *prev_solid_rdesc;
+};
+
+static int
+add_blob_size(struct blob_descriptor *blob, void *_bs)
+{
+	struct swm_blob_sizes *bs = _bs;
+
+	if (blob_continues_solid_resource(blob, &bs->prev_solid_rdesc))
+		return 0;
+
+	if (bs->num_sizes == bs->num_alloc_sizes) {
+		size_t num_alloc_sizes = max(bs->num_alloc_sizes * 2, 1024);
+		u64 *sizes = REALLOC(bs->sizes,
+				     num_alloc_sizes * sizeof(sizes[0]));
+		if (!sizes)
+			return WIMLIB_ERR_NOMEM;
+		bs->sizes = sizes;
+		bs->num_alloc_sizes = num_alloc_sizes;
+	}
+	bs->sizes[bs->num_sizes++] = swm_blob_stored_size(blob);
+	return 0;
+}
+
+/* Count the parts add_blob_to_swm() creates for the given maximum part size.  */
+static unsigned
+count_swm_parts(const struct swm_blob_sizes *bs, u64 max_part_size)
+{
+	unsigned num_parts = 1;
+	u64 part_size = bs->metadata_size;
+
+	for (size_t i = 0; i < bs->num_sizes; i++) {
+		if (part_size + bs->sizes[i] >= max_part_size && part_size != 0) {
+			num_parts++;
+			part_size = 0;
+		}
+		part_size += bs->sizes[i];
+	}
+	return num_parts;
+}
+
+/*
+ * Choose the maximum part size to give add_blob_to_swm() so that the parts come
+ * out as even in size as possible, without using more parts than necessary.
+ *
+ * The blobs aren't reordered, so that each part is still read from a single
+ * region of the WIM file in sequential order.  Instead, this finds the smallest
+ * maximum part size, not larger than @part_size, that still needs no more parts
+ * than @part_size does, or than @num_parts if that's more.  The parts before
+ * the last one then all end up about as large as the largest part has to be.
+ */
+static int
+get_balanced_part_size(WIMStruct *wim, u64 part_size, unsigned num_parts,
+		       u64 *part_size_ret)
+{
+	struct swm_blob_sizes bs = {
+		.sizes = NULL,
+	};
+	unsigned target_num_parts;
+	u64 low, high;
+	int ret;
+
+	for (int i = 0; i < wim->hdr.image_count; i++) {
+		bs.metadata_size += swm_blob_stored_size(
+				wim->image_metadata[i]->metadata_blob);
+	}
+
+	ret = for_blob_in_table_sorted_by_sequential_order(wim->blob_table,
+							   add_blob_size, &bs);
+	if (ret)
+		goto out;
+
+	target_num_parts = max(count_swm_parts(&bs, part_size), num_parts);
+
+	low = 1;
+	high = part_size;
+	while (low < high) {
+		u64 mid = low + (high - low) / 2;
+
+		if (count_swm_parts(&bs, mid) <= target_num_parts)
+			high = mid;
+		else
+			low = mid + 1;
+	}
+	*part_size_ret = low;
+out:
+	FREE(bs.sizes);
+	return ret;
+}
+
+/* Decide which blobs go into which part of the split WIM.  On success or
+ * failure, the caller must free @swm_info->parts.  */
+static int
+plan_split(WIMStruct *wim, u64 part_size, unsigned num_parts, int split_flags,
+	   struct swm_info *swm_info)
 {
-    
-	struct swm_info swm_info;
 	unsigned i;
 	int ret;
 
-	if (swm_name == NULL || swm_name[0] == T('\0') || part_size == 0)
+	memset(swm_info, 0, sizeof(*swm_info));
+
+	if (part_size == 0)
 		return WIMLIB_ERR_INVALID_PARAM;
 
-	if (write_flags & ~WIMLIB_WRITE_MASK_PUBLIC)
+	if (split_flags & ~WIMLIB_SPLIT_FLAG_BALANCED)
 		return WIMLIB_ERR_INVALID_PARAM;
 
 	if (!wim_has_metadata(wim))
 		return WIMLIB_ERR_METADATA_NOT_FOUND;
 
-	if (wim_has_solid_resources(wim)) {
-		ERROR("Splitting of WIM containing solid resources is not supported.\n"
-		      "        Export it in non-solid format first.");
-		return WIMLIB_ERR_UNSUPPORTED;
-	}
-
+	/* The blobs are copied from the on-disk WIM file as-is, so the images
+	 * themselves must be unmodified.  Changed image properties are fine,
+	 * though: the in-memory XML data is written to every part, which lets
+	 * a WIM be patched and split in a single pass without overwriting it
+	 * first.  */
 	for (i = 0; i < wim->hdr.image_count; i++) {
 		if (!is_image_unchanged_from_wim(wim->image_metadata[i], wim)) {
-			ERROR("Only an unmodified, on-disk WIM file can be split.");
+			ERROR("Only a WIM file with unmodified images can be split.");
 			return WIMLIB_ERR_UNSUPPORTED;
 		}
 	}
 
-	memset(&swm_info, 0, sizeof(swm_info));
-	swm_info.max_part_size = part_size;
+	if (split_flags & WIMLIB_SPLIT_FLAG_BALANCED) {
+		ret = get_balanced_part_size(wim, part_size, num_parts,
+					     &part_size);
+		if (ret)
+			return ret;
+	}
+
+	swm_info->max_part_size = part_size;
 
-	ret = start_new_swm_part(&swm_info);
+	ret = start_new_swm_part(swm_info);
 	if (ret)
-		goto out_free_swm_info;
+		return ret;
 
 	for (i = 0; i < wim->hdr.image_count; i++) {
 		ret = add_blob_to_swm(wim->image_metadata[i]->metadata_blob,
-				      &swm_info);
+				      swm_info);
 		if (ret)
-			goto out_free_swm_info;
+			return ret;
 	}
 
-	ret = for_blob_in_table_sorted_by_sequential_order(wim->blob_table,
-							   add_blob_to_swm,
-							   &swm_info);
+	return for_blob_in_table_sorted_by_sequential_order(wim->blob_table,
+							    add_blob_to_swm,
+							    swm_info);
+}
+
+static int
+split_wim(WIMStruct *wim, const tchar *swm_name, u64 part_size,
+	  unsigned num_parts, int split_flags, int write_flags)
+{
+	struct swm_info swm_info;
+	unsigned num_threads;
+	bool has_solid_resources;
+	int ret;
+
+	if (swm_name == NULL || swm_name[0] == T('\0'))
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	if (write_flags & ~WIMLIB_WRITE_MASK_PUBLIC)
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	has_solid_resources = wim_has_solid_resources(wim);
+
+	if ((write_flags & WIMLIB_WRITE_FLAG_PIPABLE) && has_solid_resources) {
+		ERROR("A WIM containing solid resources can't be split into "
+		      "pipable parts.");
+		return WIMLIB_ERR_UNSUPPORTED;
+	}
+
+	ret = plan_split(wim, part_size, num_parts, split_flags, &swm_info);
+	if (ret)
+		goto out_free_swm_info;
+
+	/* Copy solid resources into the parts unchanged, rather than
+	 * recompressing them or any other resources into new solid
+	 * resources.  */
+	write_flags |= WIMLIB_WRITE_FLAG_KEEP_RESOURCES;
+
+	/* Decide on the WIM version of the parts here, since the blob table
+	 * can't be scanned by write_wim_part() while other threads are writing
+	 * parts from it.  */
+	if (has_solid_resources)
+		write_flags |= WIMLIB_WRITE_FLAG_SOLID_VERSION;
+
+	num_threads = min(max(wim->num_split_threads, 1), swm_info.num_parts);
+	if (num_threads > 1 &&
+	    can_write_parts_concurrently(wim, &swm_info, write_flags))
+		ret = write_split_wim_concurrently(wim, swm_name, &swm_info,
+						   write_flags, num_threads);
+	else
+		ret = write_split_wim(wim, swm_name, &swm_info, write_flags);
+out_free_swm_info:
+	FREE(swm_info.parts);
+	return ret;
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI int
+wimlib_split(WIMStruct *wim, const tchar *swm_name,
+	     u64 part_size, int write_flags)
+{
+	return split_wim(wim, swm_name, part_size, 0, 0, write_flags);
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI int
+wimlib_split_balanced(WIMStruct *wim, const tchar *swm_name,
+		      u64 part_size, unsigned num_parts, int write_flags)
+{
+	return split_wim(wim, swm_name, part_size, num_parts,
+			 WIMLIB_SPLIT_FLAG_BALANCED, write_flags);
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI int
+wimlib_plan_split(WIMStruct *wim, u64 part_size, unsigned num_parts,
+		  int split_flags, u64 *part_sizes, unsigned *num_parts_ret)
+{
+	struct swm_info swm_info;
+	int ret;
+
+	if (num_parts_ret == NULL)
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	ret = plan_split(wim, part_size, num_parts, split_flags, &swm_info);
 	if (ret)
 		goto out_free_swm_info;
 
-	ret = write_split_wim(wim, swm_name, &swm_info, write_flags);
+	if (part_sizes) {
+		for (unsigned i = 0; i < swm_info.num_parts; i++)
+			part_sizes[i] = swm_info.parts[i].size;
+	}
+	*num_parts_ret = swm_info.num_parts;
 out_free_swm_info:
 	FREE(swm_info.parts);
 	return ret;
 }
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI void
+wimlib_set_split_threads(WIMStruct *wim, unsigned num_threads,
+			 unsigned max_threads_per_device)
+{
+	wim->num_split_threads = num_threads;
+	wim->max_split_threads_per_device = max_threads_per_device;
+}
@@ -0,0 +1,456 @@
+/*
+ * benchmark.c - Benchmarking of the compressors and decompressors
+ */
+
+/*
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this file; if not, see http://www.gnu.org/licenses/.
+ */
+
+/*
+ * This file contains code for measuring the speed, compression ratio, and
+ * memory usage of each compression format on a set of corpus files.  Like the
+ * rest of the test support code, it is only compiled when the library is
+ * configured with --enable-test-support, which here is the "wimlib-tests"
+ * command-line target (tests/wimlib_tests.c).
+ *
+ * Each corpus file is cut into chunks of the chunk size being measured, and the
+ * chunks are compressed and decompressed independently, the same way the
+ * chunks of a WIM resource are.  A chunk that doesn't compress is stored
+ * uncompressed, again like in a WIM resource, so that the ratio reflects what
+ * would actually be written.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#ifdef ENABLE_TEST_SUPPORT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "wimlib.h"
+#include "error.h"
+#include "file_io.h"
+#include "test_support.h"
+#include "util.h"
+
+/* The smallest and largest chunk sizes measured.  Chunk sizes the compressor
+ * doesn't support are skipped.  */
+#define BENCHMARK_MIN_CHUNK_SIZE	32768
+#define BENCHMARK_MAX_CHUNK_SIZE	67108864
+
+/* Each measurement is repeated until it has taken at least this long, so that
+ * the speeds of small corpus files aren't lost in the timer resolution.  */
+#define BENCHMARK_MIN_USEC		250000
+
+static const enum wimlib_compression_type benchmark_ctypes[] = {
+	WIMLIB_COMPRESSION_TYPE_XPRESS,
+	WIMLIB_COMPRESSION_TYPE_LZX,
+	WIMLIB_COMPRESSION_TYPE_LZMS,
+};
+
+static const unsigned benchmark_levels[] = {
+	20, 50, 100,
+};
+
+/*----------------------------------------------------------------------------*
+ *                          Memory usage accounting                           *
+ *----------------------------------------------------------------------------*/
+
+/* Allocations are prefixed with their size.  The prefix is kept as large as the
+ * alignment malloc() guarantees, so that the returned memory is still aligned.
+ */
+#define ALLOC_HEADER_SIZE	16
+
+static size_t cur_allocated;
+static size_t peak_allocated;
+
+static void
+account_allocation(size_t old_size, size_t new_size)
+{
+	cur_allocated = cur_allocated - old_size + new_size;
+	if (cur_allocated > peak_allocated)
+		peak_allocated = cur_allocated;
+}
+
+static void *
+counting_malloc(size_t size)
+{
+	u8 *p = malloc(ALLOC_HEADER_SIZE + size);
+
+	if (!p)
+		return NULL;
+	*(size_t *)p = size;
+	account_allocation(0, size);
+	return p + ALLOC_HEADER_SIZE;
+}
+
+static void
+counting_free(void *ptr)
+{
+	u8 *p;
+
+	if (!ptr)
+		return;
+	p = (u8 *)ptr - ALLOC_HEADER_SIZE;
+	account_allocation(*(size_t *)p, 0);
+	free(p);
+}
+
+static void *
+counting_realloc(void *ptr, size_t size)
+{
+	u8 *p;
+	size_t old_size;
+
+	if (!ptr)
+		return counting_malloc(size);
+	p = (u8 *)ptr - ALLOC_HEADER_SIZE;
+	old_size = *(size_t *)p;
+	p = realloc(p, ALLOC_HEADER_SIZE + size);
+	if (!p)
+		return NULL;
+	*(size_t *)p = size;
+	account_allocation(old_size, size);
+	return p + ALLOC_HEADER_SIZE;
+}
+
+/* Start measuring the peak memory usage above the current usage.  */
+static void
+reset_peak_allocated(void)
+{
+	peak_allocated = cur_allocated;
+}
+
+/*----------------------------------------------------------------------------*
+ *                               Measurement                                  *
+ *----------------------------------------------------------------------------*/
+
+struct benchmark_corpus {
+	const tchar *path;
+	const u8 *data;
+	size_t size;
+};
+
+/* A corpus file cut into chunks, and the compressed form of each chunk  */
+struct benchmark_chunks {
+	u32 chunk_size;
+	size_t num_chunks;
+	u8 *cbuf;
+	u32 *csizes;
+};
+
+struct benchmark_result {
+	u64 compressed_size;
+	double compress_mbps;
+	double decompress_mbps;
+	u64 compressor_memory;
+	u64 decompressor_memory;
+};
+
+static u64
+now_usec(void)
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (u64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static size_t
+chunk_usize(const struct benchmark_corpus *corpus,
+	    const struct benchmark_chunks *chunks, size_t i)
+{
+	return min(corpus->size - i * chunks->chunk_size, chunks->chunk_size);
+}
+
+static double
+mbps(u64 bytes, u64 usec)
+{
+	return (double)bytes / (double)max(usec, 1);
+}
+
+static void
+compress_chunks(struct wimlib_compressor *c,
+		const struct benchmark_corpus *corpus,
+		struct benchmark_chunks *chunks)
+{
+	for (size_t i = 0; i < chunks->num_chunks; i++) {
+		const u8 *in = corpus->data + i * chunks->chunk_size;
+		u8 *out = chunks->cbuf + i * chunks->chunk_size;
+		size_t usize = chunk_usize(corpus, chunks, i);
+		size_t csize = 0;
+
+		if (usize > 1)
+			csize = wimlib_compress(in, usize, out, usize - 1, c);
+		if (csize == 0) {
+			memcpy(out, in, usize);
+			csize = usize;
+		}
+		chunks->csizes[i] = csize;
+	}
+}
+
+static int
+decompress_chunks(struct wimlib_decompressor *d,
+		  const struct benchmark_corpus *corpus,
+		  const struct benchmark_chunks *chunks, u8 *ubuf)
+{
+	for (size_t i = 0; i < chunks->num_chunks; i++) {
+		const u8 *in = chunks->cbuf + i * chunks->chunk_size;
+		u8 *out = ubuf + i * chunks->chunk_size;
+		size_t usize = chunk_usize(corpus, chunks, i);
+
+		if (chunks->csizes[i] == usize)
+			memcpy(out, in, usize);
+		else if (wimlib_decompress(in, chunks->csizes[i],
+					   out, usize, d))
+			return WIMLIB_ERR_DECOMPRESSION;
+	}
+	return 0;
+}
+
+/* Compress and decompress @corpus with the specified compression format, chunk
+ * size, and compression level, and verify that the data survives the round
+ * trip.  @ubuf is a scratch buffer as large as the corpus file.  */
+static int
+benchmark_one(const struct benchmark_corpus *corpus,
+	      enum wimlib_compression_type ctype, unsigned level,
+	      struct benchmark_chunks *chunks, u8 *ubuf,
+	      struct benchmark_result *result)
+{
+	struct wimlib_compressor *c;
+	struct wimlib_decompressor *d;
+	u64 start, elapsed;
+	u64 passes;
+	int ret;
+
+	reset_peak_allocated();
+	ret = wimlib_create_compressor(ctype, chunks->chunk_size, level, &c);
+	if (ret)
+		return ret;
+	passes = 0;
+	start = now_usec();
+	do {
+		compress_chunks(c, corpus, chunks);
+		passes++;
+		elapsed = now_usec() - start;
+	} while (elapsed < BENCHMARK_MIN_USEC);
+	wimlib_free_compressor(c);
+	result->compressor_memory = peak_allocated - cur_allocated;
+	result->compress_mbps = mbps(passes * corpus->size, elapsed);
+
+	result->compressed_size = 0;
+	for (size_t i = 0; i < chunks->num_chunks; i++)
+		result->compressed_size += chunks->csizes[i];
+
+	reset_peak_allocated();
+	ret = wimlib_create_decompressor(ctype, chunks->chunk_size, &d);
+	if (ret)
+		return ret;
+	passes = 0;
+	start = now_usec();
+	do {
+		ret = decompress_chunks(d, corpus, chunks, ubuf);
+		if (ret)
+			break;
+		passes++;
+		elapsed = now_usec() - start;
+	} while (elapsed < BENCHMARK_MIN_USEC);
+	wimlib_free_decompressor(d);
+	if (ret)
+		return ret;
+	result->decompressor_memory = peak_allocated - cur_allocated;
+	result->decompress_mbps = mbps(passes * corpus->size, elapsed);
+
+	if (memcmp(ubuf, corpus->data, corpus->size))
+		return WIMLIB_ERR_DECOMPRESSION;
+	return 0;
+}
+
+static int
+benchmark_corpus(const struct benchmark_corpus *corpus, FILE *out)
+{
+	u8 *ubuf;
+	int ret = 0;
+
+	ubuf = MALLOC(max(corpus->size, 1));
+	if (!ubuf)
+		return WIMLIB_ERR_NOMEM;
+
+	for (u32 chunk_size = BENCHMARK_MIN_CHUNK_SIZE;
+	     chunk_size <= BENCHMARK_MAX_CHUNK_SIZE; chunk_size <<= 1)
+	{
+		struct benchmark_chunks chunks = {
+			.chunk_size = chunk_size,
+			.num_chunks = DIV_ROUND_UP(corpus->size, chunk_size),
+		};
+
+		/* Chunks larger than the corpus file would all measure the
+		 * same thing.  */
+		if (chunk_size > BENCHMARK_MIN_CHUNK_SIZE &&
+		    chunk_size / 2 >= corpus->size)
+			break;
+
+		chunks.cbuf = MALLOC(max(chunks.num_chunks * chunk_size, 1));
+		chunks.csizes = MALLOC(max(chunks.num_chunks, 1) *
+				       sizeof(chunks.csizes[0]));
+		if (!chunks.cbuf || !chunks.csizes) {
+			ret = WIMLIB_ERR_NOMEM;
+			goto next_chunk_size;
+		}
+
+		for (size_t i = 0; i < ARRAY_LEN(benchmark_ctypes); i++) {
+			enum wimlib_compression_type ctype = benchmark_ctypes[i];
+
+			for (size_t j = 0; j < ARRAY_LEN(benchmark_levels); j++) {
+				unsigned level = benchmark_levels[j];
+				struct benchmark_result result;
+
+				/* Skip chunk sizes the format doesn't
+				 * support.  */
+				if (wimlib_get_compressor_needed_memory(
+						ctype, chunk_size, level) == 0)
+					continue;
+
+				ret = benchmark_one(corpus, ctype, level,
+						    &chunks, ubuf, &result);
+				if (ret == WIMLIB_ERR_INVALID_PARAM) {
+					ret = 0;
+					continue;
+				}
+				if (ret) {
+					ERROR("%"TS": %"TS" round trip failed "
+					      "(chunk size %"PRIu32", level %u)",
+					      corpus->path,
+					      wimlib_get_compression_type_string(ctype),
+					      chunk_size, level);
+					goto next_chunk_size;
+				}
+				tfprintf(out,
+					 T("%"TS"\t%"TS"\t%"PRIu32"\t%u\t%zu\t"
+					   "%"PRIu64"\t%.4f\t%.2f\t%.2f\t"
+					   "%"PRIu64"\t%"PRIu64"\n"),
+					 corpus->path,
+					 wimlib_get_compression_type_string(ctype),
+					 chunk_size, level, corpus->size,
+					 result.compressed_size,
+					 (double)result.compressed_size /
+						(double)max(corpus->size, 1),
+					 result.compress_mbps,
+					 result.decompress_mbps,
+					 result.compressor_memory,
+					 result.decompressor_memory);
+				fflush(out);
+			}
+		}
+	next_chunk_size:
+		FREE(chunks.csizes);
+		FREE(chunks.cbuf);
+		if (ret)
+			break;
+	}
+	FREE(ubuf);
+	return ret;
+}
+
+static int
+read_corpus_file(const tchar *path, struct benchmark_corpus *corpus)
+{
+	int raw_fd;
+	struct filedes fd;
+	struct stat st;
+	void *buf;
+	int ret;
+
+	raw_fd = topen(path, O_RDONLY | O_BINARY);
+	if (raw_fd < 0) {
+		ERROR_WITH_ERRNO("Can't open \"%"TS"\"", path);
+		return WIMLIB_ERR_OPEN;
+	}
+	if (fstat(raw_fd, &st)) {
+		ERROR_WITH_ERRNO("Can't stat \"%"TS"\"", path);
+		close(raw_fd);
+		return WIMLIB_ERR_STAT;
+	}
+	if ((size_t)st.st_size != st.st_size ||
+	    (buf = MALLOC(max(st.st_size, 1))) == NULL)
+	{
+		close(raw_fd);
+		ERROR("Not enough memory to read \"%"TS"\"", path);
+		return WIMLIB_ERR_NOMEM;
+	}
+
+	filedes_init(&fd, raw_fd);
+	ret = full_read(&fd, buf, st.st_size);
+	filedes_close(&fd);
+	if (ret) {
+		ERROR_WITH_ERRNO("Error reading \"%"TS"\"", path);
+		FREE(buf);
+		return ret;
+	}
+
+	corpus->path = path;
+	corpus->data = buf;
+	corpus->size = st.st_size;
+	return 0;
+}
+
+WIMLIBAPI int
+wimlib_benchmark_codecs(const tchar * const *corpus_paths,
+			unsigned num_corpus_paths, FILE *out)
+{
+	int ret = 0;
+
+	if (!corpus_paths || !out)
+		return WIMLIB_ERR_INVALID_PARAM;
+
+	ret = wimlib_global_init(0);
+	if (ret)
+		return ret;
+
+	/* Route the library's allocations through the counting allocator for
+	 * the duration of the benchmark.  Nothing allocated before is freed
+	 * until afterwards, and nothing allocated during is kept.  */
+	wimlib_set_memory_allocator(counting_malloc, counting_free,
+				    counting_realloc);
+
+	tfprintf(out, T("corpus\tcompression_type\tchunk_size\tlevel\t"
+			"uncompressed_size\tcompressed_size\tratio\t"
+			"compress_mbps\tdecompress_mbps\t"
+			"compressor_memory\tdecompressor_memory\n"));
+
+	for (unsigned i = 0; i < num_corpus_paths; i++) {
+		struct benchmark_corpus corpus;
+
+		ret = read_corpus_file(corpus_paths[i], &corpus);
+		if (ret)
+			break;
+		ret = benchmark_corpus(&corpus, out);
+		FREE((void *)corpus.data);
+		if (ret)
+			break;
+	}
+
+	wimlib_set_memory_allocator(NULL, NULL, NULL);
+	return ret;
+}
+
+#endif /* ENABLE_TEST_SUPPORT */
@@ -40,6 +40,7 @@
 #include <unistd.h>
 
 #include "wimlib.h"
+#include "blob_table.h"
 #include "endianness.h"
 #include "encoding.h"
 #include "metadata.h"
@@ -1681,4 +1682,138 @@ wimlib_compare_images(WIMStruct *wim1, int image1,
 	return ret;
 }
 
+/*----------------------------------------------------------------------------*
+ *                       Staging file chunk bookkeeping                       *
+ *----------------------------------------------------------------------------*/
+
+#define STAGING_TEST_MAX_SIZE	(8 * STAGING_CHUNK_SIZE)
+
+/*
+ * Simulate a staging file that was created from original data of @orig_size
+ * bytes without copying any, then make @num_writes writes to it the same way
+ * wimfs_write() does: copy the edges given by staging_edges_to_copy(), write,
+ * then call staging_mark_written().  Afterwards, check that reading the staged
+ * data through staging_data_run() gives back what was written, with the rest
+ * being the original data, or zeroes past its end.
+ */
+static int
+check_staging_writes(u64 orig_size, const u64 (*writes)[2],
+		     unsigned num_writes)
+{
+	static u8 orig[STAGING_TEST_MAX_SIZE];
+	static u8 file[STAGING_TEST_MAX_SIZE];
+	static u8 expected[STAGING_TEST_MAX_SIZE];
+	struct staging_base *base;
+	u64 size = orig_size;
+	int ret = 0;
+
+	base = CALLOC(1, sizeof(*base) +
+			 DIV_ROUND_UP(DIV_ROUND_UP(orig_size,
+						   STAGING_CHUNK_SIZE), 8));
+	if (!base)
+		return WIMLIB_ERR_NOMEM;
+	base->size = orig_size;
+
+	for (u64 i = 0; i < STAGING_TEST_MAX_SIZE; i++)
+		orig[i] = 1 + (i % 251);
+	memset(file, 0, sizeof(file));
+	memset(expected, 0, sizeof(expected));
+	memcpy(expected, orig, orig_size);
+
+	for (unsigned i = 0; i < num_writes; i++) {
+		u64 start = writes[i][0];
+		u64 end = start + writes[i][1];
+		u64 ranges[2][2];
+		unsigned num_ranges;
+
+		num_ranges = staging_edges_to_copy(base, start, end, ranges);
+		for (unsigned j = 0; j < num_ranges; j++)
+			memcpy(&file[ranges[j][0]], &orig[ranges[j][0]],
+			       ranges[j][1] - ranges[j][0]);
+		memset(&file[start], 0x80 + i, end - start);
+		memset(&expected[start], 0x80 + i, end - start);
+		staging_mark_written(base, start, end);
+		size = max(size, end);
+	}
+
+	for (u64 offset = 0; offset < size && !ret; ) {
+		bool in_staging_file;
+		u64 len = staging_data_run(base, offset, size, &in_staging_file);
+
+		if (memcmp(in_staging_file ? &file[offset] : &orig[offset],
+			   &expected[offset], len))
+		{
+			ERROR("Staged data of original size %"PRIu64" is wrong "
+			      "in [%"PRIu64", %"PRIu64")",
+			      orig_size, offset, offset + len);
+			ret = WIMLIB_ERR_TEST_FAILED;
+		}
+		offset += len;
+	}
+	FREE(base);
+	return ret;
+}
+
+WIMLIBAPI int
+wimlib_test_staging_writes(void)
+{
+	static const u64 orig_sizes[] = {
+		1, 40000, 2 * STAGING_CHUNK_SIZE, 100000,
+	};
+	u64 writes[64][2];
+	int ret;
+
+	for (size_t i = 0; i < ARRAY_LEN(orig_sizes); i++) {
+		const u64 n = orig_sizes[i];
+
+		/* Appending  */
+		writes[0][0] = n;
+		writes[0][1] = 10;
+		ret = check_staging_writes(n, writes, 1);
+		if (ret)
+			return ret;
+
+		/* Appending repeatedly, across chunk boundaries  */
+		for (unsigned j = 0; j < 8; j++) {
+			writes[j][0] = n + j * 5000;
+			writes[j][1] = 5000;
+		}
+		ret = check_staging_writes(n, writes, 8);
+		if (ret)
+			return ret;
+
+		/* Writing past the end, leaving a gap  */
+		writes[0][0] = n + 3 * STAGING_CHUNK_SIZE / 2;
+		writes[0][1] = 100;
+		ret = check_staging_writes(n, writes, 1);
+		if (ret)
+			return ret;
+
+		/* Writing across the end  */
+		writes[0][0] = n - 1;
+		writes[0][1] = STAGING_CHUNK_SIZE;
+		ret = check_staging_writes(n, writes, 1);
+		if (ret)
+			return ret;
+
+		/* Overwriting the middle of the original data, which must
+		 * copy the original data on both sides of the write  */
+		writes[0][0] = n / 3;
+		writes[0][1] = 1 + n / 4;
+		ret = check_staging_writes(n, writes, 1);
+		if (ret)
+			return ret;
+
+		/* Small writes inside and just outside the original data  */
+		for (unsigned j = 0; j < 64; j++) {
+			writes[j][0] = rand32() % (n + STAGING_CHUNK_SIZE);
+			writes[j][1] = 1 + rand32() % 4096;
+		}
+		ret = check_staging_writes(n, writes, 64);
+		if (ret)
+			return ret;
+	}
+	return 0;
+}
+
 #endif /* ENABLE_TEST_SUPPORT */
@@ -3,9 +3,12 @@
 
 #ifdef ENABLE_TEST_SUPPORT
 
+#include <stdio.h>
+
 #include "types.h"
 
 #define WIMLIB_ERR_IMAGES_ARE_DIFFERENT			200
+#define WIMLIB_ERR_TEST_FAILED				201
 
 #define WIMLIB_ADD_FLAG_GENERATE_TEST_DATA		0x08000000
 
@@ -17,6 +20,18 @@ extern int
 wimlib_compare_images(WIMStruct *wim1, int image1,
 		      WIMStruct *wim2, int image2, int cmp_flags);
 
+/* Compress and decompress each corpus file with each compression format, over
+ * a range of chunk sizes and compression levels, and write the results to @out
+ * as tab-separated values, one line per measurement, after a header line.  */
+extern int
+wimlib_benchmark_codecs(const tchar * const *corpus_paths,
+			unsigned num_corpus_paths, FILE *out);
+
+/* Check the bookkeeping of which chunks of a file being modified in a
+ * read-write mounted image have been copied into its staging file.  */
+extern int
+wimlib_test_staging_writes(void);
+
 #endif /* ENABLE_TEST_SUPPORT */
 
 #endif /* _WIMLIB_TEST_SUPPORT_H */
@@ -25,7 +25,16 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdlib.h>
+#ifdef __APPLE__
+#  include <sys/clonefile.h>
+#endif
+#ifdef __linux__
+#  include <linux/fs.h>
+#  include <sys/ioctl.h>
+#endif
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <sys/types.h>
@@ -43,6 +52,7 @@
 #include "reparse.h"
 #include "timestamp.h"
 #include "unix_data.h"
+#include "util.h"
 #include "xattr.h"
 
 /* We don't require O_NOFOLLOW, but the advantage of having it is that if we
@@ -72,6 +82,13 @@ unix_get_supported_features(const char *target,
 
 #define NUM_PATHBUFS 2  /* We need 2 when creating hard links  */
 
+/* Maximum number of regular files to which the data of a blob is written as it
+ * is extracted.  Its other regular files are copied from the first once it's
+ * complete.  If the filesystem can clone files, only the first is written.  */
+#define UNIX_MAX_BLOB_WRITE_FDS 16
+
+struct unix_apply_pipeline;
+
 struct unix_apply_ctx {
 	/* Extract flags, the pointer to the WIMStruct, etc.  */
 	struct apply_ctx common;
@@ -82,8 +99,10 @@ struct unix_apply_ctx {
 	/* Index of next pathbuf to use  */
 	unsigned which_pathbuf;
 
-	/* Currently open file descriptors for extraction  */
-	struct filedes open_fds[MAX_OPEN_FILES];
+	/* Currently open file descriptors for extraction.  Any other regular
+	 * files that need the same blob are copied from open_fds[0] once it's
+	 * complete.  */
+	struct filedes open_fds[UNIX_MAX_BLOB_WRITE_FDS];
 
 	/* Number of currently open file descriptors in open_fds, starting from
 	 * the beginning of the array.  */
@@ -91,11 +110,17 @@ struct unix_apply_ctx {
 
 	/* For each currently open file, whether we're writing to it in "sparse"
 	 * mode or not.  */
-	bool is_sparse_file[MAX_OPEN_FILES];
+	bool is_sparse_file[UNIX_MAX_BLOB_WRITE_FDS];
 
 	/* Whether is_sparse_file[] is true for any currently open file  */
 	bool any_sparse_files;
 
+	/* Points to a flag set when cloning a file failed in a way that means
+	 * the filesystem can't do it, so that it isn't tried again.  The writer
+	 * threads share the flag of the main context.  */
+	atomic_bool *clone_unsupported;
+	atomic_bool clone_unsupported_flag;
+
 	/* Buffer for reading reparse point data into memory  */
 	u8 reparse_data[REPARSE_DATA_MAX_SIZE];
 
@@ -111,6 +136,10 @@ struct unix_apply_ctx {
 
 	/* Number of special files we couldn't create due to EPERM  */
 	unsigned long num_special_files_ignored;
+
+	/* If not NULL, files are created and written by a pool of writer
+	 * threads, each of which works with its own copy of this context.  */
+	struct unix_apply_pipeline *pipeline;
 };
 
 /* Returns the number of characters needed to represent the path to the
@@ -516,11 +545,25 @@ unix_create_if_directory(const struct wim_dentry *dentry,
 	return report_file_created(&ctx->common);
 }
 
-/* If @dentry represents an empty regular file or a special file, create it, set
- * its metadata, and create any needed hard links.  */
+/* Is @dentry the first alias of an empty regular file or a special file?  Such
+ * files have no blobs to extract, so they're created, along with all their
+ * aliases, when this dentry comes up.  */
+static bool
+is_empty_file_to_create(const struct wim_dentry *dentry)
+{
+	const struct wim_inode *inode = dentry->d_inode;
+
+	return dentry == inode_first_extraction_dentry(inode) &&
+		!should_extract_as_directory(inode) &&
+		!inode_is_symlink(inode) &&
+		!inode_get_blob_for_unnamed_data_stream_resolved(inode);
+}
+
+/* Create the empty regular file or special file of which @dentry is the first
+ * alias, set its metadata, and create any needed hard links.  */
 static int
-unix_extract_if_empty_file(const struct wim_dentry *dentry,
-			   struct unix_apply_ctx *ctx)
+unix_extract_empty_file(const struct wim_dentry *dentry,
+			struct unix_apply_ctx *ctx)
 {
 	const struct wim_inode *inode;
 	struct wimlib_unix_data unix_data;
@@ -529,16 +572,6 @@ unix_extract_if_empty_file(const struct wim_dentry *dentry,
 
 	inode = dentry->d_inode;
 
-	/* Extract all aliases only when the "first" comes up.  */
-	if (dentry != inode_first_extraction_dentry(inode))
-		return 0;
-
-	/* Is this a directory, a symbolic link, or any type of nonempty file?
-	 */
-	if (should_extract_as_directory(inode) || inode_is_symlink(inode) ||
-	    inode_get_blob_for_unnamed_data_stream_resolved(inode))
-		return 0;
-
 	/* Recognize special files in UNIX_DATA mode  */
 	if ((ctx->common.extract_flags & WIMLIB_EXTRACT_FLAG_UNIX_DATA) &&
 	    inode_get_unix_data(inode, &unix_data) &&
@@ -585,16 +618,16 @@ unix_extract_if_empty_file(const struct wim_dentry *dentry,
 	if (ret)
 		return ret;
 
-	ret = unix_create_hardlinks(inode, dentry, path, ctx);
-	if (ret)
-		return ret;
-
-	return report_file_created(&ctx->common);
+	return unix_create_hardlinks(inode, dentry, path, ctx);
 }
 
 static int
-unix_create_dirs_and_empty_files(const struct list_head *dentry_list,
-				 struct unix_apply_ctx *ctx)
+unix_queue_empty_file(const struct wim_dentry *dentry,
+		      struct unix_apply_ctx *ctx);
+
+static int
+unix_create_dirs(const struct list_head *dentry_list,
+		 struct unix_apply_ctx *ctx)
 {
 	const struct wim_dentry *dentry;
 	int ret;
@@ -604,8 +637,23 @@ unix_create_dirs_and_empty_files(const struct list_head *dentry_list,
 		if (ret)
 			return ret;
 	}
+	return 0;
+}
+
+static int
+unix_create_empty_files(const struct list_head *dentry_list,
+			struct unix_apply_ctx *ctx)
+{
+	const struct wim_dentry *dentry;
+	int ret;
+
 	list_for_each_entry(dentry, dentry_list, d_extraction_list_node) {
-		ret = unix_extract_if_empty_file(dentry, ctx);
+		if (!is_empty_file_to_create(dentry))
+			continue;
+		ret = unix_queue_empty_file(dentry, ctx);
+		if (ret)
+			return ret;
+		ret = report_file_created(&ctx->common);
 		if (ret)
 			return ret;
 	}
@@ -626,9 +674,7 @@ unix_count_dentries(const struct list_head *dentry_list,
 
 		if (should_extract_as_directory(inode))
 			dir_count++;
-		else if ((dentry == inode_first_extraction_dentry(inode)) &&
-			 !inode_is_symlink(inode) &&
-			 !inode_get_blob_for_unnamed_data_stream_resolved(inode))
+		else if (is_empty_file_to_create(dentry))
 			empty_file_count++;
 	}
 
@@ -667,14 +713,38 @@ retry_symlink:
 }
 
 static void
-unix_cleanup_open_fds(struct unix_apply_ctx *ctx, unsigned offset)
+unix_cleanup_open_fds(struct unix_apply_ctx *ctx)
 {
-	for (unsigned i = offset; i < ctx->num_open_fds; i++)
-		filedes_close(&ctx->open_fds[i]);
+	for (unsigned i = 0; i < ctx->num_open_fds; i++)
+		if (filedes_valid(&ctx->open_fds[i]))
+			filedes_close(&ctx->open_fds[i]);
 	ctx->num_open_fds = 0;
 	ctx->any_sparse_files = false;
 }
 
+/* Whether the other regular files that need a blob can be made by cloning the
+ * first one, rather than by writing or copying their data  */
+static bool
+unix_can_clone_files(const struct unix_apply_ctx *ctx)
+{
+#if defined(FICLONE) || defined(__APPLE__)
+	return !atomic_load_explicit(ctx->clone_unsupported,
+				     memory_order_relaxed);
+#else
+	return false;
+#endif
+}
+
+/* Record why cloning a file failed.  Some errors mean that no file on this
+ * filesystem can be cloned.  */
+static void
+unix_clone_failed(struct unix_apply_ctx *ctx, int err)
+{
+	if (err == EOPNOTSUPP || err == ENOTSUP || err == EXDEV)
+		atomic_store_explicit(ctx->clone_unsupported, true,
+				      memory_order_relaxed);
+}
+
 static int
 unix_begin_extract_blob_instance(const struct blob_descriptor *blob,
 				 const struct wim_inode *inode,
@@ -703,13 +773,18 @@ unix_begin_extract_blob_instance(const struct blob_descriptor *blob,
 
 	/* Unnamed data stream of "regular" file  */
 
-	/* This should be ensured by extract_blob_list()  */
-	wimlib_assert(ctx->num_open_fds < MAX_OPEN_FILES);
+	/* Files beyond the first that aren't written as the data is read are
+	 * copied from the first at the end.  */
+	if (ctx->num_open_fds != 0 &&
+	    (unix_can_clone_files(ctx) ||
+	     ctx->num_open_fds >= UNIX_MAX_BLOB_WRITE_FDS))
+		return 0;
 
 	first_dentry = inode_first_extraction_dentry(inode);
 	first_path = unix_build_extraction_path(first_dentry, ctx);
 retry_create:
-	fd = open(first_path, O_EXCL | O_CREAT | O_WRONLY | O_NOFOLLOW, 0644);
+	/* Open the file for reading too, so that it can be copied.  */
+	fd = open(first_path, O_EXCL | O_CREAT | O_RDWR | O_NOFOLLOW, 0644);
 	if (fd < 0) {
 		if (errno == EEXIST && !unlink(first_path))
 			goto retry_create;
@@ -743,7 +818,7 @@ unix_begin_extract_blob(struct blob_descriptor *blob, void *_ctx)
 							   ctx);
 		if (ret) {
 			ctx->reparse_ptr = NULL;
-			unix_cleanup_open_fds(ctx, 0);
+			unix_cleanup_open_fds(ctx);
 			return ret;
 		}
 	}
@@ -767,7 +842,9 @@ unix_extract_chunk(const struct blob_descriptor *blob, u64 offset,
 	 * For sparse files, only write nonzero regions.  This lets the
 	 * filesystem use holes to represent zero regions.
 	 */
-	for (p = chunk; p != end; p += len, offset += len) {
+	for (p = chunk; p != end && ctx->num_open_fds != 0;
+	     p += len, offset += len)
+	{
 		zeroes = maybe_detect_sparse_region(p, end - p, &len,
 						    ctx->any_sparse_files);
 		for (i = 0; i < ctx->num_open_fds; i++) {
@@ -789,6 +866,151 @@ err:
 	return ret;
 }
 
+/*
+ * Copy the first @size bytes of data from @src to @dst, leaving holes where the
+ * data is zero if @sparse is true.  The data is copied in the kernel if
+ * possible, or else read and written.
+ */
+static int
+unix_copy_file_data(struct filedes *src, struct filedes *dst, u64 size,
+		    bool sparse)
+{
+	u8 buf[BUFFER_SIZE];
+	u64 offset = 0;
+	int ret;
+
+#ifdef HAVE_COPY_FILE_RANGE
+	/* copy_file_range() might fill in holes, so don't use it for sparse
+	 * files.  On any failure, just continue with read() and write().  */
+	while (!sparse && offset < size) {
+		loff_t in_off = offset;
+		loff_t out_off = offset;
+		ssize_t n = copy_file_range(src->fd, &in_off, dst->fd, &out_off,
+					    size - offset, 0);
+		if (n <= 0)
+			break;
+		offset += n;
+	}
+#endif
+	while (offset < size) {
+		size_t count = min(size - offset, sizeof(buf));
+		const u8 *p = buf;
+		size_t len;
+
+		ret = full_pread(src, buf, count, offset);
+		if (ret)
+			return ret;
+		for (; p != &buf[count]; p += len, offset += len) {
+			if (!maybe_detect_sparse_region(p, &buf[count] - p,
+							&len, sparse)) {
+				ret = full_pwrite(dst, p, len, offset);
+				if (ret)
+					return ret;
+			}
+		}
+	}
+	if (sparse && ftruncate(dst->fd, size))
+		return WIMLIB_ERR_WRITE;
+	return 0;
+}
+
+/* Create the regular file @inode, and its hard links, as a copy of the file
+ * open as ctx->open_fds[0], which holds the complete data of @blob.  Then set
+ * its metadata.  */
+static int
+unix_copy_blob_instance(const struct blob_descriptor *blob,
+			const struct wim_inode *inode,
+			struct unix_apply_ctx *ctx)
+{
+	const struct wim_dentry *first_dentry;
+	const char *path;
+	struct filedes fd;
+	bool cloned = false;
+	int raw_fd;
+	int ret;
+
+	first_dentry = inode_first_extraction_dentry(inode);
+	path = unix_build_extraction_path(first_dentry, ctx);
+
+#ifdef __APPLE__
+	/* On APFS, the whole file can be cloned at once.  Elsewhere this fails,
+	 * and the file is created and its data copied instead.  */
+	if (unix_can_clone_files(ctx) && __builtin_available(macOS 10.12, *)) {
+	retry_clone:
+		if (!fclonefileat(ctx->open_fds[0].fd, AT_FDCWD, path, 0))
+			cloned = true;
+		else if (errno == EEXIST && !unlink(path))
+			goto retry_clone;
+		else
+			unix_clone_failed(ctx, errno);
+	}
+#endif
+	if (cloned) {
+		raw_fd = open(path, O_WRONLY | O_NOFOLLOW);
+	} else {
+	retry_create:
+		raw_fd = open(path, O_EXCL | O_CREAT | O_WRONLY | O_NOFOLLOW,
+			      0644);
+		if (raw_fd < 0 && errno == EEXIST && !unlink(path))
+			goto retry_create;
+	}
+	if (raw_fd < 0) {
+		ERROR_WITH_ERRNO("Can't create regular file \"%s\"", path);
+		return WIMLIB_ERR_OPEN;
+	}
+	filedes_init(&fd, raw_fd);
+
+	ret = unix_create_hardlinks(inode, first_dentry, path, ctx);
+#ifdef FICLONE
+	/* On Linux, the data can be shared with the first file if the
+	 * filesystem supports reflinks.  */
+	if (!ret && unix_can_clone_files(ctx)) {
+		if (!ioctl(raw_fd, FICLONE, ctx->open_fds[0].fd))
+			cloned = true;
+		else
+			unix_clone_failed(ctx, errno);
+	}
+#endif
+	if (!ret && !cloned) {
+		ret = unix_copy_file_data(&ctx->open_fds[0], &fd, blob->size,
+					  inode->i_attributes &
+						FILE_ATTRIBUTE_SPARSE_FILE);
+		if (ret)
+			ERROR_WITH_ERRNO("Error copying data to \"%s\"", path);
+	}
+	if (!ret)
+		ret = unix_set_metadata(raw_fd, inode, path, ctx);
+	if (filedes_close(&fd) && !ret) {
+		ERROR_WITH_ERRNO("Error closing \"%s\"", path);
+		ret = WIMLIB_ERR_WRITE;
+	}
+	return ret;
+}
+
+/* Set the metadata of the regular file @inode, open as ctx->open_fds[@i] and
+ * holding its complete data, then close it.  */
+static int
+unix_finish_open_file(const struct wim_inode *inode, unsigned i,
+		      struct unix_apply_ctx *ctx)
+{
+	struct filedes *fd = &ctx->open_fds[i];
+	int ret;
+
+	/* Set metadata on regular file just before closing.  */
+	ret = unix_set_metadata(fd->fd, inode, NULL, ctx);
+	if (ret)
+		return ret;
+
+	ret = filedes_close(fd);
+	filedes_invalidate(fd);
+	if (ret) {
+		ERROR_WITH_ERRNO("Error closing \"%s\"",
+				 unix_build_inode_extraction_path(inode, ctx));
+		return WIMLIB_ERR_WRITE;
+	}
+	return 0;
+}
+
 /* Called when a blob has been fully read for extraction  */
 static int
 unix_end_extract_blob(struct blob_descriptor *blob, int status, void *_ctx)
@@ -796,15 +1018,19 @@ unix_end_extract_blob(struct blob_descriptor *blob, int status, void *_ctx)
 	struct unix_apply_ctx *ctx = _ctx;
 	int ret;
 	unsigned j;
+	const struct wim_inode *first_inode = NULL;
 	const struct blob_extraction_target *targets = blob_extraction_targets(blob);
 
 	ctx->reparse_ptr = NULL;
 
 	if (status) {
-		unix_cleanup_open_fds(ctx, 0);
+		unix_cleanup_open_fds(ctx);
 		return status;
 	}
 
+	/* The regular files that were written come first among the targets, in
+	 * the same order as in open_fds.  The rest are copied from the first
+	 * one, which is therefore closed last.  */
 	j = 0;
 	ret = 0;
 	for (u32 i = 0; i < blob->out_refcnt; i++) {
@@ -825,35 +1051,513 @@ unix_end_extract_blob(struct blob_descriptor *blob, int status, void *_ctx)
 			ret = unix_set_metadata(-1, inode, path, ctx);
 			if (ret)
 				break;
-		} else {
-			struct filedes *fd = &ctx->open_fds[j];
-
+		} else if (j < ctx->num_open_fds) {
 			/* If the file is sparse, extend it to its final size. */
-			if (ctx->is_sparse_file[j] && ftruncate(fd->fd, blob->size)) {
-				ERROR_WITH_ERRNO("Error extending \"%s\" to final size",
-						 unix_build_inode_extraction_path(inode, ctx));
+			if (ctx->is_sparse_file[j] &&
+			    ftruncate(ctx->open_fds[j].fd, blob->size))
+			{
+				ERROR_WITH_ERRNO("Error extending \"%s\" to "
+						 "final size",
+						 unix_build_inode_extraction_path(
+							inode, ctx));
 				ret = WIMLIB_ERR_WRITE;
 				break;
 			}
-
-			/* Set metadata on regular file just before closing.  */
-			ret = unix_set_metadata(fd->fd, inode, NULL, ctx);
+			if (j == 0) {
+				first_inode = inode;
+			} else {
+				ret = unix_finish_open_file(inode, j, ctx);
+				if (ret)
+					break;
+			}
+			j++;
+		} else {
+			ret = unix_copy_blob_instance(blob, inode, ctx);
 			if (ret)
 				break;
+		}
+	}
 
-			if (filedes_close(fd)) {
-				ERROR_WITH_ERRNO("Error closing \"%s\"",
-						 unix_build_inode_extraction_path(inode, ctx));
-				ret = WIMLIB_ERR_WRITE;
+	if (!ret && first_inode)
+		ret = unix_finish_open_file(first_inode, 0, ctx);
+	unix_cleanup_open_fds(ctx);
+	return ret;
+}
+
+/*
+ * When an image contains many files, extracting it spends most of its time
+ * waiting for system calls: creating files, writing small amounts of data to
+ * them, creating hard links, and setting metadata.  To keep these from being
+ * done one at a time, the thread reading the blobs (which may itself hand off
+ * decompression to other threads) only copies each chunk of blob data into a
+ * buffer and queues it.  A pool of writer threads takes the queued blobs, and
+ * the empty files created before them, in order, and does the actual work.
+ *
+ * Each blob is handled entirely by one writer thread, using the same code as
+ * serial extraction but with its own copy of the extraction context.  The
+ * amount of buffered blob data is limited, so a writer thread that falls behind
+ * eventually stalls reading.  Writer threads start blobs in order, and a blob is
+ * only started when the number of files open for all blobs in progress stays
+ * within MAX_OPEN_FILES.
+ */
+
+/* Maximum number of writer threads  */
+#define UNIX_APPLY_MAX_WRITER_THREADS	16
+
+/* Maximum number of bytes of blob data buffered for the writer threads  */
+#define UNIX_APPLY_MAX_BUFFERED_BYTES	(64 << 20)
+
+/* A chunk of blob data queued for a writer thread  */
+struct unix_apply_chunk {
+	struct list_head list;
+	u64 offset;
+	size_t size;
+	u8 data[];
+};
+
+/* An empty file to create, or a blob to extract  */
+struct unix_apply_job {
+	struct list_head list;
+
+	/* If a blob: a private copy of its descriptor, with a private copy
+	 * of its extraction targets if they aren't stored inline.  Else NULL.
+	 */
+	struct blob_descriptor *blob;
+
+	/* If an empty file: the first alias  */
+	const struct wim_dentry *dentry;
+
+	/* Number of files that extracting this job keeps open  */
+	unsigned num_fds;
+
+	/* Chunks of the blob's data that haven't been written yet  */
+	struct list_head chunks;
+
+	/* Whether all the blob's data has been queued, and if so, the status
+	 * with which reading it ended  */
+	bool complete;
+	int status;
+
+	struct blob_descriptor blob_copy;
+};
+
+struct unix_apply_worker {
+	pthread_t thread;
+	struct unix_apply_ctx ctx;
+};
+
+struct unix_apply_pipeline {
+	pthread_mutex_t lock;
+
+	/* Signaled when a job is queued, when files are closed, and when
+	 * the writer threads should exit  */
+	pthread_cond_t job_cond;
+
+	/* Signaled when a chunk is queued or a blob is complete  */
+	pthread_cond_t chunk_cond;
+
+	/* Signaled when buffered data is freed or an error occurs  */
+	pthread_cond_t space_cond;
+
+	/* Jobs not yet started by any writer thread  */
+	struct list_head jobs;
+
+	/* The blob job whose data is currently being queued, if any  */
+	struct unix_apply_job *cur_job;
+
+	/* Number of files kept open by the jobs in progress  */
+	unsigned num_open_fds;
+
+	/* Number of bytes of blob data buffered  */
+	size_t buffered_bytes;
+
+	/* The first error that occurred in a writer thread  */
+	int error;
+
+	/* Set when no more jobs will be queued  */
+	bool terminate;
+
+	unsigned num_workers;
+	struct unix_apply_worker workers[];
+};
+
+/* Get the next job that may be started, or NULL if there is none.  The
+ * pipeline must be locked.  */
+static struct unix_apply_job *
+next_runnable_job(const struct unix_apply_pipeline *pl)
+{
+	struct unix_apply_job *job;
+
+	if (list_empty(&pl->jobs))
+		return NULL;
+	job = list_first_entry(&pl->jobs, struct unix_apply_job, list);
+	if (pl->num_open_fds != 0 &&
+	    pl->num_open_fds + job->num_fds > MAX_OPEN_FILES)
+		return NULL;
+	return job;
+}
+
+static void
+free_unix_apply_job(struct unix_apply_job *job)
+{
+	if (job->blob && job->blob->out_refcnt >
+			 ARRAY_LEN(job->blob->inline_blob_extraction_targets))
+		FREE(job->blob->blob_extraction_targets);
+	FREE(job);
+}
+
+/* Extract a blob in a writer thread as its data is queued.  If @skip is true,
+ * an error has already occurred, and the data is just discarded.  */
+static int
+unix_run_blob_job(struct unix_apply_job *job, struct unix_apply_ctx *ctx,
+		  bool skip)
+{
+	struct unix_apply_pipeline *pl = ctx->pipeline;
+	struct unix_apply_chunk *chunk;
+	bool began = false;
+	int status;
+	int ret = 0;
+
+	if (!skip) {
+		ret = unix_begin_extract_blob(job->blob, ctx);
+		began = (ret == 0);
+	}
+
+	pthread_mutex_lock(&pl->lock);
+	for (;;) {
+		while (list_empty(&job->chunks) && !job->complete)
+			pthread_cond_wait(&pl->chunk_cond, &pl->lock);
+		if (list_empty(&job->chunks))
+			break;
+		chunk = list_first_entry(&job->chunks, struct unix_apply_chunk,
+					 list);
+		list_del(&chunk->list);
+		pthread_mutex_unlock(&pl->lock);
+
+		if (began && !ret) {
+			ret = unix_extract_chunk(job->blob, chunk->offset,
+						 chunk->data, chunk->size, ctx);
+		}
+
+		pthread_mutex_lock(&pl->lock);
+		pl->buffered_bytes -= chunk->size;
+		pthread_cond_signal(&pl->space_cond);
+		FREE(chunk);
+	}
+	status = job->status;
+	pthread_mutex_unlock(&pl->lock);
+
+	if (began)
+		ret = unix_end_extract_blob(job->blob, ret ? ret : status, ctx);
+	return ret;
+}
+
+static void *
+unix_writer_thread_proc(void *arg)
+{
+	struct unix_apply_worker *worker = arg;
+	struct unix_apply_ctx *ctx = &worker->ctx;
+	struct unix_apply_pipeline *pl = ctx->pipeline;
+	struct unix_apply_job *job;
+	unsigned num_fds;
+	bool skip;
+	int ret;
+
+	pthread_mutex_lock(&pl->lock);
+	for (;;) {
+		while (!(job = next_runnable_job(pl)) &&
+		       !(pl->terminate && list_empty(&pl->jobs)))
+			pthread_cond_wait(&pl->job_cond, &pl->lock);
+		if (!job)
+			break;
+		list_del(&job->list);
+		num_fds = job->num_fds;
+		pl->num_open_fds += num_fds;
+		skip = (pl->error != 0);
+		pthread_mutex_unlock(&pl->lock);
+
+		if (job->blob)
+			ret = unix_run_blob_job(job, ctx, skip);
+		else if (!skip)
+			ret = unix_extract_empty_file(job->dentry, ctx);
+		else
+			ret = 0;
+		free_unix_apply_job(job);
+
+		pthread_mutex_lock(&pl->lock);
+		pl->num_open_fds -= num_fds;
+		if (ret && !pl->error) {
+			pl->error = ret;
+			pthread_cond_broadcast(&pl->space_cond);
+		}
+		pthread_cond_broadcast(&pl->job_cond);
+	}
+	pthread_mutex_unlock(&pl->lock);
+	return NULL;
+}
+
+/*
+ * Start the writer threads.  If none can be started, or their lock can't be
+ * set up, files are extracted serially as before.  Must be called after the
+ * path buffers have been allocated, with @path_max their size.
+ */
+static int
+unix_start_writers(struct unix_apply_ctx *ctx, size_t path_max)
+{
+	struct unix_apply_pipeline *pl;
+	unsigned num_threads;
+
+	num_threads = min(max(get_available_cpus() * 2, 4),
+			  UNIX_APPLY_MAX_WRITER_THREADS);
+
+	pl = CALLOC(1, sizeof(*pl) + num_threads * sizeof(pl->workers[0]));
+	if (!pl)
+		return WIMLIB_ERR_NOMEM;
+	if (pthread_mutex_init(&pl->lock, NULL)) {
+		WARNING_WITH_ERRNO("Failed to initialize mutex");
+		goto out_free;
+	}
+	if (pthread_cond_init(&pl->job_cond, NULL)) {
+		WARNING_WITH_ERRNO("Failed to initialize condition variable");
+		goto out_destroy_lock;
+	}
+	if (pthread_cond_init(&pl->chunk_cond, NULL)) {
+		WARNING_WITH_ERRNO("Failed to initialize condition variable");
+		goto out_destroy_job_cond;
+	}
+	if (pthread_cond_init(&pl->space_cond, NULL)) {
+		WARNING_WITH_ERRNO("Failed to initialize condition variable");
+		goto out_destroy_chunk_cond;
+	}
+	INIT_LIST_HEAD(&pl->jobs);
+	ctx->pipeline = pl;
+
+	while (pl->num_workers < num_threads) {
+		struct unix_apply_worker *worker = &pl->workers[pl->num_workers];
+		struct unix_apply_ctx *wctx = &worker->ctx;
+		unsigned i;
+		int err;
+
+		memcpy(wctx, ctx, sizeof(*ctx));
+		for (i = 0; i < NUM_PATHBUFS; i++) {
+			wctx->pathbufs[i] = MALLOC(path_max);
+			if (!wctx->pathbufs[i])
 				break;
-			}
-			j++;
+			memcpy(wctx->pathbufs[i],
+			       ctx->common.target, ctx->common.target_nchars);
+		}
+		if (i < NUM_PATHBUFS) {
+			while (i--)
+				FREE(wctx->pathbufs[i]);
+			break;
+		}
+
+		err = pthread_create(&worker->thread, NULL,
+				     unix_writer_thread_proc, worker);
+		if (err) {
+			errno = err;
+			WARNING_WITH_ERRNO("Failed to create extraction thread");
+			for (i = 0; i < NUM_PATHBUFS; i++)
+				FREE(wctx->pathbufs[i]);
+			break;
+		}
+		pl->num_workers++;
+	}
+
+	if (pl->num_workers != 0)
+		return 0;
+
+	/* No threads could be started; extract serially.  */
+	ctx->pipeline = NULL;
+	pthread_cond_destroy(&pl->space_cond);
+out_destroy_chunk_cond:
+	pthread_cond_destroy(&pl->chunk_cond);
+out_destroy_job_cond:
+	pthread_cond_destroy(&pl->job_cond);
+out_destroy_lock:
+	pthread_mutex_destroy(&pl->lock);
+out_free:
+	FREE(pl);
+	return 0;
+}
+
+/* Wait for the writer threads to finish all queued jobs, then stop them.
+ * Returns the first error that occurred in any of them.  @status is the status
+ * with which queueing jobs ended; if nonzero, a blob whose data was being
+ * queued is abandoned.  */
+static int
+unix_stop_writers(struct unix_apply_ctx *ctx, int status)
+{
+	struct unix_apply_pipeline *pl = ctx->pipeline;
+	int ret;
+
+	if (!pl)
+		return 0;
+
+	pthread_mutex_lock(&pl->lock);
+	if (pl->cur_job) {
+		pl->cur_job->status = status ? status : WIMLIB_ERR_READ;
+		pl->cur_job->complete = true;
+		pl->cur_job = NULL;
+		pthread_cond_broadcast(&pl->chunk_cond);
+	}
+	pl->terminate = true;
+	pthread_cond_broadcast(&pl->job_cond);
+	pthread_mutex_unlock(&pl->lock);
+
+	for (unsigned i = 0; i < pl->num_workers; i++) {
+		struct unix_apply_ctx *wctx = &pl->workers[i].ctx;
+
+		pthread_join(pl->workers[i].thread, NULL);
+		ctx->num_special_files_ignored += wctx->num_special_files_ignored;
+		for (unsigned j = 0; j < NUM_PATHBUFS; j++)
+			FREE(wctx->pathbufs[j]);
+	}
+	ret = pl->error;
+
+	pthread_cond_destroy(&pl->space_cond);
+	pthread_cond_destroy(&pl->chunk_cond);
+	pthread_cond_destroy(&pl->job_cond);
+	pthread_mutex_destroy(&pl->lock);
+	FREE(pl);
+	ctx->pipeline = NULL;
+	return ret;
+}
+
+/* Queue a job for the writer threads.  Returns the first error that occurred in
+ * any writer thread, in which case the job is not queued.  */
+static int
+unix_queue_job(struct unix_apply_pipeline *pl, struct unix_apply_job *job)
+{
+	int ret;
+
+	pthread_mutex_lock(&pl->lock);
+	ret = pl->error;
+	if (!ret) {
+		list_add_tail(&job->list, &pl->jobs);
+		if (job->blob)
+			pl->cur_job = job;
+		pthread_cond_signal(&pl->job_cond);
+	}
+	pthread_mutex_unlock(&pl->lock);
+	return ret;
+}
+
+static int
+unix_queue_empty_file(const struct wim_dentry *dentry,
+		      struct unix_apply_ctx *ctx)
+{
+	struct unix_apply_job *job;
+	int ret;
+
+	if (!ctx->pipeline)
+		return unix_extract_empty_file(dentry, ctx);
+
+	job = CALLOC(1, sizeof(*job));
+	if (!job)
+		return WIMLIB_ERR_NOMEM;
+	job->dentry = dentry;
+	job->num_fds = 1;
+	INIT_LIST_HEAD(&job->chunks);
+	ret = unix_queue_job(ctx->pipeline, job);
+	if (ret)
+		FREE(job);
+	return ret;
+}
+
+/* begin_blob() callback for extraction using the writer threads  */
+static int
+unix_queue_begin_blob(struct blob_descriptor *blob, void *_ctx)
+{
+	struct unix_apply_ctx *ctx = _ctx;
+	const struct blob_extraction_target *targets;
+	struct unix_apply_job *job;
+	int ret;
+
+	job = CALLOC(1, sizeof(*job));
+	if (!job)
+		return WIMLIB_ERR_NOMEM;
+
+	/* The blob descriptor and its targets may be changed or reused once
+	 * this blob is done being read, so take a copy of them.  */
+	job->blob = &job->blob_copy;
+	memcpy(job->blob, blob, sizeof(struct blob_descriptor));
+	if (blob->out_refcnt > ARRAY_LEN(blob->inline_blob_extraction_targets)) {
+		job->blob->blob_extraction_targets =
+			memdup(blob->blob_extraction_targets,
+			       blob->out_refcnt * sizeof(targets[0]));
+		if (!job->blob->blob_extraction_targets) {
+			FREE(job);
+			return WIMLIB_ERR_NOMEM;
 		}
 	}
-	unix_cleanup_open_fds(ctx, j);
+
+	/* Up to UNIX_MAX_BLOB_WRITE_FDS regular files are written, and any
+	 * others are then copied from the first, one at a time.  */
+	targets = blob_extraction_targets(blob);
+	for (u32 i = 0; i < blob->out_refcnt &&
+			job->num_fds < UNIX_MAX_BLOB_WRITE_FDS + 1; i++)
+		if (targets[i].stream->stream_type != STREAM_TYPE_REPARSE_POINT)
+			job->num_fds++;
+	INIT_LIST_HEAD(&job->chunks);
+
+	ret = unix_queue_job(ctx->pipeline, job);
+	if (ret)
+		free_unix_apply_job(job);
+	return ret;
+}
+
+/* continue_blob() callback for extraction using the writer threads  */
+static int
+unix_queue_chunk(const struct blob_descriptor *blob, u64 offset,
+		 const void *data, size_t size, void *_ctx)
+{
+	struct unix_apply_ctx *ctx = _ctx;
+	struct unix_apply_pipeline *pl = ctx->pipeline;
+	struct unix_apply_chunk *chunk;
+	int ret;
+
+	chunk = MALLOC(sizeof(*chunk) + size);
+	if (!chunk)
+		return WIMLIB_ERR_NOMEM;
+	chunk->offset = offset;
+	chunk->size = size;
+	memcpy(chunk->data, data, size);
+
+	pthread_mutex_lock(&pl->lock);
+	while (!pl->error && pl->buffered_bytes != 0 &&
+	       pl->buffered_bytes + size > UNIX_APPLY_MAX_BUFFERED_BYTES)
+		pthread_cond_wait(&pl->space_cond, &pl->lock);
+	ret = pl->error;
+	if (!ret) {
+		list_add_tail(&chunk->list, &pl->cur_job->chunks);
+		pl->buffered_bytes += size;
+		pthread_cond_broadcast(&pl->chunk_cond);
+	}
+	pthread_mutex_unlock(&pl->lock);
+	if (ret)
+		FREE(chunk);
 	return ret;
 }
 
+/* end_blob() callback for extraction using the writer threads  */
+static int
+unix_queue_end_blob(struct blob_descriptor *blob, int status, void *_ctx)
+{
+	struct unix_apply_ctx *ctx = _ctx;
+	struct unix_apply_pipeline *pl = ctx->pipeline;
+
+	pthread_mutex_lock(&pl->lock);
+	pl->cur_job->status = status;
+	pl->cur_job->complete = true;
+	pl->cur_job = NULL;
+	pthread_cond_broadcast(&pl->chunk_cond);
+	if (!status)
+		status = pl->error;
+	pthread_mutex_unlock(&pl->lock);
+	return status;
+}
+
 static int
 unix_set_dir_metadata(struct list_head *dentry_list, struct unix_apply_ctx *ctx)
 {
@@ -882,6 +1586,8 @@ unix_extract(struct list_head *dentry_list, struct apply_ctx *_ctx)
 	u64 dir_count;
 	u64 empty_file_count;
 
+	ctx->clone_unsupported = &ctx->clone_unsupported_flag;
+
 	/* Compute the maximum path length that will be needed, then allocate
 	 * some path buffers.  */
 	path_max = unix_compute_path_max(dentry_list, ctx);
@@ -909,11 +1615,7 @@ unix_extract(struct list_head *dentry_list, struct apply_ctx *_ctx)
 	if (ret)
 		goto out;
 
-	ret = unix_create_dirs_and_empty_files(dentry_list, ctx);
-	if (ret)
-		goto out;
-
-	ret = end_file_structure_phase(&ctx->common);
+	ret = unix_create_dirs(dentry_list, ctx);
 	if (ret)
 		goto out;
 
@@ -929,6 +1631,20 @@ unix_extract(struct list_head *dentry_list, struct apply_ctx *_ctx)
 		ctx->target_abspath_nchars = strlen(ctx->target_abspath);
 	}
 
+	/* From here on, files are created by the writer threads, if they can be
+	 * started.  They need the full path to the target.  */
+	ret = unix_start_writers(ctx, path_max);
+	if (ret)
+		goto out;
+
+	ret = unix_create_empty_files(dentry_list, ctx);
+	if (ret)
+		goto out;
+
+	ret = end_file_structure_phase(&ctx->common);
+	if (ret)
+		goto out;
+
 	/* Extract nonempty regular files and symbolic links.  */
 
 	struct read_blob_callbacks cbs = {
@@ -937,10 +1653,20 @@ unix_extract(struct list_head *dentry_list, struct apply_ctx *_ctx)
 		.end_blob	= unix_end_extract_blob,
 		.ctx		= ctx,
 	};
+	if (ctx->pipeline) {
+		cbs.begin_blob = unix_queue_begin_blob;
+		cbs.continue_blob = unix_queue_chunk;
+		cbs.end_blob = unix_queue_end_blob;
+	}
 	ret = extract_blob_list(&ctx->common, &cbs);
 	if (ret)
 		goto out;
 
+	/* All files must be fully written before the directories' metadata
+	 * is set.  */
+	ret = unix_stop_writers(ctx, 0);
+	if (ret)
+		goto out;
 
 	/* Set directory metadata.  We do this last so that we get the right
 	 * directory timestamps.  */
@@ -961,6 +1687,11 @@ unix_extract(struct list_head *dentry_list, struct apply_ctx *_ctx)
 			ctx->num_special_files_ignored);
 	}
 out:
+	if (ctx->pipeline) {
+		int ret2 = unix_stop_writers(ctx, ret);
+		if (!ret)
+			ret = ret2;
+	}
 	for (unsigned i = 0; i < NUM_PATHBUFS; i++)
 		FREE(ctx->pathbufs[i]);
 	FREE(ctx->target_abspath);
@@ -972,4 +1703,5 @@ const struct apply_operations unix_apply_ops = {
 	.get_supported_features = unix_get_supported_features,
 	.extract                = unix_extract,
 	.context_size           = sizeof(struct unix_apply_ctx),
+	.any_number_of_targets  = true,
 };
@@ -32,6 +32,8 @@
 #include "wimlib.h"
 #include "assert.h"
 #include "blob_table.h"
+#include "decompressed_chunk_cache.h"
+#include "chunk_decompressor.h"
 #include "dentry.h"
 #include "encoding.h"
 #include "file_io.h"
@@ -135,6 +137,28 @@ wim_has_solid_resources(const WIMStruct *wim)
 	return for_blob_in_table(wim->blob_table, is_blob_in_solid_resource, NULL);
 }
 
+/* Prepare for the data in the WIM file to be read on several threads at once.
+ * The caller must ensure that no other reads are in progress.  */
+void
+wim_begin_concurrent_reads(WIMStruct *wim)
+{
+	if (wim->concurrent_reads)
+		return;
+
+	/* The cache is created lazily by single-threaded readers; with several
+	 * readers, it must exist beforehand.  */
+	if (!wim->dcache && wim->dcache_size)
+		wim->dcache = new_decompressed_chunk_cache(wim->dcache_size);
+	wim->concurrent_reads = true;
+}
+
+/* Undo wim_begin_concurrent_reads() once all the reading threads are done.  */
+void
+wim_end_concurrent_reads(WIMStruct *wim)
+{
+	wim->concurrent_reads = false;
+}
+
 static WIMStruct *
 new_wim_struct(void)
 {
@@ -148,6 +172,7 @@ new_wim_struct(void)
 	wim->out_solid_compression_type = wim_default_solid_compression_type();
 	wim->out_solid_chunk_size = wim_default_solid_chunk_size(
 					wim->out_solid_compression_type);
+	wim->dcache_size = DEFAULT_DECOMPRESSED_CHUNK_CACHE_SIZE;
 	return wim;
 }
 
@@ -595,6 +620,45 @@ wimlib_set_output_pack_chunk_size(WIMStruct *wim, u32 chunk_size)
 	return 0;
 }
 
+/* API function documented in wimlib.h  */
+WIMLIBAPI void
+wimlib_set_decompression_threads(WIMStruct *wim, unsigned num_threads)
+{
+	if (num_threads != wim->num_decompression_threads &&
+	    wim->chunk_decompressor)
+	{
+		wim->chunk_decompressor->destroy(wim->chunk_decompressor);
+		wim->chunk_decompressor = NULL;
+	}
+	wim->num_decompression_threads = num_threads;
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI void
+wimlib_set_decompressed_chunk_cache_size(WIMStruct *wim, uint64_t max_size)
+{
+	if (max_size != wim->dcache_size) {
+		free_decompressed_chunk_cache(wim->dcache);
+		wim->dcache = NULL;
+	}
+	wim->dcache_size = max_size;
+}
+
+/* API function documented in wimlib.h  */
+WIMLIBAPI void
+wimlib_get_decompressed_chunk_cache_stats(WIMStruct *wim, uint64_t *hits_ret,
+					  uint64_t *misses_ret)
+{
+	u64 hits = 0, misses = 0;
+
+	if (wim->dcache)
+		dcache_get_stats(wim->dcache, &hits, &misses);
+	if (hits_ret)
+		*hits_ret = hits;
+	if (misses_ret)
+		*misses_ret = misses;
+}
+
 /* API function documented in wimlib.h  */
 WIMLIBAPI const tchar *
 wimlib_get_compression_type_string(enum wimlib_compression_type ctype)
@@ -653,6 +717,9 @@ begin_read(WIMStruct *wim, const void *wim_filename_or_fd, int open_flags)
 		if (ret)
 			return ret;
 
+		if (open_flags & WIMLIB_OPEN_FLAG_MMAP)
+			filedes_map(&wim->in_fd);
+
 		/* The absolute path to the WIM is requested so that
 		 * wimlib_overwrite() still works even if the process changes
 		 * its working directory.  This actually happens if a WIM is
@@ -814,7 +881,8 @@ wimlib_open_wim_with_progress(const tchar *wimfile, int open_flags,
 {
 	if (open_flags & ~(WIMLIB_OPEN_FLAG_CHECK_INTEGRITY |
 			   WIMLIB_OPEN_FLAG_ERROR_IF_SPLIT |
-			   WIMLIB_OPEN_FLAG_WRITE_ACCESS))
+			   WIMLIB_OPEN_FLAG_WRITE_ACCESS |
+			   WIMLIB_OPEN_FLAG_MMAP))
 		return WIMLIB_ERR_INVALID_PARAM;
 
 	if (!wimfile || !*wimfile || !wim_ret)
@@ -902,6 +970,9 @@ wim_decrement_refcnt(WIMStruct *wim)
 	if (filedes_valid(&wim->out_fd))
 		filedes_close(&wim->out_fd);
 	wimlib_free_decompressor(wim->decompressor);
+	if (wim->chunk_decompressor)
+		wim->chunk_decompressor->destroy(wim->chunk_decompressor);
+	free_decompressed_chunk_cache(wim->dcache);
 	xml_free_info_struct(wim->xml_info);
 	FREE(wim->filename);
 	FREE(wim);
@@ -13,6 +13,8 @@
 struct wim_image_metadata;
 struct wim_xml_info;
 struct blob_table;
+struct decompressed_chunk_cache;
+struct chunk_decompressor;
 
 /*
  * WIMStruct - represents a WIM, or a part of a non-standalone WIM
@@ -110,6 +112,38 @@ struct WIMStruct {
 	u8 decompressor_ctype;
 	u32 decompressor_max_block_size;
 
+	/* This is the cached parallel chunk decompressor for this WIM file, or
+	 * NULL if none is cached yet.  It is used instead of the above when
+	 * reading enough data that decompressing it on multiple threads is
+	 * worthwhile, and is replaced in the same way if the compression type
+	 * or chunk size changes.  Ones with large buffers aren't cached.  */
+	struct chunk_decompressor *chunk_decompressor;
+
+	/* Number of threads to use for decompressing data, or 0 to choose
+	 * automatically.  Can be changed by
+	 * wimlib_set_decompression_threads().  */
+	unsigned num_decompression_threads;
+
+	/* Cache of decompressed chunks used for small reads, such as reads of
+	 * files in a mounted image, or NULL if not created yet.  Its maximum
+	 * size is dcache_size bytes, and 0 disables it.  Can be changed
+	 * by wimlib_set_decompressed_chunk_cache_size().  */
+	struct decompressed_chunk_cache *dcache;
+	u64 dcache_size;
+
+	/* True while the data in this WIM file may be read on several threads
+	 * at once, as it is in a read-only mounted image.  Then each reading
+	 * thread keeps its own decompressor rather than using the one cached
+	 * above, the parallel chunk decompressor isn't used, and the chunk
+	 * cache must already exist.  See wim_begin_concurrent_reads().  */
+	bool concurrent_reads;
+
+	/* Maximum number of parts wimlib_split() writes at the same time, in
+	 * total and to any one device (0 meaning no limit for the latter).
+	 * Can be changed by wimlib_set_split_threads().  */
+	unsigned num_split_threads;
+	unsigned max_split_threads_per_device;
+
 	/* Temporary field; use sparingly  */
 	void *private;
 
@@ -196,6 +230,12 @@ wim_decrement_refcnt(WIMStruct *wim);
 extern bool
 wim_has_solid_resources(const WIMStruct *wim);
 
+extern void
+wim_begin_concurrent_reads(WIMStruct *wim);
+
+extern void
+wim_end_concurrent_reads(WIMStruct *wim);
+
 extern int
 read_wim_header(WIMStruct *wim, struct wim_header *hdr);
 
@@ -40,6 +40,7 @@
 #include "alloca.h"
 #include "assert.h"
 #include "blob_table.h"
+#include "decompressed_chunk_cache.h"
 #include "chunk_compressor.h"
 #include "endianness.h"
 #include "error.h"
@@ -52,6 +53,7 @@
 #include "progress.h"
 #include "resource.h"
 #include "solid.h"
+#include "util.h"
 #include "win32.h" /* win32_rename_replacement() */
 #include "write.h"
 #include "xml.h"
@@ -63,6 +65,7 @@
 #define WRITE_RESOURCE_FLAG_SOLID		0x00000004
 #define WRITE_RESOURCE_FLAG_SEND_DONE_WITH_FILE	0x00000008
 #define WRITE_RESOURCE_FLAG_SOLID_SORT		0x00000010
+#define WRITE_RESOURCE_FLAG_KEEP_RESOURCES	0x00000020
 
 static int
 write_flags_to_resource_flags(int write_flags)
@@ -81,6 +84,9 @@ write_flags_to_resource_flags(int write_flags)
 	if (write_flags & WIMLIB_WRITE_FLAG_SEND_DONE_WITH_FILE_MESSAGES)
 		write_resource_flags |= WRITE_RESOURCE_FLAG_SEND_DONE_WITH_FILE;
 
+	if (write_flags & WIMLIB_WRITE_FLAG_KEEP_RESOURCES)
+		write_resource_flags |= WRITE_RESOURCE_FLAG_KEEP_RESOURCES;
+
 	if ((write_flags & (WIMLIB_WRITE_FLAG_SOLID |
 			    WIMLIB_WRITE_FLAG_NO_SOLID_SORT)) ==
 	    WIMLIB_WRITE_FLAG_SOLID)
@@ -192,6 +198,14 @@ can_raw_copy(const struct blob_descriptor *blob, int write_resource_flags,
 	    !!(write_resource_flags & WRITE_RESOURCE_FLAG_PIPABLE))
 		return false;
 
+	/* When writing a split WIM part, reuse solid resources even if the part
+	 * isn't otherwise being written in solid format.  The blobs of a solid
+	 * resource are never divided between parts, so the whole resource is
+	 * always written.  */
+	if ((write_resource_flags & WRITE_RESOURCE_FLAG_KEEP_RESOURCES) &&
+	    (rdesc->flags & WIM_RESHDR_FLAG_SOLID))
+		return true;
+
 	/* When writing a solid WIM, we can only reuse solid resources; and when
 	 * writing a non-solid WIM, we can only reuse non-solid resources.  */
 	if (!!(rdesc->flags & WIM_RESHDR_FLAG_SOLID) !=
@@ -297,6 +311,7 @@ struct write_blobs_progress_data {
 	void *progctx;
 	union wimlib_progress_info progress;
 	u64 next_progress;
+	struct chunk_compressor *compressor;
 };
 
 static int
@@ -324,6 +339,13 @@ do_write_blobs_progress(struct write_blobs_progress_data *progress_data,
 
 	if (progress->write_streams.completed_bytes >= progress_data->next_progress) {
 
+		if (progress_data->compressor &&
+		    progress_data->compressor->get_thread_utilization)
+		{
+			progress->write_streams.thread_utilization =
+				progress_data->compressor->get_thread_utilization(
+						progress_data->compressor);
+		}
 		ret = call_progress(progress_data->progfunc,
 				    WIMLIB_PROGRESS_MSG_WRITE_STREAMS,
 				    progress,
@@ -1195,16 +1217,22 @@ find_raw_copy_blobs(struct list_head *blob_list, int write_resource_flags,
 	return num_nonraw_bytes;
 }
 
+/* Size of the buffer used to copy raw compressed resources.  This is much
+ * larger than BUFFER_SIZE because raw copies (e.g. when splitting a WIM) are
+ * limited by the throughput of the devices involved, which do better with
+ * fewer, larger requests.  */
+#define RAW_COPY_BUFFER_SIZE (1 << 20)
+
 /* Copy a raw compressed resource located in another WIM file to the WIM file
- * being written.  */
+ * being written.  @buf is a scratch buffer of RAW_COPY_BUFFER_SIZE bytes.  */
 static int
 write_raw_copy_resource(struct wim_resource_descriptor *in_rdesc,
-			struct filedes *out_fd)
+			struct filedes *out_fd, u8 *buf)
 {
 	u64 cur_read_offset;
 	u64 end_read_offset;
-	u8 buf[BUFFER_SIZE];
 	size_t bytes_to_read;
+	const void *data;
 	int ret;
 	struct filedes *in_fd;
 	struct blob_descriptor *blob;
@@ -1228,18 +1256,25 @@ write_raw_copy_resource(struct wim_resource_descriptor *in_rdesc,
 	if (likely(!in_rdesc->wim->being_compacted) ||
 	    in_rdesc->offset_in_wim > out_fd->offset) {
 		do {
-			bytes_to_read = min(sizeof(buf),
+			bytes_to_read = min(RAW_COPY_BUFFER_SIZE,
 					    end_read_offset - cur_read_offset);
 
-			ret = full_pread(in_fd, buf, bytes_to_read,
-					 cur_read_offset);
-			if (ret) {
-				ERROR_WITH_ERRNO("Error reading raw data "
-						 "from WIM file");
-				return ret;
+			/* If the input WIM file is memory-mapped, write
+			 * straight from the mapping.  */
+			data = filedes_mapped(in_fd, cur_read_offset,
+					      bytes_to_read);
+			if (!data) {
+				ret = full_pread(in_fd, buf, bytes_to_read,
+						 cur_read_offset);
+				if (ret) {
+					ERROR_WITH_ERRNO("Error reading raw data "
+							 "from WIM file");
+					return ret;
+				}
+				data = buf;
 			}
 
-			ret = full_write(out_fd, buf, bytes_to_read);
+			ret = full_write(out_fd, data, bytes_to_read);
 			if (ret) {
 				ERROR_WITH_ERRNO("Error writing raw data "
 						 "to WIM file");
@@ -1283,28 +1318,48 @@ write_raw_copy_resources(struct list_head *raw_copy_blobs,
 			 struct write_blobs_progress_data *progress_data)
 {
 	struct blob_descriptor *blob;
+	struct blob_list_prefetcher prefetcher = {
+		.wim = NULL,
+	};
+	u8 *buf;
 	int ret;
 
+	if (list_empty(raw_copy_blobs))
+		return 0;
+
+	buf = MALLOC(RAW_COPY_BUFFER_SIZE);
+	if (!buf)
+		return WIMLIB_ERR_NOMEM;
+
 	list_for_each_entry(blob, raw_copy_blobs, write_blobs_list)
 		blob->rdesc->raw_copy_ok = 1;
 
+	ret = 0;
 	list_for_each_entry(blob, raw_copy_blobs, write_blobs_list) {
 		u64 compressed_size = 0;
 
 		if (blob->rdesc->raw_copy_ok) {
+			/* Have the input device read ahead while the output
+			 * device is busy with the resources before it.  */
+			prefetch_blob_list(&prefetcher, &blob->write_blobs_list,
+					   raw_copy_blobs,
+					   offsetof(struct blob_descriptor,
+						    write_blobs_list));
+
 			/* Write each solid resource only one time.  */
-			ret = write_raw_copy_resource(blob->rdesc, out_fd);
+			ret = write_raw_copy_resource(blob->rdesc, out_fd, buf);
 			if (ret)
-				return ret;
+				break;
 			blob->rdesc->raw_copy_ok = 0;
 			compressed_size = blob->rdesc->size_in_wim;
 		}
 		ret = do_write_blobs_progress(progress_data, blob->size,
 					      compressed_size, 1, false);
 		if (ret)
-			return ret;
+			break;
 	}
-	return 0;
+	FREE(buf);
+	return ret;
 }
 
 /* Wait for and write all chunks pending in the compressor.  */
@@ -1483,6 +1538,7 @@ write_blob_list(struct list_head *blob_list,
 	struct write_blobs_ctx ctx;
 	struct list_head raw_copy_blobs;
 	u64 num_nonraw_bytes;
+	struct chunk_compressor *cached_compressor;
 
 	wimlib_assert((write_resource_flags &
 		       (WRITE_RESOURCE_FLAG_SOLID |
@@ -1563,18 +1619,33 @@ write_blob_list(struct list_head *blob_list,
 			}
 		}
 
+		/* The serial compressor can still use a second thread within
+		 * each chunk, unless the caller asked for a single thread.  */
 		if (ctx.compressor == NULL) {
 			ret = new_serial_chunk_compressor(out_ctype, out_chunk_size,
+							  num_threads != 1 &&
+							  get_available_cpus() > 1,
 							  &ctx.compressor);
 			if (ret)
 				goto out_destroy_context;
 		}
+
+		/* If a chunk cache was set with wimlib_set_chunk_cache(), look
+		 * up each chunk in it before compressing it.  */
+		ret = new_caching_chunk_compressor(ctx.compressor,
+						   &cached_compressor);
+		if (ret > 0)
+			goto out_destroy_context;
+		if (ret == 0)
+			ctx.compressor = cached_compressor;
 	}
 
-	if (ctx.compressor)
+	if (ctx.compressor) {
 		ctx.progress_data.progress.write_streams.num_threads = ctx.compressor->num_threads;
-	else
+		ctx.progress_data.compressor = ctx.compressor;
+	} else {
 		ctx.progress_data.progress.write_streams.num_threads = 1;
+	}
 
 	ret = call_progress(ctx.progress_data.progfunc,
 			    WIMLIB_PROGRESS_MSG_WRITE_STREAMS,
@@ -2633,7 +2704,8 @@ should_default_to_solid_compression(WIMStruct *wim, int write_flags)
 {
 	return wim->out_hdr.wim_version == WIM_VERSION_SOLID &&
 		!(write_flags & (WIMLIB_WRITE_FLAG_SOLID |
-				 WIMLIB_WRITE_FLAG_PIPABLE)) &&
+				 WIMLIB_WRITE_FLAG_PIPABLE |
+				 WIMLIB_WRITE_FLAG_KEEP_RESOURCES)) &&
 		wim_has_solid_resources(wim);
 }
 
@@ -2740,8 +2812,12 @@ write_wim_part(WIMStruct *wim,
 	else
 		wim->out_hdr.magic = WIM_MAGIC;
 
-	/* Set the version number.  */
-	if ((write_flags & WIMLIB_WRITE_FLAG_SOLID) ||
+	/* Set the version number.  Resources kept as-is may be solid, which
+	 * requires WIM_VERSION_SOLID; the caller says so with
+	 * WIMLIB_WRITE_FLAG_SOLID_VERSION, since the blob table can't be
+	 * scanned here while other parts are being written from it.  */
+	if (write_flags & (WIMLIB_WRITE_FLAG_SOLID |
+			   WIMLIB_WRITE_FLAG_SOLID_VERSION) ||
 	    wim->out_compression_type == WIMLIB_COMPRESSION_TYPE_LZMS)
 		wim->out_hdr.wim_version = WIM_VERSION_SOLID;
 	else
@@ -3051,6 +3127,15 @@ overwrite_wim_inplace(WIMStruct *wim, int write_flags, unsigned num_threads)
 	struct list_head blob_table_list;
 	struct filter_context filter_ctx;
 
+	/* The WIM file may be truncated below, which would make accessing a
+	 * mapping of it fault, so read it with pread() from now on.  */
+	filedes_unmap(&wim->in_fd);
+
+	/* Compaction may move resources to offsets that cached chunks are
+	 * currently keyed by.  */
+	if (wim->dcache)
+		dcache_clear(wim->dcache);
+
 	/* Include an integrity table by default if no preference was given and
 	 * the WIM already had an integrity table.  */
 	if (!(write_flags & (WIMLIB_WRITE_FLAG_CHECK_INTEGRITY |
@@ -3267,6 +3352,10 @@ overwrite_wim_via_tmpfile(WIMStruct *wim, int write_flags, unsigned num_threads)
 		filedes_invalidate(&wim->in_fd);
 	}
 
+	/* The cached chunks are keyed by offsets in the old WIM file.  */
+	if (wim->dcache)
+		dcache_clear(wim->dcache);
+
 	/* Rename the new WIM file to the original WIM file.  Note: on Windows
 	 * this actually calls win32_rename_replacement(), not _wrename(), so
 	 * that removing the existing destination file can be handled.  */
@@ -10,6 +10,8 @@
 #define WIMLIB_WRITE_FLAG_NO_NEW_BLOBS			0x20000000
 #define WIMLIB_WRITE_FLAG_USE_EXISTING_TOTALBYTES	0x10000000
 #define WIMLIB_WRITE_FLAG_NO_METADATA			0x08000000
+#define WIMLIB_WRITE_FLAG_KEEP_RESOURCES		0x04000000
+#define WIMLIB_WRITE_FLAG_SOLID_VERSION			0x02000000
 
 /* Keep in sync with wimlib.h  */
 #define WIMLIB_WRITE_MASK_PUBLIC (			  \
@@ -133,6 +133,9 @@ x86_setup_cpu_features(void)
 	if (IS_SET(features_3, 8))
 		features |= X86_CPU_FEATURE_BMI2;
 
+	if (IS_SET(features_3, 29))
+		features |= X86_CPU_FEATURE_SHA;
+
 out:
 
 #if DEBUG
@@ -157,6 +160,8 @@ out:
 		printf("BMI2 ");
 	if (features & X86_CPU_FEATURE_AVX2)
 		printf("AVX2 ");
+	if (features & X86_CPU_FEATURE_SHA)
+		printf("SHA ");
 	printf("\n");
 #endif /* DEBUG */
 
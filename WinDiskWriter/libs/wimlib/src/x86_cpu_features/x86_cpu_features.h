@@ -15,6 +15,7 @@
 #define X86_CPU_FEATURE_BMI		0x00000080
 #define X86_CPU_FEATURE_AVX2		0x00000100
 #define X86_CPU_FEATURE_BMI2		0x00000200
+#define X86_CPU_FEATURE_SHA		0x00000400
 
 #define X86_CPU_FEATURES_KNOWN		0x80000000
 
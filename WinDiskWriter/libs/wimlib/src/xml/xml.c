@@ -1156,6 +1156,35 @@ err:
 	return ret;
 }
 
+/* Make an independent copy of a 'struct wim_xml_info', for example so that the
+ * document can be serialized on another thread while the original is in use.
+ * Returns NULL if out of memory.  */
+struct wim_xml_info *
+xml_copy_info_struct(const struct wim_xml_info *info)
+{
+	struct wim_xml_info *copy;
+
+	copy = alloc_wim_xml_info();
+	if (!copy)
+		goto err;
+
+	copy->doc = xmlCopyDoc(info->doc, 1);
+	if (!copy->doc)
+		goto err_free_copy;
+
+	copy->root = xmlDocGetRootElement(copy->doc);
+	if (setup_images(copy, copy->root))
+		goto err_free_doc;
+	return copy;
+
+err_free_doc:
+	xmlFreeDoc(copy->doc);
+err_free_copy:
+	FREE(copy);
+err:
+	return NULL;
+}
+
 /* Swap the INDEX attributes of two IMAGE elements.  */
 static void
 swap_index_attributes(xmlNode *image_node_1, xmlNode *image_node_2)
@@ -13,6 +13,9 @@ xml_new_info_struct(void);
 extern void
 xml_free_info_struct(struct wim_xml_info *info);
 
+extern struct wim_xml_info *
+xml_copy_info_struct(const struct wim_xml_info *info);
+
 /*****************************************************************************/
 
 extern int
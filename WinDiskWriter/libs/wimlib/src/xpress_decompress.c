@@ -76,6 +76,13 @@
 /* This value is chosen for fast decompression.  */
 #define XPRESS_TABLEBITS 11
 
+/* The number of bits to have in the bit buffer before decoding each symbol.
+ * If the bit buffer is wide enough, this covers the offset bits of a match as
+ * well, so that a match needs only one refill.  */
+#define XPRESS_ENSURE_BITS					\
+	(BITSTREAM_MAX_ENSURE_BITS >= XPRESS_MAX_CODEWORD_LEN + 16 ?	\
+	 XPRESS_MAX_CODEWORD_LEN + 16 : XPRESS_MAX_CODEWORD_LEN)
+
 struct xpress_decompressor {
 	union {
 		DECODE_TABLE(decode_table, XPRESS_NUM_SYMBOLS,
@@ -84,6 +91,7 @@ struct xpress_decompressor {
 	};
 	DECODE_TABLE_WORKING_SPACE(working_space, XPRESS_NUM_SYMBOLS,
 				   XPRESS_MAX_CODEWORD_LEN);
+	MULTI_LITERAL_TABLE(literal_table, XPRESS_TABLEBITS);
 } _aligned_attribute(DECODE_TABLE_ALIGNMENT);
 
 static int
@@ -97,6 +105,7 @@ xpress_decompress(const void *restrict compressed_data, size_t compressed_size,
 	u8 *out_next = out_begin;
 	u8 * const out_end = out_begin + uncompressed_size;
 	struct input_bitstream is;
+	bool use_literal_table;
 
 	/* Read the Huffman codeword lengths.  */
 	if (compressed_size < XPRESS_NUM_SYMBOLS / 2)
@@ -106,12 +115,18 @@ xpress_decompress(const void *restrict compressed_data, size_t compressed_size,
 		d->lens[2 * i + 1] = in_begin[i] >> 4;
 	}
 
-	/* Build a decoding table for the Huffman code.  */
+	/* Build a decoding table for the Huffman code.  The codeword lengths
+	 * share memory with the table, so look at them first.  */
+	use_literal_table = multi_literal_table_pays_off(d->lens,
+							 XPRESS_TABLEBITS);
 	if (make_huffman_decode_table(d->decode_table, XPRESS_NUM_SYMBOLS,
 				      XPRESS_TABLEBITS, d->lens,
 				      XPRESS_MAX_CODEWORD_LEN,
 				      d->working_space))
 		return -1;
+	if (use_literal_table)
+		make_multi_literal_table(d->literal_table, d->decode_table,
+					 XPRESS_TABLEBITS);
 
 	/* Decode the matches and literals.  */
 
@@ -119,13 +134,32 @@ xpress_decompress(const void *restrict compressed_data, size_t compressed_size,
 			     compressed_size - XPRESS_NUM_SYMBOLS / 2);
 
 	while (out_next != out_end) {
+		u32 entry;
 		unsigned sym;
 		unsigned log2_offset;
 		u32 length;
 		u32 offset;
 
-		sym = read_huffsym(&is, d->decode_table,
-				   XPRESS_TABLEBITS, XPRESS_MAX_CODEWORD_LEN);
+		/* If the next codeword is for a literal, decode it, and the
+		 * literal after it if that fits in the same table lookup.
+		 * Otherwise decode one symbol the usual way.  */
+		bitstream_ensure_bits(&is, XPRESS_ENSURE_BITS);
+		if (use_literal_table) {
+			entry = d->literal_table[
+				bitstream_peek_bits(&is, XPRESS_TABLEBITS)];
+			if (entry & MULTI_LITERAL_FLAG) {
+				out_next = write_multi_literal(&is, entry,
+							       out_next,
+							       out_end);
+				continue;
+			}
+		} else {
+			entry = d->decode_table[
+				bitstream_peek_bits(&is, XPRESS_TABLEBITS)];
+		}
+		sym = decode_huffsym_entry(&is, d->decode_table, entry,
+					   XPRESS_TABLEBITS,
+					   XPRESS_MAX_CODEWORD_LEN);
 		if (sym < XPRESS_NUM_CHARS) {
 			/* Literal  */
 			*out_next++ = sym;
@@ -134,7 +168,14 @@ xpress_decompress(const void *restrict compressed_data, size_t compressed_size,
 			length = sym & 0xf;
 			log2_offset = (sym >> 4) & 0xf;
 
-			bitstream_ensure_bits(&is, 16);
+			if (XPRESS_ENSURE_BITS < XPRESS_MAX_CODEWORD_LEN + 16)
+				bitstream_ensure_bits(&is, 16);
+
+			/* Any extra length bytes follow the coding unit in
+			 * which these 16 bits end, so stop reading ahead of
+			 * it.  */
+			if (length == 0xf)
+				bitstream_unread_units(&is, 16);
 
 			offset = ((u32)1 << log2_offset) |
 				 bitstream_pop_bits(&is, log2_offset);
@@ -0,0 +1,159 @@
+/*
+ * wimlib_tests.c - Command-line driver for the library's test support code
+ */
+
+/*
+ * This file is free software; you can redistribute it and/or modify it under
+ * the terms of the GNU Lesser General Public License as published by the Free
+ * Software Foundation; either version 3 of the License, or (at your option) any
+ * later version.
+ *
+ * This file is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU Lesser General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this file; if not, see http://www.gnu.org/licenses/.
+ */
+
+/*
+ * This program is built by the "wimlib-tests" target, which compiles the
+ * library with ENABLE_TEST_SUPPORT defined.  It is not part of the application.
+ *
+ * Usage:
+ *
+ *	wimlib-tests benchmark [-o OUTPUT.tsv] CORPUS_FILE...
+ *
+ *		Measure each compression format on the corpus files, and write
+ *		the results as tab-separated values to OUTPUT.tsv, or to
+ *		standard output if no output file is given.
+ *
+ *	wimlib-tests staging-writes
+ *
+ *		Check the bookkeeping of which chunks of a file modified in a
+ *		read-write mounted image are in its staging file.
+ *
+ * The exit status is 0 on success, 1 if the command failed, and 2 on a usage
+ * error.
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "wimlib.h"
+#include "test_support.h"
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s benchmark [-o OUTPUT.tsv] CORPUS_FILE...\n"
+		"       %s staging-writes\n", prog, prog);
+}
+
+static int
+cmd_benchmark(int argc, char **argv)
+{
+	const char *out_path = NULL;
+	FILE *out = stdout;
+	int ret;
+
+	if (argc >= 2 && !strcmp(argv[0], "-o")) {
+		out_path = argv[1];
+		argc -= 2;
+		argv += 2;
+	}
+	if (argc < 1)
+		return -1;
+
+	if (out_path) {
+		out = fopen(out_path, "w");
+		if (!out) {
+			fprintf(stderr, "Can't open \"%s\": %s\n",
+				out_path, strerror(errno));
+			return 1;
+		}
+	}
+
+	ret = wimlib_benchmark_codecs((const char * const *)argv, argc, out);
+
+	if (fflush(out) || ferror(out)) {
+		fprintf(stderr, "Error writing the results: %s\n",
+			strerror(errno));
+		if (!ret)
+			ret = WIMLIB_ERR_WRITE;
+	}
+	if (out != stdout)
+		fclose(out);
+
+	if (ret) {
+		fprintf(stderr, "Benchmark failed: %s\n",
+			wimlib_get_error_string(ret));
+		return 1;
+	}
+	return 0;
+}
+
+static int
+cmd_staging_writes(int argc, char **argv)
+{
+	int ret;
+
+	if (argc != 0)
+		return -1;
+
+	ret = wimlib_test_staging_writes();
+	if (ret == WIMLIB_ERR_TEST_FAILED) {
+		fprintf(stderr, "Staging writes test failed\n");
+		return 1;
+	}
+	if (ret) {
+		fprintf(stderr, "Staging writes test couldn't run: %s\n",
+			wimlib_get_error_string(ret));
+		return 1;
+	}
+	printf("Staging writes test passed\n");
+	return 0;
+}
+
+static const struct {
+	const char *name;
+	int (*func)(int argc, char **argv);
+} commands[] = {
+	{ "benchmark", cmd_benchmark },
+	{ "staging-writes", cmd_staging_writes },
+};
+
+int
+main(int argc, char **argv)
+{
+	int ret;
+
+	/* This also points the library's error messages at stderr.  */
+	ret = wimlib_global_init(0);
+	if (ret) {
+		fprintf(stderr, "Failed to initialize the library: %s\n",
+			wimlib_get_error_string(ret));
+		return 1;
+	}
+	wimlib_set_print_errors(true);
+
+	if (argc >= 2) {
+		for (size_t i = 0; i < sizeof(commands) / sizeof(commands[0]); i++) {
+			if (!strcmp(argv[1], commands[i].name)) {
+				ret = commands[i].func(argc - 2, argv + 2);
+				if (ret >= 0)
+					return ret;
+				break;
+			}
+		}
+	}
+	usage(argv[0]);
+	return 2;
+}